@@ -56,6 +56,8 @@ fi
 %files
 %defattr(-,root,root,-)
 /usr/bin/tonegend
+%{_datadir}/dbus-1/services/com.Nokia.Telephony.Tones.service
+%{_datadir}/%{name}/toneplan
 %config /etc/dbus-1/system.d/tone-generator.conf
 /usr/lib/systemd/user/%{name}.service
 /usr/lib/systemd/user/user-session.target.wants/%{name}.service
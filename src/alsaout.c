@@ -0,0 +1,558 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <alsa/asoundlib.h>
+#include <pulse/pulseaudio.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "ausrv.h"
+#include "stream.h"
+#include "alsaout.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define DEFAULT_DEVICE  "default"
+#define DEFAULT_PERIOD  20      /* msec */
+#define MAX_POLLFDS     4
+
+struct alsaout {
+    pa_mainloop_api    *api;
+    struct stream      *stream;
+    snd_pcm_t          *pcm;
+    snd_pcm_uframes_t   period;         /* period size in frames */
+    snd_pcm_uframes_t   buffer;         /* buffer size in frames */
+    snd_pcm_uframes_t   fill;           /* fill level & start threshold */
+    int                 closing;
+    int                 npfd;
+    struct pollfd       pfd[MAX_POLLFDS];
+    pa_io_event        *io[MAX_POLLFDS];
+    pa_time_event      *timer;          /* for closing */
+};
+
+static int  alsa_config(char *);
+static int  alsa_create(struct stream *, char *, void *, uint32_t, uint32_t);
+static void alsa_write(struct stream *, int16_t *, size_t, void (*)(void *));
+static int  alsa_cork(struct stream *, int);
+static int  alsa_flush(struct stream *);
+static int  alsa_drain(struct stream *);
+static int  alsa_timing(struct stream *, uint64_t *);
+static void alsa_release(struct stream *);
+
+static int  setup_pcm(struct alsaout *, uint32_t *, uint32_t, uint32_t);
+static int  fill_buffer(struct alsaout *);
+static int  recover(struct alsaout *, int);
+static void io_callback(pa_mainloop_api *, pa_io_event *, int,
+                        pa_io_event_flags_t, void *);
+static void close_callback(pa_mainloop_api *, pa_time_event *,
+                           const struct timeval *, void *);
+static void close_later(struct alsaout *, uint32_t);
+static void destroy_alsaout(struct alsaout *);
+
+static char     *device = NULL;
+static uint32_t  period_ms = 0;         /* 0 means -r or DEFAULT_PERIOD */
+static uint32_t  buffer_ms = 0;         /* 0 means -b or 4 periods */
+
+struct stream_backend alsaout_backend = {
+    .name        = "alsa",
+    .need_server = 0,
+    .config      = alsa_config,
+    .create      = alsa_create,
+    .write       = alsa_write,
+    .cork        = alsa_cork,
+    .flush       = alsa_flush,
+    .drain       = alsa_drain,
+    .timing      = alsa_timing,
+    .release     = alsa_release,
+};
+
+
+static int alsa_config(char *opts)
+{
+    char *key, *val, *next, *end;
+    char  buf[256];
+
+    if (opts == NULL)
+        return 0;
+
+    if (strlen(opts) >= sizeof(buf)) {
+        LOG_ERROR("%s(): output options are too long", __FUNCTION__);
+        return -1;
+    }
+    strcpy(buf, opts);
+
+    for (key = buf;  key != NULL;  key = next) {
+        if ((next = strchr(key, ',')) != NULL)
+            *next++ = '\0';
+
+        if ((val = strchr(key, '=')) == NULL)
+            goto invalid;
+
+        *val++ = '\0';
+
+        if (!strcmp(key, "device")) {
+            free(device);
+            device = strdup(val);
+        }
+        else if (!strcmp(key, "period")) {
+            period_ms = strtoul(val, &end, 10);
+            if (*end || period_ms < 1 || period_ms > 1000)
+                goto invalid;
+        }
+        else if (!strcmp(key, "buffer")) {
+            buffer_ms = strtoul(val, &end, 10);
+            if (*end || buffer_ms < 2 || buffer_ms > 10000)
+                goto invalid;
+        }
+        else
+            goto invalid;
+    }
+
+    if (period_ms && buffer_ms && buffer_ms < period_ms * 2) {
+        LOG_ERROR("%s(): buffer must hold at least two periods", __FUNCTION__);
+        return -1;
+    }
+
+    return 0;
+
+ invalid:
+    LOG_ERROR("%s(): invalid output option '%s'", __FUNCTION__, key);
+    return -1;
+}
+
+static int alsa_create(struct stream *stream, char *sink, void *proplist,
+                       uint32_t tlength, uint32_t bufsize)
+{
+    struct alsaout     *out;
+    const char         *dev;
+    pa_io_event_flags_t flags;
+    int                 err;
+    int                 i;
+
+    (void)proplist;
+
+    if (stream->format != STREAM_FORMAT_S16LE) {
+        LOG_ERROR("%s(): ALSA output renders in place and supports "
+                  "16 bit samples only", __FUNCTION__);
+        return -1;
+    }
+
+    dev = sink ? sink : (device ? device : DEFAULT_DEVICE);
+
+    if ((out = malloc(sizeof(*out))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+
+    out->api    = stream->ausrv->api;
+    out->stream = stream;
+
+    if ((err = snd_pcm_open(&out->pcm, dev, SND_PCM_STREAM_PLAYBACK,
+                            SND_PCM_NONBLOCK)) < 0) {
+        LOG_ERROR("%s(): can't open ALSA device '%s': %s", __FUNCTION__,
+                  dev, snd_strerror(err));
+        free(out);
+        return -1;
+    }
+
+    if (setup_pcm(out, &stream->rate, tlength, bufsize) < 0)
+        goto failed;
+
+    /* we render a period at a time, right when the device asks for it */
+    stream->bufsize = out->period * sizeof(int16_t);
+
+    out->npfd = snd_pcm_poll_descriptors_count(out->pcm);
+
+    if (out->npfd < 1 || out->npfd > MAX_POLLFDS) {
+        LOG_ERROR("%s(): unsupported number (%d) of poll descriptors",
+                  __FUNCTION__, out->npfd);
+        goto failed;
+    }
+
+    snd_pcm_poll_descriptors(out->pcm, out->pfd, out->npfd);
+
+    for (i = 0;  i < out->npfd;  i++) {
+        flags = PA_IO_EVENT_NULL;
+
+        if (out->pfd[i].events & POLLIN)   flags |= PA_IO_EVENT_INPUT;
+        if (out->pfd[i].events & POLLOUT)  flags |= PA_IO_EVENT_OUTPUT;
+
+        out->io[i] = out->api->io_new(out->api, out->pfd[i].fd, flags,
+                                      io_callback, out);
+    }
+
+    stream->output = out;
+
+    TRACE("%s(): stream '%s' on '%s' %uHz period %lu buffer %lu frames",
+          __FUNCTION__, stream->name, dev, stream->rate,
+          out->period, out->buffer);
+
+    /*
+     * prefill up to the start threshold only; whatever we queue before the
+     * first tone is there is latency that the tone has to wait out
+     */
+    if (fill_buffer(out) < 0) {
+        stream->output = NULL;
+        goto failed;
+    }
+
+    return 0;
+
+ failed:
+    destroy_alsaout(out);
+    return -1;
+}
+
+static void alsa_write(struct stream *stream, int16_t *samples, size_t buflen,
+                       void (*free_cb)(void *))
+{
+    (void)stream;
+    (void)buflen;
+
+    /* we never call stream_request() so this should not happen */
+    LOG_ERROR("%s(): unexpected write", __FUNCTION__);
+
+    if (free_cb != NULL)
+        free_cb(samples);
+}
+
+static int alsa_cork(struct stream *stream, int cork)
+{
+    struct alsaout *out = (struct alsaout *)stream->output;
+
+    return snd_pcm_pause(out->pcm, cork) < 0 ? -1 : 0;
+}
+
+static int alsa_flush(struct stream *stream)
+{
+    struct alsaout *out = (struct alsaout *)stream->output;
+
+    snd_pcm_drop(out->pcm);
+    close_later(out, 0);
+
+    return 0;
+}
+
+static int alsa_drain(struct stream *stream)
+{
+    struct alsaout    *out = (struct alsaout *)stream->output;
+    snd_pcm_sframes_t  delay;
+
+    /* let the ring play out, then close the device */
+    if (snd_pcm_delay(out->pcm, &delay) < 0 || delay < 0)
+        delay = 0;
+
+    close_later(out, ((uint64_t)delay * 1000000ULL) / stream->rate);
+
+    return 0;
+}
+
+static int alsa_timing(struct stream *stream, uint64_t *latency)
+{
+    struct alsaout    *out = (struct alsaout *)stream->output;
+    snd_pcm_sframes_t  delay;
+
+    if (snd_pcm_delay(out->pcm, &delay) < 0)
+        return -1;
+
+    *latency = delay > 0 ? ((uint64_t)delay * 1000000ULL) / stream->rate : 0;
+
+    return 0;
+}
+
+static void alsa_release(struct stream *stream)
+{
+    destroy_alsaout((struct alsaout *)stream->output);
+    stream->output = NULL;
+}
+
+
+static int setup_pcm(struct alsaout *out, uint32_t *rate,
+                     uint32_t tlength, uint32_t bufsize)
+{
+    snd_pcm_t           *pcm = out->pcm;
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_sw_params_t *sw;
+    unsigned int         r   = *rate;
+    uint32_t             per = period_ms;
+    uint32_t             buf = buffer_ms;
+    int                  err;
+
+    if (!per)
+        per = bufsize != (uint32_t)-1 ? (bufsize/2)*1000 / r : DEFAULT_PERIOD;
+    if (!per)
+        per = 1;
+
+    if (!buf)
+        buf = tlength != (uint32_t)-1 ? (tlength/2)*1000 / r : per * 4;
+    if (buf < per * 2)
+        buf = per * 2;
+
+    out->period = ((snd_pcm_uframes_t)r * per) / 1000;
+    out->buffer = ((snd_pcm_uframes_t)r * buf) / 1000;
+
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_sw_params_alloca(&sw);
+
+    if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(pcm, hw,
+                                 SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(pcm,hw,SND_PCM_FORMAT_S16_LE))<0||
+        (err = snd_pcm_hw_params_set_channels(pcm, hw, 1)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_near(pcm, hw, &r, NULL)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size_near(pcm, hw,
+                                                      &out->period,NULL))<0||
+        (err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw,
+                                                      &out->buffer)) < 0 ||
+        (err = snd_pcm_hw_params(pcm, hw)) < 0)
+    {
+        LOG_ERROR("%s(): can't set hw parameters: %s", __FUNCTION__,
+                  snd_strerror(err));
+        return -1;
+    }
+
+    /*
+     * the ring is kept filled up to two periods only, the rest of it is
+     * headroom for when we are late; we are woken up when one of the two
+     * periods has been played
+     */
+    out->fill = out->period * 2;
+
+    if (out->fill > out->buffer)
+        out->fill = out->buffer;
+
+    if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0 ||
+        (err = snd_pcm_sw_params_set_avail_min(pcm, sw,
+                                 out->buffer - out->fill + out->period)) < 0 ||
+        (err = snd_pcm_sw_params_set_start_threshold(pcm, sw,out->fill)) < 0 ||
+        (err = snd_pcm_sw_params(pcm, sw)) < 0)
+    {
+        LOG_ERROR("%s(): can't set sw parameters: %s", __FUNCTION__,
+                  snd_strerror(err));
+        return -1;
+    }
+
+    if (r != *rate) {
+        LOG_INFO("ALSA device does not support %uHz; using %uHz", *rate, r);
+        *rate = r;
+    }
+
+    return 0;
+}
+
+static int fill_buffer(struct alsaout *out)
+{
+    struct stream                *stream = out->stream;
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t             offset;
+    snd_pcm_uframes_t             frames;
+    snd_pcm_sframes_t             avail;
+    snd_pcm_sframes_t             committed;
+    int16_t                      *samples;
+    int                           err;
+
+    while (!out->closing) {
+        if ((avail = snd_pcm_avail_update(out->pcm)) < 0) {
+            if (recover(out, avail) < 0)
+                return -1;
+            continue;
+        }
+
+        if ((snd_pcm_uframes_t)avail > out->buffer)
+            avail = out->buffer;
+
+        /* top up to the fill level, a period at a time */
+        if (out->buffer - avail + out->period > out->fill)
+            break;
+
+        /* a period may be split in two at the end of the ring */
+        avail = out->period;
+
+        while (avail > 0) {
+            frames = avail;
+
+            if ((err = snd_pcm_mmap_begin(out->pcm, &areas, &offset,
+                                          &frames)) < 0) {
+                if (recover(out, err) < 0)
+                    return -1;
+                break;
+            }
+
+            samples = (int16_t *)((char *)areas[0].addr +
+                                  (areas[0].first + offset * areas[0].step)/8);
+
+            stream_render(stream, samples, frames * sizeof(int16_t));
+
+            committed = snd_pcm_mmap_commit(out->pcm, offset, frames);
+
+            if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+                if (recover(out, committed >= 0 ? -EPIPE : committed) < 0)
+                    return -1;
+                break;
+            }
+
+            avail -= frames;
+        }
+    }
+
+    if (!out->closing && snd_pcm_state(out->pcm) == SND_PCM_STATE_PREPARED) {
+        if ((err = snd_pcm_start(out->pcm)) < 0) {
+            LOG_ERROR("%s(): can't start stream '%s': %s", __FUNCTION__,
+                      stream->name, snd_strerror(err));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * the caller tears the stream down if we fail; destroying it from here
+ * would leave the caller in the middle of a write on a dead stream
+ */
+static int recover(struct alsaout *out, int err)
+{
+    struct stream *stream = out->stream;
+
+    if (err == -EPIPE || err == -ESTRPIPE) {
+        LOG_ERROR("Stream '%s' underflow", stream->name);
+        stream->stat.underflows++;
+    }
+
+    if ((err = snd_pcm_recover(out->pcm, err, 1)) < 0) {
+        LOG_ERROR("%s(): can't recover stream '%s': %s", __FUNCTION__,
+                  stream->name, snd_strerror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void io_callback(pa_mainloop_api *api, pa_io_event *event, int fd,
+                        pa_io_event_flags_t events, void *userdata)
+{
+    struct alsaout *out = (struct alsaout *)userdata;
+    unsigned short  revents;
+    int             i;
+
+    (void)api;
+    (void)event;
+
+    for (i = 0;  i < out->npfd;  i++) {
+        out->pfd[i].revents = 0;
+
+        if (out->pfd[i].fd == fd) {
+            if (events & PA_IO_EVENT_INPUT)   out->pfd[i].revents |= POLLIN;
+            if (events & PA_IO_EVENT_OUTPUT)  out->pfd[i].revents |= POLLOUT;
+            if (events & PA_IO_EVENT_ERROR)   out->pfd[i].revents |= POLLERR;
+            if (events & PA_IO_EVENT_HANGUP)  out->pfd[i].revents |= POLLHUP;
+        }
+    }
+
+    if (out->closing)
+        return;
+
+    if (snd_pcm_poll_descriptors_revents(out->pcm, out->pfd, out->npfd,
+                                         &revents) < 0)
+        return;
+
+    if (((revents & POLLERR) && recover(out, -EPIPE) < 0) ||
+        ((revents & (POLLOUT | POLLERR)) && fill_buffer(out) < 0))
+    {
+        stream_destroy(out->stream);
+    }
+}
+
+static void close_callback(pa_mainloop_api *api, pa_time_event *event,
+                           const struct timeval *tv, void *userdata)
+{
+    struct alsaout *out    = (struct alsaout *)userdata;
+    struct stream  *stream = out->stream;
+
+    (void)api;
+    (void)event;
+    (void)tv;
+
+    TRACE("%s(): stream '%s' closed", __FUNCTION__, stream->name);
+
+    destroy_alsaout(out);
+    stream_free(stream);
+}
+
+static void close_later(struct alsaout *out, uint32_t usec)
+{
+    struct timeval tv;
+    int            i;
+
+    out->closing = TRUE;
+
+    for (i = 0;  i < out->npfd;  i++)
+        out->api->io_enable(out->io[i], PA_IO_EVENT_NULL);
+
+    gettimeofday(&tv, NULL);
+    tv.tv_usec += usec;
+    tv.tv_sec  += tv.tv_usec / 1000000;
+    tv.tv_usec %= 1000000;
+
+    out->timer = out->api->time_new(out->api, &tv, close_callback, out);
+}
+
+static void destroy_alsaout(struct alsaout *out)
+{
+    int i;
+
+    if (out != NULL) {
+        for (i = 0;  i < out->npfd;  i++) {
+            if (out->io[i] != NULL)
+                out->api->io_free(out->io[i]);
+        }
+
+        if (out->timer != NULL)
+            out->api->time_free(out->timer);
+
+        if (out->pcm != NULL)
+            snd_pcm_close(out->pcm);
+
+        free(out);
+    }
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -21,15 +21,25 @@ USA.
 
 #define _GNU_SOURCE
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
 
 #include <log/log.h>
 #include <trace/trace.h>
 
 #include "stream.h"
+#include "scache.h"
 #include "ausrv.h"
+#include "pool.h"
+#include "mainloop.h"
+#include "startup.h"
 
 #if PA_API_VERSION < 9
 #error Invalid PulseAudio API version
@@ -40,6 +50,11 @@ USA.
 
 #define DEFAULT_SERVER  "default Pulse Audio"
 #define CONNECT_DELAY   10                              /* in seconds */
+#define IDLE_TIMEOUT    60                              /* in seconds */
+#define PREFAULT_STACK  (256 * 1024)
+
+#define CMD_PASSIVE     0x01    /* does nothing without streams */
+#define CMD_LATEST      0x02    /* supersedes its deferred predecessor */
 
 #define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
 #define LOG_INFO(f, args...) log_error(logctx, f, ##args)
@@ -54,8 +69,39 @@ static void event_callback(pa_context *, pa_subscription_event_type_t,
 static void connect_server(struct ausrv *);
 static void restart_timer(struct ausrv *, int);
 static void cancel_timer(struct ausrv *);
+static int  setup_command_queue(struct ausrv *);
+static void command_callback(pa_mainloop_api *, pa_io_event *, int,
+                             pa_io_event_flags_t, void *);
+static void run_queue(struct ausrv *);
+static void setup_render_thread(struct ausrv *, uintptr_t *);
+static int  queue_command(struct ausrv *, int,
+                          void (*)(struct ausrv *, uintptr_t *),
+                          void (*)(uintptr_t *),
+                          uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+static int  run_locked(struct ausrv *, struct ausrv_cmd *);
+static int  hold_command(struct ausrv *, struct ausrv_cmd *);
+static void drop_command(struct ausrv_cmd *);
+static int  connecting(struct ausrv *);
+static void replay_pending(struct ausrv *);
+static void drop_pending(struct ausrv *);
+static void restart_idle_timer(struct ausrv *);
+static void cancel_idle_timer(struct ausrv *);
+static void disconnect_server(struct ausrv *);
+static int  defer_command(struct ausrv *, struct ausrv_cmd *);
+static void run_deferred(struct ausrv *);
+static void flush_callback(pa_mainloop_api *, pa_defer_event *, void *);
+static int  setup_post_queue(struct ausrv *);
+static void post_callback(pa_mainloop_api *, pa_io_event *, int,
+                          pa_io_event_flags_t, void *);
+static void run_posts(struct ausrv *);
+static uint64_t monotonic_usec(void);
 
 static char *pa_client_name;
+static int   render_thread = FALSE;
+static int   rt_priority   = 0;         /* 0: no SCHED_FIFO */
+static int   rt_cpu        = -1;        /* -1: no affinity */
+static int   lazy_connect  = FALSE;
+static int   idle_timeout  = IDLE_TIMEOUT;  /* 0: stay connected */
 
 
 int ausrv_init(int argc, char **argv)
@@ -75,9 +121,26 @@ void ausrv_exit(void)
     pa_client_name = NULL;
 }
 
+void ausrv_set_render_thread(int enable, int priority, int cpu)
+{
+    render_thread = enable;
+    rt_priority   = priority;
+    rt_cpu        = cpu;
+}
+
+/*
+ * In lazy mode the server is connected on the first request, which is
+ * held until the context is ready, and disconnected once there were no
+ * streams for idle_secs seconds.
+ */
+void ausrv_set_lazy_connect(int enable, int idle_secs)
+{
+    lazy_connect = enable;
+    idle_timeout = idle_secs;
+}
+
 struct ausrv *ausrv_create(struct tonegend *tonegend, char *server)
 {
-    pa_glib_mainloop   *mainloop = NULL;
     struct ausrv       *ausrv;
     pa_mainloop_api    *mainloop_api;
 
@@ -85,34 +148,91 @@ struct ausrv *ausrv_create(struct tonegend *tonegend, char *server)
         LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
         goto failed;
     }
+    memset(ausrv, 0, sizeof(*ausrv));
+    ausrv->cmdq.evfd = -1;
+    ausrv->postfd    = -1;
 
-    if ((mainloop = pa_glib_mainloop_new(NULL)) == NULL) {
-        LOG_ERROR("%s(): pa_glib_mainloop_new() failed", __FUNCTION__);
-        goto failed;
-    }
-
-    mainloop_api = pa_glib_mainloop_get_api(mainloop);
+    mainloop_api = mainloop_get_api();
 
     if (pa_signal_init(mainloop_api) < 0) {
         LOG_ERROR("%s(): pa_signal_init() failed", __FUNCTION__);
         goto failed;
     }
     
-    memset(ausrv, 0, sizeof(*ausrv));
     ausrv->tonegend = tonegend;
     ausrv->server   = strdup(server ? server : DEFAULT_SERVER);
-    ausrv->mainloop = mainloop;
+    ausrv->api      = mainloop_api;
 
-    connect_server(ausrv);
+    /* on the main loop even with a render thread: it feeds the ring */
+    ausrv->flush = mainloop_api->defer_new(mainloop_api, flush_callback,
+                                           (void *)ausrv);
+    if (ausrv->flush == NULL) {
+        LOG_ERROR("%s(): can't create defer event", __FUNCTION__);
+        goto failed;
+    }
+    mainloop_api->defer_enable(ausrv->flush, FALSE);
+
+    if (render_thread) {
+        if ((ausrv->rtloop = pa_threaded_mainloop_new()) == NULL) {
+            LOG_ERROR("%s(): pa_threaded_mainloop_new() failed",
+                      __FUNCTION__);
+            goto failed;
+        }
+
+        ausrv->api = pa_threaded_mainloop_get_api(ausrv->rtloop);
+
+        if (setup_command_queue(ausrv) < 0 || setup_post_queue(ausrv) < 0)
+            goto failed;
+    }
+
+    if (!stream_output_needs_server()) {
+        LOG_INFO("Output does not need an audio server");
+        set_connection_status(ausrv, CONNECTED);
+    }
+    else if (lazy_connect)
+        LOG_INFO("Connecting to the server on the first request");
+    else
+        restart_timer(ausrv, 0);    /* once the main loop runs */
+
+    if (ausrv->rtloop != NULL) {
+        if (pa_threaded_mainloop_start(ausrv->rtloop) < 0) {
+            LOG_ERROR("%s(): can't start the render thread", __FUNCTION__);
+            goto failed;
+        }
+
+        ausrv_queue_command(ausrv, setup_render_thread, 0,0,0,0);
+    }
 
     return ausrv;
 
  failed:
-    if (mainloop != NULL)
-        pa_glib_mainloop_free(mainloop);
+    if (ausrv != NULL) {
+        if (ausrv->flush != NULL)
+            mainloop_api->defer_free(ausrv->flush);
+
+        if (ausrv->context != NULL)
+            pa_context_unref(ausrv->context);
+
+        if (ausrv->cmdq.evio != NULL)
+            ausrv->api->io_free(ausrv->cmdq.evio);
+
+        if (ausrv->cmdq.evfd >= 0)
+            close(ausrv->cmdq.evfd);
+
+        if (ausrv->postio != NULL)
+            mainloop_api->io_free(ausrv->postio);
+
+        if (ausrv->postfd >= 0)
+            close(ausrv->postfd);
 
-    if (ausrv != NULL)
+        if (ausrv->rtloop != NULL)
+            pa_threaded_mainloop_free(ausrv->rtloop);
+    }
+
+    if (ausrv != NULL) {
+        free(ausrv->server);
         free(ausrv);
+    }
 
     return NULL;
 
@@ -120,20 +240,241 @@ struct ausrv *ausrv_create(struct tonegend *tonegend, char *server)
 
 void ausrv_destroy(struct ausrv *ausrv)
 {
+    struct ausrv_cmdq *q;
+    int                i;
+
     if (ausrv != NULL) {
+        /* from now on everything runs on this thread */
+        if (ausrv->rtloop != NULL)
+            pa_threaded_mainloop_stop(ausrv->rtloop);
+
         stream_kill_all(ausrv);
+        scache_reset(ausrv);
+
+        cancel_idle_timer(ausrv);
+
+        /* what the render thread posted last; it may free memory */
+        run_posts(ausrv);
+
+        for (q = &ausrv->cmdq;  q->tail != q->head;  q->tail++)
+            drop_command(q->cmd + (q->tail & (AUSRV_CMDQ_LEN - 1)));
+
+        for (i = 0;  i < ausrv->ndeferred;  i++)
+            drop_command(ausrv->deferred + i);
+
+        for (i = 0;  i < ausrv->npending;  i++)
+            drop_command(ausrv->pending + i);
+
+        if (ausrv->flush != NULL)
+            mainloop_get_api()->defer_free(ausrv->flush);
 
         if (ausrv->context != NULL)
             pa_context_unref(ausrv->context);
         
-        if (ausrv->mainloop != NULL)
-            pa_glib_mainloop_free(ausrv->mainloop);
-        
+        if (ausrv->cmdq.evio != NULL)
+            ausrv->api->io_free(ausrv->cmdq.evio);
+
+        if (ausrv->cmdq.evfd >= 0)
+            close(ausrv->cmdq.evfd);
+
+        if (ausrv->postio != NULL)
+            mainloop_get_api()->io_free(ausrv->postio);
+
+        if (ausrv->postfd >= 0)
+            close(ausrv->postfd);
+
+        if (ausrv->rtloop != NULL)
+            pa_threaded_mainloop_free(ausrv->rtloop);
+
         free(ausrv->server);
         free(ausrv);
     }
 }
 
+/*
+ * Called by the entry points of the audio side with their own arguments.
+ * Returns TRUE if the call was queued to the render thread or held while
+ * the server is being connected, and FALSE if the caller is to do the job
+ * right away, i.e. we have no render thread or we are on it.
+ */
+int ausrv_queue_command(struct ausrv *ausrv,
+                        void (*func)(struct ausrv *, uintptr_t *),
+                        uintptr_t arg0, uintptr_t arg1,
+                        uintptr_t arg2, uintptr_t arg3)
+{
+    return queue_command(ausrv, 0, func, NULL, arg0, arg1, arg2, arg3);
+}
+
+/*
+ * The same for requests that do nothing without streams, e.g. stopping
+ * a tone; these do not make a lazy connection by themselves.
+ */
+int ausrv_queue_passive_command(struct ausrv *ausrv,
+                                void (*func)(struct ausrv *, uintptr_t *),
+                                uintptr_t arg0, uintptr_t arg1,
+                                uintptr_t arg2, uintptr_t arg3)
+{
+    return queue_command(ausrv, CMD_PASSIVE, func, NULL, arg0, arg1, arg2, arg3);
+}
+
+/*
+ * The same for requests that undo whatever an earlier call of the same
+ * function did, e.g. starting a tone on a stream that already plays one.
+ * A deferred call of the function that has not run yet is dropped if it
+ * was queued this way, too.
+ */
+int ausrv_queue_latest_command(struct ausrv *ausrv,
+                               void (*func)(struct ausrv *, uintptr_t *),
+                               uintptr_t arg0, uintptr_t arg1,
+                               uintptr_t arg2, uintptr_t arg3)
+{
+    return queue_command(ausrv, CMD_LATEST, func, NULL, arg0, arg1, arg2, arg3);
+}
+
+/*
+ * The same for requests that hand over memory, e.g. a dial string. If
+ * the request is dropped, e.g. the server goes while it is held, 'drop'
+ * is called with the arguments to free it.
+ */
+int ausrv_queue_owned_command(struct ausrv *ausrv,
+                              void (*func)(struct ausrv *, uintptr_t *),
+                              void (*drop)(uintptr_t *),
+                              uintptr_t arg0, uintptr_t arg1,
+                              uintptr_t arg2, uintptr_t arg3)
+{
+    return queue_command(ausrv, 0, func, drop, arg0, arg1, arg2, arg3);
+}
+
+/*
+ * While on, the D-Bus method handlers only validate their arguments and
+ * the commands they issue are collected, so the reply goes out before
+ * any audio work is done. The collected commands run from the main loop
+ * once the messages at hand are dispatched.
+ */
+void ausrv_defer_commands(struct ausrv *ausrv, int on)
+{
+    ausrv->deferring = on;
+}
+
+/*
+ * Runs 'func' on the main loop: right away unless we are on the render
+ * thread, which must not block on the main loop, e.g. on the locks of
+ * libdbus. From there the post is pushed to a lock-free list and the
+ * main loop is woken up to run it.
+ */
+void ausrv_post_main(struct ausrv *ausrv, struct ausrv_post *post,
+                     void (*func)(struct ausrv *, struct ausrv_post *))
+{
+    uint64_t one = 1;
+
+    if (ausrv->rtloop == NULL || !pa_threaded_mainloop_in_thread(ausrv->rtloop)){
+        func(ausrv, post);
+        return;
+    }
+
+    if (__atomic_exchange_n(&post->posted, TRUE, __ATOMIC_ACQ_REL))
+        return;
+
+    post->func = func;
+    post->next = __atomic_load_n(&ausrv->posts, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&ausrv->posts, &post->next, post,
+                                        TRUE, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+
+    if (write(ausrv->postfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("%s(): can't wake up main loop: %s", __FUNCTION__,
+                  strerror(errno));
+}
+
+void ausrv_print_statistics(struct ausrv *ausrv)
+{
+    struct ausrv_connstat *st = &ausrv->connstat;
+
+    printf("server connections: %u, connect latency avg %u usec "
+           "max %u usec\n"
+           "   %u idle disconnects, %u requests held until connected, "
+           "%u dropped\n"
+           "   %u requests run after the reply, %u superseded\n"
+           "   %u requests run on the main thread; render thread behind\n",
+           st->connects, st->connects ? (uint32_t)(st->sum/st->connects) : 0,
+           st->max, st->disconnects, st->held, st->dropped,
+           st->deferred, st->superseded, st->inlined);
+}
+
+static int queue_command(struct ausrv *ausrv, int flags,
+                         void (*func)(struct ausrv *, uintptr_t *),
+                         void (*drop)(uintptr_t *),
+                         uintptr_t arg0, uintptr_t arg1,
+                         uintptr_t arg2, uintptr_t arg3)
+{
+    struct ausrv_cmdq *q = &ausrv->cmdq;
+    struct ausrv_cmd   cmd;
+    uint32_t           head;
+    uint32_t           tail;
+    uint64_t           one = 1;
+
+    cmd.func   = func;
+    cmd.drop   = drop;
+    cmd.flags  = flags;
+    cmd.arg[0] = arg0;
+    cmd.arg[1] = arg1;
+    cmd.arg[2] = arg2;
+    cmd.arg[3] = arg3;
+
+    if (ausrv->rtloop != NULL && (ausrv->locked ||
+                                  pa_threaded_mainloop_in_thread(ausrv->rtloop)))
+        return hold_command(ausrv, &cmd);
+
+    /* only the main thread defers, so this is not read by the other one */
+    if (ausrv->deferring)
+        return defer_command(ausrv, &cmd);
+
+    if (ausrv->rtloop == NULL)
+        return hold_command(ausrv, &cmd);
+
+    head = q->head;
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= AUSRV_CMDQ_LEN)
+        return run_locked(ausrv, &cmd);
+
+    q->cmd[head & (AUSRV_CMDQ_LEN - 1)] = cmd;
+
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    if (write(q->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        LOG_ERROR("%s(): can't wake up render thread: %s", __FUNCTION__,
+                  strerror(errno));
+
+    return TRUE;
+}
+
+
+/*
+ * The render thread is behind, e.g. it is starved or the client sends
+ * faster than it can go. Nothing is dropped, stopping a tone least of
+ * all: the queued commands and this one run here while the render
+ * thread is held on its lock, in the order they were issued.
+ */
+static int run_locked(struct ausrv *ausrv, struct ausrv_cmd *cmd)
+{
+    TRACE("%s(): command queue is full", __FUNCTION__);
+
+    ausrv->connstat.inlined++;
+
+    pa_threaded_mainloop_lock(ausrv->rtloop);
+    ausrv->locked = TRUE;
+
+    run_queue(ausrv);
+    cmd->func(ausrv, cmd->arg);
+
+    ausrv->locked = FALSE;
+    pa_threaded_mainloop_unlock(ausrv->rtloop);
+
+    return TRUE;
+}
 
 static void set_connection_status(struct ausrv *ausrv, int sts)
 {
@@ -151,9 +492,10 @@ static void set_connection_status(struct ausrv *ausrv, int sts)
 
 static void context_callback(pa_context *context, void *userdata)
 {
-    struct ausrv *ausrv = (struct ausrv *)userdata;
-    int           err   = 0;
-    const char   *strerr;
+    struct ausrv          *ausrv = (struct ausrv *)userdata;
+    int                    err   = 0;
+    const char            *strerr;
+    struct ausrv_connstat *st;
 
     if (context == NULL) {
         LOG_ERROR("%s() called with zero context", __FUNCTION__);
@@ -186,7 +528,22 @@ static void context_callback(pa_context *context, void *userdata)
         TRACE("ausrv: connection established.");
         set_connection_status(ausrv, CONNECTED);
         cancel_timer(ausrv);
-        LOG_INFO("Pulse Audio OK");        
+
+        st = &ausrv->connstat;
+        st->last = monotonic_usec() - st->start;
+        st->sum += st->last;
+        st->connects++;
+
+        if (st->last > st->max)
+            st->max = st->last;
+
+        LOG_INFO("Pulse Audio OK (connected in %u msec)", st->last / 1000);
+        startup_mark(STARTUP_SERVER);
+
+        if (lazy_connect)
+            restart_idle_timer(ausrv);
+
+        replay_pending(ausrv);
         break;
         
     case PA_CONTEXT_TERMINATED:
@@ -205,7 +562,15 @@ static void context_callback(pa_context *context, void *userdata)
     disconnect:
         set_connection_status(ausrv, DISCONNECTED);
         stream_kill_all(ausrv);
-        restart_timer(ausrv, CONNECT_DELAY);
+        scache_reset(ausrv);
+
+        /* by the time a retry succeeds these would be late anyway */
+        drop_pending(ausrv);
+
+        if (!lazy_connect)
+            restart_timer(ausrv, CONNECT_DELAY);
+        else
+            cancel_idle_timer(ausrv);   /* the next request tries again */
     }
 }
 
@@ -269,7 +634,7 @@ static void retry_connect(pa_mainloop_api *api, pa_time_event *event,
 
 static void restart_timer(struct ausrv *ausrv, int secs)
 {
-    pa_mainloop_api *api = pa_glib_mainloop_get_api(ausrv->mainloop);
+    pa_mainloop_api *api = ausrv->api;
     struct timeval   tv;
 
     gettimeofday(&tv, NULL);
@@ -287,7 +652,7 @@ static void cancel_timer(struct ausrv *ausrv)
     pa_mainloop_api *api;
     
     if (ausrv->timer != NULL) {
-        api = pa_glib_mainloop_get_api(ausrv->mainloop);
+        api = ausrv->api;
         api->time_free(ausrv->timer);
         ausrv->timer = NULL;
     }
@@ -296,7 +661,7 @@ static void cancel_timer(struct ausrv *ausrv)
 
 static void connect_server(struct ausrv *ausrv)
 {
-    pa_mainloop_api *api    = pa_glib_mainloop_get_api(ausrv->mainloop);
+    pa_mainloop_api *api    = ausrv->api;
     char            *server = ausrv->server;
 
     cancel_timer(ausrv);
@@ -328,9 +693,401 @@ static void connect_server(struct ausrv *ausrv)
 
 
     LOG_INFO("Trying to connect to %s...", server ? server : DEFAULT_SERVER);
+
+    ausrv->connstat.start = monotonic_usec();
     pa_context_connect(ausrv->context, server, PA_CONTEXT_NOAUTOSPAWN, NULL);
 }
 
+static void disconnect_server(struct ausrv *ausrv)
+{
+    LOG_INFO("Disconnecting from the idle server");
+
+    cancel_idle_timer(ausrv);
+
+    stream_kill_all(ausrv);
+    scache_reset(ausrv);
+
+    if (ausrv->context != NULL) {
+        pa_context_set_state_callback(ausrv->context, NULL, NULL);
+        pa_context_set_subscribe_callback(ausrv->context, NULL, NULL);
+        pa_context_disconnect(ausrv->context);
+        pa_context_unref(ausrv->context);
+        ausrv->context = NULL;
+    }
+
+    set_connection_status(ausrv, DISCONNECTED);
+
+    ausrv->connstat.disconnects++;
+}
+
+static int hold_command(struct ausrv *ausrv, struct ausrv_cmd *cmd)
+{
+    int busy;
+    int i;
+
+    if (!stream_output_needs_server())
+        return FALSE;
+
+    if (ausrv->connected) {
+        if (lazy_connect)
+            restart_idle_timer(ausrv);
+        return FALSE;
+    }
+
+    /* without a connection on the way the request fails as it used to */
+    if (!(busy = connecting(ausrv)) && !lazy_connect)
+        return FALSE;
+
+    /* nothing to stop, unless it is waiting for the connection */
+    if ((cmd->flags & CMD_PASSIVE) && ausrv->npending == 0)
+        return FALSE;
+
+    if (ausrv->npending >= AUSRV_CMDQ_LEN) {
+        /* the oldest request that starts something goes, not a stop */
+        for (i = 0;  i < ausrv->npending - 1;  i++) {
+            if (!(ausrv->pending[i].flags & CMD_PASSIVE))
+                break;
+        }
+
+        LOG_ERROR("%s(): too many requests waiting for the server; "
+                  "dropping one", __FUNCTION__);
+
+        drop_command(ausrv->pending + i);
+        memmove(ausrv->pending + i, ausrv->pending + i + 1,
+                (ausrv->npending - i - 1) * sizeof(*cmd));
+        ausrv->npending--;
+        ausrv->connstat.dropped++;
+    }
+
+    ausrv->pending[ausrv->npending++] = *cmd;
+
+    if (!busy)
+        connect_server(ausrv);
+
+    return TRUE;
+}
+
+static int connecting(struct ausrv *ausrv)
+{
+    if (ausrv->context == NULL)
+        return ausrv->timer != NULL;    /* the first connect is scheduled */
+
+    switch (pa_context_get_state(ausrv->context)) {
+    case PA_CONTEXT_UNCONNECTED:
+    case PA_CONTEXT_CONNECTING:
+    case PA_CONTEXT_AUTHORIZING:
+    case PA_CONTEXT_SETTING_NAME:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void replay_pending(struct ausrv *ausrv)
+{
+    struct ausrv_cmd cmd;
+    int              n = ausrv->npending;
+    int              i;
+
+    ausrv->npending = 0;
+    ausrv->connstat.held += n;
+
+    for (i = 0;  i < n;  i++) {
+        cmd = ausrv->pending[i];
+        cmd.func(ausrv, cmd.arg);
+    }
+}
+
+static void drop_pending(struct ausrv *ausrv)
+{
+    int i;
+
+    if (ausrv->npending > 0) {
+        LOG_ERROR("%s(): dropping %d requests; no server", __FUNCTION__,
+                  ausrv->npending);
+
+        for (i = 0;  i < ausrv->npending;  i++)
+            drop_command(ausrv->pending + i);
+
+        ausrv->connstat.dropped += ausrv->npending;
+        ausrv->npending = 0;
+    }
+}
+
+static void drop_command(struct ausrv_cmd *cmd)
+{
+    if (cmd->drop != NULL)
+        cmd->drop(cmd->arg);
+}
+
+static int defer_command(struct ausrv *ausrv, struct ausrv_cmd *cmd)
+{
+    pa_mainloop_api  *api = mainloop_get_api();
+    int               i;
+
+    /*
+     * only a call that was itself queued as the latest one is undone by
+     * the next; the same function may also take requests that add to
+     * what it did before, e.g. the fixed length presses of dtmf_play()
+     */
+    if ((cmd->flags & CMD_LATEST)) {
+        for (i = ausrv->ndeferred - 1;  i >= 0;  i--) {
+            if (ausrv->deferred[i].func != cmd->func)
+                continue;
+
+            if ((ausrv->deferred[i].flags & CMD_LATEST)) {
+                drop_command(ausrv->deferred + i);
+                memmove(ausrv->deferred + i, ausrv->deferred + i + 1,
+                        (ausrv->ndeferred - i - 1) * sizeof(*cmd));
+                ausrv->ndeferred--;
+                ausrv->connstat.superseded++;
+            }
+            break;              /* there can't be another one */
+        }
+    }
+
+    if (ausrv->ndeferred >= AUSRV_CMDQ_LEN)
+        run_deferred(ausrv);
+
+    ausrv->deferred[ausrv->ndeferred++] = *cmd;
+
+    api->defer_enable(ausrv->flush, TRUE);
+
+    return TRUE;
+}
+
+static void run_deferred(struct ausrv *ausrv)
+{
+    struct ausrv_cmd cmd;
+    int              deferring = ausrv->deferring;
+    int              n = ausrv->ndeferred;
+    int              i;
+
+    ausrv->deferring = FALSE;
+    ausrv->ndeferred = 0;
+    ausrv->connstat.deferred += n;
+
+    for (i = 0;  i < n;  i++) {
+        cmd = ausrv->deferred[i];
+        cmd.func(ausrv, cmd.arg);
+    }
+
+    ausrv->deferring = deferring;
+}
+
+static void flush_callback(pa_mainloop_api *api, pa_defer_event *ev,
+                           void *data)
+{
+    struct ausrv *ausrv = (struct ausrv *)data;
+
+    api->defer_enable(ev, FALSE);
+
+    run_deferred(ausrv);
+}
+
+static void idle_expired(pa_mainloop_api *api, pa_time_event *event,
+                         const struct timeval *tv, void *data)
+{
+    struct ausrv *ausrv = (struct ausrv *)data;
+
+    (void)api;
+    (void)event;
+    (void)tv;
+
+    if (ausrv->streams != NULL)
+        restart_idle_timer(ausrv);
+    else
+        disconnect_server(ausrv);
+}
+
+static void restart_idle_timer(struct ausrv *ausrv)
+{
+    pa_mainloop_api *api = ausrv->api;
+    struct timeval   tv;
+
+    if (idle_timeout <= 0)
+        return;
+
+    gettimeofday(&tv, NULL);
+    tv.tv_sec += idle_timeout;
+
+    if (ausrv->idle != NULL)
+        api->time_restart(ausrv->idle, &tv);
+    else
+        ausrv->idle = api->time_new(api, &tv, idle_expired, (void *)ausrv);
+}
+
+static void cancel_idle_timer(struct ausrv *ausrv)
+{
+    if (ausrv->idle != NULL) {
+        ausrv->api->time_free(ausrv->idle);
+        ausrv->idle = NULL;
+    }
+}
+
+static uint64_t monotonic_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+
+
+static int setup_command_queue(struct ausrv *ausrv)
+{
+    struct ausrv_cmdq *q = &ausrv->cmdq;
+
+    if ((q->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LOG_ERROR("%s(): can't create eventfd: %s", __FUNCTION__,
+                  strerror(errno));
+        return -1;
+    }
+
+    q->evio = ausrv->api->io_new(ausrv->api, q->evfd, PA_IO_EVENT_INPUT,
+                                 command_callback, ausrv);
+
+    if (q->evio == NULL) {
+        LOG_ERROR("%s(): can't watch eventfd", __FUNCTION__);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void command_callback(pa_mainloop_api *api, pa_io_event *event, int fd,
+                             pa_io_event_flags_t events, void *userdata)
+{
+    struct ausrv      *ausrv = (struct ausrv *)userdata;
+    uint64_t           cnt;
+
+    (void)api;
+    (void)event;
+    (void)events;
+
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        LOG_ERROR("%s(): read failed: %s", __FUNCTION__, strerror(errno));
+
+    run_queue(ausrv);
+}
+
+/* on the render thread, or on the main one holding the rtloop lock */
+static void run_queue(struct ausrv *ausrv)
+{
+    struct ausrv_cmdq *q = &ausrv->cmdq;
+    struct ausrv_cmd   cmd;
+    uint32_t           tail;
+
+    tail = q->tail;
+
+    while (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        cmd = q->cmd[tail & (AUSRV_CMDQ_LEN - 1)];
+
+        /* release the slot before running it; it may queue more */
+        __atomic_store_n(&q->tail, ++tail, __ATOMIC_RELEASE);
+
+        cmd.func(ausrv, cmd.arg);
+    }
+}
+
+static void setup_render_thread(struct ausrv *ausrv, uintptr_t *arg)
+{
+    struct sched_param param;
+    cpu_set_t          cpus;
+    int                err;
+
+    (void)ausrv;
+    (void)arg;
+
+    if (rt_priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rt_priority;
+
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+            LOG_ERROR("Can't set SCHED_FIFO priority %d for the render "
+                      "thread: %s", rt_priority, strerror(err));
+        else
+            TRACE("render thread runs with SCHED_FIFO priority %d",
+                  rt_priority);
+    }
+
+    if (rt_cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(rt_cpu, &cpus);
+
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpus),&cpus)))
+            LOG_ERROR("Can't bind the render thread to CPU %d: %s",
+                      rt_cpu, strerror(err));
+        else
+            TRACE("render thread is bound to CPU %d", rt_cpu);
+    }
+
+    pool_prefault_stack(PREFAULT_STACK);
+}
+
+static int setup_post_queue(struct ausrv *ausrv)
+{
+    pa_mainloop_api *api = mainloop_get_api();
+
+    if ((ausrv->postfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LOG_ERROR("%s(): can't create eventfd: %s", __FUNCTION__,
+                  strerror(errno));
+        return -1;
+    }
+
+    ausrv->postio = api->io_new(api, ausrv->postfd, PA_IO_EVENT_INPUT,
+                                post_callback, ausrv);
+
+    if (ausrv->postio == NULL) {
+        LOG_ERROR("%s(): can't watch eventfd", __FUNCTION__);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void post_callback(pa_mainloop_api *api, pa_io_event *event, int fd,
+                          pa_io_event_flags_t events, void *userdata)
+{
+    struct ausrv *ausrv = (struct ausrv *)userdata;
+    uint64_t      cnt;
+
+    (void)api;
+    (void)event;
+    (void)events;
+
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        LOG_ERROR("%s(): read failed: %s", __FUNCTION__, strerror(errno));
+
+    run_posts(ausrv);
+}
+
+static void run_posts(struct ausrv *ausrv)
+{
+    struct ausrv_post *list;
+    struct ausrv_post *post;
+    struct ausrv_post *next;
+
+    list = __atomic_exchange_n(&ausrv->posts, NULL, __ATOMIC_ACQUIRE);
+
+    /* the list is the last posted first */
+    for (post = list, list = NULL;  post;  post = next) {
+        next       = post->next;
+        post->next = list;
+        list       = post;
+    }
+
+    for (post = list;  post;  post = next) {
+        next = post->next;
+
+        /* it may be posted again, or freed, by its function */
+        __atomic_store_n(&post->posted, FALSE, __ATOMIC_RELEASE);
+
+        post->func(ausrv, post);
+    }
+}
 
 
 
@@ -26,31 +26,112 @@ USA.
 #define _GNU_SOURCE
 #endif
 
+#include <stdint.h>
+
 #include <glib.h>
 
 #include <pulse/pulseaudio.h>
-#include <pulse/glib-mainloop.h>
+
+#define AUSRV_CMDQ_LEN  64      /* must be a power of 2 */
 
 struct tonegend;
 struct stream;
+struct ausrv;
+
+struct ausrv_cmd {
+    void      (*func)(struct ausrv *, uintptr_t *);
+    void      (*drop)(uintptr_t *);     /* frees the args if not run */
+    int         flags;
+    uintptr_t   arg[4];
+};
+
+/*
+ * Work the audio side hands back to the main loop, e.g. sending a D-Bus
+ * signal. It is embedded in the data of the caller and is on the list
+ * at most once; posting it again before it ran does nothing.
+ */
+struct ausrv_post {
+    struct ausrv_post  *next;
+    void              (*func)(struct ausrv *, struct ausrv_post *);
+    int                 posted;
+};
+
+/*
+ * with a render thread the control thread talks to it through a
+ * single-producer single-consumer ring; head is only written by the
+ * control thread and tail by the render thread
+ */
+struct ausrv_cmdq {
+    int                evfd;     /* doorbell */
+    pa_io_event       *evio;
+    uint32_t           head;
+    uint32_t           tail;
+    struct ausrv_cmd   cmd[AUSRV_CMDQ_LEN];
+};
+
+struct ausrv_connstat {
+    uint64_t           start;    /* monotonic usec of the last connect */
+    uint32_t           connects;
+    uint32_t           disconnects;  /* idle disconnects */
+    uint32_t           last;     /* connect latency, usec */
+    uint32_t           max;
+    uint64_t           sum;
+    uint32_t           held;     /* requests replayed after connecting */
+    uint32_t           dropped;
+    uint32_t           deferred; /* requests run after the D-Bus reply */
+    uint32_t           superseded;   /* dropped for a later one */
+    uint32_t           inlined;  /* run here as the ring was full */
+};
 
 struct ausrv {
     struct tonegend   *tonegend;
     char              *server;
     int                connected;
-    pa_glib_mainloop  *mainloop;
+    pa_threaded_mainloop *rtloop;   /* render thread or NULL */
+    pa_mainloop_api   *api;      /* the main loop the audio runs on */
     pa_context        *context;
     pa_time_event     *timer;
+    pa_time_event     *idle;     /* lazy mode: disconnect when it fires */
     int                nextid;
     struct stream     *streams;
+    struct ausrv_cmdq  cmdq;
+    struct ausrv_cmd   pending[AUSRV_CMDQ_LEN];  /* waiting for READY */
+    int                npending;
+    pa_defer_event    *flush;    /* runs the deferred commands */
+    int                deferring;
+    struct ausrv_cmd   deferred[AUSRV_CMDQ_LEN];  /* after the D-Bus reply */
+    int                ndeferred;
+    int                locked;   /* running audio side work under rtloop */
+    struct ausrv_post *posts;    /* pushed by the render thread */
+    int                postfd;   /* its doorbell on the main loop */
+    pa_io_event       *postio;
+    struct ausrv_connstat connstat;
 };
 
 
 int ausrv_init(int, char **);
 void ausrv_exit(void);
+void ausrv_set_render_thread(int, int, int);
+void ausrv_set_lazy_connect(int, int);
 
 struct ausrv *ausrv_create(struct tonegend *, char *);
 void ausrv_destroy(struct ausrv *);
+int ausrv_queue_command(struct ausrv *, void (*)(struct ausrv *, uintptr_t *),
+                        uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+int ausrv_queue_passive_command(struct ausrv *,
+                                void (*)(struct ausrv *, uintptr_t *),
+                                uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+int ausrv_queue_latest_command(struct ausrv *,
+                               void (*)(struct ausrv *, uintptr_t *),
+                               uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+int ausrv_queue_owned_command(struct ausrv *,
+                              void (*)(struct ausrv *, uintptr_t *),
+                              void (*)(uintptr_t *),
+                              uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+void ausrv_defer_commands(struct ausrv *, int);
+void ausrv_post_main(struct ausrv *, struct ausrv_post *,
+                     void (*)(struct ausrv *, struct ausrv_post *));
+void ausrv_print_statistics(struct ausrv *);
 
 
 #endif /* __TONEGEND_AUSRV_H__ */
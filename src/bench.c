@@ -0,0 +1,769 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <libgen.h>
+
+#include <glib.h>
+
+#include "stream.h"
+#include "tone.h"
+#include "envelop.h"
+#include "worker.h"
+#include "shed.h"
+#include "dispatch.h"
+#include "g711.h"
+
+/*
+ * Render throughput benchmark. A number of streams with a DTMF tone
+ * pair each are rendered buffer by buffer, the way stream_request()
+ * renders the write-ahead buffers, first on the calling thread alone
+ * and then on a growing number of render workers.
+ *
+ * With -x the streams are overloaded instead: every buffer costs the
+ * given extra time, the buffer length is the deadline and the load
+ * shedding levels are driven from the slack left in each round.
+ *
+ * With -d the D-Bus method lookup is timed instead, for the methods the
+ * daemon registers: the dispatch table against the hash table keyed by
+ * a concatenated string that was used before.
+ *
+ * With -D a dial string is laid out as DialString does it, rendered and
+ * measured: the start, length and frequencies of every tone against the
+ * timeline and the ITU-T Q.23 (+-1.8 %) and Q.24 (40 ms) tolerances.
+ *
+ * With -G the G.711 encoder is checked against the reference expanders
+ * of both laws and the given number of buffers is encoded and timed.
+ */
+
+#define DIAL_PAUSE  2000000     /* usec; ',' as in dtmf.c */
+#define DIAL_MAX    64
+
+struct bench {
+    struct stream  stream;
+    int16_t       *samples;
+    int            length;
+    int            load;        /* extra rendering cost in usec */
+};
+
+static void usage(char *, int);
+static void render(void *);
+static double run(struct bench *, int, int);
+static void stress(struct bench *, int, int, int);
+static void busy(int);
+static void lookup(int);
+static int  dial(char *, int, int);
+static int  g711(int, int, int);
+static int  g711_check(int);
+static int  ulaw2linear(uint8_t);
+static int  alaw2linear(uint8_t);
+static int  segments(int16_t *, int, int, int *, int *, int);
+static double peak_freq(int16_t *, int, int, double);
+static double elapsed_nsec(struct timespec *, struct timespec *);
+
+static int low_freq[4]  = { 697, 770, 852, 941 };
+static int high_freq[4] = { 1209, 1336, 1477, 1633 };
+static char  keypad[]     = "123A456B789C*0#D";
+static char *classes[3] = { STREAM_NOTIFICATION, STREAM_INDICATOR,
+                            STREAM_DTMF };
+static char *methods[][3] = {
+    { "com.Nokia.Telephony.Tones", "StartEventTone",        "uiu" },
+    { "com.Nokia.Telephony.Tones", "StartNotificationTone", "uiu" },
+    { "com.Nokia.Telephony.Tones", "StopTone",              ""    },
+    { "com.Nokia.Telephony.Tones", "StopEventTone",         "u"   },
+    { "com.Nokia.Notification",    "StartNotificationTone", "uiu" },
+    { "com.Nokia.Notification",    "StopTone",              ""    },
+};
+
+
+int main(int argc, char **argv)
+{
+    struct bench *benches;
+    struct bench *b;
+    int           nstream  = 64;
+    int           nbuffer  = 500;
+    int           maxthr   = sysconf(_SC_NPROCESSORS_ONLN);
+    int           buflen   = 20;        /* msec */
+    int           rate     = 48000;
+    int           load     = 0;         /* usec, -x */
+    int           calls    = 0;         /* -d */
+    char         *digits   = NULL;      /* -D */
+    int           encode   = 0;         /* -G */
+    int           opt;
+    int           i, t;
+    double        persec;
+    double        base = 0.0;
+
+    while ((opt = getopt(argc, argv, "s:n:t:l:r:x:d:D:G:h")) != -1) {
+        switch (opt) {
+        case 's':   nstream = atoi(optarg);     break;
+        case 'n':   nbuffer = atoi(optarg);     break;
+        case 't':   maxthr  = atoi(optarg);     break;
+        case 'l':   buflen  = atoi(optarg);     break;
+        case 'r':   rate    = atoi(optarg);     break;
+        case 'x':   load    = atoi(optarg);     break;
+        case 'd':   calls   = atoi(optarg);     break;
+        case 'D':   digits  = optarg;           break;
+        case 'G':   encode  = atoi(optarg);     break;
+        case 'h':   usage(argv[0], 0);          break;
+        default:    usage(argv[0], EINVAL);     break;
+        }
+    }
+
+    if (nstream < 1 || nbuffer < 1 || maxthr < 0 || maxthr > WORKER_MAX ||
+        buflen < 1 || rate < 8000 || load < 0 || calls < 0 || encode < 0)
+        usage(argv[0], EINVAL);
+
+    if (calls > 0) {
+        lookup(calls);
+        return 0;
+    }
+
+    if (encode > 0)
+        return g711(encode, buflen, rate);
+
+    if (tone_init(argc, argv) < 0 || envelop_init(argc, argv) < 0)
+        return ENOMEM;
+
+    if (digits != NULL)
+        return dial(digits, rate, buflen);
+
+    if ((benches = calloc(nstream, sizeof(*benches))) == NULL)
+        return ENOMEM;
+
+    for (i = 0;  i < nstream;  i++) {
+        b = benches + i;
+
+        b->stream.name  = classes[i % 3];
+        b->stream.prio  = i % 3 + 1;
+        b->stream.rate  = rate;
+        b->stream.write = tone_write_callback;
+        b->length       = (rate * buflen) / 1000;
+        b->load         = load;
+
+        if ((b->samples = malloc(b->length * sizeof(int16_t))) == NULL)
+            return ENOMEM;
+
+        worker_job_init(&b->stream.job, render, b);
+
+        tone_create(&b->stream, TONE_DTMF_L, low_freq[i % 4], 50,
+                    1000000, 1000000, 0, 0);
+        tone_create(&b->stream, TONE_DTMF_H, high_freq[(i / 4) % 4], 50,
+                    1000000, 1000000, 0, 0);
+    }
+
+    printf("%d streams, %d buffers of %d msec at %d Hz per stream\n",
+           nstream, nbuffer, buflen, rate);
+
+    if (load > 0)
+        stress(benches, nstream, nbuffer, buflen);
+    else {
+        printf("workers   buffers/sec   streams in real time   speedup\n");
+
+        for (t = 0;  t <= maxthr;  t++) {
+            if (worker_start(t, 0) < 0)
+                return EIO;
+
+            persec = run(benches, nstream, nbuffer);
+
+            if (t == 0)
+                base = persec;
+
+            printf("%7d   %11.0f   %20.0f   %6.2fx\n", t, persec,
+                   persec * buflen / 1000.0, persec / base);
+
+            worker_stop();
+        }
+    }
+
+    for (i = 0;  i < nstream;  i++) {
+        tone_destroy_callback(benches[i].stream.data);
+        free(benches[i].samples);
+    }
+
+    free(benches);
+
+    return 0;
+}
+
+
+static void usage(char *argv0, int exit_code)
+{
+    printf("usage: %s [-h] [-s streams] [-n buffers_per_stream] "
+           "[-t max_workers] [-l buflen_in_ms] [-r sample_rate]\n"
+           "       [-x overload_per_buffer_in_usec] [-d dbus_calls]\n"
+           "       [-D dial_string[:on_ms[:off_ms]]] [-G g711_buffers]\n",
+           basename(argv0));
+    exit(exit_code);
+}
+
+static void render(void *data)
+{
+    struct bench *b = (struct bench *)data;
+
+    if (b->stream.muted) {
+        memset(b->samples, 0, b->length * sizeof(int16_t));
+        b->stream.time += (b->length * 1000000ULL) / b->stream.rate;
+    }
+    else {
+        b->stream.time = b->stream.write(&b->stream, b->samples, b->length);
+
+        if (b->load > 0)
+            busy(b->load);
+    }
+
+    if (shed_enabled())
+        shed_account(b->stream.shed, b->stream.muted);
+}
+
+static void busy(int usec)
+{
+    struct timespec start;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000L +
+             (now.tv_nsec - start.tv_nsec) / 1000L < usec);
+}
+
+static double run(struct bench *benches, int nstream, int nbuffer)
+{
+    struct timespec start;
+    struct timespec end;
+    double          elapsed;
+    int             i, n;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (n = 0;  n < nbuffer;  n++) {
+        for (i = 0;  i < nstream;  i++) {
+            if (worker_submit(&benches[i].stream.job) < 0)
+                render(benches + i);
+        }
+
+        for (i = 0;  i < nstream;  i++)
+            worker_wait(&benches[i].stream.job);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (double)(end.tv_sec - start.tv_sec) +
+              (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return (double)nstream * (double)nbuffer / elapsed;
+}
+
+static void stress(struct bench *benches, int nstream, int nbuffer,
+                   int buflen)
+{
+    struct timespec   start;
+    struct timespec   end;
+    int64_t           deadline = buflen * 1000;
+    int64_t           elapsed;
+    uint32_t          played[4];
+    uint32_t          late = 0;
+    int               level;
+    int               i, n;
+
+    memset(played, 0, sizeof(played));
+
+    shed_set_margin(deadline / 4);
+
+    printf("overload: %d usec extra per buffer, deadline %lld usec\n",
+           benches[0].load, (long long)deadline);
+    printf("buffer   level   round (usec)\n");
+
+    for (n = 0;  n < nbuffer;  n++) {
+        level = shed_level();
+
+        for (i = 0;  i < nstream;  i++) {
+            benches[i].stream.shed  = level;
+            benches[i].stream.muted = level >= SHED_PRIORITY &&
+                                      benches[i].stream.prio < 3;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0;  i < nstream;  i++) {
+            if (worker_submit(&benches[i].stream.job) < 0)
+                render(benches + i);
+        }
+
+        for (i = 0;  i < nstream;  i++) {
+            worker_wait(&benches[i].stream.job);
+
+            if (!benches[i].stream.muted)
+                played[benches[i].stream.prio]++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        elapsed = (int64_t)(end.tv_sec - start.tv_sec) * 1000000LL +
+                  (end.tv_nsec - start.tv_nsec) / 1000LL;
+
+        if (elapsed > deadline)
+            late++;
+
+        if (n % (nbuffer / 10 + 1) == 0)
+            printf("%6d   %5d   %12lld\n", n, level, (long long)elapsed);
+
+        shed_check(deadline - elapsed);
+    }
+
+    shed_print_stats();
+
+    printf("%u of %d rounds missed the deadline\n", late, nbuffer);
+    printf("buffers played: dtmf %u, indicator %u, notification %u\n",
+           played[3], played[2], played[1]);
+}
+
+static double elapsed_nsec(struct timespec *start, struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 +
+           (double)(end->tv_nsec - start->tv_nsec);
+}
+
+static void lookup(int calls)
+{
+    struct dispatch  table;
+    GHashTable      *hash;
+    struct timespec  start;
+    struct timespec  end;
+    gchar           *key;
+    char           **m;
+    int              nmethod = sizeof(methods) / sizeof(methods[0]);
+    uintptr_t        found;
+    int              i;
+
+    memset(&table, 0, sizeof(table));
+    hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    for (i = 0;  i < nmethod;  i++) {
+        m = methods[i];
+
+        if (dispatch_add(&table, m[0], m[1], m[2], (void *)(m + 1)) < 0)
+            exit(ENOMEM);
+
+        key = g_strconcat(m[1], "__", m[2], "__", m[0], NULL);
+        g_hash_table_insert(hash, key, (gpointer)(m + 1));
+    }
+
+    printf("%d calls over %d methods\n", calls, nmethod);
+    printf("lookup           nsec/call\n");
+
+    found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0;  i < calls;  i++) {
+        m = methods[i % nmethod];
+
+        key = g_strconcat(m[1], "__", m[2], "__", m[0], NULL);
+        found += (uintptr_t)g_hash_table_lookup(hash, key) != 0;
+        g_free(key);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("hash table   %13.1f\n", elapsed_nsec(&start, &end) / calls);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0;  i < calls;  i++) {
+        m = methods[i % nmethod];
+        found += dispatch_find(&table, m[0], m[1], m[2]) != NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("dispatch     %13.1f\n", elapsed_nsec(&start, &end) / calls);
+
+    if (found != (uintptr_t)calls * 2)
+        printf("lookup failures: %lu\n", (unsigned long)(calls * 2 - found));
+
+    g_hash_table_destroy(hash);
+    dispatch_free(&table);
+}
+
+
+static int dial(char *spec, int rate, int buflen)
+{
+    struct stream  stream;
+    int16_t       *samples;
+    char          *digits = spec;
+    char          *p;
+    char          *e;
+    uint32_t       on     = 100000;
+    uint32_t       off    = 100000;
+    uint32_t       start[DIAL_MAX];
+    int            key[DIAL_MAX];
+    int            onset[DIAL_MAX + 1];
+    int            offset[DIAL_MAX + 1];
+    uint32_t       t, gap;
+    int            nsamp, len, pos;
+    int            n, nseg, i, k;
+    double         f, lerr, herr;
+    double         maxstart = 0, maxlen = 0, maxfreq = 0;
+    double         minlen = 1e9, minpause = 1e9;
+    double         length, pause;
+
+    if ((p = strchr(spec, ':')) != NULL) {
+        *p++ = '\0';
+        on = strtoul(p, &e, 10) * 1000;
+        if (*e == ':')
+            off = strtoul(e + 1, &e, 10) * 1000;
+        if (*e || on < 10000 || off < 10000)
+            usage("tonegend-bench", EINVAL);
+    }
+
+    if (tone_init(0, NULL) < 0 || envelop_init(0, NULL) < 0)
+        return ENOMEM;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.name  = STREAM_DTMF;
+    stream.rate  = rate;
+    stream.write = tone_write_callback;
+
+    /* as dtmf_dial() does it */
+    for (p = digits, t = gap = 0, n = 0;  *p && n < DIAL_MAX;  p++) {
+        if (*p == ',')
+            gap += DIAL_PAUSE;
+        else if ((e = strchr(keypad, *p)) != NULL && *e) {
+            key[n]   = e - keypad;
+            start[n] = t + gap;
+            t = start[n] + on;
+
+            tone_create(&stream, TONE_DTMF_L, low_freq[key[n] / 4], 50,
+                        on, on, gap, on);
+            tone_create(&stream, TONE_DTMF_H, high_freq[key[n] % 4], 50,
+                        on, on, gap, on);
+            gap = off;
+            n++;
+        }
+    }
+
+    if (n == 0)
+        usage("tonegend-bench", EINVAL);
+
+    nsamp = (int)(((uint64_t)t + 100000) * rate / 1000000);
+    len   = (rate * buflen) / 1000;
+
+    if ((samples = calloc(nsamp + len, sizeof(int16_t))) == NULL)
+        return ENOMEM;
+
+    for (pos = 0;  pos < nsamp;  pos += len)
+        stream.time = stream.write(&stream, samples + pos, len);
+
+    nseg = segments(samples, nsamp, rate, onset, offset, DIAL_MAX + 1);
+
+    printf("%d tones of %u msec, %u msec apart, at %d Hz in %d msec "
+           "buffers\n", n, on / 1000, off / 1000, rate, buflen);
+    printf("key   start err   length   pause   low Hz  (err %%)   "
+           "high Hz (err %%)\n");
+
+    for (i = 0;  i < nseg && i < n;  i++) {
+        k = key[i];
+        length = (double)(offset[i] - onset[i]) * 1e6 / rate;
+        pause  = i + 1 < nseg ? (double)(onset[i+1]-offset[i]) * 1e6 / rate
+                              : 0;
+        f      = (double)onset[i] * 1e6 / rate - start[i];
+
+        /* the middle half, clear of the envelopes */
+        pos  = onset[i] + (offset[i] - onset[i]) / 4;
+        len  = (offset[i] - onset[i]) / 2;
+        lerr = peak_freq(samples + pos, len, rate, low_freq[k / 4]);
+        herr = peak_freq(samples + pos, len, rate, high_freq[k % 4]);
+        lerr = (lerr - low_freq[k / 4]) * 100.0 / low_freq[k / 4];
+        herr = (herr - high_freq[k % 4]) * 100.0 / high_freq[k % 4];
+
+        printf("  %c   %7.0f us   %6.1f  %6.1f   %6d  (%+5.2f)   %6d  "
+               "(%+5.2f)\n", keypad[k], f, length / 1000, pause / 1000,
+               low_freq[k / 4], lerr, high_freq[k % 4], herr);
+
+        maxstart = fmax(maxstart, fabs(f));
+        maxlen   = fmax(maxlen, fabs(length - on));
+        maxfreq  = fmax(maxfreq, fmax(fabs(lerr), fabs(herr)));
+        minlen   = fmin(minlen, length);
+
+        if (i + 1 < nseg)
+            minpause = fmin(minpause, pause);
+    }
+
+    printf("max start error %.0f usec, max length error %.0f usec, "
+           "max frequency error %.2f %%\n", maxstart, maxlen, maxfreq);
+    printf("Q.23 frequencies within 1.8 %%: %s\n",
+           maxfreq <= 1.8 ? "yes" : "NO");
+    printf("Q.24 tones and pauses at least 40 msec: %s\n",
+           nseg == n && minlen >= 40000 && (n < 2 || minpause >= 40000) ?
+           "yes" : "NO");
+
+    if (nseg != n)
+        printf("found %d tones instead of %d\n", nseg, n);
+
+    tone_destroy_callback(stream.data);
+    free(samples);
+
+    return 0;
+}
+
+/*
+ * Where the output is above 5 % of its peak, bridging the zero
+ * crossings; returns the number of tones found.
+ */
+static int g711(int nbuffer, int buflen, int rate)
+{
+    static char    *names[2] = { "mu-law", "A-law" };
+    struct timespec start, end;
+    int16_t        *samples;
+    uint8_t        *encoded;
+    int             len = (rate * buflen) / 1000;
+    int             law, i;
+    double          nsec;
+
+    g711_init();
+
+    if (g711_check(G711_ULAW) < 0 || g711_check(G711_ALAW) < 0)
+        return EINVAL;
+
+    samples = malloc(len * sizeof(int16_t));
+    encoded = malloc(len);
+
+    if (samples == NULL || encoded == NULL)
+        return ENOMEM;
+
+    /* a DTMF pair at -6 dBFS, so that all the segments are in use */
+    for (i = 0;  i < len;  i++) {
+        samples[i] = 8192.0 * (sin(2.0 * M_PI * 697.0 * i / rate) +
+                               sin(2.0 * M_PI * 1209.0 * i / rate));
+    }
+
+    printf("%d buffers of %d samples\n", nbuffer, len);
+    printf("law       Msamples/sec   nsec/sample\n");
+
+    for (law = G711_ULAW;  law <= G711_ALAW;  law++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0;  i < nbuffer;  i++)
+            g711_encode(law, encoded, samples, len);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        nsec = elapsed_nsec(&start, &end);
+
+        printf("%-6s    %12.1f   %11.2f\n", names[law],
+               (double)nbuffer * len * 1e3 / nsec,
+               nsec / ((double)nbuffer * len));
+    }
+
+    free(encoded);
+    free(samples);
+
+    return 0;
+}
+
+/*
+ * Bit exactness of the encoder: the end points and zero against the
+ * values in G.711, every code word back from its reconstruction level
+ * (the 'negative zero' of mu-law encodes as positive zero) and every
+ * 16 bit input to a monotonic code whose level is within half a step
+ * of it. mu-law drops the two low bits first, which may add 3 to that.
+ */
+static int g711_check(int law)
+{
+    static int16_t  known[3]     = { 0, 32767, -32768 };
+    static uint8_t  expect[2][3] = {{ 0xff, 0x80, 0x00 },
+                                    { 0xd5, 0xaa, 0x2a }};
+    int16_t         x;
+    uint8_t         code, want;
+    int             level, prev, step, seg, max, slack;
+    int             errors = 0;
+    int             i;
+
+    for (i = 0;  i < 3;  i++) {
+        g711_encode(law, &code, known + i, 1);
+
+        if (code != expect[law][i]) {
+            printf("%s: %d encodes to 0x%02x instead of 0x%02x\n",
+                   law == G711_ALAW ? "A-law" : "mu-law", known[i], code,
+                   expect[law][i]);
+            errors++;
+        }
+    }
+
+    for (i = 0;  i < 256;  i++) {
+        x    = law == G711_ALAW ? alaw2linear(i) : ulaw2linear(i);
+        want = (law == G711_ULAW && i == 0x7f) ? 0xff : i;
+
+        g711_encode(law, &code, &x, 1);
+
+        if (code != want) {
+            printf("%s: code 0x%02x comes back as 0x%02x\n",
+                   law == G711_ALAW ? "A-law" : "mu-law", i, code);
+            errors++;
+        }
+    }
+
+    max   = law == G711_ALAW ? 32256 : 32124;
+    slack = law == G711_ALAW ? 0 : 3;
+    prev  = -65536;
+
+    for (i = -32768;  i < 32768;  i++) {
+        x = i;
+
+        g711_encode(law, &code, &x, 1);
+
+        if (law == G711_ALAW) {
+            level = alaw2linear(code);
+            seg   = ((code ^ 0x55) & 0x70) >> 4;
+            step  = seg < 2 ? 16 : 16 << (seg - 1);
+        }
+        else {
+            level = ulaw2linear(code);
+            seg   = (~code & 0x70) >> 4;
+            step  = 8 << seg;
+        }
+
+        if (level < prev ||
+            (i >= -max && i <= max && abs(level - i) > step / 2 + slack))
+        {
+            if (errors++ < 10) {
+                printf("%s: %d encodes to 0x%02x (%d)\n",
+                       law == G711_ALAW ? "A-law" : "mu-law", i, code,
+                       level);
+            }
+        }
+
+        prev = level;
+    }
+
+    printf("%s: %s\n", law == G711_ALAW ? "A-law" : "mu-law",
+           errors ? "FAILED" : "bit exact");
+
+    return errors ? -1 : 0;
+}
+
+/* the expanders of the Sun reference code */
+static int ulaw2linear(uint8_t u)
+{
+    int t;
+
+    u = ~u;
+    t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+
+    return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+static int alaw2linear(uint8_t a)
+{
+    int t;
+    int seg;
+
+    a  ^= 0x55;
+    t   = (a & 0x0f) << 4;
+    seg = (a & 0x70) >> 4;
+
+    switch (seg) {
+    case 0:   t += 8;                               break;
+    case 1:   t += 0x108;                           break;
+    default:  t += 0x108;  t <<= seg - 1;           break;
+    }
+
+    return (a & 0x80) ? t : -t;
+}
+
+static int segments(int16_t *samples, int nsamp, int rate,
+                    int *onset, int *offset, int max)
+{
+    int peak = 1;
+    int hold = rate / 500;      /* 2 msec */
+    int quiet;
+    int thr;
+    int n, i;
+
+    for (i = 0;  i < nsamp;  i++)
+        peak = abs(samples[i]) > peak ? abs(samples[i]) : peak;
+
+    thr = peak / 20;
+
+    for (i = n = 0, quiet = -1;  i < nsamp;  i++) {
+        if (abs(samples[i]) > thr) {
+            if (quiet < 0) {
+                if (n >= max)
+                    break;
+                onset[n] = i;
+            }
+            quiet = 0;
+            offset[n] = i + 1;
+        }
+        else if (quiet >= 0 && ++quiet >= hold) {
+            quiet = -1;
+            n++;
+        }
+    }
+
+    return quiet >= 0 ? n + 1 : n;
+}
+
+/* strongest frequency within 5 % of the nominal one, in 0.5 Hz steps */
+static double peak_freq(int16_t *samples, int n, int rate, double nominal)
+{
+    double best = nominal;
+    double max  = -1;
+    double f, c, s0, s1, s2, power;
+    int    i;
+
+    for (f = nominal * 0.95;  f <= nominal * 1.05;  f += 0.5) {
+        c  = 2.0 * cos(2.0 * M_PI * f / rate);
+        s1 = s2 = 0;
+
+        for (i = 0;  i < n;  i++) {
+            s0 = samples[i] + c * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+
+        if ((power = s1 * s1 + s2 * s2 - c * s1 * s2) > max) {
+            max  = power;
+            best = f;
+        }
+    }
+
+    return best;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,343 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "tonegend.h"
+#include "dbusif.h"
+#include "ausrv.h"
+#include "stream.h"
+#include "tone.h"
+#include "indicator.h"
+#include "cadence.h"
+#include "tonesig.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define MAX_FREQ      20000     /* Hz */
+#define MAX_PERIOD    60000     /* msec, on + off and start */
+#define MAX_DURATION  600000    /* msec */
+#define MAX_RAMP      1000      /* msec */
+
+struct method {
+    char  *intf;                                    /* interface name */
+    char  *memb;                                    /* method name */
+    char  *sig;                                     /* signature */
+    int  (*func)(DBusMessage *, struct tonegend *); /* implementing function */
+};
+
+static int define_tone(DBusMessage *, struct tonegend *);
+static int play_tone(DBusMessage *, struct tonegend *);
+static int compile(DBusMessageIter *, struct cadence *);
+static void install(struct ausrv *, struct cadence *);
+static void install_command(struct ausrv *, uintptr_t *);
+static void drop_install(uintptr_t *);
+
+static struct method  method_defs[] = {
+    {NULL, "DefineTone", "ua(auuuuu)u", define_tone},
+    {NULL, "PlayTone"  , "uiu"        , play_tone  },
+    {NULL, NULL, NULL, NULL}
+};
+
+/*
+ * The definitions are compiled on the D-Bus side, then handed over to
+ * the audio side that plays them. Only the latter touches 'cadences';
+ * 'defined' tells the D-Bus side what ids can be played.
+ */
+static struct cadence *cadences[CADENCE_MAX];
+static char            defined[CADENCE_MAX];
+static uint32_t        serial;
+
+
+int cadence_init(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    return 0;
+}
+
+int cadence_create(struct tonegend *tonegend)
+{
+    struct method *m;
+    int err;
+    int sts;
+
+    for (m = method_defs, err = 0;    m->memb != NULL;    m++) {
+        sts = dbusif_register_input_method(tonegend, m->intf, m->memb,
+                                           m->sig, m->func);
+
+        if (sts < 0) {
+            LOG_ERROR("%s(): Can't register D-Bus method '%s'",
+                      __FUNCTION__, m->memb);
+            err = -1;
+        }
+    }
+
+    return err;
+}
+
+/* on the D-Bus side: can the tone be played */
+int cadence_defined(uint32_t id)
+{
+    return id < CADENCE_MAX && defined[id];
+}
+
+struct cadence *cadence_find(uint32_t id)
+{
+    return id < CADENCE_MAX ? cadences[id] : NULL;
+}
+
+/*
+ * sets up the tones of the definition on the stream, cut at 'dur' usec
+ * if that is given; returns how long they play or 0 if for ever
+ */
+uint32_t cadence_create_tones(struct stream *stream, struct cadence *cad,
+                              uint32_t vol, int dur)
+{
+    struct cadence_part *part;
+    struct tone         *tone;
+    uint32_t             length;
+    int                  i;
+
+    for (i = 0;  i < cad->nparts;  i++) {
+        part   = cad->parts + i;
+        length = part->duration;
+
+        if (dur > 0) {
+            if (part->start >= (uint32_t)dur)
+                continue;
+            if (!length || part->start + length > (uint32_t)dur)
+                length = dur - part->start;
+        }
+
+        tone = tone_create(stream, TONE_CUSTOM, part->freq,
+                           (vol * part->level) / 100, part->period,
+                           part->play, part->start, length);
+        if (tone != NULL)
+            tone_set_ramp(tone, cad->ramp);
+    }
+
+    if (dur > 0 && (!cad->length || (uint32_t)dur < cad->length))
+        return dur;
+
+    return cad->length;
+}
+
+
+static int define_tone(DBusMessage *msg, struct tonegend *tonegend)
+{
+    struct cadence   *cad;
+    DBusMessageIter   it;
+    uint32_t          id;
+    uint32_t          ramp;
+
+    if (!dbus_message_iter_init(msg, &it)) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    /* the signature is checked by the dispatcher */
+    dbus_message_iter_get_basic(&it, &id);
+    dbus_message_iter_next(&it);
+
+    if (id >= CADENCE_MAX) {
+        LOG_ERROR("%s(): invalid tone id %u", __FUNCTION__, id);
+        return FALSE;
+    }
+
+    if ((cad = (struct cadence *)calloc(1, sizeof(*cad))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return FALSE;
+    }
+
+    if (compile(&it, cad) < 0) {
+        LOG_ERROR("%s(): invalid definition of tone %u", __FUNCTION__, id);
+        free(cad);
+        return FALSE;
+    }
+
+    dbus_message_iter_next(&it);
+    dbus_message_iter_get_basic(&it, &ramp);
+
+    if (ramp > MAX_RAMP) {
+        LOG_ERROR("%s(): invalid envelope %u msec", __FUNCTION__, ramp);
+        free(cad);
+        return FALSE;
+    }
+
+    cad->id     = id;
+    cad->serial = ++serial;
+    cad->ramp   = ramp * 1000;
+
+    TRACE("%s(): tone %u: %d parts, %u usec", __FUNCTION__, id,
+          cad->nparts, cad->length);
+
+    defined[id] = TRUE;
+
+    install(tonegend->ausrv_ctx, cad);
+
+    return TRUE;
+}
+
+static int play_tone(DBusMessage *msg, struct tonegend *tonegend)
+{
+    uint32_t  id;
+    int32_t   dbm0;
+    uint32_t  duration;
+    int       success;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_UINT32, &id,
+                                    DBUS_TYPE_INT32 , &dbm0,
+                                    DBUS_TYPE_UINT32, &duration,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    if (!cadence_defined(id) || duration > MAX_DURATION) {
+        LOG_ERROR("%s(): no tone %u or invalid duration %u msec",
+                  __FUNCTION__, id, duration);
+        return FALSE;
+    }
+
+    TRACE("%s(): tone %u volume %d dbm0 duration %u msec",
+          __FUNCTION__, id, dbm0, duration);
+
+    tonesig_begin(tonegend, msg);
+    indicator_play_custom(tonegend->ausrv_ctx, id, tone_linear_volume(dbm0),
+                          duration * 1000);
+    tonesig_end(tonegend);
+
+    return TRUE;
+}
+
+/*
+ * every (frequencies, level, on, off, start, duration) of the array is
+ * a part per frequency; the times are turned from msec to usec
+ */
+static int compile(DBusMessageIter *it, struct cadence *cad)
+{
+    struct cadence_part *part;
+    DBusMessageIter      arr;
+    DBusMessageIter      elem;
+    DBusMessageIter      field;
+    uint32_t            *freqs;
+    uint32_t             val[5];
+    uint32_t             end;
+    int                  nfreq;
+    int                  fixed;
+    int                  i;
+
+    fixed = TRUE;
+
+    dbus_message_iter_recurse(it, &arr);
+
+    while (dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_STRUCT) {
+        dbus_message_iter_recurse(&arr, &elem);
+
+        dbus_message_iter_recurse(&elem, &field);
+        dbus_message_iter_get_fixed_array(&field, &freqs, &nfreq);
+
+        for (i = 0;  i < 5;  i++) {
+            dbus_message_iter_next(&elem);
+            dbus_message_iter_get_basic(&elem, val + i);
+        }
+
+        /* level, on, off, start, duration */
+        if (nfreq < 1 || cad->nparts + nfreq > CADENCE_MAXPART ||
+            val[0] < 1 || val[0] > 100 || val[1] < 1 ||
+            val[1] + val[2] > MAX_PERIOD || val[3] > MAX_PERIOD ||
+            val[4] > MAX_DURATION)
+            return -1;
+
+        for (i = 0;  i < nfreq;  i++) {
+            if (freqs[i] < 1 || freqs[i] > MAX_FREQ)
+                return -1;
+
+            part = cad->parts + cad->nparts++;
+
+            part->freq     = freqs[i];
+            part->level    = val[0];
+            part->play     = val[1] * 1000;
+            part->period   = (val[1] + val[2]) * 1000;
+            part->start    = val[3] * 1000;
+            part->duration = val[4] * 1000;
+        }
+
+        if (!val[4])
+            fixed = FALSE;
+        else if ((end = (val[3] + val[4]) * 1000) > cad->length)
+            cad->length = end;
+
+        dbus_message_iter_next(&arr);
+    }
+
+    if (cad->nparts == 0)
+        return -1;
+
+    if (!fixed)
+        cad->length = 0;
+
+    return 0;
+}
+
+static void install(struct ausrv *ausrv, struct cadence *cad)
+{
+    if (ausrv_queue_owned_command(ausrv, install_command, drop_install,
+                                  (uintptr_t)cad, 0,0,0))
+        return;
+
+    free(cadences[cad->id]);
+    cadences[cad->id] = cad;
+}
+
+static void install_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    install(ausrv, (struct cadence *)arg[0]);
+}
+
+static void drop_install(uintptr_t *arg)
+{
+    free((struct cadence *)arg[0]);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
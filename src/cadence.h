@@ -0,0 +1,75 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_CADENCE_H__
+#define __TONEGEND_CADENCE_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#define CADENCE_MAX       256   /* ids 0 ... CADENCE_MAX-1 */
+#define CADENCE_MAXPART   16    /* tones in a definition, one per frequency */
+
+/*
+ * A tone defined by a client, compiled to the arguments of
+ * tone_create(): every part is a sine played for 'play' usec of every
+ * 'period', from 'start' on for 'duration' usec (0: as long as asked).
+ */
+struct cadence_part {
+    uint32_t  freq;
+    uint32_t  level;            /* % of the volume */
+    uint32_t  period;
+    uint32_t  play;
+    uint32_t  start;
+    uint32_t  duration;
+};
+
+struct cadence {
+    uint32_t             id;
+    uint32_t             serial;    /* of the definition, for caching */
+    uint32_t             ramp;      /* envelope ramp in usec, or 0 */
+    uint32_t             length;    /* of a fixed length tone, or 0 */
+    int                  nparts;
+    struct cadence_part  parts[CADENCE_MAXPART];
+};
+
+struct tonegend;
+struct ausrv;
+struct stream;
+
+int cadence_init(int, char **);
+int cadence_create(struct tonegend *);
+int cadence_defined(uint32_t);
+struct cadence *cadence_find(uint32_t);
+uint32_t cadence_create_tones(struct stream *, struct cadence *, uint32_t,
+                              int);
+
+#endif /* __TONEGEND_CADENCE_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
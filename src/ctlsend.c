@@ -0,0 +1,163 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ctlsock.h"
+
+/*
+ * Sends one packet to the control socket of 'tonegend -K' and prints
+ * the reply. Every command is an operation name followed by its three
+ * arguments as laid out in ctlsock.h, e.g.
+ *
+ *     tonegend-ctl sequence 1 50 100 sequence 2 50 100 stop 1 0 0
+ *
+ * plays '1' and '2' back to back and stops them. The exit code is 0 if
+ * the daemon ran every command and the errno of the failure otherwise.
+ */
+
+struct op {
+    const char *name;
+    uint8_t     code;
+};
+
+static void usage(char *, int);
+static int  opcode(const char *);
+
+static struct op ops[] = {
+    { "dtmf"     , CTL_DTMF      },
+    { "indicator", CTL_INDICATOR },
+    { "note"     , CTL_NOTE      },
+    { "stop"     , CTL_STOP      },
+    { "sequence" , CTL_SEQUENCE  },
+    { NULL       , 0             }
+};
+
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct ctl_cmd     cmd[CTLSOCK_MAXCMD];
+    struct ctl_reply   reply;
+    char              *path = NULL;
+    int                ncmd;
+    int                code;
+    int                fd;
+    int                opt;
+    int                i;
+
+    while ((opt = getopt(argc, argv, "K:h")) != -1) {
+        switch (opt) {
+        case 'K':   path = optarg;              break;
+        case 'h':   usage(argv[0], 0);          break;
+        default:    usage(argv[0], EINVAL);     break;
+        }
+    }
+
+    if (optind >= argc || (argc - optind) % 4 ||
+        (argc - optind) / 4 > CTLSOCK_MAXCMD)
+        usage(argv[0], EINVAL);
+
+    memset(cmd, 0, sizeof(cmd));
+
+    for (ncmd = 0;  optind < argc;  ncmd++, optind += 4) {
+        if ((code = opcode(argv[optind])) < 0)
+            usage(argv[0], EINVAL);
+
+        cmd[ncmd].op  = code;
+        cmd[ncmd].seq = ncmd + 1;
+
+        for (i = 0;  i < 3;  i++)
+            cmd[ncmd].arg[i] = strtoul(argv[optind + 1 + i], NULL, 0);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (path != NULL)
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    else if (getenv("XDG_RUNTIME_DIR") != NULL)
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+                 getenv("XDG_RUNTIME_DIR"), CTLSOCK_NAME);
+    else
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/tonegend-%u.ctl",
+                 (unsigned)getuid());
+
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        printf("can't connect to '%s': %s\n", addr.sun_path, strerror(errno));
+        return EIO;
+    }
+
+    if (send(fd, cmd, ncmd * sizeof(cmd[0]), MSG_NOSIGNAL) < 0 ||
+        recv(fd, &reply, sizeof(reply), 0) != sizeof(reply))
+    {
+        printf("control socket failed: %s\n", strerror(errno));
+        return EIO;
+    }
+
+    close(fd);
+
+    printf("seq %u status %d (%s) count %u\n", reply.seq, reply.status,
+           strerror(-reply.status), reply.count);
+
+    return -reply.status;
+}
+
+
+static void usage(char *argv0, int exit_code)
+{
+    printf("usage: %s [-h] [-K control_socket] "
+           "{dtmf | indicator | note | stop | sequence} arg0 arg1 arg2 ...\n",
+           basename(argv0));
+    exit(exit_code);
+}
+
+static int opcode(const char *name)
+{
+    struct op *op;
+
+    for (op = ops;  op->name != NULL;  op++) {
+        if (!strcmp(name, op->name))
+            return op->code;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
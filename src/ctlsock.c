@@ -0,0 +1,697 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "tonegend.h"
+#include "ausrv.h"
+#include "indicator.h"
+#include "dtmf.h"
+#include "note.h"
+#include "tone.h"
+#include "mainloop.h"
+#include "limit.h"
+#include "ctlsock.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+struct ctlclient {
+    struct ctlclient *next;
+    struct ctlsock   *ctlsock;
+    int               fd;
+    char              name[24]; /* for the request limits */
+    pa_io_event      *evio;
+    struct ctl_ring  *ring;     /* shared with the client, or NULL */
+    uint32_t          tail;     /* our copy; the shared one is advisory */
+    int               bell;     /* eventfd of the ring */
+    pa_io_event      *evbell;
+    pa_time_event    *throttled; /* the ring waits for a token */
+};
+
+static void accept_client(pa_mainloop_api *, pa_io_event *, int,
+                          pa_io_event_flags_t, void *);
+static void handle_packet(pa_mainloop_api *, pa_io_event *, int,
+                          pa_io_event_flags_t, void *);
+static void handle_ring(pa_mainloop_api *, pa_io_event *, int,
+                        pa_io_event_flags_t, void *);
+static void retry_ring(pa_mainloop_api *, pa_time_event *,
+                       const struct timeval *, void *);
+static void run_ring(struct ctlclient *);
+static int  admit(struct ctlclient *, struct ctl_cmd *, uint32_t *);
+static int  take_rights(struct msghdr *, int *, int);
+static int  setup_ring(struct ctlclient *, int *);
+static int  execute(struct ausrv *, struct ctl_cmd *);
+static int  sequence(struct ausrv *, struct ctl_cmd *, int);
+static void destroy_client(struct ctlclient *);
+
+
+int ctlsock_init(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    return 0;
+}
+
+int ctlsock_default_path(char *buf, int len)
+{
+    char *dir = getenv("XDG_RUNTIME_DIR");
+    int   l;
+
+    if (dir != NULL && dir[0] == '/')
+        l = snprintf(buf, len, "%s/%s", dir, CTLSOCK_NAME);
+    else
+        l = snprintf(buf, len, "/tmp/tonegend-%u.ctl", (unsigned)getuid());
+
+    return (l < 0 || l >= len) ? -1 : 0;
+}
+
+struct ctlsock *ctlsock_create(struct tonegend *tonegend, char *path)
+{
+    struct ctlsock     *ctlsock = NULL;
+    struct sockaddr_un  addr;
+    char                dflt[sizeof(addr.sun_path)];
+    struct stat         st;
+    mode_t              mask;
+    int                 sts;
+
+    if (path == NULL) {
+        if (ctlsock_default_path(dflt, sizeof(dflt)) < 0) {
+            LOG_ERROR("%s(): control socket path is too long", __FUNCTION__);
+            return NULL;
+        }
+        path = dflt;
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG_ERROR("%s(): control socket path '%s' is too long",
+                  __FUNCTION__, path);
+        return NULL;
+    }
+
+    if ((ctlsock = (struct ctlsock *)malloc(sizeof(*ctlsock))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+    memset(ctlsock, 0, sizeof(*ctlsock));
+    ctlsock->tonegend = tonegend;
+    ctlsock->api      = mainloop_get_api();
+    ctlsock->fd       = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+                               SOCK_CLOEXEC, 0);
+
+    if (ctlsock->fd < 0) {
+        LOG_ERROR("%s(): Can't create control socket: %s",
+                  __FUNCTION__, strerror(errno));
+        goto failed;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /*
+     * a stale socket of an earlier instance can go, D-Bus keeps us
+     * unique; anything else at the path was not made by us
+     */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            LOG_ERROR("%s(): '%s' exists and is not a socket",
+                      __FUNCTION__, path);
+            goto failed;
+        }
+        unlink(path);
+    }
+
+    mask = umask(0077);
+    sts  = bind(ctlsock->fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    if (sts < 0) {
+        LOG_ERROR("%s(): Can't bind to '%s': %s",
+                  __FUNCTION__, path, strerror(errno));
+        goto failed;
+    }
+
+    /* from now on the socket file is ours to remove */
+    if ((ctlsock->path = strdup(path)) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        unlink(path);
+        goto failed;
+    }
+
+    if (listen(ctlsock->fd, 8) < 0) {
+        LOG_ERROR("%s(): Can't listen on '%s': %s",
+                  __FUNCTION__, path, strerror(errno));
+        goto failed;
+    }
+
+    ctlsock->evio = ctlsock->api->io_new(ctlsock->api, ctlsock->fd,
+                                         PA_IO_EVENT_INPUT, accept_client,
+                                         ctlsock);
+    if (ctlsock->evio == NULL) {
+        LOG_ERROR("%s(): Can't watch the control socket", __FUNCTION__);
+        goto failed;
+    }
+
+    LOG_INFO("control socket at '%s'", path);
+
+    return ctlsock;
+
+ failed:
+    ctlsock_destroy(ctlsock);
+    return NULL;
+}
+
+void ctlsock_destroy(struct ctlsock *ctlsock)
+{
+    if (ctlsock != NULL) {
+        while (ctlsock->clients != NULL)
+            destroy_client(ctlsock->clients);
+
+        if (ctlsock->evio != NULL)
+            ctlsock->api->io_free(ctlsock->evio);
+
+        if (ctlsock->fd >= 0)
+            close(ctlsock->fd);
+
+        if (ctlsock->path != NULL)
+            unlink(ctlsock->path);
+
+        free(ctlsock->path);
+        free(ctlsock);
+    }
+}
+
+
+static void accept_client(pa_mainloop_api *api, pa_io_event *evio, int fd,
+                          pa_io_event_flags_t events, void *userdata)
+{
+    struct ctlsock   *ctlsock = (struct ctlsock *)userdata;
+    struct ctlclient *client;
+    struct ucred      cred;
+    socklen_t         len = sizeof(cred);
+    int               cfd;
+
+    (void)evio;
+    (void)events;
+
+    while ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0) {
+        /* the socket file is 0600 but it may have been handed over */
+        if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+            (cred.uid != getuid() && cred.uid != 0))
+        {
+            LOG_WARNING("%s(): refused control client", __FUNCTION__);
+            close(cfd);
+            continue;
+        }
+
+        if ((client = (struct ctlclient *)malloc(sizeof(*client))) == NULL) {
+            LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+            close(cfd);
+            continue;
+        }
+        memset(client, 0, sizeof(*client));
+        client->ctlsock = ctlsock;
+        client->fd      = cfd;
+        /* a process is one client however many connections it opens */
+        snprintf(client->name, sizeof(client->name), "ctl:%d", (int)cred.pid);
+        client->bell    = -1;
+        client->evio    = api->io_new(api, cfd, PA_IO_EVENT_INPUT,
+                                      handle_packet, client);
+
+        if (client->evio == NULL) {
+            LOG_ERROR("%s(): Can't watch control client", __FUNCTION__);
+            close(cfd);
+            free(client);
+            continue;
+        }
+
+        client->next     = ctlsock->clients;
+        ctlsock->clients = client;
+
+        TRACE("%s(): control client %d (pid %d)",
+              __FUNCTION__, cfd, (int)cred.pid);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        LOG_ERROR("%s(): accept failed: %s", __FUNCTION__, strerror(errno));
+}
+
+static void handle_packet(pa_mainloop_api *api, pa_io_event *evio, int fd,
+                          pa_io_event_flags_t events, void *userdata)
+{
+    struct ctlclient *client = (struct ctlclient *)userdata;
+    struct ausrv     *ausrv  = client->ctlsock->tonegend->ausrv_ctx;
+    struct ctl_cmd    cmd[CTLSOCK_MAXCMD];
+    struct ctl_reply  reply;
+    struct iovec      iov;
+    struct msghdr     msg;
+    char              ctrl[CMSG_SPACE(2 * sizeof(int))];
+    int               fds[2];
+    ssize_t           len;
+    uint32_t          wait;
+    int               ncmd;
+    int               sts;
+    int               n;
+    int               i;
+
+    (void)api;
+    (void)evio;
+
+    if (events & (PA_IO_EVENT_HANGUP | PA_IO_EVENT_ERROR)) {
+        destroy_client(client);
+        return;
+    }
+
+    iov.iov_base = cmd;
+    iov.iov_len  = sizeof(cmd);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+
+    if (len <= 0) {
+        if (len == 0 || (errno != EAGAIN && errno != EINTR))
+            destroy_client(client);
+        return;
+    }
+
+    memset(&reply, 0, sizeof(reply));
+
+    ncmd = len / sizeof(cmd[0]);
+    sts  = (len % sizeof(cmd[0])) || (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC));
+
+    /* the ring must come in a packet of its own */
+    if (take_rights(&msg, fds, 2) != 2 || sts || ncmd != 1 ||
+        cmd[0].op != CTL_RING)
+    {
+        for (i = 0;  i < 2;  i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+    }
+
+    if (sts) {
+        reply.status = -EINVAL;
+        goto send_reply;
+    }
+
+    /* the reply goes out before the audio work, like on D-Bus */
+    ausrv_defer_commands(ausrv, TRUE);
+
+    for (i = 0;  i < ncmd;  i += n) {
+        n = 1;
+
+        if (cmd[i].op == CTL_SEQUENCE) {
+            while (i + n < ncmd && cmd[i + n].op == CTL_SEQUENCE)
+                n++;
+        }
+
+        reply.seq = cmd[i + n - 1].seq;
+
+        /* a sequence is a single request, like StartToneSequence */
+        if (!admit(client, cmd + i, &wait))
+            sts = -EBUSY;
+        else if (cmd[i].op == CTL_RING)
+            sts = setup_ring(client, fds);
+        else if (cmd[i].op == CTL_SEQUENCE)
+            sts = sequence(ausrv, cmd + i, n);
+        else
+            sts = execute(ausrv, cmd + i);
+
+        if (sts < 0) {
+            reply.seq    = cmd[i].seq;
+            reply.status = sts;
+            break;
+        }
+
+        reply.count += n;
+    }
+
+ send_reply:
+    if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL|MSG_DONTWAIT) < 0)
+        TRACE("%s(): reply failed: %s", __FUNCTION__, strerror(errno));
+
+    ausrv_defer_commands(ausrv, FALSE);
+}
+
+static void handle_ring(pa_mainloop_api *api, pa_io_event *evio, int fd,
+                        pa_io_event_flags_t events, void *userdata)
+{
+    struct ctlclient *client = (struct ctlclient *)userdata;
+    uint64_t          cnt;
+    ssize_t           len;
+
+    (void)api;
+    (void)evio;
+    (void)events;
+
+    len = read(fd, &cnt, sizeof(cnt));
+
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+        destroy_client(client);
+        return;
+    }
+
+    /* a throttled ring is run by the timer, in its time */
+    if (client->throttled == NULL)
+        run_ring(client);
+}
+
+static void retry_ring(pa_mainloop_api *api, pa_time_event *event,
+                       const struct timeval *tv, void *userdata)
+{
+    struct ctlclient *client = (struct ctlclient *)userdata;
+
+    (void)tv;
+
+    api->time_free(event);
+    client->throttled = NULL;
+
+    run_ring(client);
+}
+
+/*
+ * Runs the commands of the ring up to the first one without a token,
+ * which is left there for the timer; the client sees the ring fill up.
+ */
+static void run_ring(struct ctlclient *client)
+{
+    pa_mainloop_api  *api    = client->ctlsock->api;
+    struct ausrv     *ausrv  = client->ctlsock->tonegend->ausrv_ctx;
+    struct ctl_ring  *ring   = client->ring;
+    struct ctl_cmd    cmd;
+    struct timeval    tv;
+    uint32_t          head;
+    uint32_t          tail;
+    uint32_t          wait;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = client->tail;
+
+    if (head - tail > CTL_RING_LEN) {
+        LOG_WARNING("%s(): corrupted command ring", __FUNCTION__);
+        destroy_client(client);
+        return;
+    }
+
+    ausrv_defer_commands(ausrv, TRUE);
+
+    for (wait = 0;  tail != head;  tail++) {
+        /* the client can scribble the slot while we look at it */
+        cmd = ring->cmd[tail & (CTL_RING_LEN - 1)];
+
+        if (!admit(client, &cmd, &wait))
+            break;
+
+        if (cmd.op == CTL_RING || execute(ausrv, &cmd) < 0)
+            TRACE("%s(): ring command %u failed", __FUNCTION__, cmd.seq);
+    }
+
+    client->tail = tail;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    ausrv_defer_commands(ausrv, FALSE);
+
+    if (wait > 0) {
+        TRACE("%s(): ring of control client %d throttled for %u usec",
+              __FUNCTION__, client->fd, wait);
+
+        gettimeofday(&tv, NULL);
+        tv.tv_sec  += wait / 1000000;
+        tv.tv_usec += wait % 1000000;
+
+        if (tv.tv_usec >= 1000000) {
+            tv.tv_sec  += 1;
+            tv.tv_usec -= 1000000;
+        }
+
+        client->throttled = api->time_new(api, &tv, retry_ring, client);
+    }
+}
+
+/* takes a token of the client for the command; stops need none */
+static int admit(struct ctlclient *client, struct ctl_cmd *cmd,
+                 uint32_t *waitp)
+{
+    if (cmd->op == CTL_RING) {
+        *waitp = 0;
+        return TRUE;
+    }
+
+    return limit_take(client->name, cmd->op == CTL_STOP, waitp) == LIMIT_PASS;
+}
+
+static int take_rights(struct msghdr *msg, int *fds, int max)
+{
+    struct cmsghdr *cmsg;
+    int            *fdp;
+    int             nfd;
+    int             n;
+    int             i;
+
+    for (i = 0;  i < max;  i++)
+        fds[i] = -1;
+
+    n = 0;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        fdp = (int *)CMSG_DATA(cmsg);
+        nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+        for (i = 0;  i < nfd;  i++) {
+            if (n < max)
+                fds[n++] = fdp[i];
+            else
+                close(fdp[i]);
+        }
+    }
+
+    return n;
+}
+
+static int setup_ring(struct ctlclient *client, int *fds)
+{
+    pa_mainloop_api *api = client->ctlsock->api;
+    struct stat      st;
+    int              seals;
+    void            *ring;
+    int              sts;
+
+    sts = -EINVAL;
+
+    if (fds[0] < 0 || fds[1] < 0 || client->ring != NULL)
+        goto failed;
+
+    /* a shrinking memfd would fault us at the next access */
+    seals = fcntl(fds[0], F_GET_SEALS);
+
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fds[0], &st) < 0 ||
+        st.st_size < (off_t)sizeof(struct ctl_ring))
+        goto failed;
+
+    ring = mmap(NULL, sizeof(struct ctl_ring), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fds[0], 0);
+
+    if (ring == MAP_FAILED) {
+        sts = -errno;
+        goto failed;
+    }
+
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    client->ring   = (struct ctl_ring *)ring;
+    client->tail   = __atomic_load_n(&client->ring->head, __ATOMIC_ACQUIRE);
+    client->evbell = api->io_new(api, fds[1], PA_IO_EVENT_INPUT,
+                                 handle_ring, client);
+
+    if (client->evbell == NULL) {
+        munmap(client->ring, sizeof(struct ctl_ring));
+        client->ring = NULL;
+        sts = -ENOMEM;
+        goto failed;
+    }
+
+    client->ring->tail = client->tail;
+    client->bell = fds[1];
+    close(fds[0]);
+    fds[0] = fds[1] = -1;
+
+    TRACE("%s(): command ring for control client %d", __FUNCTION__,
+          client->fd);
+
+    return 0;
+
+ failed:
+    if (fds[0] >= 0)
+        close(fds[0]);
+    if (fds[1] >= 0)
+        close(fds[1]);
+
+    fds[0] = fds[1] = -1;
+
+    return sts;
+}
+
+static int execute(struct ausrv *ausrv, struct ctl_cmd *cmd)
+{
+    uint32_t *arg = cmd->arg;
+
+    switch (cmd->op) {
+
+    case CTL_DTMF:
+        if (arg[0] >= DTMF_MAX || arg[1] > 100 || arg[2] > 3600000)
+            return -EINVAL;
+        dtmf_play(ausrv, arg[0], arg[1], arg[2] * 1000);
+        break;
+
+    case CTL_INDICATOR:
+        if (arg[0] < TONE_DIAL || arg[0] > TONE_RING ||
+            arg[1] > 100 || arg[2] > 3600000)
+            return -EINVAL;
+        indicator_play(ausrv, arg[0], arg[1], arg[2] * 1000);
+        break;
+
+    case CTL_NOTE:
+        if (note_check(arg[0] & 0xff, (arg[0] >> 8) & 0xff, arg[1] & 0xffff,
+                       (arg[0] >> 16) & 0xff, arg[1] >> 16, arg[2]) < 0)
+            return -EINVAL;
+        note_play(ausrv, arg[0] & 0xff, (arg[0] >> 8) & 0xff,
+                  arg[1] & 0xffff, (arg[0] >> 16) & 0xff, arg[1] >> 16,
+                  arg[2], 0);
+        break;
+
+    case CTL_SEQUENCE:
+        /* a ring slot is a sequence of its own */
+        return sequence(ausrv, cmd, 1);
+
+    case CTL_STOP:
+        if (arg[0] & CTL_STOP_DTMF)
+            dtmf_stop(ausrv);
+        if (arg[0] & CTL_STOP_INDICATOR)
+            indicator_stop(ausrv, KILL_STREAM);
+        break;
+
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    return 0;
+}
+
+static int sequence(struct ausrv *ausrv, struct ctl_cmd *cmd, int n)
+{
+    struct dtmf_press *seq;
+    uint32_t          *arg;
+    int                i;
+
+    for (i = 0;  i < n;  i++) {
+        arg = cmd[i].arg;
+
+        if (arg[0] >= DTMF_MAX || arg[1] > 100 ||
+            (arg[2] & 0xffff) < 10 || (arg[2] >> 16) > 10000)
+            return -EINVAL;
+    }
+
+    if ((seq = (struct dtmf_press *)malloc(n * sizeof(*seq))) == NULL)
+        return -ENOMEM;
+
+    for (i = 0;  i < n;  i++) {
+        arg = cmd[i].arg;
+
+        seq[i].type = arg[0];
+        seq[i].vol  = arg[1];
+        seq[i].dur  = (arg[2] & 0xffff) * 1000;
+        seq[i].gap  = (arg[2] >> 16) * 1000;
+    }
+
+    dtmf_sequence(ausrv, seq, n);
+
+    return 0;
+}
+
+static void destroy_client(struct ctlclient *client)
+{
+    struct ctlsock    *ctlsock = client->ctlsock;
+    pa_mainloop_api   *api     = ctlsock->api;
+    struct ctlclient **prev;
+
+    for (prev = &ctlsock->clients;  *prev;  prev = &(*prev)->next) {
+        if (*prev == client) {
+            *prev = client->next;
+            break;
+        }
+    }
+
+    TRACE("%s(): control client %d gone", __FUNCTION__, client->fd);
+
+    if (client->throttled != NULL)
+        api->time_free(client->throttled);
+    if (client->evbell != NULL)
+        api->io_free(client->evbell);
+    if (client->bell >= 0)
+        close(client->bell);
+    if (client->ring != NULL)
+        munmap(client->ring, sizeof(struct ctl_ring));
+
+    api->io_free(client->evio);
+    close(client->fd);
+
+    free(client);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,110 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_CTLSOCK_H__
+#define __TONEGEND_CTLSOCK_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#include <pulse/pulseaudio.h>
+
+/*
+ * Local control socket: a SEQPACKET Unix socket, by default
+ * $XDG_RUNTIME_DIR/tonegend.ctl, that takes packets of fixed size
+ * commands. The commands of a packet are run in order and answered
+ * with a single reply. Consecutive CTL_SEQUENCE commands of a packet
+ * are played back to back as one DTMF sequence. A client can also
+ * hand over a shared memory ring and an eventfd with CTL_RING; the
+ * commands it puts to the ring are run when the eventfd is signalled,
+ * without any reply. Every client has the request limits of a D-Bus
+ * client (see limit.h): a command without a token is refused with
+ * EBUSY, and a ring command waits in the ring until there is one.
+ */
+
+#define CTLSOCK_NAME     "tonegend.ctl"
+#define CTLSOCK_MAXCMD   64     /* commands in a packet */
+
+#define CTL_DTMF         1      /* digit, volume %, msec (0: until stop) */
+#define CTL_INDICATOR    2      /* TONE_DIAL ... TONE_RING, volume %, msec */
+#define CTL_NOTE         3      /* note | scale<<8 | style<<16,
+                                   beat | fract<<16, volume % */
+#define CTL_STOP         4      /* CTL_STOP_DTMF | CTL_STOP_INDICATOR */
+#define CTL_RING         5      /* memfd and eventfd in SCM_RIGHTS */
+#define CTL_SEQUENCE     6      /* digit, volume %, msec | gap msec<<16 */
+
+#define CTL_STOP_DTMF       0x01
+#define CTL_STOP_INDICATOR  0x02
+
+struct ctl_cmd {
+    uint8_t   op;
+    uint8_t   pad;
+    uint16_t  seq;
+    uint32_t  arg[3];
+};
+
+struct ctl_reply {
+    uint16_t  seq;              /* of the last command of the packet */
+    int16_t   status;           /* 0 or -errno of the first failure */
+    uint32_t  count;            /* commands run */
+};
+
+#define CTL_RING_LEN     64     /* must be a power of 2 */
+
+/*
+ * single producer, single consumer: head is only written by the client
+ * and tail by the daemon, once the command is done
+ */
+struct ctl_ring {
+    uint32_t        head;
+    uint32_t        tail;
+    struct ctl_cmd  cmd[CTL_RING_LEN];
+};
+
+
+struct tonegend;
+struct ctlclient;
+
+struct ctlsock {
+    struct tonegend  *tonegend;
+    pa_mainloop_api  *api;
+    char             *path;
+    int               fd;
+    pa_io_event      *evio;
+    struct ctlclient *clients;
+};
+
+int ctlsock_init(int, char **);
+struct ctlsock *ctlsock_create(struct tonegend *, char *);
+void ctlsock_destroy(struct ctlsock *);
+int ctlsock_default_path(char *, int);
+
+#endif /* __TONEGEND_CTLSOCK_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -25,11 +25,16 @@ USA.
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #include <log/log.h>
 #include <trace/trace.h>
 
 #include "tonegend.h"
+#include "ausrv.h"
+#include "mainloop.h"
+#include "startup.h"
+#include "limit.h"
 #include "dbusif.h"
 
 #define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
@@ -39,9 +44,19 @@ USA.
 #define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
 
 static DBusHandlerResult handle_message(DBusConnection *,DBusMessage *,void *);
-static gchar *create_key(gchar *, gchar *, gchar *);
-static void destroy_key(gpointer);
-
+static void handle_call(struct dbusif *, DBusMessage *, int);
+static int  send_signal(struct tonegend *, const char *, char *, char *, int,
+                        va_list);
+static void serve_queued(pa_mainloop_api *, pa_time_event *,
+                         const struct timeval *, void *);
+static void schedule_queued(struct dbusif *, uint32_t);
+static void release_message(void *);
+static int  watch_limited(DBusConnection *);
+static DBusHandlerResult name_owner_changed(DBusConnection *, DBusMessage *,
+                                            void *);
+
+#define OWNER_RULE  "type='signal',sender='" DBUS_SERVICE_DBUS "',"  \
+                    "member='NameOwnerChanged',arg0='%s'"
 
 static char *path    = "/com/Nokia/Telephony/Tones";
 static char *service = "com.Nokia.Telephony.Tones";
@@ -91,7 +106,10 @@ struct dbusif *dbusif_create(struct tonegend *tonegend)
      */
     dbus_connection_set_exit_on_disconnect(conn, FALSE);
 
-    dbus_connection_setup_with_g_main(conn, NULL);
+    if (mainloop_setup_dbus(conn) < 0) {
+        LOG_ERROR("%s(): can't hook D-Bus to the main loop", __FUNCTION__);
+        goto failed;
+    }
 
     if (!dbus_connection_register_object_path(conn, path, &method, dbusif)) {
         LOG_ERROR("%s(): failed to register object path", __FUNCTION__);
@@ -110,10 +128,13 @@ struct dbusif *dbusif_create(struct tonegend *tonegend)
         goto failed;
     }
 
+    startup_mark(STARTUP_NAME);
+
+    if (watch_limited(conn) < 0)
+        goto failed;
+
     dbusif->tonegend = tonegend;
     dbusif->conn   = conn;
-    dbusif->hash   = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                           destroy_key, NULL);
     LOG_INFO("D-Bus setup OK");
 
     return dbusif;
@@ -128,10 +149,12 @@ struct dbusif *dbusif_create(struct tonegend *tonegend)
 void dbusif_destroy(struct dbusif *dbusif)
 {
     if (dbusif) {
+        limit_flush(release_message);
 
-        if (dbusif->hash != NULL)
-            g_hash_table_destroy(dbusif->hash);
+        if (dbusif->queued != NULL)
+            mainloop_get_api()->time_free(dbusif->queued);
 
+        dispatch_free(&dbusif->methods);
         free(dbusif);
     }
 }
@@ -142,7 +165,6 @@ int dbusif_register_input_method(struct tonegend *tonegend,
                                  int (*method)(DBusMessage*, struct tonegend*))
 {
     struct dbusif *dbusif = tonegend->dbus_ctx;
-    gchar         *key;
 
     if (!memb || !sig || !method) {
         LOG_ERROR("%s(): Called with invalid argument(s)", __FUNCTION__);
@@ -153,8 +175,10 @@ int dbusif_register_input_method(struct tonegend *tonegend,
     if (intf == NULL)
         intf = service;
 
-    key = create_key((gchar *)memb, (gchar *)sig, (gchar *)intf);
-    g_hash_table_insert(dbusif->hash, key, (gpointer)method);
+    if (dispatch_add(&dbusif->methods, intf, memb, sig, (void *)method) < 0) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
 
     return 0;
 }
@@ -174,49 +198,111 @@ int dbusif_unregister_input_method(struct tonegend *tonegend, char *intf,
 int dbusif_send_signal(struct tonegend *tonegend, char *intf, char *name,
                        int first_arg_type, ...)
 {
-    struct dbusif *dbusif = tonegend->dbus_ctx;
-    DBusMessage   *msg;
-    va_list        ap;
-    int            success;
-    
-    do { /* not a loop */
-        success = FALSE;
+    va_list ap;
+    int     sts;
 
-        if (name == NULL) {
-            LOG_ERROR("%s(): Called with invalid argument", __FUNCTION__);
-            errno   = EINVAL;
-            break;
-        }
+    va_start(ap, first_arg_type);
+    sts = send_signal(tonegend, NULL, intf, name, first_arg_type, ap);
+    va_end(ap);
 
-        if (intf == NULL)
-            intf = service;
+    return sts;
+}
 
-        if ((msg = dbus_message_new_signal(path, intf, name)) == NULL) {
-            errno = ENOMEM;
-            break;
-        }
+/* the same, but only to 'dest' so that no other client is woken up */
+int dbusif_send_signal_to(struct tonegend *tonegend, const char *dest,
+                          char *intf, char *name, int first_arg_type, ...)
+{
+    va_list ap;
+    int     sts;
 
-        va_start(ap, first_arg_type);
+    va_start(ap, first_arg_type);
+    sts = send_signal(tonegend, dest, intf, name, first_arg_type, ap);
+    va_end(ap);
 
-        if (dbus_message_append_args_valist(msg, first_arg_type, ap)) {
-            success = dbus_connection_send(dbusif->conn, msg, NULL);
-        }
+    return sts;
+}
 
-        va_end(ap);
+/*
+ * Appends return values to the reply of the method call being served;
+ * only to be called from a method handler. If the handler fails after
+ * all, the values are dropped and an error is sent instead.
+ */
+int dbusif_reply_args(struct tonegend *tonegend, int first_arg_type, ...)
+{
+    struct dbusif *dbusif = tonegend->dbus_ctx;
+    va_list        ap;
+    int            success;
 
-        dbus_message_unref(msg);
+    if (dbusif->call == NULL) {
+        LOG_ERROR("%s(): no method call is being served", __FUNCTION__);
+        errno = EINVAL;
+        return -1;
+    }
 
-    } while(FALSE);
+    if (dbusif->reply == NULL &&
+        (dbusif->reply = dbus_message_new_method_return(dbusif->call)) == NULL)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    va_start(ap, first_arg_type);
+    success = dbus_message_append_args_valist(dbusif->reply,
+                                              first_arg_type, ap);
+    va_end(ap);
 
     return success ? 0 : -1;
 }
 
+int dbusif_can_send_fds(struct tonegend *tonegend)
+{
+    struct dbusif *dbusif = tonegend->dbus_ctx;
+
+    return dbus_connection_can_send_type(dbusif->conn, DBUS_TYPE_UNIX_FD);
+}
+
 
 static DBusHandlerResult handle_message(DBusConnection *conn,
                                         DBusMessage    *msg,
                                         void           *user_data)
 {
     struct dbusif   *dbusif = (struct dbusif *)user_data;
+    const char      *memb;
+    int              stop;
+
+    (void)conn;
+
+    if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+        TRACE("%s(): ignoring non method_call's", __FUNCTION__);
+    else {
+        mainloop_request_dispatched();
+
+        /* stopping a tone must not wait for a token */
+        memb = dbus_message_get_member(msg);
+        stop = memb != NULL && !strncmp(memb, "Stop", 4);
+
+        switch (limit_admit(dbus_message_get_sender(msg), msg, stop)) {
+
+        case LIMIT_PASS:
+            handle_call(dbusif, msg, TRUE);
+            break;
+
+        case LIMIT_QUEUE:
+            dbus_message_ref(msg);
+            schedule_queued(dbusif, 0);
+            break;
+
+        default:
+            handle_call(dbusif, msg, FALSE);
+            break;
+        }
+    }
+    
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void handle_call(struct dbusif *dbusif, DBusMessage *msg, int admitted)
+{
     struct tonegend *tonegend = dbusif->tonegend;
     DBusMessage     *reply  = NULL;
     uint32_t         ser;
@@ -224,81 +310,232 @@ static DBusHandlerResult handle_message(DBusConnection *conn,
     const char      *intf;
     const char      *memb;
     const char      *sig;
-    gchar           *key;
     const char      *errname;
     char             errdesc[256];
     int              success;
 
-    (void)conn;
-
-    if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL)
-        TRACE("%s(): ignoring non method_call's", __FUNCTION__);
-    else {
-        intf = dbus_message_get_interface(msg);
-        memb = dbus_message_get_member(msg);
-        sig  = dbus_message_get_signature(msg);
-        ser  = dbus_message_get_serial(msg);
+    intf = dbus_message_get_interface(msg);
+    memb = dbus_message_get_member(msg);
+    sig  = dbus_message_get_signature(msg);
+    ser  = dbus_message_get_serial(msg);
 
 #if 0
-        TRACE("%s(): message no #%u received: '%s', '%s', '%s'",
-              __FUNCTION__, ser, intf, memb, sig);
+    TRACE("%s(): message no #%u received: '%s', '%s', '%s'",
+          __FUNCTION__, ser, intf, memb, sig);
 #endif
         
-        key = create_key((gchar *)memb, (gchar *)sig, (gchar *)intf);
-        method = g_hash_table_lookup(dbusif->hash, key);
-        g_free(key);
+    method = dispatch_find(&dbusif->methods, intf, memb, sig);
 
+    if (!admitted)
+        success = FALSE;
+    else {
+        /* the audio work is done after the reply is sent */
+        ausrv_defer_commands(tonegend->ausrv_ctx, TRUE);
+        dbusif->call = msg;
         success = method ? method(msg, tonegend) : FALSE;
+        dbusif->call = NULL;
+        ausrv_defer_commands(tonegend->ausrv_ctx, FALSE);
+    }
 
-        if (success)
+    if (success) {
+        if ((reply = dbusif->reply) == NULL)
             reply = dbus_message_new_method_return(msg);
+    }
+    else {
+        if (dbusif->reply != NULL)
+            dbus_message_unref(dbusif->reply);
+
+        if (!admitted) {
+            errname = DBUS_ERROR_LIMITS_EXCEEDED;
+            snprintf(errdesc, sizeof(errdesc), "Too many requests");
+        }
+        else if (method) {
+            errname = DBUS_ERROR_FAILED;
+            snprintf(errdesc, sizeof(errdesc), "Internal error");
+        }
         else {
-            if (method) {
-                errname = DBUS_ERROR_FAILED;
-                snprintf(errdesc, sizeof(errdesc), "Internal error");
-            }
-            else {
-                errname = DBUS_ERROR_NOT_SUPPORTED;
-                snprintf(errdesc, sizeof(errdesc), "Method '%s(%s)' "
-                         "not supported", memb, sig);
-            }
-            reply = dbus_message_new_error(msg, errname, errdesc);
+            errname = DBUS_ERROR_NOT_SUPPORTED;
+            snprintf(errdesc, sizeof(errdesc), "Method '%s(%s)' "
+                     "not supported", memb, sig);
         }
+        reply = dbus_message_new_error(msg, errname, errdesc);
+    }
 
-        dbus_message_set_reply_serial(msg, ser);
+    dbusif->reply = NULL;
+
+    dbus_message_set_reply_serial(msg, ser);
         
-        if (!dbus_connection_send(dbusif->conn, reply, NULL))
-            LOG_ERROR("%s(): D-Bus message reply failure", __FUNCTION__);
+    if (!dbus_connection_send(dbusif->conn, reply, NULL))
+        LOG_ERROR("%s(): D-Bus message reply failure", __FUNCTION__);
 #if 0
-        else
-            TRACE("%s(): message no #%u replied", __FUNCTION__, ser);
+    else
+        TRACE("%s(): message no #%u replied", __FUNCTION__, ser);
 #endif
 
-        dbus_message_unref(reply);
-    }
+    dbus_message_unref(reply);
+}
+
+static int send_signal(struct tonegend *tonegend, const char *dest,
+                       char *intf, char *name, int first_arg_type, va_list ap)
+{
+    struct dbusif *dbusif = tonegend->dbus_ctx;
+    DBusMessage   *msg;
+    int            success;
     
-    return DBUS_HANDLER_RESULT_HANDLED;
+    do { /* not a loop */
+        success = FALSE;
+
+        if (name == NULL) {
+            LOG_ERROR("%s(): Called with invalid argument", __FUNCTION__);
+            errno   = EINVAL;
+            break;
+        }
+
+        if (intf == NULL)
+            intf = service;
+
+        if ((msg = dbus_message_new_signal(path, intf, name)) == NULL) {
+            errno = ENOMEM;
+            break;
+        }
+
+        if (dest == NULL || dbus_message_set_destination(msg, dest)) {
+            if (dbus_message_append_args_valist(msg, first_arg_type, ap))
+                success = dbus_connection_send(dbusif->conn, msg, NULL);
+        }
+
+        dbus_message_unref(msg);
+
+    } while(FALSE);
+
+    return success ? 0 : -1;
 }
 
-static gchar *create_key(gchar *memb, gchar *sign, gchar *intf)
+/*
+ * Serve the throttled requests whose senders have tokens again, taking
+ * the clients in turn.
+ */
+static void serve_queued(pa_mainloop_api *api, pa_time_event *event,
+                         const struct timeval *tv, void *data)
 {
-    gchar *key = NULL;
+    struct dbusif *dbusif = (struct dbusif *)data;
+    DBusMessage   *msg;
+    uint32_t       wait;
 
-    if (memb == NULL) memb = "";
-    if (sign == NULL) sign = "";
-    if (intf == NULL) intf = "";
+    (void)api;
+    (void)event;
+    (void)tv;
 
-    key = g_strconcat(memb, "__", sign, "__", intf, NULL);
+    while ((msg = limit_next(&wait)) != NULL) {
+        handle_call(dbusif, msg, TRUE);
+        dbus_message_unref(msg);
+    }
 
-    return key;
+    if (wait > 0)
+        schedule_queued(dbusif, wait);
 }
 
+static void schedule_queued(struct dbusif *dbusif, uint32_t usec)
+{
+    pa_mainloop_api *api = mainloop_get_api();
+    struct timeval   tv;
+
+    gettimeofday(&tv, NULL);
+    tv.tv_sec  += usec / 1000000;
+    tv.tv_usec += usec % 1000000;
+
+    if (tv.tv_usec >= 1000000) {
+        tv.tv_sec  += 1;
+        tv.tv_usec -= 1000000;
+    }
+
+    if (dbusif->queued != NULL)
+        api->time_restart(dbusif->queued, &tv);
+    else
+        dbusif->queued = api->time_new(api, &tv, serve_queued, dbusif);
+}
 
-static void destroy_key(gpointer key)
+static void release_message(void *msg)
 {
-    g_free(key);
+    dbus_message_unref((DBusMessage *)msg);
 }
 
+/*
+ * Follow the owners of the well known names that have limits of their
+ * own. The current owners are asked once; the bus tells the changes.
+ */
+static int watch_limited(DBusConnection *conn)
+{
+    DBusMessage *msg;
+    DBusMessage *reply;
+    const char  *name;
+    const char  *owner;
+    char         rule[512];
+    int          i;
+
+    if (limit_client_name(0) == NULL)
+        return 0;
+
+    if (!dbus_connection_add_filter(conn, name_owner_changed, NULL, NULL)) {
+        LOG_ERROR("%s(): Can't add D-Bus filter", __FUNCTION__);
+        return -1;
+    }
+
+    for (i = 0;  (name = limit_client_name(i)) != NULL;  i++) {
+        snprintf(rule, sizeof(rule), OWNER_RULE, name);
+        dbus_bus_add_match(conn, rule, NULL);
+
+        msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+                                           DBUS_INTERFACE_DBUS,
+                                           "GetNameOwner");
+        if (msg == NULL ||
+            !dbus_message_append_args(msg, DBUS_TYPE_STRING, &name,
+                                      DBUS_TYPE_INVALID))
+        {
+            LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+            if (msg != NULL)
+                dbus_message_unref(msg);
+            return -1;
+        }
+
+        /* an error reply only means that nobody owns it yet */
+        reply = dbus_connection_send_with_reply_and_block(conn, msg, -1, NULL);
+
+        if (reply != NULL) {
+            if (dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner,
+                                      DBUS_TYPE_INVALID))
+                limit_set_owner(name, owner);
+
+            dbus_message_unref(reply);
+        }
+
+        dbus_message_unref(msg);
+    }
+
+    return 0;
+}
+
+static DBusHandlerResult name_owner_changed(DBusConnection *conn,
+                                            DBusMessage    *msg,
+                                            void           *data)
+{
+    const char *name;
+    const char *before;
+    const char *after;
+
+    (void)conn;
+    (void)data;
+
+    if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged") &&
+        dbus_message_get_args(msg, NULL,
+                              DBUS_TYPE_STRING, &name,
+                              DBUS_TYPE_STRING, &before,
+                              DBUS_TYPE_STRING, &after,
+                              DBUS_TYPE_INVALID))
+        limit_set_owner(name, after);
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
 
 /*
  * Local Variables:
@@ -32,12 +32,19 @@ USA.
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
+#include <pulse/pulseaudio.h>
+
+#include "dispatch.h"
+
 struct tonegend;
 
 struct dbusif {
     struct tonegend *tonegend;
     DBusConnection  *conn;
-    GHashTable      *hash;
+    struct dispatch  methods;
+    pa_time_event   *queued;    /* serves the throttled requests */
+    DBusMessage     *call;      /* the method call being served */
+    DBusMessage     *reply;     /* its return values, if any */
 };
 
 int dbusif_init(int, char **);
@@ -51,6 +58,10 @@ int dbusif_register_input_method(struct tonegend *, char *, char *, char *,
 int dbusif_unregister_input_method(struct tonegend *, char *, char *, char *);
 
 int dbusif_send_signal(struct tonegend *, char *, char *, int, ...);
+int dbusif_send_signal_to(struct tonegend *, const char *, char *, char *,
+                          int, ...);
+int dbusif_reply_args(struct tonegend *, int, ...);
+int dbusif_can_send_fds(struct tonegend *);
 
 
 #endif /* __TONEGEND_DBUSIF_H__ */
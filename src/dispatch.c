@@ -0,0 +1,183 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dispatch.h"
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#define TABLE_CHUNK  16
+
+static int  compare(const char *, const char *, const char *,
+                    struct dispatch_entry *);
+static int  search(struct dispatch *, const char *, const char *,
+                   const char *, int *);
+
+
+/*
+ * Registering an existing member, signature and interface combination
+ * again replaces the data, like inserting into a hash table would.
+ */
+int dispatch_add(struct dispatch *dsp, const char *intf, const char *memb,
+                 const char *sig, void *data)
+{
+    struct dispatch_entry *entries;
+    struct dispatch_entry *e;
+    int                    idx;
+    int                    size;
+
+    if (search(dsp, intf, memb, sig, &idx)) {
+        dsp->entries[idx].data = data;
+        return 0;
+    }
+
+    if (dsp->nentry >= dsp->size) {
+        size    = dsp->size + TABLE_CHUNK;
+        entries = realloc(dsp->entries, size * sizeof(*entries));
+
+        if (entries == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        dsp->entries = entries;
+        dsp->size    = size;
+    }
+
+    e = dsp->entries + idx;
+    memmove(e + 1, e, (dsp->nentry - idx) * sizeof(*e));
+
+    e->memb = strdup(memb ? memb : "");
+    e->sig  = strdup(sig  ? sig  : "");
+    e->intf = strdup(intf ? intf : "");
+    e->data = data;
+
+    dsp->nentry++;
+
+    if (!e->memb || !e->sig || !e->intf) {
+        free(e->memb);
+        free(e->sig);
+        free(e->intf);
+
+        memmove(e, e + 1, (--dsp->nentry - idx) * sizeof(*e));
+
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+void *dispatch_find(struct dispatch *dsp, const char *intf, const char *memb,
+                    const char *sig)
+{
+    int idx;
+
+    if (!search(dsp, intf, memb, sig, &idx))
+        return NULL;
+
+    return dsp->entries[idx].data;
+}
+
+void dispatch_free(struct dispatch *dsp)
+{
+    struct dispatch_entry *e;
+    int                    i;
+
+    for (i = 0;  i < dsp->nentry;  i++) {
+        e = dsp->entries + i;
+
+        free(e->memb);
+        free(e->sig);
+        free(e->intf);
+    }
+
+    free(dsp->entries);
+
+    memset(dsp, 0, sizeof(*dsp));
+}
+
+
+/*
+ * The member name comes first as it tells the methods apart the
+ * soonest; most of them are registered with a single signature on the
+ * default interface.
+ */
+static int compare(const char *intf, const char *memb, const char *sig,
+                   struct dispatch_entry *e)
+{
+    int cmp;
+
+    if ((cmp = strcmp(memb ? memb : "", e->memb)) != 0)
+        return cmp;
+
+    if ((cmp = strcmp(sig ? sig : "", e->sig)) != 0)
+        return cmp;
+
+    return strcmp(intf ? intf : "", e->intf);
+}
+
+/*
+ * Returns TRUE if found, with its index in *idxp; otherwise *idxp is
+ * where it would have to be inserted.
+ */
+static int search(struct dispatch *dsp, const char *intf, const char *memb,
+                  const char *sig, int *idxp)
+{
+    int lo = 0;
+    int hi = dsp->nentry;
+    int mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        cmp = compare(intf, memb, sig, dsp->entries + mid);
+
+        if (cmp == 0) {
+            *idxp = mid;
+            return TRUE;
+        }
+
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    *idxp = lo;
+    return FALSE;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
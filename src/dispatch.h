@@ -0,0 +1,57 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_DISPATCH_H__
+#define __TONEGEND_DISPATCH_H__
+
+/*
+ * Method dispatch table: member, signature and interface names kept
+ * sorted in an array, so looking up an incoming call is a binary search
+ * over the strings of the message itself, with nothing allocated.
+ */
+
+struct dispatch_entry {
+    char  *memb;                /* method name */
+    char  *sig;                 /* signature */
+    char  *intf;                /* interface name */
+    void  *data;                /* what the lookup returns */
+};
+
+struct dispatch {
+    struct dispatch_entry *entries;     /* sorted by memb, sig, intf */
+    int                    nentry;
+    int                    size;        /* allocated entries */
+};
+
+int   dispatch_add(struct dispatch *, const char *, const char *,
+                   const char *, void *);
+void *dispatch_find(struct dispatch *, const char *, const char *,
+                    const char *);
+void  dispatch_free(struct dispatch *);
+
+#endif /* __TONEGEND_DISPATCH_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
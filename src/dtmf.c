@@ -24,6 +24,7 @@ USA.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #include <glib.h>
 
@@ -31,11 +32,14 @@ USA.
 #include <trace/trace.h>
 
 #include "ausrv.h"
+#include "mainloop.h"
 #include "stream.h"
 #include "tone.h"
 #include "indicator.h"
 #include "dtmf.h"
 #include "dbusif.h"
+#include "scache.h"
+#include "tonesig.h"
 
 #define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
 #define LOG_INFO(f, args...) log_error(logctx, f, ##args)
@@ -46,12 +50,20 @@ USA.
 #define MUTE_ON  1
 #define MUTE_OFF 0
 
+#define MIN_PRESS 40000         /* usec; shortest DTMF tone (ITU-T Q.24) */
+#define DIAL_PAUSE 2000000      /* usec; ',' in a dial string */
+
 struct dtmf {
     char           symbol;
     uint32_t       low_freq;
     uint32_t       high_freq;
 };
 
+struct dial {
+    struct ausrv  *ausrv;
+    char          *digits;
+};
+
 
 static struct dtmf dtmf_defs[DTMF_MAX] = {
     {'0', 941, 1336},
@@ -75,14 +87,39 @@ static struct dtmf dtmf_defs[DTMF_MAX] = {
 static char   *dtmf_stream = STREAM_DTMF;
 static void   *dtmf_props  = NULL;
 static int     vol_scale   = 100;
-static int     mute        = MUTE_OFF;
-static guint   tmute_id;
+static int     mute        = MUTE_OFF;  /* as last signalled */
+static int     mute_wanted = MUTE_OFF;  /* set by the audio side */
+static int     mute_now;                /* no batching; set likewise */
+static pa_time_event   *tmute;
+static pa_mainloop_api *tmute_api;
+static pa_defer_event  *dmute;          /* on the main loop */
+static struct ausrv_post mute_post;
 
 
 static void destroy_callback(void *);
 static void set_mute_timeout(struct ausrv *, guint);
-static gboolean mute_timeout_callback(gpointer);
+static void mute_timeout_callback(pa_mainloop_api *, pa_time_event *,
+                                  const struct timeval *, void *);
 static void request_muting(struct ausrv *, dbus_bool_t);
+static void mute_posted(struct ausrv *, struct ausrv_post *);
+static void mute_defer_callback(pa_mainloop_api *, pa_defer_event *, void *);
+static void send_muting(struct ausrv *);
+static int  restart_tones(struct stream *, struct dtmf *, uint32_t);
+static struct stream *create_stream(struct ausrv *);
+static struct tone *add_tones(struct stream *, struct dtmf *, uint32_t,
+                              uint32_t, uint32_t);
+static uint32_t append_tones(struct stream *, uint, uint32_t, int, int);
+static void add_event(struct stream *, uint, uint32_t, struct tone *,
+                      uint32_t);
+static void dialed(void *, int);
+static void sequenced(void *, int);
+static void play_command(struct ausrv *, uintptr_t *);
+static void append_command(struct ausrv *, uintptr_t *);
+static void sequence_command(struct ausrv *, uintptr_t *);
+static void drop_sequence(uintptr_t *);
+static void dial_command(struct ausrv *, uintptr_t *);
+static void drop_dial(uintptr_t *);
+static void stop_command(struct ausrv *, uintptr_t *);
 
 
 
@@ -96,17 +133,44 @@ int dtmf_init(int argc, char **argv)
 
 void dtmf_play(struct ausrv *ausrv, uint type, uint32_t vol, int dur)
 {
-    struct stream *stream = stream_find(ausrv, dtmf_stream);
+    struct stream *stream;
     struct dtmf   *dtmf   = dtmf_defs + type;
     uint32_t       per    = dur;
     uint32_t       play   = dur > 60000 ? dur - 20000 : dur;
     int            type_l = TONE_DTMF_L;
     int            type_h = TONE_DTMF_H;
     uint32_t       timeout;
+    int            cacheable;
+    struct stream *detached;
+    struct tone   *tone = NULL;
+    char           name[64];
         
     if (type >= DTMF_MAX || (dur != 0 && dur < 10000))
         return;
 
+    /* a continuous tone stops whatever DTMF was playing before */
+    if (dur ? ausrv_queue_command(ausrv, play_command, type, vol, dur, 0) :
+        ausrv_queue_latest_command(ausrv, play_command, type, vol, dur, 0))
+        return;
+
+    stream = stream_find(ausrv, dtmf_stream);
+
+    vol = (vol_scale * vol) / 100;
+
+    /*
+     * fixed length tones come from the sample cache, unless they
+     * need to be chained after the ones that are still playing
+     */
+    if ((cacheable = (dur && stream == NULL && !tonesig_wanted()))) {
+        snprintf(name, sizeof(name), "tonegend-dtmf-%u-%u-%d", type,vol,dur);
+
+        if (scache_play(ausrv, name, dtmf_props)) {
+            request_muting(ausrv, MUTE_ON);
+            set_mute_timeout(ausrv, dur + 2 * 1000000);
+            return;
+        }
+    }
+
     if (!dur) {
         /*
          * These types will make the DTMF tone as 'indicator'
@@ -121,26 +185,38 @@ void dtmf_play(struct ausrv *ausrv, uint type, uint32_t vol, int dur)
     if (stream != NULL) {
         if (!dur) {
             indicator_stop(ausrv, KILL_STREAM);
+
+            /* a key pressed right after the other: no tone churn */
+            if (restart_tones(stream, dtmf, vol))
+                goto started;
+
             dtmf_stop(ausrv);
         }
     }
-    else {
-        stream = stream_create(ausrv, dtmf_stream, NULL, 0,
-                               tone_write_callback,
-                               destroy_callback,
-                               dtmf_props,
-                               NULL);
-
-        if (stream == NULL) {
-            LOG_ERROR("%s(): Can't create stream", __FUNCTION__);
-            return;
-        }
-    }
-
-    vol = (vol_scale * vol) / 100;
+    else if ((stream = create_stream(ausrv)) == NULL)
+        return;
 
     tone_create(stream, type_l, dtmf->low_freq , vol/2, per,play, 0,dur);
-    tone_create(stream, type_h, dtmf->high_freq, vol/2, per,play, 0,dur);
+    tone = tone_create(stream, type_h, dtmf->high_freq, vol/2, per,play,
+                       0,dur);
+
+ started:
+    add_event(stream, type, vol, tone, dur);
+    tonesig_laid_out(stream, stream->time, dur ? stream->time + dur : 0);
+
+    /* next time the server can play it from its sample cache */
+    if (cacheable) {
+        detached = stream_create_detached(ausrv, name, 0,
+                                          tone_write_callback,
+                                          tone_destroy_callback, NULL);
+        if (detached != NULL) {
+            tone_create(detached, type_l, dtmf->low_freq , vol/2, per,play,
+                        0,dur);
+            tone_create(detached, type_h, dtmf->high_freq, vol/2, per,play,
+                        0,dur);
+            scache_upload(ausrv, name, detached, dur);
+        }
+    }
 
     timeout = dur ? dur + (30 * 1000000) : (1 * 60 * 1000000);
 
@@ -150,15 +226,224 @@ void dtmf_play(struct ausrv *ausrv, uint type, uint32_t vol, int dur)
     set_mute_timeout(ausrv, 0);
 }
 
+/*
+ * A fixed length tone on the stream timeline, 'gap' usec after the
+ * DTMF tones already there end, or right away if there are none. These
+ * never come from the sample cache, so that a sequence of them needs
+ * only one stream and the gaps are exact to the sample.
+ */
+void dtmf_append(struct ausrv *ausrv, uint type, uint32_t vol, int dur,
+                 int gap)
+{
+    struct stream *stream;
+
+    if (type >= DTMF_MAX || dur < 10000 || gap < 0)
+        return;
+
+    if (ausrv_queue_command(ausrv, append_command, type, vol, dur, gap))
+        return;
+
+    stream = stream_find(ausrv, dtmf_stream);
+
+    if (stream == NULL && (stream = create_stream(ausrv)) == NULL)
+        return;
+
+    append_tones(stream, type, vol, dur, gap);
+
+    request_muting(ausrv, MUTE_ON);
+    set_mute_timeout(ausrv, 0);
+}
+
+/*
+ * The tones of the sequence appended one after the other, as by
+ * dtmf_append(), in one command. Unlike single presses the sequence is
+ * cut short by dtmf_stop(), like a dial string. The array is taken over.
+ */
+void dtmf_sequence(struct ausrv *ausrv, struct dtmf_press *seq, int n)
+{
+    struct stream *stream;
+    uint32_t       left;
+    int            i;
+
+    if (ausrv_queue_owned_command(ausrv, sequence_command, drop_sequence,
+                                  (uintptr_t)seq, n, 0,0))
+        return;
+
+    stream = stream_find(ausrv, dtmf_stream);
+
+    if (stream != NULL || (stream = create_stream(ausrv)) != NULL) {
+        for (i = 0, left = 0;  i < n;  i++) {
+            if (seq[i].type < DTMF_MAX && seq[i].dur >= 10000)
+                left = append_tones(stream, seq[i].type, seq[i].vol,
+                                    seq[i].dur, seq[i].gap);
+        }
+
+        if (left > 0)
+            stream_add_cue(stream, stream->time + left, sequenced, NULL);
+
+        request_muting(ausrv, MUTE_ON);
+        set_mute_timeout(ausrv, 0);
+    }
+
+    free(seq);
+}
+
+/*
+ * Every symbol of the string is an 'on' usec tone followed by 'off'
+ * usec of silence, and ',' adds a pause. The string is laid on the
+ * stream timeline in one go, as dtmf_append() would do it symbol by
+ * symbol, and a DialStringDone signal with the string follows once it
+ * has been played. The string is taken over.
+ */
+void dtmf_dial(struct ausrv *ausrv, char *digits, uint32_t on, uint32_t off,
+               uint32_t vol)
+{
+    struct stream  *stream;
+    struct dial    *dial;
+    uint32_t        left;
+
+    if (ausrv_queue_owned_command(ausrv, dial_command, drop_dial,
+                                  (uintptr_t)digits, on, off, vol))
+        return;
+
+    stream = stream_find(ausrv, dtmf_stream);
+
+    if (stream == NULL && (stream = create_stream(ausrv)) == NULL) {
+        free(digits);
+        return;
+    }
+
+    left = dtmf_create_tones(stream, digits, on, off, (vol_scale * vol) / 100);
+
+    tonesig_laid_out(stream, stream->time + left -
+                     dtmf_dial_length(digits, on, off), stream->time + left);
+
+    stream_set_timeout(stream, left + (30 * 1000000));
+
+    request_muting(ausrv, MUTE_ON);
+    set_mute_timeout(ausrv, 0);
+
+    TRACE("%s(): '%s' done in %u usec", __FUNCTION__, digits, left);
+
+    if ((dial = (struct dial *)malloc(sizeof(*dial))) == NULL) {
+        free(digits);
+        return;
+    }
+
+    dial->ausrv  = ausrv;
+    dial->digits = digits;
+
+    /* played out once the end went through the output buffers */
+    if (stream_add_cue(stream, stream->time + left, dialed, dial) < 0) {
+        free(dial->digits);
+        free(dial);
+    }
+}
+
+/*
+ * sets up the tones of the dial string on the stream, 'on' usec each
+ * and 'off' usec apart; a single symbol with no 'on' time plays for
+ * ever. Returns how long they play, 0 if for ever.
+ */
+uint32_t dtmf_create_tones(struct stream *stream, const char *digits,
+                           uint32_t on, uint32_t off, uint32_t vol)
+{
+    struct dtmf *dtmf;
+    struct tone *tone;
+    uint32_t     gap;
+    int          type;
+    const char  *p;
+
+    if (!on) {
+        if ((type = dtmf_symbol(digits[0])) < 0)
+            return 0;
+
+        dtmf = dtmf_defs + type;
+
+        tone_create(stream, TONE_DTMF_L, dtmf->low_freq , vol/2,
+                    1000000,1000000, 0,0);
+        tone_create(stream, TONE_DTMF_H, dtmf->high_freq, vol/2,
+                    1000000,1000000, 0,0);
+        add_event(stream, type, vol, NULL, 0);
+        return 0;
+    }
+
+    for (p = digits, gap = 0, tone = NULL;  *p;  p++) {
+        if (*p == ',')
+            gap += DIAL_PAUSE;
+        else if ((type = dtmf_symbol(*p)) >= 0) {
+            tone = add_tones(stream, dtmf_defs + type, vol, on, gap);
+            gap  = off;
+        }
+    }
+
+    return tone ? tone_time_left(tone) : 0;
+}
+
+/* how long dtmf_create_tones() plays the dial string, in usec */
+uint32_t dtmf_dial_length(const char *digits, uint32_t on, uint32_t off)
+{
+    uint32_t    length;
+    uint32_t    gap;
+    const char *p;
+
+    for (p = digits, gap = 0, length = 0;  *p;  p++) {
+        if (*p == ',')
+            gap += DIAL_PAUSE;
+        else if (dtmf_symbol(*p) >= 0) {
+            length += gap + on;
+            gap     = off;
+        }
+    }
+
+    return length;
+}
+
+int dtmf_symbol(char symbol)
+{
+    int i;
+
+    for (i = 0;  i < DTMF_MAX;  i++) {
+        if (dtmf_defs[i].symbol == symbol)
+            return i;
+    }
+
+    /* lower case for the extra column */
+    if (symbol >= 'a' && symbol <= 'd')
+        return DTMF_A + (symbol - 'a');
+
+    return -1;
+}
+
 void dtmf_stop(struct ausrv *ausrv)
 {
-    struct stream *stream = stream_find(ausrv, dtmf_stream);
+    struct stream *stream;
     struct tone   *tone;
     struct tone   *next;
+    uint32_t       end;
+    uint32_t       left;
+    int            cut;
+
+    if (ausrv_queue_passive_command(ausrv, stop_command, 0,0,0,0))
+        return;
+
+    stream = stream_find(ausrv, dtmf_stream);
 
     TRACE("%s() stream=%s", __FUNCTION__, stream ? stream->name:"<no-stream>");
 
     if (stream != NULL) {
+        end = stream->time;
+
+        left = 0;
+
+        /*
+         * a dial string or a sequence is cut short; a dial string is
+         * not done then, so no signal. Single fixed length presses are
+         * left to play out otherwise.
+         */
+        cut  = stream_drop_cues(stream, dialed) > 0;
+        cut |= stream_drop_cues(stream, sequenced) > 0;
+
         for (tone = (struct tone *)stream->data;  tone;  tone = next) {
 
             next = tone->next;
@@ -167,13 +452,22 @@ void dtmf_stop(struct ausrv *ausrv)
                 
             case TONE_DTMF_IND_L:
             case TONE_DTMF_IND_H:
-                /* in the future a linear ramp-down enevlop can be set */
-                tone_destroy(tone, KILL_CHAIN);
+                /*
+                 * a key released right after it was pressed still
+                 * gets a short tone; the renderer ends it on time and
+                 * the next key can restart it meanwhile
+                 */
+                if (!tone_end_after(tone, MIN_PRESS))
+                    tone_destroy(tone, KILL_CHAIN);
+                else if (stream->time + tone_time_left(tone) > end)
+                    end = stream->time + tone_time_left(tone);
                 break;
 
             default:
-                if (!tone_chainable(tone->type))
+                if (cut || !tone_chainable(tone->type))
                     tone_destroy(tone, KILL_CHAIN);
+                else if (tone_time_left(tone) > left)
+                    left = tone_time_left(tone);
                 break;
             }
         }
@@ -181,7 +475,18 @@ void dtmf_stop(struct ausrv *ausrv)
         if (stream->data == NULL)
             stream_clean_buffer(stream);
 
-        stream_set_timeout(stream, 10 * 1000000);
+        stream_end_events(stream, end);
+
+        if (cut) {
+            stream_cut_events(stream, end);
+            tonesig_cut(stream, end);
+        }
+        else
+            tonesig_stopped(stream, end);
+
+        /* as long as the presses that are left need it */
+        stream_set_timeout(stream, left ? left + (30 * 1000000) :
+                                          10 * 1000000);
         set_mute_timeout(ausrv, 2 * 1000000);        
     }
 }
@@ -198,6 +503,148 @@ void dtmf_set_volume(uint32_t volume)
     vol_scale = volume;
 }
 
+static void play_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    dtmf_play(ausrv, arg[0], arg[1], arg[2]);
+}
+
+static void append_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    dtmf_append(ausrv, arg[0], arg[1], arg[2], arg[3]);
+}
+
+static void sequence_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    dtmf_sequence(ausrv, (struct dtmf_press *)arg[0], arg[1]);
+}
+
+static void drop_sequence(uintptr_t *arg)
+{
+    free((struct dtmf_press *)arg[0]);
+}
+
+static void dial_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    dtmf_dial(ausrv, (char *)arg[0], arg[1], arg[2], arg[3]);
+}
+
+static void drop_dial(uintptr_t *arg)
+{
+    free((char *)arg[0]);
+}
+
+static void stop_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    (void)arg;
+
+    dtmf_stop(ausrv);
+}
+
+static struct stream *create_stream(struct ausrv *ausrv)
+{
+    struct stream *stream;
+
+    stream = stream_create(ausrv, dtmf_stream, NULL, 0,
+                           tone_write_callback,
+                           destroy_callback,
+                           dtmf_props,
+                           NULL);
+
+    if (stream == NULL) {
+        LOG_ERROR("%s(): Can't create stream", __FUNCTION__);
+        return NULL;
+    }
+
+    stream_set_checkpoint(stream, tone_save, tone_restore, tone_discard);
+
+    return stream;
+}
+
+/* a chained, fixed length tone pair 'gap' usec after the previous one */
+static struct tone *add_tones(struct stream *stream, struct dtmf *dtmf,
+                              uint32_t vol, uint32_t dur, uint32_t gap)
+{
+    struct tone *tone;
+
+    tone_create(stream, TONE_DTMF_L, dtmf->low_freq, vol/2, dur,dur, gap,dur);
+    tone = tone_create(stream, TONE_DTMF_H, dtmf->high_freq, vol/2, dur,dur,
+                       gap,dur);
+
+    add_event(stream, dtmf - dtmf_defs, vol, tone, dur);
+
+    return tone;
+}
+
+/*
+ * The key as an RFC 4733 event, where its tones are on the timeline:
+ * 'dur' usec up to the end of 'tone', or from now on until dtmf_stop()
+ * if 'dur' is 0. The event codes are the indices of dtmf_defs.
+ */
+static void add_event(struct stream *stream, uint type, uint32_t vol,
+                      struct tone *tone, uint32_t dur)
+{
+    int level = tone_event_level(vol);
+
+    if (!dur) {
+        /* a new key ends the event of the previous one */
+        stream_end_events(stream, stream->time);
+        stream_add_event(stream, stream->time, 0, type, level);
+    }
+    else if (tone != NULL) {
+        stream_add_event(stream, stream->time + tone_time_left(tone) - dur,
+                         dur, type, level);
+    }
+}
+
+/* returns how long the tones play from now on, in usec */
+static uint32_t append_tones(struct stream *stream, uint type, uint32_t vol,
+                             int dur, int gap)
+{
+    struct tone *tone;
+    uint32_t     left = 0;
+
+    vol = (vol_scale * vol) / 100;
+
+    if ((tone = add_tones(stream, dtmf_defs + type, vol, dur, gap)) != NULL) {
+        left = tone_time_left(tone);
+
+        stream_set_timeout(stream, left + (30 * 1000000));
+        tonesig_laid_out(stream, stream->time + left - dur,
+                         stream->time + left);
+    }
+
+    return left;
+}
+
+/*
+ * on the main loop; not played if the string was cut short by
+ * dtmf_stop() or the stream went
+ */
+static void dialed(void *data, int played)
+{
+    struct dial *dial = (struct dial *)data;
+    int          sts;
+
+    if (played) {
+        sts = dbusif_send_signal(dial->ausrv->tonegend, NULL,
+                                 "DialStringDone",
+                                 DBUS_TYPE_STRING, &dial->digits,
+                                 DBUS_TYPE_INVALID);
+        if (sts != 0)
+            LOG_ERROR("failed to send DialStringDone signal");
+    }
+
+    free(dial->digits);
+    free(dial);
+}
+
+/* only marks the end of a sequence, for dtmf_stop() to find */
+static void sequenced(void *data, int played)
+{
+    (void)data;
+    (void)played;
+}
+
 static void destroy_callback(void *data)
 {
     struct tone   *tone = (struct tone *)data;
@@ -206,13 +653,13 @@ static void destroy_callback(void *data)
 
     set_mute_timeout(NULL, 0);
 
-    if (mute && tone != NULL) {
+    if (tone != NULL) {
         stream = tone->stream;
         ausrv  = stream->ausrv;
 
+        /* no batching here; we might be on the way out */
+        __atomic_store_n(&mute_now, TRUE, __ATOMIC_RELEASE);
         request_muting(ausrv, MUTE_OFF);
-
-        mute = MUTE_OFF;
     }
 
     tone_destroy_callback(data);
@@ -220,41 +667,114 @@ static void destroy_callback(void *data)
 
 static void set_mute_timeout(struct ausrv *ausrv, guint interval)
 {
+    struct timeval tv;
+
     if (interval)
         TRACE("add %d usec mute timeout", interval);
-    else if (tmute_id)
+    else if (tmute != NULL)
         TRACE("remove mute timeout");
 
-    if (tmute_id != 0) {
-        g_source_remove(tmute_id);
-        tmute_id = 0;
+    if (tmute != NULL) {
+        tmute_api->time_free(tmute);
+        tmute = NULL;
     }
 
     if (interval > 0 && ausrv != NULL) {
-        tmute_id = g_timeout_add(interval/1000, mute_timeout_callback, ausrv);
+        gettimeofday(&tv, NULL);
+        tv.tv_sec  += interval / 1000000;
+        tv.tv_usec += interval % 1000000;
+
+        if (tv.tv_usec >= 1000000) {
+            tv.tv_sec  += 1;
+            tv.tv_usec -= 1000000;
+        }
+
+        /*
+         * the timer lives on the audio loop so that it is serialized
+         * with dtmf_play() and dtmf_stop() even with a render thread
+         */
+        tmute_api = ausrv->api;
+        tmute = tmute_api->time_new(tmute_api, &tv, mute_timeout_callback,
+                                    ausrv);
     }
 }
 
-static gboolean mute_timeout_callback(gpointer data)
+static void mute_timeout_callback(pa_mainloop_api *api, pa_time_event *event,
+                                  const struct timeval *tv, void *data)
 {
     struct ausrv *ausrv = (struct ausrv *)data;
 
+    (void)tv;
+
     TRACE("mute timeout fired");
 
+    api->time_free(event);
+    tmute = NULL;
+
     request_muting(ausrv, MUTE_OFF);
+}
+
+/*
+ * The Mute signal is sent once the commands at hand are done, so that
+ * a burst of key presses that turns it off and on again sends nothing.
+ * The audio side only says what it wants; the signal goes out from the
+ * main loop.
+ */
+static void request_muting(struct ausrv *ausrv, dbus_bool_t new_mute)
+{
+    if (ausrv == NULL)
+        return;
 
-    tmute_id = 0;
+    __atomic_store_n(&mute_wanted, new_mute ? MUTE_ON : MUTE_OFF,
+                     __ATOMIC_RELEASE);
 
-    return FALSE;
+    ausrv_post_main(ausrv, &mute_post, mute_posted);
 }
 
-static void request_muting(struct ausrv *ausrv, dbus_bool_t new_mute)
+static void mute_posted(struct ausrv *ausrv, struct ausrv_post *post)
 {
-    int sts;
+    pa_mainloop_api *api = mainloop_get_api();
 
-    new_mute = new_mute ? MUTE_ON : MUTE_OFF;
+    (void)post;
 
-    if (ausrv != NULL && mute != new_mute) {
+    if (__atomic_exchange_n(&mute_now, FALSE, __ATOMIC_ACQ_REL)) {
+        send_muting(ausrv);
+        return;
+    }
+
+    if (dmute == NULL) {
+        dmute = api->defer_new(api, mute_defer_callback, ausrv);
+
+        if (dmute == NULL) {
+            send_muting(ausrv);
+            return;
+        }
+    }
+
+    api->defer_enable(dmute, __atomic_load_n(&mute_wanted, __ATOMIC_ACQUIRE)
+                             != mute);
+}
+
+static void mute_defer_callback(pa_mainloop_api *api, pa_defer_event *event,
+                                void *data)
+{
+    struct ausrv *ausrv = (struct ausrv *)data;
+
+    api->defer_enable(event, FALSE);
+
+    send_muting(ausrv);
+}
+
+/* on the main loop */
+static void send_muting(struct ausrv *ausrv)
+{
+    dbus_bool_t new_mute = __atomic_load_n(&mute_wanted, __ATOMIC_ACQUIRE);
+    int         sts;
+
+    if (dmute != NULL)
+        mainloop_get_api()->defer_enable(dmute, FALSE);
+
+    if (mute != new_mute) {
         sts = dbusif_send_signal(ausrv->tonegend, NULL, "Mute",
                                  DBUS_TYPE_BOOLEAN, &new_mute,
                                  DBUS_TYPE_INVALID);
@@ -268,6 +788,46 @@ static void request_muting(struct ausrv *ausrv, dbus_bool_t new_mute)
     }
 }
 
+/*
+ * Restart the continuous tone pair of the previous key with the
+ * frequencies of this one, if there is such a pair. The fixed length
+ * tones chained on the stream are left alone, as dtmf_stop() would.
+ */
+static int restart_tones(struct stream *stream, struct dtmf *dtmf,
+                         uint32_t vol)
+{
+    struct tone *tone;
+    struct tone *low  = NULL;
+    struct tone *high = NULL;
+
+    for (tone = (struct tone *)stream->data;  tone;  tone = tone->next) {
+        switch (tone->type) {
+        case TONE_DTMF_IND_L:
+            if (low != NULL || tone->chain != NULL)
+                return FALSE;
+            low = tone;
+            break;
+        case TONE_DTMF_IND_H:
+            if (high != NULL || tone->chain != NULL)
+                return FALSE;
+            high = tone;
+            break;
+        default:
+            if (!tone_chainable(tone->type))
+                return FALSE;
+            break;
+        }
+    }
+
+    if (low == NULL || high == NULL)
+        return FALSE;
+
+    tone_restart(low , dtmf->low_freq , vol/2);
+    tone_restart(high, dtmf->high_freq, vol/2);
+
+    return TRUE;
+}
+
 
 
 /*
@@ -46,8 +46,26 @@ USA.
 #define DTMF_D          15
 #define DTMF_MAX        16
 
+struct stream;
+
+/* a fixed length tone of a sequence, 'gap' usec after the previous one */
+struct dtmf_press {
+    uint        type;
+    uint32_t    vol;
+    uint32_t    dur;            /* usec */
+    uint32_t    gap;            /* usec */
+};
+
+
 int  dtmf_init(int, char **);
 void dtmf_play(struct ausrv *, uint, uint32_t, int);
+void dtmf_append(struct ausrv *, uint, uint32_t, int, int);
+void dtmf_sequence(struct ausrv *, struct dtmf_press *, int);
+void dtmf_dial(struct ausrv *, char *, uint32_t, uint32_t, uint32_t);
+int  dtmf_symbol(char);
+uint32_t dtmf_create_tones(struct stream *, const char *, uint32_t, uint32_t,
+                           uint32_t);
+uint32_t dtmf_dial_length(const char *, uint32_t, uint32_t);
 void dtmf_stop(struct ausrv *);
 void dtmf_set_properties(char *);
 void dtmf_set_volume(uint32_t);
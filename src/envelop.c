@@ -29,6 +29,7 @@ USA.
 #include <trace/trace.h>
 
 #include "envelop.h"
+#include "pool.h"
 #ifndef TRUE
 #define TRUE  1
 #endif
@@ -42,6 +43,10 @@ USA.
 
 #define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
 
+#define POOL_SIZE 64            /* envelopes preallocated at startup */
+
+static struct pool *envelop_pool;
+
 
 static inline union envelop *ramp_create(int type, uint32_t length,
                                          uint32_t start, uint32_t end)
@@ -51,7 +56,7 @@ static inline union envelop *ramp_create(int type, uint32_t length,
     struct envelop_ramp_def *up;
     struct envelop_ramp_def *down;
 
-    if ((envelop = malloc(sizeof(struct envelop_ramp))) != NULL) {
+    if ((envelop = pool_alloc(envelop_pool)) != NULL) {
         ramp   = &envelop->ramp;
         up     = &ramp->up;
         down   = &ramp->down;
@@ -123,6 +128,10 @@ int envelop_init(int argc, char **argv)
     (void)argc;
     (void)argv;
 
+    if ((envelop_pool = pool_create("envelop", sizeof(union envelop),
+                                    POOL_SIZE)) == NULL)
+        return -1;
+
     return 0;
 }
 
@@ -145,6 +154,16 @@ union envelop *envelop_create(int type, uint32_t length,
     return env;
 }
 
+union envelop *envelop_copy(union envelop *envelop)
+{
+    union envelop *copy = NULL;
+
+    if (envelop != NULL && (copy = pool_alloc(envelop_pool)) != NULL)
+        memcpy(copy, envelop, sizeof(*copy));
+
+    return copy;
+}
+
 void envelop_update(union envelop *envelop, uint32_t length, uint32_t end)
 {
     if (envelop != NULL) {
@@ -169,7 +188,7 @@ void envelop_destroy(union envelop *envelop)
         default:                                            break;
         }
 
-        free(envelop);
+        pool_free(envelop_pool, envelop);
     }
 }
 
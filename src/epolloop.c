@@ -0,0 +1,689 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "mainloop.h"
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define MAX_EVENTS  16          /* epoll events per wakeup */
+
+/*
+ * An experimental pa_mainloop_api on epoll, built instead of the GLib
+ * loop with --enable-epoll; it has not been measured against that one
+ * and is not the default. All time events share a single timerfd armed
+ * to the earliest of them and an eventfd wakes the loop up for quitting
+ * or after a change made by another thread. The loop thread
+ * holds the loop lock except while it sleeps in epoll_wait(), so other
+ * threads can safely call the api as well; they take the lock and wake
+ * the loop up. The daemon itself no longer does that: the render thread
+ * hands its work to the main loop through ausrv_post_main().
+ */
+
+struct pa_io_event {
+    struct pa_io_event        *next;
+    int                        fd;
+    pa_io_event_flags_t        events;
+    pa_io_event_cb_t           cb;
+    void                      *userdata;
+    pa_io_event_destroy_cb_t   destroy;
+    int                        dead;
+};
+
+struct pa_time_event {
+    struct pa_time_event      *next;
+    struct timeval             tv;
+    int                        enabled;
+    pa_time_event_cb_t         cb;
+    void                      *userdata;
+    pa_time_event_destroy_cb_t destroy;
+    int                        dead;
+};
+
+struct pa_defer_event {
+    struct pa_defer_event     *next;
+    int                        enabled;
+    pa_defer_event_cb_t        cb;
+    void                      *userdata;
+    pa_defer_event_destroy_cb_t destroy;
+    int                        dead;
+};
+
+struct epoll_loop {
+    pa_mainloop_api         api;
+    int                     epfd;
+    int                     tfd;        /* timerfd for the time events */
+    int                     wakefd;     /* eventfd */
+    pthread_mutex_t         lock;
+    pthread_t               thread;
+    int                     running;
+    int                     quit;       /* set by signal handlers, too */
+    struct pa_io_event     *ios;
+    struct pa_time_event   *times;
+    struct pa_defer_event  *defers;
+    int                     ndefer;     /* enabled defer events */
+    int                     ndead;      /* events waiting to be freed */
+    struct timeval          armed;      /* current timerfd expiry */
+    DBusConnection         *conn;
+};
+
+static int  enter(void);
+static void leave(int);
+static void update_fd(int);
+static void arm_timer(void);
+static void dispatch_io(int, uint32_t);
+static void dispatch_timers(void);
+static void dispatch_defers(void);
+static void collect_dead(int);
+
+static pa_io_event *io_new(pa_mainloop_api *, int, pa_io_event_flags_t,
+                           pa_io_event_cb_t, void *);
+static void io_enable(pa_io_event *, pa_io_event_flags_t);
+static void io_free(pa_io_event *);
+static void io_set_destroy(pa_io_event *, pa_io_event_destroy_cb_t);
+static pa_time_event *time_new(pa_mainloop_api *, const struct timeval *,
+                               pa_time_event_cb_t, void *);
+static void time_restart(pa_time_event *, const struct timeval *);
+static void time_free(pa_time_event *);
+static void time_set_destroy(pa_time_event *, pa_time_event_destroy_cb_t);
+static pa_defer_event *defer_new(pa_mainloop_api *, pa_defer_event_cb_t,
+                                 void *);
+static void defer_enable(pa_defer_event *, int);
+static void defer_free(pa_defer_event *);
+static void defer_set_destroy(pa_defer_event *, pa_defer_event_destroy_cb_t);
+static void quit(pa_mainloop_api *, int);
+
+const char *mainloop_backend = "epoll";
+
+static struct epoll_loop  loop = {
+    .epfd   = -1,
+    .tfd    = -1,
+    .wakefd = -1,
+    .lock   = PTHREAD_MUTEX_INITIALIZER
+};
+
+
+int mainloop_create(void)
+{
+    struct epoll_event ev;
+
+    loop.api.userdata          = &loop;
+    loop.api.io_new            = io_new;
+    loop.api.io_enable         = io_enable;
+    loop.api.io_free           = io_free;
+    loop.api.io_set_destroy    = io_set_destroy;
+    loop.api.time_new          = time_new;
+    loop.api.time_restart      = time_restart;
+    loop.api.time_free         = time_free;
+    loop.api.time_set_destroy  = time_set_destroy;
+    loop.api.defer_new         = defer_new;
+    loop.api.defer_enable      = defer_enable;
+    loop.api.defer_free        = defer_free;
+    loop.api.defer_set_destroy = defer_set_destroy;
+    loop.api.quit              = quit;
+
+    if ((loop.epfd   = epoll_create1(EPOLL_CLOEXEC))                   < 0 ||
+        (loop.tfd    = timerfd_create(CLOCK_REALTIME,
+                                      TFD_NONBLOCK | TFD_CLOEXEC))     < 0 ||
+        (loop.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))         < 0)
+    {
+        LOG_ERROR("%s(): can't create epoll loop: %s", __FUNCTION__,
+                  strerror(errno));
+        goto failed;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+
+    ev.data.fd = loop.tfd;
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.tfd, &ev) < 0)
+        goto failed;
+
+    ev.data.fd = loop.wakefd;
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.wakefd, &ev) < 0)
+        goto failed;
+
+    mainloop_stats_reset();
+
+    return 0;
+
+ failed:
+    mainloop_destroy();
+    return -1;
+}
+
+void mainloop_destroy(void)
+{
+    if (loop.conn != NULL) {
+        mainloop_detach_dbus(loop.conn);
+        loop.conn = NULL;
+    }
+
+    collect_dead(TRUE);
+
+    if (loop.epfd >= 0)
+        close(loop.epfd);
+    if (loop.tfd >= 0)
+        close(loop.tfd);
+    if (loop.wakefd >= 0)
+        close(loop.wakefd);
+
+    loop.epfd = loop.tfd = loop.wakefd = -1;
+}
+
+pa_mainloop_api *mainloop_get_api(void)
+{
+    return &loop.api;
+}
+
+void mainloop_run(void)
+{
+    struct epoll_event  events[MAX_EVENTS];
+    int                 timeout;
+    int                 n, i;
+
+    pthread_mutex_lock(&loop.lock);
+
+    loop.thread = pthread_self();
+    __atomic_store_n(&loop.running, TRUE, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&loop.quit, __ATOMIC_RELAXED)) {
+        if (loop.ndefer > 0) {
+            dispatch_defers();
+
+            if (__atomic_load_n(&loop.quit, __ATOMIC_RELAXED))
+                break;
+        }
+
+        arm_timer();
+
+        timeout = loop.ndefer > 0 ? 0 : -1;
+
+        pthread_mutex_unlock(&loop.lock);
+        n = epoll_wait(loop.epfd, events, MAX_EVENTS, timeout);
+        pthread_mutex_lock(&loop.lock);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_ERROR("%s(): epoll_wait failed: %s", __FUNCTION__,
+                      strerror(errno));
+            break;
+        }
+
+        if (n > 0 || timeout != 0)
+            mainloop_woke_up();
+
+        for (i = 0;  i < n;  i++) {
+            if (events[i].data.fd == loop.wakefd) {
+                uint64_t cnt;
+
+                if (read(loop.wakefd, &cnt, sizeof(cnt)) < 0 &&
+                    errno != EAGAIN)
+                    LOG_ERROR("%s(): can't read eventfd", __FUNCTION__);
+            }
+            else if (events[i].data.fd == loop.tfd)
+                dispatch_timers();
+            else
+                dispatch_io(events[i].data.fd, events[i].events);
+        }
+
+        if (loop.ndead > 0)
+            collect_dead(FALSE);
+    }
+
+    __atomic_store_n(&loop.running, FALSE, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&loop.lock);
+}
+
+/* called from the signal handler as well */
+int mainloop_quit(void)
+{
+    uint64_t one = 1;
+
+    if (loop.wakefd < 0)
+        return -1;
+
+    __atomic_store_n(&loop.quit, TRUE, __ATOMIC_RELAXED);
+
+    if (write(loop.wakefd, &one, sizeof(one)) < 0)
+        return -1;
+
+    return 0;
+}
+
+int mainloop_setup_dbus(DBusConnection *conn)
+{
+    if (mainloop_attach_dbus(&loop.api, conn) < 0)
+        return -1;
+
+    loop.conn = conn;
+
+    return 0;
+}
+
+
+static int enter(void)
+{
+    if (__atomic_load_n(&loop.running, __ATOMIC_ACQUIRE) &&
+        !pthread_equal(pthread_self(), loop.thread))
+    {
+        pthread_mutex_lock(&loop.lock);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void leave(int locked)
+{
+    uint64_t one = 1;
+
+    if (locked) {
+        /* let the loop pick up the change */
+        if (write(loop.wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            LOG_ERROR("%s(): can't wake up main loop", __FUNCTION__);
+
+        pthread_mutex_unlock(&loop.lock);
+    }
+}
+
+/*
+ * epoll takes every fd only once; libdbus, for one, has separate read
+ * and write watches on its socket. So the interest set of an fd is the
+ * union of the live io events on it.
+ */
+static void update_fd(int fd)
+{
+    struct pa_io_event *io;
+    struct epoll_event  ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+
+    for (io = loop.ios;  io;  io = io->next) {
+        if (io->fd == fd && !io->dead) {
+            if (io->events & PA_IO_EVENT_INPUT)
+                ev.events |= EPOLLIN;
+            if (io->events & PA_IO_EVENT_OUTPUT)
+                ev.events |= EPOLLOUT;
+        }
+    }
+
+    if (!ev.events)
+        epoll_ctl(loop.epfd, EPOLL_CTL_DEL, fd, &ev);
+    else if (epoll_ctl(loop.epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        if (errno != ENOENT || epoll_ctl(loop.epfd,EPOLL_CTL_ADD,fd,&ev) < 0)
+            LOG_ERROR("%s(): can't watch fd %d: %s", __FUNCTION__, fd,
+                      strerror(errno));
+    }
+}
+
+static void arm_timer(void)
+{
+    struct pa_time_event *te;
+    struct timeval       *first = NULL;
+    struct itimerspec     its;
+
+    for (te = loop.times;  te;  te = te->next) {
+        if (te->enabled && !te->dead && (!first || timercmp(&te->tv, first,<)))
+            first = &te->tv;
+    }
+
+    if (first == NULL) {
+        if (!timerisset(&loop.armed))
+            return;
+        timerclear(&loop.armed);
+    }
+    else {
+        if (timercmp(first, &loop.armed, ==))
+            return;
+        loop.armed = *first;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = loop.armed.tv_sec;
+    its.it_value.tv_nsec = loop.armed.tv_usec * 1000;
+
+    if (timerfd_settime(loop.tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        LOG_ERROR("%s(): can't arm timer: %s", __FUNCTION__, strerror(errno));
+}
+
+static void dispatch_io(int fd, uint32_t revents)
+{
+    struct pa_io_event  *io;
+    pa_io_event_flags_t  flags;
+
+    for (io = loop.ios;  io;  io = io->next) {
+        if (io->fd != fd || io->dead || !io->events)
+            continue;
+
+        flags = PA_IO_EVENT_NULL;
+
+        if ((revents & EPOLLIN) && (io->events & PA_IO_EVENT_INPUT))
+            flags |= PA_IO_EVENT_INPUT;
+        if ((revents & EPOLLOUT) && (io->events & PA_IO_EVENT_OUTPUT))
+            flags |= PA_IO_EVENT_OUTPUT;
+        if (revents & EPOLLHUP)
+            flags |= PA_IO_EVENT_HANGUP;
+        if (revents & EPOLLERR)
+            flags |= PA_IO_EVENT_ERROR;
+
+        if (flags)
+            io->cb(&loop.api, io, fd, flags, io->userdata);
+    }
+}
+
+static void dispatch_timers(void)
+{
+    struct pa_time_event *te;
+    struct timeval        now;
+    uint64_t              cnt;
+
+    if (read(loop.tfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        LOG_ERROR("%s(): can't read timerfd", __FUNCTION__);
+
+    timerclear(&loop.armed);
+    gettimeofday(&now, NULL);
+
+    for (te = loop.times;  te;  te = te->next) {
+        if (te->enabled && !te->dead && !timercmp(&te->tv, &now, >)) {
+            te->enabled = FALSE;
+            te->cb(&loop.api, te, &te->tv, te->userdata);
+        }
+    }
+}
+
+static void dispatch_defers(void)
+{
+    struct pa_defer_event *de;
+
+    for (de = loop.defers;  de;  de = de->next) {
+        if (de->enabled && !de->dead)
+            de->cb(&loop.api, de, de->userdata);
+    }
+}
+
+static void collect_dead(int all)
+{
+    struct pa_io_event    *io,  **iop;
+    struct pa_time_event  *te,  **tep;
+    struct pa_defer_event *de,  **dep;
+
+    for (iop = &loop.ios;  (io = *iop) != NULL; ) {
+        if (io->dead || all) {
+            *iop = io->next;
+            if (io->destroy)
+                io->destroy(&loop.api, io, io->userdata);
+            free(io);
+        }
+        else
+            iop = &io->next;
+    }
+
+    for (tep = &loop.times;  (te = *tep) != NULL; ) {
+        if (te->dead || all) {
+            *tep = te->next;
+            if (te->destroy)
+                te->destroy(&loop.api, te, te->userdata);
+            free(te);
+        }
+        else
+            tep = &te->next;
+    }
+
+    for (dep = &loop.defers;  (de = *dep) != NULL; ) {
+        if (de->dead || all) {
+            *dep = de->next;
+            if (de->destroy)
+                de->destroy(&loop.api, de, de->userdata);
+            free(de);
+        }
+        else
+            dep = &de->next;
+    }
+
+    loop.ndead = 0;
+
+    if (all)
+        loop.ndefer = 0;
+}
+
+static pa_io_event *io_new(pa_mainloop_api *api, int fd,
+                           pa_io_event_flags_t events, pa_io_event_cb_t cb,
+                           void *userdata)
+{
+    struct pa_io_event *io;
+    int                 locked;
+
+    (void)api;
+
+    if ((io = calloc(1, sizeof(*io))) == NULL)
+        return NULL;
+
+    io->fd       = fd;
+    io->events   = events;
+    io->cb       = cb;
+    io->userdata = userdata;
+
+    locked = enter();
+
+    io->next = loop.ios;
+    loop.ios = io;
+
+    update_fd(fd);
+
+    leave(locked);
+
+    return io;
+}
+
+static void io_enable(pa_io_event *io, pa_io_event_flags_t events)
+{
+    int locked = enter();
+
+    if (io->events != events) {
+        io->events = events;
+        update_fd(io->fd);
+    }
+
+    leave(locked);
+}
+
+static void io_free(pa_io_event *io)
+{
+    int locked = enter();
+
+    io->dead   = TRUE;
+    io->events = PA_IO_EVENT_NULL;
+    loop.ndead++;
+
+    update_fd(io->fd);
+
+    leave(locked);
+}
+
+static void io_set_destroy(pa_io_event *io, pa_io_event_destroy_cb_t cb)
+{
+    io->destroy = cb;
+}
+
+static pa_time_event *time_new(pa_mainloop_api *api, const struct timeval *tv,
+                               pa_time_event_cb_t cb, void *userdata)
+{
+    struct pa_time_event *te;
+    int                   locked;
+
+    (void)api;
+
+    if ((te = calloc(1, sizeof(*te))) == NULL)
+        return NULL;
+
+    te->cb       = cb;
+    te->userdata = userdata;
+
+    if (tv != NULL) {
+        te->tv      = *tv;
+        te->enabled = TRUE;
+    }
+
+    locked = enter();
+
+    te->next   = loop.times;
+    loop.times = te;
+
+    leave(locked);
+
+    return te;
+}
+
+static void time_restart(pa_time_event *te, const struct timeval *tv)
+{
+    int locked = enter();
+
+    if (tv == NULL)
+        te->enabled = FALSE;
+    else {
+        te->tv      = *tv;
+        te->enabled = TRUE;
+    }
+
+    leave(locked);
+}
+
+static void time_free(pa_time_event *te)
+{
+    int locked = enter();
+
+    te->dead    = TRUE;
+    te->enabled = FALSE;
+    loop.ndead++;
+
+    leave(locked);
+}
+
+static void time_set_destroy(pa_time_event *te, pa_time_event_destroy_cb_t cb)
+{
+    te->destroy = cb;
+}
+
+static pa_defer_event *defer_new(pa_mainloop_api *api, pa_defer_event_cb_t cb,
+                                 void *userdata)
+{
+    struct pa_defer_event *de;
+    int                    locked;
+
+    (void)api;
+
+    if ((de = calloc(1, sizeof(*de))) == NULL)
+        return NULL;
+
+    de->enabled  = TRUE;
+    de->cb       = cb;
+    de->userdata = userdata;
+
+    locked = enter();
+
+    de->next    = loop.defers;
+    loop.defers = de;
+    loop.ndefer++;
+
+    leave(locked);
+
+    return de;
+}
+
+static void defer_enable(pa_defer_event *de, int enable)
+{
+    int locked = enter();
+
+    enable = enable ? TRUE : FALSE;
+
+    if (de->enabled != enable && !de->dead) {
+        de->enabled  = enable;
+        loop.ndefer += enable ? 1 : -1;
+    }
+
+    leave(locked);
+}
+
+static void defer_free(pa_defer_event *de)
+{
+    int locked = enter();
+
+    if (de->enabled && !de->dead)
+        loop.ndefer--;
+
+    de->dead    = TRUE;
+    de->enabled = FALSE;
+    loop.ndead++;
+
+    leave(locked);
+}
+
+static void defer_set_destroy(pa_defer_event *de,
+                              pa_defer_event_destroy_cb_t cb)
+{
+    de->destroy = cb;
+}
+
+static void quit(pa_mainloop_api *api, int retval)
+{
+    (void)api;
+    (void)retval;
+
+    mainloop_quit();
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,652 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pulse/pulseaudio.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "ausrv.h"
+#include "stream.h"
+#include "fileout.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define PACE_REALTIME   0       /* consume samples like a sound card */
+#define PACE_FREE       1       /* consume samples as fast as we can */
+
+#define FORMAT_RAW      0
+#define FORMAT_WAV      1
+
+#define DEFAULT_MINREQ  20      /* msec */
+#define WAV_HEADER_LEN  44
+
+struct fileout_config {
+    char          *path;        /* file, fifo or '-' for stdout */
+    int            format;
+    int            pace;
+};
+
+struct fileout {
+    pa_mainloop_api  *api;
+    struct stream    *stream;
+    int               fd;
+    int               format;
+    int               pace;
+    int               closing;
+    uint32_t          rate;
+    uint32_t          ss;       /* bytes per sample in the file */
+    uint32_t          tlength;  /* initial request in bytes */
+    uint32_t          period;   /* request period in usec */
+    struct timeval    due;      /* time of the next request */
+    uint64_t          first;    /* time of the first request in usec */
+    uint64_t          written;  /* bytes consumed so far */
+    pa_time_event    *timer;
+    pa_defer_event   *defer;
+    dev_t             dev;      /* identity of the file we write to */
+    ino_t             ino;
+    int               shared;   /* appending to a file someone else owns */
+    struct fileout   *next;     /* list of live file outputs */
+};
+
+static int  null_config(char *);
+static int  file_config(char *);
+static int  fileout_create(struct stream *, char *, void *,uint32_t,uint32_t);
+static void fileout_write(struct stream *, int16_t *, size_t, void (*)(void*));
+static int  fileout_cork(struct stream *, int);
+static int  fileout_close(struct stream *);
+static int  fileout_timing(struct stream *, uint64_t *);
+static void fileout_release(struct stream *);
+
+static int  parse_options(char *, struct fileout_config *, int);
+static int  check_path(char *);
+static int  expand_path(char *, char *, char *, size_t);
+static int  open_file(struct fileout *, struct fileout_config *, char *);
+static int  shared_output(struct fileout *);
+static void unlink_output(struct fileout *);
+static void write_wav_header(struct fileout *, uint32_t);
+static void write_data(struct fileout *, void *, size_t);
+static void start_timer(struct fileout *);
+static void stop_timer(struct fileout *);
+static void timer_callback(pa_mainloop_api *, pa_time_event *,
+                           const struct timeval *, void *);
+static void defer_callback(pa_mainloop_api *, pa_defer_event *, void *);
+static void destroy_fileout(struct fileout *);
+static uint64_t now_usec(void);
+
+static struct fileout_config null_cfg = { NULL, FORMAT_RAW, PACE_REALTIME };
+static struct fileout_config file_cfg = { NULL, FORMAT_RAW, PACE_REALTIME };
+static struct fileout        *outputs;
+
+struct stream_backend fileout_null_backend = {
+    .name        = "null",
+    .need_server = 0,
+    .config      = null_config,
+    .create      = fileout_create,
+    .write       = fileout_write,
+    .cork        = fileout_cork,
+    .flush       = fileout_close,
+    .drain       = fileout_close,
+    .timing      = fileout_timing,
+    .release     = fileout_release,
+};
+
+struct stream_backend fileout_file_backend = {
+    .name        = "file",
+    .need_server = 0,
+    .config      = file_config,
+    .create      = fileout_create,
+    .write       = fileout_write,
+    .cork        = fileout_cork,
+    .flush       = fileout_close,
+    .drain       = fileout_close,
+    .timing      = fileout_timing,
+    .release     = fileout_release,
+};
+
+
+static int null_config(char *opts)
+{
+    return parse_options(opts, &null_cfg, FALSE);
+}
+
+static int file_config(char *opts)
+{
+    if (parse_options(opts, &file_cfg, TRUE) < 0)
+        return -1;
+
+    if (file_cfg.path == NULL) {
+        LOG_ERROR("%s(): 'file' output needs a path=... option",__FUNCTION__);
+        return -1;
+    }
+
+    if (check_path(file_cfg.path) < 0) {
+        LOG_ERROR("%s(): invalid path '%s'; the only '%%' directive allowed "
+                  "is a single '%%s'", __FUNCTION__, file_cfg.path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int fileout_create(struct stream *stream, char *sink, void *proplist,
+                          uint32_t tlength, uint32_t bufsize)
+{
+    struct fileout_config *cfg;
+    struct fileout        *out;
+
+    (void)sink;
+    (void)proplist;
+
+    cfg = (stream->backend == &fileout_file_backend) ? &file_cfg : &null_cfg;
+
+    if ((out = malloc(sizeof(*out))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+
+    if (bufsize == (uint32_t)-1) {
+        bufsize = (stream->rate * DEFAULT_MINREQ / 1000) * sizeof(int16_t);
+        stream->bufsize = bufsize;
+    }
+
+    if (tlength == (uint32_t)-1)
+        tlength = bufsize * 4;
+
+    out->api     = stream->ausrv->api;
+    out->stream  = stream;
+    out->fd      = -1;
+    out->format  = cfg->format;
+    out->pace    = cfg->pace;
+    out->rate    = stream->rate;
+    out->ss      = stream_sample_size(stream);
+    out->tlength = tlength;
+    out->period  = ((uint64_t)(bufsize / 2) * 1000000ULL) / stream->rate;
+
+    if (cfg->path != NULL && (out->fd = open_file(out,cfg,stream->name)) < 0){
+        free(out);
+        return -1;
+    }
+
+    if (out->format == FORMAT_WAV && !out->shared)
+        write_wav_header(out, 0xffffffff);
+
+    /* the first request is issued from the main loop, like PA would do */
+    out->defer = out->api->defer_new(out->api, defer_callback, out);
+
+    stream->output = out;
+
+    return 0;
+}
+
+static void fileout_write(struct stream *stream, int16_t *samples,
+                          size_t buflen, void (*free_cb)(void *))
+{
+    struct fileout *out = (struct fileout *)stream->output;
+
+    if (out->fd >= 0)
+        write_data(out, samples, buflen);
+
+    out->written += buflen;
+
+    if (free_cb != NULL)
+        free_cb(samples);
+}
+
+static int fileout_cork(struct stream *stream, int cork)
+{
+    struct fileout *out = (struct fileout *)stream->output;
+
+    if (out->closing)
+        return -1;
+
+    if (out->pace == PACE_FREE)
+        out->api->defer_enable(out->defer, !cork);
+    else if (cork)
+        stop_timer(out);
+    else if (out->first) {
+        gettimeofday(&out->due, NULL);
+        start_timer(out);
+    }
+
+    return 0;
+}
+
+static int fileout_close(struct stream *stream)
+{
+    struct fileout *out = (struct fileout *)stream->output;
+
+    /*
+     * whatever was written is already in the file; we just have to stop
+     * consuming and finish the file from the main loop
+     */
+    stop_timer(out);
+
+    out->closing = TRUE;
+    out->api->defer_enable(out->defer, TRUE);
+
+    return 0;
+}
+
+static int fileout_timing(struct stream *stream, uint64_t *latency)
+{
+    struct fileout *out = (struct fileout *)stream->output;
+    uint64_t        played;
+    uint64_t        queued;
+
+    if (out->pace == PACE_FREE || !out->first)
+        *latency = 0;
+    else {
+        played = now_usec() - out->first;
+        queued = ((out->written / out->ss) * 1000000ULL) / out->rate;
+
+        *latency = queued > played ? queued - played : 0;
+    }
+
+    return 0;
+}
+
+static void fileout_release(struct stream *stream)
+{
+    destroy_fileout((struct fileout *)stream->output);
+    stream->output = NULL;
+}
+
+
+static int parse_options(char *opts, struct fileout_config *cfg, int file)
+{
+    char *key, *val, *next;
+    char  buf[256];
+
+    if (opts == NULL)
+        return 0;
+
+    if (strlen(opts) >= sizeof(buf)) {
+        LOG_ERROR("%s(): output options are too long", __FUNCTION__);
+        return -1;
+    }
+    strcpy(buf, opts);
+
+    for (key = buf;  key != NULL;  key = next) {
+        if ((next = strchr(key, ',')) != NULL)
+            *next++ = '\0';
+
+        if ((val = strchr(key, '=')) == NULL)
+            goto invalid;
+
+        *val++ = '\0';
+
+        if (!strcmp(key, "pace")) {
+            if (!strcmp(val, "realtime"))
+                cfg->pace = PACE_REALTIME;
+            else if (!strcmp(val, "free"))
+                cfg->pace = PACE_FREE;
+            else
+                goto invalid;
+        }
+        else if (file && !strcmp(key, "format")) {
+            if (!strcmp(val, "raw"))
+                cfg->format = FORMAT_RAW;
+            else if (!strcmp(val, "wav"))
+                cfg->format = FORMAT_WAV;
+            else
+                goto invalid;
+        }
+        else if (file && !strcmp(key, "path")) {
+            free(cfg->path);
+            cfg->path = strdup(val);
+        }
+        else
+            goto invalid;
+    }
+
+    return 0;
+
+ invalid:
+    LOG_ERROR("%s(): invalid output option '%s'", __FUNCTION__, key);
+    return -1;
+}
+
+/*
+ * the path is not a format string; '%s' is the only directive we know of
+ * and it may appear once at most
+ */
+static int check_path(char *path)
+{
+    char *p;
+    int   n;
+
+    for (p = path, n = 0;  (p = strchr(p, '%')) != NULL;  p += 2, n++) {
+        if (p[1] != 's' || n > 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int expand_path(char *pattern, char *name, char *path, size_t len)
+{
+    char   *p;
+    size_t  n;
+    int     l;
+
+    if ((p = strstr(pattern, "%s")) == NULL)
+        l = snprintf(path, len, "%s", pattern);
+    else {
+        n = p - pattern;
+        l = snprintf(path, len, "%.*s%s%s", (int)n, pattern, name, p + 2);
+    }
+
+    return (l < 0 || (size_t)l >= len) ? -1 : 0;
+}
+
+/*
+ * a '%s' in the path is replaced by the stream name, so that each stream
+ * can go to its own file; otherwise all streams share the same file. Files
+ * are written in append mode and one that another stream is still writing
+ * is not truncated under it, so the streams don't overwrite each other.
+ */
+static int open_file(struct fileout *out, struct fileout_config *cfg,
+                     char *name)
+{
+    char            path[PATH_MAX];
+    struct stat     st;
+    struct fileout *o;
+    int             flags;
+    int             fd;
+
+    if (!strcmp(cfg->path, "-"))
+        return dup(STDOUT_FILENO);
+
+    if (expand_path(cfg->path, name, path, sizeof(path)) < 0) {
+        LOG_ERROR("%s(): path for stream '%s' is too long",
+                  __FUNCTION__, name);
+        return -1;
+    }
+
+    flags = O_WRONLY | O_CREAT | O_TRUNC | O_APPEND;
+
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        for (o = outputs;  o != NULL;  o = o->next) {
+            if (o->dev == st.st_dev && o->ino == st.st_ino) {
+                flags = O_WRONLY | O_APPEND;
+                out->shared = TRUE;
+                break;
+            }
+        }
+    }
+
+    if ((fd = open(path, flags, 0644)) < 0) {
+        LOG_ERROR("%s(): can't open '%s': %s", __FUNCTION__, path,
+                  strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) == 0) {
+        /* never let a slow reader on a pipe block the daemon */
+        if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        else if (S_ISREG(st.st_mode)) {
+            out->dev  = st.st_dev;
+            out->ino  = st.st_ino;
+            out->next = outputs;
+            outputs   = out;
+        }
+    }
+
+    TRACE("%s(): %s stream '%s' to '%s'", __FUNCTION__,
+          out->shared ? "appending" : "writing", name, path);
+
+    return fd;
+}
+
+static int shared_output(struct fileout *out)
+{
+    struct fileout *o;
+
+    for (o = outputs;  o != NULL;  o = o->next) {
+        if (o != out && o->dev == out->dev && o->ino == out->ino)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void unlink_output(struct fileout *out)
+{
+    struct fileout **p;
+
+    for (p = &outputs;  *p != NULL;  p = &(*p)->next) {
+        if (*p == out) {
+            *p = out->next;
+            break;
+        }
+    }
+}
+
+static void write_wav_header(struct fileout *out, uint32_t datalen)
+{
+    uint8_t  hdr[WAV_HEADER_LEN];
+    uint32_t riflen = datalen == 0xffffffff ? datalen : datalen + 36;
+    uint32_t brate  = out->rate * out->ss;
+    uint32_t code;
+
+    switch (out->stream->format) {
+    case STREAM_FORMAT_ULAW:  code = 7;  break;
+    case STREAM_FORMAT_ALAW:  code = 6;  break;
+    default:                  code = 1;  break;     /* PCM */
+    }
+
+#define PUT16(o, v) do { hdr[o] = (v) & 0xff; hdr[o+1] = ((v) >> 8) & 0xff; }\
+                    while (0)
+#define PUT32(o, v) do { PUT16(o, (v) & 0xffff); PUT16(o+2, (v) >> 16); } \
+                    while (0)
+
+    memcpy(hdr +  0, "RIFF", 4);
+    PUT32(4, riflen);
+    memcpy(hdr +  8, "WAVEfmt ", 8);
+    PUT32(16, 16);                          /* fmt chunk length */
+    PUT16(20, code);                        /* PCM or G.711 */
+    PUT16(22, 1);                           /* mono */
+    PUT32(24, out->rate);
+    PUT32(28, brate);
+    PUT16(32, out->ss);                     /* block align */
+    PUT16(34, out->ss * 8);                 /* bits per sample */
+    memcpy(hdr + 36, "data", 4);
+    PUT32(40, datalen);
+
+#undef PUT32
+#undef PUT16
+
+    write_data(out, hdr, sizeof(hdr));
+}
+
+static void write_data(struct fileout *out, void *data, size_t len)
+{
+    char    *p = (char *)data;
+    ssize_t  n;
+
+    while (len > 0) {
+        if ((n = write(out->fd, p, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN) {
+                TRACE("%s(): reader is slow; dropping %zu bytes",
+                      __FUNCTION__, len);
+                out->stream->stat.underflows++;
+            }
+            else {
+                LOG_ERROR("%s(): write failed: %s", __FUNCTION__,
+                          strerror(errno));
+            }
+            return;
+        }
+
+        p   += n;
+        len -= n;
+    }
+}
+
+static void start_timer(struct fileout *out)
+{
+    if (out->timer != NULL)
+        out->api->time_restart(out->timer, &out->due);
+    else
+        out->timer = out->api->time_new(out->api, &out->due,
+                                        timer_callback, out);
+}
+
+static void stop_timer(struct fileout *out)
+{
+    if (out->timer != NULL) {
+        out->api->time_free(out->timer);
+        out->timer = NULL;
+    }
+}
+
+static void timer_callback(pa_mainloop_api *api, pa_time_event *event,
+                           const struct timeval *tv, void *userdata)
+{
+    struct fileout *out = (struct fileout *)userdata;
+    uint64_t        due;
+
+    (void)api;
+    (void)tv;
+
+    if (event != out->timer) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    /* schedule relative to the previous deadline, so we don't drift */
+    due = (uint64_t)out->due.tv_sec * 1000000ULL + out->due.tv_usec;
+    due += out->period;
+
+    out->due.tv_sec  = due / 1000000ULL;
+    out->due.tv_usec = due % 1000000ULL;
+
+    start_timer(out);
+
+    stream_request(out->stream, out->stream->bufsize);
+}
+
+static void defer_callback(pa_mainloop_api *api, pa_defer_event *event,
+                           void *userdata)
+{
+    struct fileout *out = (struct fileout *)userdata;
+    struct stream  *stream = out->stream;
+    struct stat     st;
+    off_t           datalen;
+
+    (void)event;
+
+    if (out->closing) {
+        TRACE("%s(): stream '%s' closed", __FUNCTION__, stream->name);
+
+        /* the last one to close a shared file gets to fix up the header */
+        if (out->format == FORMAT_WAV && out->fd >= 0 && !shared_output(out)
+            && fstat(out->fd, &st) == 0 && st.st_size >= WAV_HEADER_LEN)
+        {
+            datalen = st.st_size - WAV_HEADER_LEN;
+
+            fcntl(out->fd, F_SETFL, fcntl(out->fd, F_GETFL) & ~O_APPEND);
+
+            if (lseek(out->fd, 0, SEEK_SET) == 0)
+                write_wav_header(out, (uint32_t)datalen);
+        }
+
+        destroy_fileout(out);
+        stream_free(stream);
+
+        return;
+    }
+
+    if (!out->first) {
+        out->first = now_usec();
+
+        if (out->pace == PACE_REALTIME) {
+            /* the next request is due when a period worth has been played */
+            api->defer_enable(out->defer, FALSE);
+
+            out->due.tv_sec  = (out->first + out->period) / 1000000ULL;
+            out->due.tv_usec = (out->first + out->period) % 1000000ULL;
+
+            start_timer(out);
+        }
+
+        stream_request(stream, out->tlength);
+    }
+    else {
+        /* unthrottled; we keep being called on each main loop iteration */
+        stream_request(stream, stream->bufsize);
+    }
+}
+
+static void destroy_fileout(struct fileout *out)
+{
+    if (out != NULL) {
+        stop_timer(out);
+
+        if (out->defer != NULL)
+            out->api->defer_free(out->defer);
+
+        if (out->fd >= 0)
+            close(out->fd);
+
+        unlink_output(out);
+        free(out);
+    }
+}
+
+static uint64_t now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
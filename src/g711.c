@@ -0,0 +1,153 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "g711.h"
+
+/*
+ * G.711 encoding by table lookup. The tables are built at startup by
+ * the classic segment search encoders (as in the Sun reference code),
+ * so the result is bit exact with them for every 16 bit input. Neither
+ * law uses the lowest two bits, so 16k entries per law cover it all.
+ */
+
+#define LUT_SHIFT   2
+#define LUT_SIZE    (1 << (16 - LUT_SHIFT))
+
+#define SEG_SHIFT   4
+#define QUANT_MASK  0x0f
+#define ULAW_BIAS   0x84
+#define ULAW_CLIP   8159
+
+static uint8_t linear2ulaw(int16_t);
+static uint8_t linear2alaw(int16_t);
+static int     search(int, const int16_t *, int);
+
+static const int16_t seg_aend[8] = {
+    0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff
+};
+static const int16_t seg_uend[8] = {
+    0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff
+};
+
+static uint8_t ulaw_lut[LUT_SIZE];
+static uint8_t alaw_lut[LUT_SIZE];
+
+
+void g711_init(void)
+{
+    int     i;
+    int16_t pcm;
+
+    for (i = 0;  i < LUT_SIZE;  i++) {
+        pcm = (int16_t)(uint16_t)(i << LUT_SHIFT);
+
+        ulaw_lut[i] = linear2ulaw(pcm);
+        alaw_lut[i] = linear2alaw(pcm);
+    }
+}
+
+/*
+ * dst may be the same buffer as src; each output byte lands on or
+ * before the input sample it was made of
+ */
+void g711_encode(int law, uint8_t *dst, int16_t *src, size_t nsamp)
+{
+    const uint8_t *lut = (law == G711_ALAW) ? alaw_lut : ulaw_lut;
+    size_t         i;
+
+    for (i = 0;  i < nsamp;  i++)
+        dst[i] = lut[(uint16_t)src[i] >> LUT_SHIFT];
+}
+
+
+static uint8_t linear2ulaw(int16_t pcm)
+{
+    int val = pcm >> 2;
+    int mask;
+    int seg;
+
+    if (val < 0) {
+        val  = -val;
+        mask = 0x7f;
+    }
+    else
+        mask = 0xff;
+
+    if (val > ULAW_CLIP)
+        val = ULAW_CLIP;
+
+    val += ULAW_BIAS >> 2;
+
+    if ((seg = search(val, seg_uend, 8)) >= 8)
+        return 0x7f ^ mask;
+
+    return ((seg << SEG_SHIFT) | ((val >> (seg + 1)) & QUANT_MASK)) ^ mask;
+}
+
+static uint8_t linear2alaw(int16_t pcm)
+{
+    int val = pcm >> 3;
+    int mask;
+    int seg;
+    int aval;
+
+    if (val >= 0)
+        mask = 0xd5;
+    else {
+        mask = 0x55;
+        val  = -val - 1;
+    }
+
+    if ((seg = search(val, seg_aend, 8)) >= 8)
+        return 0x7f ^ mask;
+
+    aval = seg << SEG_SHIFT;
+
+    if (seg < 2)
+        aval |= (val >> 1) & QUANT_MASK;
+    else
+        aval |= (val >> seg) & QUANT_MASK;
+
+    return aval ^ mask;
+}
+
+static int search(int val, const int16_t *table, int size)
+{
+    int i;
+
+    for (i = 0;  i < size;  i++) {
+        if (val <= table[i])
+            return i;
+    }
+
+    return size;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,44 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_G711_H__
+#define __TONEGEND_G711_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define G711_ULAW          0
+#define G711_ALAW          1
+
+#define G711_ULAW_SILENCE  0xff     /* encoded zero */
+#define G711_ALAW_SILENCE  0xd5
+
+void g711_init(void);
+void g711_encode(int, uint8_t *, int16_t *, size_t);
+
+#endif /* __TONEGEND_G711_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
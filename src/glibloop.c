@@ -0,0 +1,129 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <pulse/glib-mainloop.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "mainloop.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+static gint counting_poll(GPollFD *, guint, gint);
+
+const char *mainloop_backend = "GLib";
+
+static GMainLoop        *main_loop;
+static pa_glib_mainloop *pa_loop;
+static GPollFunc         poll_func;
+
+
+int mainloop_create(void)
+{
+    if ((main_loop = g_main_loop_new(NULL, FALSE)) == NULL) {
+        LOG_ERROR("%s(): g_main_loop_new() failed", __FUNCTION__);
+        return -1;
+    }
+
+    if ((pa_loop = pa_glib_mainloop_new(NULL)) == NULL) {
+        LOG_ERROR("%s(): pa_glib_mainloop_new() failed", __FUNCTION__);
+        mainloop_destroy();
+        return -1;
+    }
+
+    /* only to count the wakeups */
+    poll_func = g_main_context_get_poll_func(NULL);
+    g_main_context_set_poll_func(NULL, counting_poll);
+
+    mainloop_stats_reset();
+
+    return 0;
+}
+
+void mainloop_destroy(void)
+{
+    if (pa_loop != NULL) {
+        pa_glib_mainloop_free(pa_loop);
+        pa_loop = NULL;
+    }
+
+    if (main_loop != NULL) {
+        g_main_loop_unref(main_loop);
+        main_loop = NULL;
+    }
+}
+
+pa_mainloop_api *mainloop_get_api(void)
+{
+    return pa_glib_mainloop_get_api(pa_loop);
+}
+
+void mainloop_run(void)
+{
+    g_main_loop_run(main_loop);
+}
+
+int mainloop_quit(void)
+{
+    if (main_loop == NULL)
+        return -1;
+
+    g_main_loop_quit(main_loop);
+
+    return 0;
+}
+
+int mainloop_setup_dbus(DBusConnection *conn)
+{
+    dbus_connection_setup_with_g_main(conn, NULL);
+
+    return 0;
+}
+
+
+static gint counting_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+    gint n = poll_func(fds, nfds, timeout);
+
+    if (n > 0 || timeout != 0)
+        mainloop_woke_up();
+
+    return n;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
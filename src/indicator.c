@@ -32,6 +32,11 @@ USA.
 #include "stream.h"
 #include "tone.h"
 #include "indicator.h"
+#include "scache.h"
+#include "cadence.h"
+#include "plan.h"
+#include "pcmcache.h"
+#include "tonesig.h"
 
 #define MAX_TONE_LENGTH (1 * 60 * 1000000)
 
@@ -47,9 +52,17 @@ USA.
 
 static char     *ind_stream = STREAM_INDICATOR;
 static int       standard   = STD_CEPT;
+static const struct plan_country *country = NULL;  /* overrides standard */
 static void     *ind_props  = NULL;
 static uint32_t  vol_scale  = 100;
 
+static void play(struct ausrv *, int, struct cadence *, uint32_t, int);
+static uint32_t create_tones(struct stream *, int, uint32_t, int);
+static uint32_t country_tones(struct stream *, int, uint32_t, int);
+static uint32_t fixed_length(int);
+static void play_command(struct ausrv *, uintptr_t *);
+static void stop_command(struct ausrv *, uintptr_t *);
+
 int indicator_init(int argc, char **argv)
 {
     (void)argc;
@@ -61,14 +74,143 @@ int indicator_init(int argc, char **argv)
 
 void indicator_play(struct ausrv *ausrv, int type, uint32_t vol, int dur)
 {
-    struct stream *stream  = stream_find(ausrv, ind_stream);
-    uint32_t       timeout = dur ? dur : MAX_TONE_LENGTH;
+    if (ausrv_queue_latest_command(ausrv, play_command, type, vol, dur, 0))
+        return;
+
+    play(ausrv, type, NULL, vol, dur);
+}
+
+/* a tone of cadence.c; it replaces any other indicator tone */
+void indicator_play_custom(struct ausrv *ausrv, uint32_t id, uint32_t vol,
+                           int dur)
+{
+    struct cadence *cad;
+
+    if (ausrv_queue_latest_command(ausrv, play_command, TONE_CUSTOM,
+                                   vol, dur, id))
+        return;
+
+    if ((cad = cadence_find(id)) == NULL) {
+        LOG_ERROR("%s(): no tone %u", __FUNCTION__, id);
+        return;
+    }
+
+    play(ausrv, TONE_CUSTOM, cad, vol, dur);
+}
+
+void indicator_stop(struct ausrv *ausrv, int kill_stream)
+{
+    struct stream *stream;
+    struct tone   *tone;
+    struct tone   *hd;
+
+    if (ausrv_queue_passive_command(ausrv, stop_command, kill_stream, 0,0,0))
+        return;
+
+    stream = stream_find(ausrv, ind_stream);
+
+    TRACE("%s(kill_stream=%s) stream=%s", __FUNCTION__, 
+          kill_stream ? "true":"false", stream ? stream->name:"<no-stream>");
     
+    scache_stop(ausrv);
+
+    if (stream != NULL) {
+        if (kill_stream) 
+            stream_destroy(stream);
+        else {
+            /* destroy all but DTMF tones */
+            for (hd = (struct tone *)&stream->data;  hd;  hd = hd->next) {
+                while ((tone=hd->next) != NULL && !tone_chainable(tone->type))
+                    tone_destroy(tone, KILL_CHAIN);
+            }
+
+            tonesig_stopped(stream, stream->time);
+        }
+    }
+}
+
+void indicator_set_standard(int std)
+{
+    if (std <= STD_UNKNOWN || std >= STD_MAX)
+        LOG_ERROR("%s(): invalid standard %d", __FUNCTION__, std);
+    else {
+        standard = std;
+        country  = NULL;
+        pcmcache_invalidate();
+    }
+}
+
+/* the tones of a country of the tone plan instead of a standard */
+int indicator_set_country(const char *code)
+{
+    const struct plan_country *c;
+
+    if ((c = plan_country(code)) == NULL) {
+        LOG_ERROR("%s(): no tones for country '%s'", __FUNCTION__, code);
+        return -1;
+    }
+
+    country = c;
+    pcmcache_invalidate();
+
+    return 0;
+}
+
+void indicator_set_properties(char *propstring)
+{
+    ind_props = stream_parse_properties(propstring);
+}
+
+void indicator_set_volume(uint32_t volume)
+{
+    vol_scale = volume;
+}
+
+
+static void play(struct ausrv *ausrv, int type, struct cadence *cad,
+                 uint32_t vol, int dur)
+{
+    struct stream *stream;
+    struct stream *detached;
+    uint32_t       length;
+    uint32_t       timeout;
+    uint32_t       start;
+    uint32_t       end;
+    char           name[64];
+
+    stream = stream_find(ausrv, ind_stream);
+
+    vol = (vol_scale * vol) / 100;
+
+    scache_stop(ausrv);
+
     if (stream != NULL) {
         dtmf_stop(ausrv);
         indicator_stop(ausrv, PRESERVE_STREAM);
     }
+
+    if (cad != NULL) {
+        /* a new definition gets a new name */
+        length = dur && (uint32_t)dur < cad->length ? 0 : cad->length;
+        snprintf(name, sizeof(name), "tonegend-cad-%u-%u", cad->serial, vol);
+    }
+    else if (country != NULL) {
+        length = fixed_length(type);
+        length = dur && (uint32_t)dur < length ? 0 : length;
+        snprintf(name, sizeof(name), "tonegend-ind-%d-%s-%u",
+                 type, country->code, vol);
+    }
     else {
+        length = fixed_length(type);
+        snprintf(name, sizeof(name), "tonegend-ind-%d-%d-%u",
+                 type, standard, vol);
+    }
+
+    /* the timing of a tone on a stream is known to the sample */
+    if (length > 0 && !tonesig_wanted() && scache_play(ausrv, name, ind_props))
+        return;
+
+    if (stream == NULL) {
         stream = stream_create(ausrv, ind_stream, NULL, 0,
                                tone_write_callback,
                                tone_destroy_callback,
@@ -79,10 +221,63 @@ void indicator_play(struct ausrv *ausrv, int type, uint32_t vol, int dur)
             LOG_ERROR("%s(): Can't create stream", __FUNCTION__);
             return;
         }
+
+        stream_set_checkpoint(stream, tone_save, tone_restore, tone_discard);
     }
 
-    vol = (vol_scale * vol) / 100;
-    
+    start = stream->time;
+
+    if (cad == NULL)
+        stream_set_timeout(stream, create_tones(stream, type, vol, dur));
+    else {
+        timeout = cadence_create_tones(stream, cad, vol, dur);
+        stream_set_timeout(stream, timeout ? timeout + MAX_SHORT_TONE_LENGTH
+                                           : MAX_TONE_LENGTH);
+    }
+
+    end = dur && (!length || (uint32_t)dur < length) ? (uint32_t)dur : length;
+    tonesig_laid_out(stream, start, end ? start + end : 0);
+
+    /* next time the server can play it from its sample cache */
+    if (length > 0) {
+        detached = stream_create_detached(ausrv, name, 0,
+                                          tone_write_callback,
+                                          tone_destroy_callback, NULL);
+        if (detached != NULL) {
+            if (cad == NULL)
+                create_tones(detached, type, vol, dur);
+            else
+                cadence_create_tones(detached, cad, vol, dur);
+            scache_upload(ausrv, name, detached, length);
+        }
+    }
+}
+
+/*
+ * sets up the tones of the indicator on the stream;
+ * returns the timeout of the stream
+ */
+static uint32_t create_tones(struct stream *stream, int type, uint32_t vol,
+                             int dur)
+{
+    /* endless tones play from the PCM cache, if they are there */
+    if (pcmcache_create_tone(stream, type, vol, dur) != NULL)
+        return dur ? (uint32_t)dur : MAX_TONE_LENGTH;
+
+    return indicator_create_tones(stream, type, vol, dur);
+}
+
+/*
+ * the same, synthesized; the PCM cache is rendered with this
+ */
+uint32_t indicator_create_tones(struct stream *stream, int type, uint32_t vol,
+                                int dur)
+{
+    uint32_t timeout = dur ? dur : MAX_TONE_LENGTH;
+
+    if (country != NULL)
+        return country_tones(stream, type, vol, dur);
+
     switch (type) {
         
     case TONE_DIAL:
@@ -228,49 +423,81 @@ void indicator_play(struct ausrv *ausrv, int type, uint32_t vol, int dur)
         break;
     }
 
-    stream_set_timeout(stream, timeout);
+    return timeout;
 }
 
-void indicator_stop(struct ausrv *ausrv, int kill_stream)
+/*
+ * the same from the tone plan, cut at 'dur' usec if that is given
+ */
+static uint32_t country_tones(struct stream *stream, int type, uint32_t vol,
+                              int dur)
 {
-    struct stream *stream = stream_find(ausrv, ind_stream);
-    struct tone   *tone;
-    struct tone   *hd;
+    const struct plan_tone *t;
+    uint32_t                length;
+    uint32_t                len;
+    int                     count;
+    int                     i;
 
-    TRACE("%s(kill_stream=%s) stream=%s", __FUNCTION__, 
-          kill_stream ? "true":"false", stream ? stream->name:"<no-stream>");
-    
-    if (stream != NULL) {
-        if (kill_stream) 
-            stream_destroy(stream);
-        else {
-            /* destroy all but DTMF tones */
-            for (hd = (struct tone *)&stream->data;  hd;  hd = hd->next) {
-                while ((tone=hd->next) != NULL && !tone_chainable(tone->type))
-                    tone_destroy(tone, KILL_CHAIN);
-            }
+    if ((t = plan_tones(country, type, &count, &length)) == NULL) {
+        TRACE("%s(): no tone %d for country '%s'", __FUNCTION__,
+              type, country->code);
+        return MAX_SHORT_TONE_LENGTH;
+    }
+
+    for (i = 0;  i < count;  i++, t++) {
+        len = t->duration;
+
+        if (dur > 0) {
+            if (t->start >= (uint32_t)dur)
+                continue;
+            if (!len || t->start + len > (uint32_t)dur)
+                len = dur - t->start;
         }
+
+        tone_create(stream, type, t->freq, (vol * t->level) / 100,
+                    t->period, t->play, t->start, len);
     }
+
+    if (length > 0 && (dur <= 0 || length <= (uint32_t)dur))
+        return length + MAX_SHORT_TONE_LENGTH;
+
+    return dur > 0 ? (uint32_t)dur : MAX_TONE_LENGTH;
 }
 
-void indicator_set_standard(int std)
+static void play_command(struct ausrv *ausrv, uintptr_t *arg)
 {
-    if (std <= STD_UNKNOWN || std >= STD_MAX)
-        LOG_ERROR("%s(): invalid standard %d", __FUNCTION__, std);
+    if (arg[0] == TONE_CUSTOM)
+        indicator_play_custom(ausrv, arg[3], arg[1], arg[2]);
     else
-        standard = std;
+        indicator_play(ausrv, arg[0], arg[1], arg[2]);
 }
 
-void indicator_set_properties(char *propstring)
+static void stop_command(struct ausrv *ausrv, uintptr_t *arg)
 {
-    ind_props = stream_parse_properties(propstring);
+    indicator_stop(ausrv, arg[0]);
 }
 
-void indicator_set_volume(uint32_t volume)
+/*
+ * the length of the tones that are always the same, i.e. what is
+ * worth to put to the sample cache; zero for anything else
+ */
+static uint32_t fixed_length(int type)
 {
-    vol_scale = volume;
-}
+    uint32_t length;
+    int      count;
+
+    if (country != NULL)
+        return plan_tones(country, type, &count, &length) ? length : 0;
 
+    if (standard == STD_JAPAN)
+        return 0;
+
+    switch (type) {
+    case TONE_RADIO_ACK:    return 200000;
+    case TONE_RADIO_NA:     return 1200000;
+    default:                return 0;
+    }
+}
 
 /*
  * Local Variables:
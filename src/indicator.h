@@ -38,14 +38,18 @@ USA.
 #define STD_ATNT           4
 #define STD_MAX            5
 
+struct stream;
 
 
 int  indicator_init(int, char **);
 void indicator_play(struct ausrv *, int, uint32_t, int);
+void indicator_play_custom(struct ausrv *, uint32_t, uint32_t, int);
 void indicator_stop(struct ausrv *, int);
 void indicator_set_standard(int);
+int  indicator_set_country(const char *);
 void indicator_set_properties(char *);
 void indicator_set_volume(uint32_t);
+uint32_t indicator_create_tones(struct stream *, int, uint32_t, int);
 
 #endif /* __TONEGEND_INDICATOR_H__ */
 
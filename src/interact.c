@@ -36,6 +36,9 @@ USA.
 #include "indicator.h"
 #include "dtmf.h"
 #include "interact.h"
+#include "mainloop.h"
+#include "shed.h"
+#include "limit.h"
 
 
 #define DISCONNECTED    0
@@ -47,7 +50,8 @@ USA.
 
 #define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
 
-static gboolean handle_input(GIOChannel *, GIOCondition, gpointer);
+static void handle_input(pa_mainloop_api *, pa_io_event *, int,
+                         pa_io_event_flags_t, void *);
 
 /********************* Temporary *************************/
 #include "note.h"
@@ -90,15 +94,16 @@ struct interact *interact_create(struct tonegend *tonegend, int fd)
     }
     memset(interact, 0, sizeof(*interact));
     interact->tonegend = tonegend;
+    interact->api      = mainloop_get_api();
 
-    if ((interact->chan = g_io_channel_unix_new(fd)) == NULL) {
-        LOG_ERROR("%s(): Can't make G-I/O channel", __FUNCTION__);
+    interact->evio = interact->api->io_new(interact->api, fd,
+                                           PA_IO_EVENT_INPUT, handle_input,
+                                           interact);
+    if (interact->evio == NULL) {
+        LOG_ERROR("%s(): Can't watch the console", __FUNCTION__);
         goto failed;
     }
 
-    interact->evsrc = g_io_add_watch(interact->chan, G_IO_IN|G_IO_HUP|G_IO_ERR,
-                                     handle_input, interact);
-
     return interact;
 
  failed:
@@ -112,16 +117,15 @@ struct interact *interact_create(struct tonegend *tonegend, int fd)
 void interact_destroy(struct interact *interact)
 {
     if (interact) {
-        g_io_channel_shutdown(interact->chan, TRUE, NULL);
-        g_io_channel_unref(interact->chan);
-
-        g_source_remove(interact->evsrc);
+        if (interact->evio != NULL)
+            interact->api->io_free(interact->evio);
 
         free(interact);
     }
 }
 
-static gboolean handle_input(GIOChannel *ch, GIOCondition cond, gpointer data)
+static void handle_input(pa_mainloop_api *api, pa_io_event *ev, int fd,
+                         pa_io_event_flags_t events, void *data)
 {
 #define PRINT(f, args...)  printf(f "\n", ##args)
 #define TONE(t)            indicator_play(ausrv, t, 95, 0)
@@ -135,15 +139,17 @@ static gboolean handle_input(GIOChannel *ch, GIOCondition cond, gpointer data)
     int               cnt;
     char              cmd;
 
-    (void)ch;
-    (void)cond;
+    (void)events;
         
     for (;;) {
-        if ((cnt = read(0, &cmd, 1)) != 1) {
-            if (errno == EINTR)
+        if ((cnt = read(fd, &cmd, 1)) != 1) {
+            if (cnt < 0 && errno == EINTR)
                 continue;
-            else
-                return FALSE;
+            else {
+                api->io_free(ev);
+                interact->evio = NULL;
+                return;
+            }
         }
         
         switch (cmd) {
@@ -172,10 +178,13 @@ static gboolean handle_input(GIOChannel *ch, GIOCondition cond, gpointer data)
         case 'e':  PRINT("EU standard");           STANDARD(CEPT);       break;
         case 'j':  PRINT("Japan standard");        STANDARD(JAPAN);      break;
         case '!':  PRINT("Play ...");              ringtone(ausrv);      break;
+        case 'L':  shed_print_stats();                                   break;
+        case 'M':  mainloop_print_stats();                               break;
+        case 'Q':  limit_print_stats();                                  break;
         default:                                                         break;
         }
 
-        return TRUE;
+        return;
     }
 
 #undef DTMF
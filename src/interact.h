@@ -27,14 +27,15 @@ USA.
 #endif
 
 #include <stdint.h>
-#include <glib.h>
+
+#include <pulse/pulseaudio.h>
 
 struct tonegend;
 
 struct interact {
     struct tonegend *tonegend;
-    GIOChannel      *chan;
-    guint            evsrc;
+    pa_mainloop_api *api;
+    pa_io_event     *evio;
 };
 
 
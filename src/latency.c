@@ -0,0 +1,632 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <dbus/dbus.h>
+
+#include "tone.h"
+#include "ctlsock.h"
+
+/*
+ * Client side round trip latency of the tone requests: the time from
+ * sending a request to receiving its reply, as a dialer sees it.
+ * Every round starts an event tone and stops it again after the given
+ * interval, e.g. keypresses at a steady rate; -r replays a keypad at the
+ * given number of keys per second, going through the digits. The CPU
+ * time the daemon used meanwhile is read from /proc.
+ *
+ * -t selects the transport: D-Bus method calls, packets on the control
+ * socket of 'tonegend -K' or its shared command ring. The ring has no
+ * replies; its round trip ends when the daemon has taken the command.
+ */
+
+#define SERVICE    "com.Nokia.Telephony.Tones"
+#define PATH       "/com/Nokia/Telephony/Tones"
+#define INTERFACE  "com.Nokia.Telephony.Tones"
+
+#define CTL_VOLUME 50
+
+struct client {
+    DBusConnection  *conn;
+    int              fd;
+    struct ctl_ring *ring;
+    int              bell;
+    uint16_t         seq;
+};
+
+struct transport {
+    char  *name;
+    int  (*setup)(struct client *);
+    int  (*start)(struct client *, uint32_t, uint32_t *);
+    int  (*stop)(struct client *, uint32_t *);
+};
+
+static void usage(char *, int);
+static int run(struct transport *, struct client *, int, int, int);
+static int dbus_start(struct client *, uint32_t, uint32_t *);
+static int dbus_stop(struct client *, uint32_t *);
+static int call(DBusConnection *, DBusMessage *, uint32_t *);
+static int sock_setup(struct client *);
+static int sock_start(struct client *, uint32_t, uint32_t *);
+static int sock_stop(struct client *, uint32_t *);
+static int transact(struct client *, struct ctl_cmd *, uint32_t *);
+static int ring_setup(struct client *);
+static int ring_start(struct client *, uint32_t, uint32_t *);
+static int ring_stop(struct client *, uint32_t *);
+static int post(struct client *, struct ctl_cmd *, uint32_t *);
+static void make_cmd(struct ctl_cmd *, struct client *, uint32_t);
+static uint64_t now_usec(void);
+static int compare(const void *, const void *);
+static void report(char *, uint32_t *, int);
+static uint32_t daemon_pid(DBusConnection *);
+static uint64_t cpu_usec(uint32_t);
+
+static struct transport transports[] = {
+    { "dbus"  , NULL      , dbus_start, dbus_stop },
+    { "socket", sock_setup, sock_start, sock_stop },
+    { "ring"  , ring_setup, ring_start, ring_stop },
+    { NULL    , NULL      , NULL      , NULL      }
+};
+
+static char *ctlpath;
+
+
+int main(int argc, char **argv)
+{
+    struct client     client;
+    struct transport *tr;
+    DBusError         err;
+    char             *trname   = "dbus";
+    int               rounds   = 100;
+    int               interval = 20;      /* msec */
+    int               rate     = 0;       /* keys per second, -r */
+    int               event    = -1;      /* -1: all the digits in turn */
+    int               found    = 0;
+    int               opt;
+
+    while ((opt = getopt(argc, argv, "n:i:r:e:t:K:h")) != -1) {
+        switch (opt) {
+        case 'n':   rounds   = atoi(optarg);    break;
+        case 'i':   interval = atoi(optarg);    break;
+        case 'r':   rate     = atoi(optarg);    break;
+        case 'e':   event    = atoi(optarg);    break;
+        case 't':   trname   = optarg;          break;
+        case 'K':   ctlpath  = optarg;          break;
+        case 'h':   usage(argv[0], 0);          break;
+        default:    usage(argv[0], EINVAL);     break;
+        }
+    }
+
+    if (rounds < 1 || interval < 0 || rate < 0 || event > 79)
+        usage(argv[0], EINVAL);
+
+    /* a key is held for half of its period */
+    if (rate > 0)
+        interval = 500 / rate;
+
+    memset(&client, 0, sizeof(client));
+    client.fd   = -1;
+    client.bell = -1;
+
+    dbus_error_init(&err);
+
+    /* the daemon is looked up on the bus for its CPU time in any case */
+    if ((client.conn = dbus_bus_get(DBUS_BUS_SESSION, &err)) == NULL) {
+        printf("can't connect to the session bus: %s\n", err.message);
+        dbus_error_free(&err);
+        return EIO;
+    }
+
+    printf("%d rounds, %d msec between the requests\n", rounds, interval);
+
+    for (tr = transports;  tr->name;  tr++) {
+        if (strcmp(trname, "all") && strcmp(trname, tr->name))
+            continue;
+
+        found = 1;
+
+        if (tr->setup != NULL && tr->setup(&client) < 0)
+            return EIO;
+
+        if (run(tr, &client, rounds, interval, event) < 0)
+            return EIO;
+    }
+
+    if (!found)
+        usage(argv[0], EINVAL);
+
+    if (client.ring != NULL)
+        munmap(client.ring, sizeof(struct ctl_ring));
+    if (client.bell >= 0)
+        close(client.bell);
+    if (client.fd >= 0)
+        close(client.fd);
+
+    dbus_connection_unref(client.conn);
+
+    return 0;
+}
+
+
+static void usage(char *argv0, int exit_code)
+{
+    printf("usage: %s [-h] [-n rounds] [-i interval_in_ms] "
+           "[-r keys_per_sec] [-e event] [-t {dbus | socket | ring | all}] "
+           "[-K control_socket]\n", basename(argv0));
+    exit(exit_code);
+}
+
+static int run(struct transport *tr, struct client *client, int rounds,
+               int interval, int event)
+{
+    uint32_t *start_rtt;
+    uint32_t *stop_rtt;
+    uint32_t  ev;
+    uint32_t  pid;
+    uint64_t  cpu;
+    uint64_t  begin;
+    uint64_t  wall;
+    int       i;
+
+    start_rtt = calloc(rounds, sizeof(uint32_t));
+    stop_rtt  = calloc(rounds, sizeof(uint32_t));
+
+    if (start_rtt == NULL || stop_rtt == NULL)
+        return -1;
+
+    pid   = daemon_pid(client->conn);
+    cpu   = cpu_usec(pid);
+    begin = now_usec();
+
+    for (i = 0;  i < rounds;  i++) {
+        ev = event < 0 ? (uint32_t)(i % 12) : (uint32_t)event;
+
+        if (tr->start(client, ev, start_rtt + i) < 0)
+            return -1;
+
+        usleep(interval * 1000);
+
+        if (tr->stop(client, stop_rtt + i) < 0)
+            return -1;
+
+        usleep(interval * 1000);
+    }
+
+    wall = now_usec() - begin;
+    cpu  = cpu_usec(pid) - cpu;
+
+    printf("\n%-6s  request       min     avg     p50     p99     max (usec)"
+           "\n", tr->name);
+
+    report("start", start_rtt, rounds);
+    report("stop",  stop_rtt,  rounds);
+
+    if (pid > 0) {
+        printf("daemon cpu: %.1f msec in %.1f sec (%.2f%%), "
+               "%.1f usec per key\n", (double)cpu / 1000.0,
+               (double)wall / 1e6, (double)cpu * 100.0 / (double)wall,
+               (double)cpu / rounds);
+    }
+
+    free(start_rtt);
+    free(stop_rtt);
+
+    return 0;
+}
+
+static int dbus_start(struct client *client, uint32_t ev, uint32_t *rtt)
+{
+    DBusMessage *msg;
+    int32_t      dbm0     = -10;
+    uint32_t     duration = 0;
+    int          sts;
+
+    msg = dbus_message_new_method_call(SERVICE, PATH, INTERFACE,
+                                       "StartEventTone");
+
+    if (msg == NULL || !dbus_message_append_args(msg,
+                                                 DBUS_TYPE_UINT32, &ev,
+                                                 DBUS_TYPE_INT32 , &dbm0,
+                                                 DBUS_TYPE_UINT32, &duration,
+                                                 DBUS_TYPE_INVALID))
+        return -1;
+
+    sts = call(client->conn, msg, rtt);
+
+    dbus_message_unref(msg);
+
+    return sts;
+}
+
+static int dbus_stop(struct client *client, uint32_t *rtt)
+{
+    DBusMessage *msg;
+    int          sts;
+
+    msg = dbus_message_new_method_call(SERVICE, PATH, INTERFACE, "StopTone");
+
+    if (msg == NULL)
+        return -1;
+
+    sts = call(client->conn, msg, rtt);
+
+    dbus_message_unref(msg);
+
+    return sts;
+}
+
+static int call(DBusConnection *conn, DBusMessage *msg, uint32_t *rtt)
+{
+    DBusMessage *reply;
+    DBusError    err;
+    uint64_t     start;
+
+    dbus_error_init(&err);
+
+    start = now_usec();
+    reply = dbus_connection_send_with_reply_and_block(conn, msg, 5000, &err);
+    *rtt  = (uint32_t)(now_usec() - start);
+
+    if (reply == NULL) {
+        printf("%s failed: %s\n", dbus_message_get_member(msg), err.message);
+        dbus_error_free(&err);
+        return -1;
+    }
+
+    dbus_message_unref(reply);
+
+    return 0;
+}
+
+static int sock_setup(struct client *client)
+{
+    struct sockaddr_un addr;
+
+    if (client->fd >= 0)
+        return 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (ctlpath != NULL)
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", ctlpath);
+    else if (getenv("XDG_RUNTIME_DIR") != NULL)
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+                 getenv("XDG_RUNTIME_DIR"), CTLSOCK_NAME);
+    else
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/tonegend-%u.ctl",
+                 (unsigned)getuid());
+
+    client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (client->fd < 0 ||
+        connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        printf("can't connect to '%s': %s\n", addr.sun_path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int sock_start(struct client *client, uint32_t ev, uint32_t *rtt)
+{
+    struct ctl_cmd cmd;
+
+    make_cmd(&cmd, client, ev);
+
+    return transact(client, &cmd, rtt);
+}
+
+static int sock_stop(struct client *client, uint32_t *rtt)
+{
+    struct ctl_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op     = CTL_STOP;
+    cmd.seq    = ++client->seq;
+    cmd.arg[0] = CTL_STOP_DTMF | CTL_STOP_INDICATOR;
+
+    return transact(client, &cmd, rtt);
+}
+
+static int transact(struct client *client, struct ctl_cmd *cmd, uint32_t *rtt)
+{
+    struct ctl_reply reply;
+    uint64_t         start;
+
+    start = now_usec();
+
+    if (send(client->fd, cmd, sizeof(*cmd), MSG_NOSIGNAL) < 0 ||
+        recv(client->fd, &reply, sizeof(reply), 0) != sizeof(reply))
+    {
+        printf("control socket failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    *rtt = (uint32_t)(now_usec() - start);
+
+    if (reply.status < 0 || reply.seq != cmd->seq) {
+        printf("command %u failed: %s\n", cmd->seq, strerror(-reply.status));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ring_setup(struct client *client)
+{
+    struct ctl_cmd   cmd;
+    struct ctl_reply reply;
+    struct iovec     iov;
+    struct msghdr    msg;
+    struct cmsghdr  *cmsg;
+    char             ctrl[CMSG_SPACE(2 * sizeof(int))];
+    int              fds[2];
+
+    if (sock_setup(client) < 0)
+        return -1;
+
+    fds[0] = memfd_create("tonegend-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    fds[1] = eventfd(0, EFD_CLOEXEC);
+
+    if (fds[0] < 0 || fds[1] < 0 ||
+        ftruncate(fds[0], sizeof(struct ctl_ring)) < 0 ||
+        fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+    {
+        printf("can't create the command ring: %s\n", strerror(errno));
+        return -1;
+    }
+
+    client->ring = mmap(NULL, sizeof(struct ctl_ring), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fds[0], 0);
+
+    if (client->ring == MAP_FAILED) {
+        client->ring = NULL;
+        printf("can't map the command ring: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op  = CTL_RING;
+    cmd.seq = ++client->seq;
+
+    iov.iov_base = &cmd;
+    iov.iov_len  = sizeof(cmd);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(client->fd, &msg, MSG_NOSIGNAL) < 0 ||
+        recv(client->fd, &reply, sizeof(reply), 0) != sizeof(reply) ||
+        reply.status < 0)
+    {
+        printf("the daemon refused the command ring\n");
+        return -1;
+    }
+
+    close(fds[0]);
+    client->bell = fds[1];
+
+    return 0;
+}
+
+static int ring_start(struct client *client, uint32_t ev, uint32_t *rtt)
+{
+    struct ctl_cmd cmd;
+
+    make_cmd(&cmd, client, ev);
+
+    return post(client, &cmd, rtt);
+}
+
+static int ring_stop(struct client *client, uint32_t *rtt)
+{
+    struct ctl_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op     = CTL_STOP;
+    cmd.seq    = ++client->seq;
+    cmd.arg[0] = CTL_STOP_DTMF | CTL_STOP_INDICATOR;
+
+    return post(client, &cmd, rtt);
+}
+
+static int post(struct client *client, struct ctl_cmd *cmd, uint32_t *rtt)
+{
+    struct ctl_ring *ring = client->ring;
+    uint64_t         one  = 1;
+    uint64_t         start;
+    uint32_t         head;
+
+    start = now_usec();
+    head  = ring->head;
+
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+           CTL_RING_LEN)
+        sched_yield();
+
+    ring->cmd[head & (CTL_RING_LEN - 1)] = *cmd;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    if (write(client->bell, &one, sizeof(one)) != sizeof(one))
+        return -1;
+
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != head + 1) {
+        if (now_usec() - start > 5000000) {
+            printf("command %u was not taken\n", cmd->seq);
+            return -1;
+        }
+        sched_yield();
+    }
+
+    *rtt = (uint32_t)(now_usec() - start);
+
+    return 0;
+}
+
+/* StartEventTone events as control commands */
+static void make_cmd(struct ctl_cmd *cmd, struct client *client, uint32_t ev)
+{
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->seq    = ++client->seq;
+    cmd->arg[1] = CTL_VOLUME;
+
+    if (ev < 16) {
+        cmd->op     = CTL_DTMF;
+        cmd->arg[0] = ev;
+    }
+    else {
+        cmd->op = CTL_INDICATOR;
+
+        switch (ev) {
+        case 72:    cmd->arg[0] = TONE_BUSY;        break;
+        case 73:    cmd->arg[0] = TONE_CONGEST;     break;
+        case 74:    cmd->arg[0] = TONE_ERROR;       break;
+        case 79:    cmd->arg[0] = TONE_WAIT;        break;
+        case 70:    cmd->arg[0] = TONE_RING;        break;
+        default:    cmd->arg[0] = TONE_DIAL;        break;
+        }
+    }
+}
+
+static uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static uint32_t daemon_pid(DBusConnection *conn)
+{
+    DBusMessage *msg;
+    DBusMessage *reply;
+    const char  *name = SERVICE;
+    uint32_t     pid  = 0;
+
+    msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+                                       DBUS_INTERFACE_DBUS,
+                                       "GetConnectionUnixProcessID");
+    if (msg == NULL)
+        return 0;
+
+    dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+
+    reply = dbus_connection_send_with_reply_and_block(conn, msg, 5000, NULL);
+
+    if (reply != NULL) {
+        if (!dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, &pid,
+                                   DBUS_TYPE_INVALID))
+            pid = 0;
+        dbus_message_unref(reply);
+    }
+
+    dbus_message_unref(msg);
+
+    return pid;
+}
+
+/* user and system time of the process */
+static uint64_t cpu_usec(uint32_t pid)
+{
+    char                path[64];
+    char                buf[1024];
+    char               *p;
+    FILE               *f;
+    unsigned long long  utime = 0;
+    unsigned long long  stime = 0;
+    long                hz    = sysconf(_SC_CLK_TCK);
+
+    if (pid == 0)
+        return 0;
+
+    snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+
+    /* the command may contain spaces; the fields start after the ')' */
+    if (fgets(buf, sizeof(buf), f) != NULL && (p = strrchr(buf, ')'))) {
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+               &utime, &stime);
+    }
+
+    fclose(f);
+
+    return (utime + stime) * 1000000ULL / (hz > 0 ? hz : 100);
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(char *name, uint32_t *rtt, int n)
+{
+    uint64_t sum = 0;
+    int      i;
+
+    qsort(rtt, n, sizeof(*rtt), compare);
+
+    for (i = 0;  i < n;  i++)
+        sum += rtt[i];
+
+    printf("%-14s %7u %7u %7u %7u %7u\n", name, rtt[0],
+           (uint32_t)(sum / n), rtt[n / 2], rtt[(n * 99) / 100], rtt[n - 1]);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,515 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "limit.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+/*
+ * Per client request limits. Every sender has a token bucket of 'burst'
+ * requests that is refilled at 'rate' requests per second. A request
+ * without a token, or one that would overtake the earlier requests of
+ * its sender, waits in the sender's queue; the queues are served round
+ * robin as the tokens come, so a flooding client only delays itself.
+ * When its queue is full the request is refused.
+ *
+ * Exempt requests, the stops, take no token; they only wait for the
+ * requests their sender queued before them. A client
+ * that owns a well known name with limits of its own, see
+ * limit_set_client(), gets those instead of the defaults.
+ */
+
+#define TOKEN        1000000ULL /* one request, in refill units */
+#define SWEEP_LIMIT  64         /* clients kept before forgetting idle ones */
+
+struct client {
+    char      *sender;
+    uint32_t   burst;
+    uint32_t   rate;            /* 0: not limited */
+    uint32_t   depth;
+    uint64_t   tokens;          /* in TOKEN units */
+    uint64_t   stamp;           /* usec of the last refill */
+    GQueue     queue;           /* requests waiting for a token */
+    GQueue     exempt;          /* the ones of the queue that need none */
+    int        active;          /* in the round robin */
+    uint32_t   passed;
+    uint32_t   queued;
+    uint32_t   rejected;
+};
+
+struct rule {
+    struct rule *next;
+    char        *name;          /* well known name of the client */
+    char        *owner;         /* its unique name, or NULL */
+    uint32_t     burst;
+    uint32_t     rate;
+    uint32_t     depth;
+};
+
+static struct client *get_client(const char *, uint64_t);
+static void apply_rule(struct client *);
+static void refill(struct client *, uint64_t);
+static void free_client(gpointer);
+static gboolean idle_client(gpointer, gpointer, gpointer);
+static void print_client(gpointer, gpointer, gpointer);
+static uint64_t monotonic_usec(void);
+
+static uint32_t            burst = LIMIT_BURST;
+static uint32_t            rate  = LIMIT_RATE;    /* 0 disables limiting */
+static uint32_t            depth = LIMIT_DEPTH;
+static GHashTable         *clients;
+static GQueue              active = G_QUEUE_INIT; /* clients with a queue */
+static struct rule        *rules;
+static struct limit_stats  stats;
+
+
+void limit_set(uint32_t max_burst, uint32_t per_sec, uint32_t max_queue)
+{
+    burst = max_burst > 0 ? max_burst : 1;
+    rate  = per_sec;
+    depth = max_queue;
+}
+
+/*
+ * Limits for the client owning a well known name; a rate of 0 leaves
+ * it unlimited. The owner is told by limit_set_owner().
+ */
+int limit_set_client(const char *name, uint32_t max_burst, uint32_t per_sec,
+                     uint32_t max_queue)
+{
+    struct rule *r;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL ||
+        (r->name = strdup(name)) == NULL) {
+        free(r);
+        return -1;
+    }
+
+    r->burst = max_burst > 0 ? max_burst : 1;
+    r->rate  = per_sec;
+    r->depth = max_queue;
+    r->next  = rules;
+    rules    = r;
+
+    return 0;
+}
+
+/* the well known names with limits of their own, by index */
+const char *limit_client_name(int idx)
+{
+    struct rule *r;
+
+    for (r = rules;  r != NULL && idx > 0;  r = r->next)
+        idx--;
+
+    return r ? r->name : NULL;
+}
+
+/* the unique name that owns a well known one now, NULL if none */
+void limit_set_owner(const char *name, const char *owner)
+{
+    struct rule   *r;
+    struct client *c;
+    char          *old;
+
+    for (r = rules;  r != NULL;  r = r->next) {
+        if (!strcmp(r->name, name))
+            break;
+    }
+
+    if (r == NULL)
+        return;
+
+    old      = r->owner;
+    r->owner = (owner && owner[0]) ? strdup(owner) : NULL;
+
+    TRACE("%s(): '%s' is owned by '%s'", __FUNCTION__, name,
+          r->owner ? r->owner : "nobody");
+
+    if (clients != NULL) {
+        if (old && (c = g_hash_table_lookup(clients, old)) != NULL)
+            apply_rule(c);
+        if (r->owner && (c = g_hash_table_lookup(clients, r->owner)))
+            apply_rule(c);
+    }
+
+    free(old);
+}
+
+int limit_enabled(void)
+{
+    return rate > 0 || rules != NULL;
+}
+
+/*
+ * Returns LIMIT_PASS if the request can be served right away, LIMIT_QUEUE
+ * if it was queued (the caller keeps it alive until limit_next() returns
+ * it) or LIMIT_REJECT if it is to be refused. An exempt request never
+ * waits for a token; it is refused only if its sender has a queue's
+ * worth of them waiting already.
+ */
+int limit_admit(const char *sender, void *request, int exempt)
+{
+    struct client *c;
+    uint64_t       now = monotonic_usec();
+    guint          len;
+
+    if (!rate && !rules)
+        return LIMIT_PASS;
+
+    if ((c = get_client(sender, now)) == NULL)
+        return LIMIT_PASS;      /* out of memory; don't punish the client */
+
+    refill(c, now);
+
+    if (g_queue_is_empty(&c->queue)) {
+        if (exempt || !c->rate) {
+            c->passed++;
+            stats.passed++;
+            return LIMIT_PASS;
+        }
+
+        if (c->tokens >= TOKEN) {
+            c->tokens -= TOKEN;
+            c->passed++;
+            stats.passed++;
+            return LIMIT_PASS;
+        }
+    }
+
+    /* both kinds have a queue's worth of room */
+    if (exempt)
+        len = g_queue_get_length(&c->exempt);
+    else
+        len = g_queue_get_length(&c->queue)-g_queue_get_length(&c->exempt);
+
+    if (len >= c->depth) {
+        c->rejected++;
+        stats.rejected++;
+
+        TRACE("%s(): rejected a request of '%s'", __FUNCTION__, c->sender);
+
+        return LIMIT_REJECT;
+    }
+
+    if (exempt)
+        g_queue_push_tail(&c->exempt, request);
+
+    g_queue_push_tail(&c->queue, request);
+    c->queued++;
+    stats.queued++;
+
+    if (g_queue_get_length(&c->queue) > stats.maxdepth)
+        stats.maxdepth = g_queue_get_length(&c->queue);
+
+    if (!c->active) {
+        c->active = TRUE;
+        g_queue_push_tail(&active, c);
+    }
+
+    return LIMIT_QUEUE;
+}
+
+/*
+ * The same for clients that are answered right away instead of being
+ * queued, e.g. the ones of the control socket: returns LIMIT_PASS if a
+ * token was taken and LIMIT_REJECT with *waitp set to the usecs until
+ * the next one otherwise. Exempt requests always pass.
+ */
+int limit_take(const char *sender, int exempt, uint32_t *waitp)
+{
+    struct client *c;
+    uint64_t       now = monotonic_usec();
+
+    *waitp = 0;
+
+    if (!rate && !rules)
+        return LIMIT_PASS;
+
+    if ((c = get_client(sender, now)) == NULL)
+        return LIMIT_PASS;
+
+    refill(c, now);
+
+    if (exempt || !c->rate || c->tokens >= TOKEN) {
+        if (!exempt && c->rate)
+            c->tokens -= TOKEN;
+        c->passed++;
+        stats.passed++;
+        return LIMIT_PASS;
+    }
+
+    c->rejected++;
+    stats.rejected++;
+
+    *waitp = (uint32_t)((TOKEN - c->tokens + c->rate - 1) / c->rate);
+
+    TRACE("%s(): throttled a request of '%s'", __FUNCTION__, c->sender);
+
+    return LIMIT_REJECT;
+}
+
+/*
+ * Hand back the next queued request that may be served now, taking the
+ * clients in turn. If there is none, *waitp is set to the usecs until
+ * there will be one, or 0 if nothing is queued.
+ */
+void *limit_next(uint32_t *waitp)
+{
+    struct client *c;
+    void          *request;
+    uint64_t       now  = monotonic_usec();
+    uint64_t       wait = 0;
+    uint64_t       w;
+    guint          i, n;
+
+    n = g_queue_get_length(&active);
+
+    for (i = 0;  i < n;  i++) {
+        c = g_queue_pop_head(&active);
+
+        refill(c, now);
+
+        request = g_queue_peek_head(&c->queue);
+
+        if (request == g_queue_peek_head(&c->exempt))
+            g_queue_pop_head(&c->exempt);
+        else if (!c->rate || c->tokens >= TOKEN) {
+            if (c->rate)
+                c->tokens -= TOKEN;
+        }
+        else
+            request = NULL;
+
+        if (request != NULL) {
+            g_queue_pop_head(&c->queue);
+
+            if (g_queue_is_empty(&c->queue))
+                c->active = FALSE;
+            else
+                g_queue_push_tail(&active, c);
+
+            *waitp = 0;
+            return request;
+        }
+
+        w = (TOKEN - c->tokens + c->rate - 1) / c->rate;
+
+        if (!wait || w < wait)
+            wait = w;
+
+        g_queue_push_tail(&active, c);
+    }
+
+    *waitp = (uint32_t)wait;
+
+    return NULL;
+}
+
+/* drop every queued request, e.g. on exit */
+void limit_flush(void (*release)(void *))
+{
+    struct client *c;
+    void          *request;
+
+    while ((c = g_queue_pop_head(&active)) != NULL) {
+        while ((request = g_queue_pop_head(&c->queue)) != NULL)
+            release(request);
+
+        g_queue_clear(&c->exempt);
+        c->active = FALSE;
+    }
+
+    if (clients != NULL) {
+        g_hash_table_destroy(clients);
+        clients = NULL;
+    }
+}
+
+void limit_get_stats(struct limit_stats *st)
+{
+    memcpy(st, &stats, sizeof(*st));
+    st->clients = clients ? g_hash_table_size(clients) : 0;
+}
+
+void limit_print_stats(void)
+{
+    struct limit_stats st;
+    struct rule       *r;
+
+    limit_get_stats(&st);
+
+    printf("request limits: %u burst, %u/sec, queue %u per client\n"
+           "   %u passed, %u throttled, %u rejected, longest queue %u, "
+           "%u clients\n",
+           burst, rate, depth, st.passed, st.queued, st.rejected,
+           st.maxdepth, st.clients);
+
+    for (r = rules;  r != NULL;  r = r->next) {
+        printf("   limits of '%s': %u burst, %u/sec, queue %u, owner '%s'\n",
+               r->name, r->burst, r->rate, r->depth,
+               r->owner ? r->owner : "");
+    }
+
+    if (clients != NULL)
+        g_hash_table_foreach(clients, print_client, NULL);
+}
+
+
+static struct client *get_client(const char *sender, uint64_t now)
+{
+    struct client *c;
+
+    if (sender == NULL)
+        sender = "";
+
+    if (clients == NULL) {
+        clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        NULL, free_client);
+        if (clients == NULL)
+            return NULL;
+    }
+
+    if ((c = g_hash_table_lookup(clients, sender)) != NULL)
+        return c;
+
+    /* the bus does not tell us about clients that are gone; forget the
+       ones that have been quiet long enough to have a full bucket */
+    if (g_hash_table_size(clients) >= SWEEP_LIMIT)
+        g_hash_table_foreach_remove(clients, idle_client, &now);
+
+    if ((c = calloc(1, sizeof(*c))) == NULL ||
+        (c->sender = strdup(sender)) == NULL) {
+        free(c);
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    apply_rule(c);
+
+    c->tokens = (uint64_t)c->burst * TOKEN;
+    c->stamp  = now;
+    g_queue_init(&c->queue);
+    g_queue_init(&c->exempt);
+
+    g_hash_table_insert(clients, c->sender, c);
+
+    return c;
+}
+
+static void apply_rule(struct client *c)
+{
+    struct rule *r;
+
+    for (r = rules;  r != NULL;  r = r->next) {
+        if (r->owner != NULL && !strcmp(r->owner, c->sender))
+            break;
+    }
+
+    c->burst = r ? r->burst : burst;
+    c->rate  = r ? r->rate  : rate;
+    c->depth = r ? r->depth : depth;
+
+    if (c->tokens > (uint64_t)c->burst * TOKEN)
+        c->tokens = (uint64_t)c->burst * TOKEN;
+}
+
+static void refill(struct client *c, uint64_t now)
+{
+    uint64_t full = (uint64_t)c->burst * TOKEN;
+
+    c->tokens += (now - c->stamp) * c->rate;
+    c->stamp   = now;
+
+    if (c->tokens > full)
+        c->tokens = full;
+}
+
+static void free_client(gpointer data)
+{
+    struct client *c = (struct client *)data;
+
+    g_queue_clear(&c->queue);
+    g_queue_clear(&c->exempt);
+    free(c->sender);
+    free(c);
+}
+
+static gboolean idle_client(gpointer key, gpointer value, gpointer data)
+{
+    struct client *c   = (struct client *)value;
+    uint64_t       now = *(uint64_t *)data;
+
+    (void)key;
+
+    if (c->active)
+        return FALSE;
+
+    refill(c, now);
+
+    return c->tokens >= (uint64_t)c->burst * TOKEN;
+}
+
+static void print_client(gpointer key, gpointer value, gpointer data)
+{
+    struct client *c = (struct client *)value;
+
+    (void)key;
+    (void)data;
+
+    if (c->queued || c->rejected) {
+        printf("   '%s': %u passed, %u throttled, %u rejected\n",
+               c->sender, c->passed, c->queued, c->rejected);
+    }
+}
+
+static uint64_t monotonic_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,65 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_LIMIT_H__
+#define __TONEGEND_LIMIT_H__
+
+#include <stdint.h>
+
+/*
+ * what to do with a request, see limit_admit()
+ */
+#define LIMIT_PASS     0        /* go ahead */
+#define LIMIT_QUEUE    1        /* queued; limit_next() hands it back */
+#define LIMIT_REJECT   2        /* the client's queue is full */
+
+#define LIMIT_BURST    50       /* default bucket size, requests */
+#define LIMIT_RATE     100      /* default refill, requests per second */
+#define LIMIT_DEPTH    20       /* default queue length per client */
+
+struct limit_stats {
+    uint32_t  clients;          /* clients with a bucket right now */
+    uint32_t  passed;           /* requests let through right away */
+    uint32_t  queued;           /* throttled: served later, in turn */
+    uint32_t  rejected;         /* refused, the client's queue was full */
+    uint32_t  maxdepth;         /* longest queue of a client so far */
+};
+
+void  limit_set(uint32_t, uint32_t, uint32_t);
+int   limit_set_client(const char *, uint32_t, uint32_t, uint32_t);
+const char *limit_client_name(int);
+void  limit_set_owner(const char *, const char *);
+int   limit_enabled(void);
+int   limit_admit(const char *, void *, int);
+int   limit_take(const char *, int, uint32_t *);
+void *limit_next(uint32_t *);
+void  limit_flush(void (*)(void *));
+void  limit_get_stats(struct limit_stats *);
+void  limit_print_stats(void);
+
+#endif /* __TONEGEND_LIMIT_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
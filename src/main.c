@@ -29,6 +29,7 @@ USA.
 #include <getopt.h>
 #include <errno.h>
 #include <pwd.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -44,6 +45,7 @@ USA.
 #include "dbusif.h"
 #include "ausrv.h"
 #include "stream.h"
+#include "scache.h"
 #include "tone.h"
 #include "envelop.h"
 #include "indicator.h"
@@ -52,6 +54,21 @@ USA.
 #include "rfc4733.h"
 #include "notification.h"
 #include "interact.h"
+#include "pool.h"
+#include "worker.h"
+#include "shed.h"
+#include "mainloop.h"
+#include "startup.h"
+#include "limit.h"
+#include "ctlsock.h"
+#include "cadence.h"
+#include "plan.h"
+#include "pcmcache.h"
+#include "pcmexport.h"
+#include "tonesig.h"
+#include "rtcheck.h"
+
+#define PREFAULT_STACK (256 * 1024)
 
 
 #define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
@@ -65,6 +82,10 @@ struct cmdopt {
     int       uid;
     char     *path;
     int       standard;
+    char     *country;
+    char     *plan;
+    int       pcmcache;
+    char     *pcmdir;
     int       interactive;
     int       sample_rate;
     int       statistics;
@@ -76,16 +97,33 @@ struct cmdopt {
     uint32_t  dtmf_volume;
     uint32_t  notif_volume;
     uint32_t  ind_volume;
+    char     *output;
+    char     *formats;
+    int       render_thread;
+    int       rt_priority;
+    int       rt_cpu;
+    int       realtime;
+    int       workers;
+    int       render_ahead;
+    int       shed_margin;
+    int       lazy_connect;
+    int       idle_timeout;
+    uint32_t  limit_burst;
+    uint32_t  limit_rate;
+    uint32_t  limit_depth;
+    int       ctlsock;
+    char     *ctlpath;
 };
 
 
 static void usage(int, char **, int);
+static int  parse_limit(char *, uint32_t *, uint32_t *, uint32_t *);
 static void parse_options(int, char **, struct cmdopt *);
 static void signal_handler(int, siginfo_t *, void *);
 static int daemonize(uid_t uid, const char *path);
+static void setup_realtime(void);
 
 static char      *pa_server_name;
-static GMainLoop *main_loop;
 
 
 int main(int argc, char **argv)
@@ -94,10 +132,16 @@ int main(int argc, char **argv)
     struct tonegend tonegend;
     struct cmdopt cmdopt;
 
+    startup_init();
+
     cmdopt.daemon = 0;
     cmdopt.uid = -1;
     cmdopt.path = NULL;
     cmdopt.standard = STD_CEPT;
+    cmdopt.country = NULL;
+    cmdopt.plan = NULL;
+    cmdopt.pcmcache = 0;
+    cmdopt.pcmdir = NULL;
     cmdopt.interactive = 0;
     cmdopt.sample_rate = 48000;
     cmdopt.statistics = 0;
@@ -109,9 +153,33 @@ int main(int argc, char **argv)
     cmdopt.dtmf_volume = 100;
     cmdopt.ind_volume = 100;
     cmdopt.notif_volume = 100;
+    cmdopt.output = NULL;
+    cmdopt.formats = NULL;
+    cmdopt.render_thread = 0;
+    cmdopt.rt_priority = 0;
+    cmdopt.rt_cpu = -1;
+    cmdopt.realtime = 0;
+    cmdopt.workers = 0;
+    cmdopt.render_ahead = 0;
+    cmdopt.shed_margin = 0;
+    cmdopt.lazy_connect = 0;
+    cmdopt.idle_timeout = 60;
+    cmdopt.limit_burst = LIMIT_BURST;
+    cmdopt.limit_rate = LIMIT_RATE;
+    cmdopt.limit_depth = LIMIT_DEPTH;
+    cmdopt.ctlsock = 0;
+    cmdopt.ctlpath = NULL;
     
     parse_options(argc, argv, &cmdopt);
 
+    if (cmdopt.render_thread) {
+#if !GLIB_CHECK_VERSION(2,32,0)
+        if (!g_thread_supported())
+            g_thread_init(NULL);
+#endif
+        dbus_threads_init_default();
+    }
+
     memset(&tonegend, 0, sizeof(tonegend));
 
     memset(&sa, 0, sizeof(sa));
@@ -128,6 +196,7 @@ int main(int argc, char **argv)
     if (dbusif_init(argc, argv)    < 0 ||
         ausrv_init(argc, argv)     < 0 ||
         stream_init(argc, argv)    < 0 ||
+        scache_init(argc, argv)    < 0 ||
         tone_init(argc, argv)      < 0 ||
         envelop_init(argc, argv)   < 0 ||
         indicator_init(argc, argv) < 0 ||
@@ -135,7 +204,11 @@ int main(int argc, char **argv)
         note_init(argc, argv)      < 0 ||
         interact_init(argc, argv)  < 0 ||
         rfc4733_init(argc, argv)   < 0 ||
-        notif_init(argc, argv)     < 0) {
+        notif_init(argc, argv)     < 0 ||
+        cadence_init(argc, argv)   < 0 ||
+        pcmexport_init(argc, argv) < 0 ||
+        tonesig_init(argc, argv)   < 0 ||
+        ctlsock_init(argc, argv)   < 0) {
         LOG_ERROR("Error during initialization");
         return EINVAL;
     }
@@ -144,6 +217,34 @@ int main(int argc, char **argv)
     stream_set_default_samplerate(cmdopt.sample_rate);
     stream_print_statistics(cmdopt.statistics);
     stream_buffering_parameters(cmdopt.buflen, cmdopt.minreq);
+    stream_set_realtime(cmdopt.realtime);
+    stream_set_render_ahead(cmdopt.render_ahead);
+    shed_set_margin(cmdopt.shed_margin * 1000);
+    ausrv_set_render_thread(cmdopt.render_thread, cmdopt.rt_priority,
+                            cmdopt.rt_cpu);
+    ausrv_set_lazy_connect(cmdopt.lazy_connect, cmdopt.idle_timeout);
+    limit_set(cmdopt.limit_burst, cmdopt.limit_rate, cmdopt.limit_depth);
+
+    if (stream_set_output(cmdopt.output) < 0) {
+        LOG_ERROR("Invalid output '%s'", cmdopt.output);
+        return EINVAL;
+    }
+
+    if (stream_set_formats(cmdopt.formats) < 0) {
+        LOG_ERROR("Invalid format '%s'", cmdopt.formats);
+        return EINVAL;
+    }
+
+    if (plan_open(cmdopt.plan) < 0 && (cmdopt.plan || cmdopt.country)) {
+        LOG_ERROR("Can't load the tone plan '%s'",
+                  cmdopt.plan ? cmdopt.plan : TONEPLAN);
+        return EINVAL;
+    }
+
+    if (cmdopt.country && indicator_set_country(cmdopt.country) < 0) {
+        LOG_ERROR("Invalid country '%s'", cmdopt.country);
+        return EINVAL;
+    }
 
     dtmf_set_properties(cmdopt.dtmf_tags);
     indicator_set_properties(cmdopt.ind_tags);
@@ -156,7 +257,15 @@ int main(int argc, char **argv)
     if (cmdopt.daemon)
         daemonize(cmdopt.uid, cmdopt.path);
 
-    if ((main_loop = g_main_loop_new(NULL, FALSE)) == NULL) {
+    if (cmdopt.realtime)
+        setup_realtime();   /* memory locks are not inherited by fork() */
+
+    if (worker_start(cmdopt.workers, cmdopt.rt_priority) < 0) {
+        LOG_ERROR("Can't start render workers");
+        return EIO;
+    }
+
+    if (mainloop_create() < 0) {
         LOG_ERROR("Can't create main loop");
         return EIO;
     }
@@ -181,6 +290,30 @@ int main(int argc, char **argv)
         return EIO;
     }
 
+    if (cadence_create(&tonegend) < 0) {
+        LOG_ERROR("Can't setup custom tone interface on D-Bus");
+        return EIO;
+    }
+
+    if (pcmexport_create(&tonegend, cmdopt.sample_rate) < 0) {
+        LOG_ERROR("Can't setup PCM export interface on D-Bus");
+        return EIO;
+    }
+
+    if (tonesig_create(&tonegend) < 0) {
+        LOG_ERROR("Can't setup tone signals on D-Bus");
+        return EIO;
+    }
+
+    if (cmdopt.ctlsock) {
+        tonegend.ctlsock_ctx = ctlsock_create(&tonegend, cmdopt.ctlpath);
+
+        if (tonegend.ctlsock_ctx == NULL) {
+            LOG_ERROR("Can't setup the control socket");
+            return EIO;
+        }
+    }
+
     if (!cmdopt.daemon && cmdopt.interactive) {
         if (!(tonegend.intact_ctx = interact_create(&tonegend,fileno(stdin)))){
             LOG_ERROR("Can't setup interactive console");
@@ -189,21 +322,43 @@ int main(int argc, char **argv)
         printf("Running in interactive mode\n");
     }
 
-    indicator_set_standard(cmdopt.standard);
+    if (cmdopt.country == NULL)
+        indicator_set_standard(cmdopt.standard);
 
-    g_main_loop_run(main_loop);
+    if (cmdopt.pcmcache && pcmcache_open(cmdopt.pcmdir,cmdopt.sample_rate) < 0)
+        LOG_ERROR("Can't setup the PCM cache; tones are rendered as usual");
+
+    mainloop_run();
 
     LOG_INFO("Exiting now ...");
 
+    if (cmdopt.statistics) {
+        startup_print();
+        ausrv_print_statistics(tonegend.ausrv_ctx);
+
+        if (limit_enabled())
+            limit_print_stats();
+    }
+
+    ctlsock_destroy(tonegend.ctlsock_ctx);
     ausrv_destroy(tonegend.ausrv_ctx);
     dbusif_destroy(tonegend.dbus_ctx);
     interact_destroy(tonegend.intact_ctx);
+    worker_stop();
+
+    if (cmdopt.statistics && shed_enabled())
+        shed_print_stats();
+
+    if (cmdopt.statistics)
+        mainloop_print_stats();
 
-    if (main_loop != NULL) 
-        g_main_loop_unref(main_loop);
+    mainloop_destroy();
 
     ausrv_exit();
 
+    pcmcache_close();
+    plan_close();
+
     return 0;
 }
 
@@ -213,11 +368,16 @@ static void usage(int argc, char **argv, int exit_code)
     (void)argc;
 
     printf("usage: %s [-h] [-d] [-u username] "
-           "[-s {cept | ansi | japan | atnt }] "
+           "[-s {cept | ansi | japan | atnt | country_code}] [-P tone_plan] "
            "[-b buflen_in_ms] [-r min_req_time_in_ms] [-i] [-8] [-S] "
            "[--tag-dtmf tags] [--tag-indicator tags] [--tag-notif tags] "
            "[--volume-dtmf volume] [--volume-indicator volume] "
-           "[--volume-notif volume]"
+           "[--volume-notif volume] "
+           "[-o {pulse | null[,opts] | file,path=file[,opts] | "
+           "rtp,dest=host:port[,opts] | alsa[,opts]}] "
+           "[-F [stream=]{s16le | ulaw | alaw}[,...]] "
+           "[-T[priority[,cpu]]] [-R] [-W workers] [-A blocks] [-L msec] [-C[idle_secs]] "
+           "[-Q [name=]burst,rate[,queue]] [-K[path]] [-M[dir]]"
            "\n",
            basename(argv[0]));
     exit(exit_code);
@@ -239,6 +399,47 @@ static uint32_t parse_volume(char *volstr)
     return vol;
 }
 
+/* burst,rate[,queue] or 0 for no limits */
+static int parse_limit(char *str, uint32_t *burst, uint32_t *rate,
+                       uint32_t *depth)
+{
+    char *e;
+    long  t;
+
+    t = strtol(str, &e, 10);
+
+    if (t < 0 || t > 10000 || (*e && *e != ','))
+        return -1;
+
+    if (t == 0) {
+        *rate = 0;
+        return *e ? -1 : 0;
+    }
+
+    *burst = t;
+
+    if (*e != ',')
+        return -1;
+
+    t = strtol(e + 1, &e, 10);
+
+    if (t < 1 || t > 10000 || (*e && *e != ','))
+        return -1;
+
+    *rate = t;
+
+    if (*e == ',') {
+        t = strtol(e + 1, &e, 10);
+
+        if (t < 0 || t > 1000 || *e)
+            return -1;
+
+        *depth = t;
+    }
+
+    return 0;
+}
+
 static void parse_options(int argc, char **argv, struct cmdopt *cmdopt)
 {
     struct option options[] = {
@@ -257,8 +458,20 @@ static void parse_options(int argc, char **argv, struct cmdopt *cmdopt)
         { "volume-dtmf"     , required_argument, NULL, '1' },
         { "volume-indicator", required_argument, NULL, '2' },
         { "volume-notif"    , required_argument, NULL, '3' },
+        { "output"          , required_argument, NULL, 'o' },
+        { "format"          , required_argument, NULL, 'F' },
+        { "render-thread"   , optional_argument, NULL, 'T' },
+        { "realtime"        , no_argument      , NULL, 'R' },
+        { "render-workers"  , required_argument, NULL, 'W' },
+        { "render-ahead"    , required_argument, NULL, 'A' },
+        { "shed-margin"     , required_argument, NULL, 'L' },
+        { "lazy-connect"    , optional_argument, NULL, 'C' },
+        { "rate-limit"      , required_argument, NULL, 'Q' },
+        { "control-socket"  , optional_argument, NULL, 'K' },
+        { "tone-plan"       , required_argument, NULL, 'P' },
+        { "pcm-cache"       , optional_argument, NULL, 'M' },
         
-#define OPTS "du:s:b:r:hi8SD:I:N:"
+#define OPTS "du:s:b:r:hi8SD:I:N:o:F:T::RW:A:L:C::Q:K::P:M::"
         { NULL           , 0                , NULL,  0  }
     };
     
@@ -266,6 +479,7 @@ static void parse_options(int argc, char **argv, struct cmdopt *cmdopt)
     struct passwd *pwd;
     long int t;
     char *e;
+    uint32_t burst, rate, depth;
 
     while ((option = getopt_long(argc, argv, OPTS, options, NULL)) != -1) {
         switch (option) {
@@ -306,6 +520,8 @@ static void parse_options(int argc, char **argv, struct cmdopt *cmdopt)
             break;
 
         case 's':
+            cmdopt->country = NULL;
+
             if (!strcmp(optarg, "cept"))
                 cmdopt->standard = STD_CEPT;
             else if (!strcmp(optarg, "ansi"))
@@ -314,6 +530,8 @@ static void parse_options(int argc, char **argv, struct cmdopt *cmdopt)
                 cmdopt->standard = STD_JAPAN;
             else if (!strcmp(optarg, "atnt"))
                 cmdopt->standard = STD_ATNT;
+            else if (strlen(optarg) == 2)
+                cmdopt->country = optarg;   /* looked up in the tone plan */
             else {
                 printf("invalid standard '%s'\n", optarg);
                 usage(argc, argv, EINVAL);
@@ -370,6 +588,118 @@ static void parse_options(int argc, char **argv, struct cmdopt *cmdopt)
             cmdopt->notif_volume = parse_volume(optarg);
             break;
 
+        case 'o':
+            cmdopt->output = optarg;
+            break;
+
+        case 'F':
+            cmdopt->formats = optarg;
+            break;
+
+        case 'T':
+            cmdopt->render_thread = 1;
+
+            if (optarg != NULL) {
+                t = strtol(optarg, &e, 10);
+
+                if (t < 0 || t > 99 || (*e && *e != ','))
+                    usage(argc, argv, EINVAL);
+
+                cmdopt->rt_priority = t;
+
+                if (*e == ',') {
+                    t = strtol(e + 1, &e, 10);
+
+                    if (t < 0 || t >= CPU_SETSIZE || *e)
+                        usage(argc, argv, EINVAL);
+
+                    cmdopt->rt_cpu = t;
+                }
+            }
+            break;
+
+        case 'R':
+            cmdopt->realtime = 1;
+            break;
+
+        case 'C':
+            cmdopt->lazy_connect = 1;
+
+            if (optarg != NULL) {
+                t = strtol(optarg, &e, 10);
+
+                if (*e || t < 0 || t > 86400)
+                    usage(argc, argv, EINVAL);
+
+                cmdopt->idle_timeout = t;
+            }
+            break;
+
+        case 'Q':
+            if ((e = strchr(optarg, '=')) != NULL) {
+                /* name=burst,rate[,queue]: limits of a single client */
+                *e++  = '\0';
+                burst = LIMIT_BURST;
+                rate  = LIMIT_RATE;
+                depth = LIMIT_DEPTH;
+
+                if (!optarg[0] || parse_limit(e, &burst, &rate, &depth) < 0 ||
+                    limit_set_client(optarg, burst, rate, depth) < 0)
+                    usage(argc, argv, EINVAL);
+            }
+            else if (parse_limit(optarg, &cmdopt->limit_burst,
+                                 &cmdopt->limit_rate,
+                                 &cmdopt->limit_depth) < 0)
+                usage(argc, argv, EINVAL);
+            break;
+
+        case 'K':
+            cmdopt->ctlsock = 1;
+            cmdopt->ctlpath = optarg;
+            break;
+
+        case 'P':
+            cmdopt->plan = optarg;
+            break;
+
+        case 'M':
+            cmdopt->pcmcache = 1;
+            cmdopt->pcmdir = optarg;
+            break;
+
+        case 'W':
+            t = strtol(optarg, &e, 10);
+
+            if (*e == '\0' && t >= 0 && t <= WORKER_MAX)
+                cmdopt->workers = t;
+            else {
+                printf("invalid number of render workers '%s'\n", optarg);
+                usage(argc, argv, EINVAL);
+            }
+            break;
+
+        case 'A':
+            t = strtol(optarg, &e, 10);
+
+            if (*e == '\0' && t >= 0 && t <= 64)
+                cmdopt->render_ahead = t;
+            else {
+                printf("invalid render-ahead depth '%s'\n", optarg);
+                usage(argc, argv, EINVAL);
+            }
+            break;
+
+        case 'L':
+            t = strtol(optarg, &e, 10);
+
+            if (*e == '\0' && t >= 0 && t <= 1000)
+                cmdopt->shed_margin = t;
+            else {
+                printf("invalid load shedding margin '%s'\n", optarg);
+                usage(argc, argv, EINVAL);
+            }
+            break;
+
         default:
             usage(argc, argv, EINVAL);
             break;
@@ -394,10 +724,8 @@ static void signal_handler(int signo, siginfo_t *info, void *data)
     case SIGHUP:
     case SIGTERM:
     case SIGINT:
-        if (main_loop != NULL) {
-            g_main_loop_quit(main_loop);
+        if (mainloop_quit() == 0)
             break;
-        }
         /* intentional fall over */
 
     default:
@@ -405,6 +733,18 @@ static void signal_handler(int signo, siginfo_t *info, void *data)
     }
 }
 
+static void setup_realtime(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        LOG_ERROR("Can't lock memory: %s; page faults may delay the audio",
+                  strerror(errno));
+    }
+
+    pool_prefault_stack(PREFAULT_STACK);
+
+    rtcheck_arm();
+}
+
 static int daemonize(uid_t uid, const char *path)
 {
     pid_t   pid;
@@ -0,0 +1,356 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "mainloop.h"
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+/*
+ * D-Bus connection driven by a pa_mainloop_api: every DBusWatch is an
+ * io event, every enabled DBusTimeout a time event, and the incoming
+ * messages are dispatched from a defer event while there are any.
+ */
+struct dbus_glue {
+    pa_mainloop_api  *api;
+    DBusConnection   *conn;
+    pa_defer_event   *dispatch;
+};
+
+static uint64_t now_usec(void);
+static pa_io_event_flags_t watch_flags(DBusWatch *);
+static void timeout_expiry(DBusTimeout *, struct timeval *);
+static dbus_bool_t add_watch(DBusWatch *, void *);
+static void remove_watch(DBusWatch *, void *);
+static void toggle_watch(DBusWatch *, void *);
+static void watch_callback(pa_mainloop_api *, pa_io_event *, int,
+                           pa_io_event_flags_t, void *);
+static dbus_bool_t add_timeout(DBusTimeout *, void *);
+static void remove_timeout(DBusTimeout *, void *);
+static void toggle_timeout(DBusTimeout *, void *);
+static void timeout_callback(pa_mainloop_api *, pa_time_event *,
+                             const struct timeval *, void *);
+static void dispatch_status(DBusConnection *, DBusDispatchStatus, void *);
+static void dispatch_callback(pa_mainloop_api *, pa_defer_event *, void *);
+
+static struct mainloop_stats stats;
+static struct dbus_glue     *glue;
+
+
+void mainloop_stats_reset(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.start = now_usec();
+}
+
+void mainloop_woke_up(void)
+{
+    stats.wakeups++;
+    stats.wakeup = now_usec();
+}
+
+void mainloop_request_dispatched(void)
+{
+    uint64_t lat = now_usec() - stats.wakeup;
+
+    stats.requests++;
+    stats.latsum += lat;
+
+    if (lat > stats.latmax)
+        stats.latmax = lat;
+}
+
+void mainloop_print_stats(void)
+{
+    FILE     *f;
+    char      line[128];
+    long      rss = -1;
+    double    uptime;
+
+    if ((f = fopen("/proc/self/status", "r")) != NULL) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+                break;
+        }
+        fclose(f);
+    }
+
+    uptime = (double)(now_usec() - stats.start) / 1000000.0;
+
+    printf("%s main loop: %u wakeups in %.1f sec (%.2f/sec), RSS %ld kB\n"
+           "   %u D-Bus requests, dispatch latency avg %u usec max %u usec\n",
+           mainloop_backend, stats.wakeups, uptime,
+           uptime > 0.0 ? stats.wakeups / uptime : 0.0, rss, stats.requests,
+           stats.requests ? (uint32_t)(stats.latsum / stats.requests) : 0,
+           stats.latmax);
+}
+
+int mainloop_attach_dbus(pa_mainloop_api *api, DBusConnection *conn)
+{
+    if ((glue = malloc(sizeof(*glue))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+
+    glue->api  = api;
+    glue->conn = conn;
+
+    if ((glue->dispatch = api->defer_new(api, dispatch_callback, glue))==NULL){
+        LOG_ERROR("%s(): can't create defer event", __FUNCTION__);
+        free(glue);
+        glue = NULL;
+        return -1;
+    }
+
+    api->defer_enable(glue->dispatch, FALSE);
+
+    if (!dbus_connection_set_watch_functions(conn, add_watch, remove_watch,
+                                             toggle_watch, glue, NULL) ||
+        !dbus_connection_set_timeout_functions(conn, add_timeout,
+                                               remove_timeout, toggle_timeout,
+                                               glue, NULL))
+    {
+        LOG_ERROR("%s(): can't set up D-Bus watches", __FUNCTION__);
+        mainloop_detach_dbus(conn);
+        return -1;
+    }
+
+    dbus_connection_set_dispatch_status_function(conn, dispatch_status,
+                                                 glue, NULL);
+
+    dispatch_status(conn, dbus_connection_get_dispatch_status(conn), glue);
+
+    return 0;
+}
+
+void mainloop_detach_dbus(DBusConnection *conn)
+{
+    if (glue != NULL && glue->conn == conn) {
+        dbus_connection_set_dispatch_status_function(conn, NULL, NULL, NULL);
+        dbus_connection_set_watch_functions(conn, NULL,NULL,NULL, NULL,NULL);
+        dbus_connection_set_timeout_functions(conn, NULL,NULL,NULL, NULL,NULL);
+
+        glue->api->defer_free(glue->dispatch);
+
+        free(glue);
+        glue = NULL;
+    }
+}
+
+
+static uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static pa_io_event_flags_t watch_flags(DBusWatch *watch)
+{
+    pa_io_event_flags_t flags = PA_IO_EVENT_NULL;
+    unsigned int        wflags;
+
+    if (dbus_watch_get_enabled(watch)) {
+        wflags = dbus_watch_get_flags(watch);
+
+        if (wflags & DBUS_WATCH_READABLE)
+            flags |= PA_IO_EVENT_INPUT;
+        if (wflags & DBUS_WATCH_WRITABLE)
+            flags |= PA_IO_EVENT_OUTPUT;
+    }
+
+    return flags;
+}
+
+static dbus_bool_t add_watch(DBusWatch *watch, void *data)
+{
+    struct dbus_glue *g = (struct dbus_glue *)data;
+    pa_io_event      *ev;
+
+    ev = g->api->io_new(g->api, dbus_watch_get_unix_fd(watch),
+                        watch_flags(watch), watch_callback, watch);
+    if (ev == NULL)
+        return FALSE;
+
+    dbus_watch_set_data(watch, ev, NULL);
+
+    return TRUE;
+}
+
+static void remove_watch(DBusWatch *watch, void *data)
+{
+    struct dbus_glue *g  = (struct dbus_glue *)data;
+    pa_io_event      *ev = dbus_watch_get_data(watch);
+
+    if (ev != NULL) {
+        g->api->io_free(ev);
+        dbus_watch_set_data(watch, NULL, NULL);
+    }
+}
+
+static void toggle_watch(DBusWatch *watch, void *data)
+{
+    struct dbus_glue *g  = (struct dbus_glue *)data;
+    pa_io_event      *ev = dbus_watch_get_data(watch);
+
+    if (ev != NULL)
+        g->api->io_enable(ev, watch_flags(watch));
+}
+
+static void watch_callback(pa_mainloop_api *api, pa_io_event *ev, int fd,
+                           pa_io_event_flags_t events, void *data)
+{
+    DBusWatch    *watch  = (DBusWatch *)data;
+    unsigned int  wflags = 0;
+
+    (void)api;
+    (void)ev;
+    (void)fd;
+
+    if (events & PA_IO_EVENT_INPUT)
+        wflags |= DBUS_WATCH_READABLE;
+    if (events & PA_IO_EVENT_OUTPUT)
+        wflags |= DBUS_WATCH_WRITABLE;
+    if (events & PA_IO_EVENT_HANGUP)
+        wflags |= DBUS_WATCH_HANGUP;
+    if (events & PA_IO_EVENT_ERROR)
+        wflags |= DBUS_WATCH_ERROR;
+
+    dbus_watch_handle(watch, wflags);
+}
+
+static void timeout_expiry(DBusTimeout *timeout, struct timeval *tv)
+{
+    int interval = dbus_timeout_get_interval(timeout);
+
+    gettimeofday(tv, NULL);
+
+    tv->tv_sec  += interval / 1000;
+    tv->tv_usec += (interval % 1000) * 1000;
+
+    if (tv->tv_usec >= 1000000) {
+        tv->tv_sec  += 1;
+        tv->tv_usec -= 1000000;
+    }
+}
+
+static dbus_bool_t add_timeout(DBusTimeout *timeout, void *data)
+{
+    struct dbus_glue *g = (struct dbus_glue *)data;
+    pa_time_event    *ev;
+    struct timeval    tv;
+
+    if (!dbus_timeout_get_enabled(timeout))
+        return TRUE;
+
+    timeout_expiry(timeout, &tv);
+
+    if ((ev = g->api->time_new(g->api, &tv, timeout_callback, timeout))==NULL)
+        return FALSE;
+
+    dbus_timeout_set_data(timeout, ev, NULL);
+
+    return TRUE;
+}
+
+static void remove_timeout(DBusTimeout *timeout, void *data)
+{
+    struct dbus_glue *g  = (struct dbus_glue *)data;
+    pa_time_event    *ev = dbus_timeout_get_data(timeout);
+
+    if (ev != NULL) {
+        g->api->time_free(ev);
+        dbus_timeout_set_data(timeout, NULL, NULL);
+    }
+}
+
+static void toggle_timeout(DBusTimeout *timeout, void *data)
+{
+    remove_timeout(timeout, data);
+    add_timeout(timeout, data);
+}
+
+static void timeout_callback(pa_mainloop_api *api, pa_time_event *ev,
+                             const struct timeval *tv, void *data)
+{
+    DBusTimeout    *timeout = (DBusTimeout *)data;
+    struct timeval  next;
+
+    (void)tv;
+
+    /* D-Bus timeouts are periodic until removed */
+    timeout_expiry(timeout, &next);
+    api->time_restart(ev, &next);
+
+    dbus_timeout_handle(timeout);
+}
+
+static void dispatch_status(DBusConnection *conn, DBusDispatchStatus status,
+                            void *data)
+{
+    struct dbus_glue *g = (struct dbus_glue *)data;
+
+    (void)conn;
+
+    g->api->defer_enable(g->dispatch, status == DBUS_DISPATCH_DATA_REMAINS);
+}
+
+static void dispatch_callback(pa_mainloop_api *api, pa_defer_event *ev,
+                              void *data)
+{
+    struct dbus_glue *g = (struct dbus_glue *)data;
+
+    (void)api;
+
+    if (dbus_connection_dispatch(g->conn) != DBUS_DISPATCH_DATA_REMAINS)
+        g->api->defer_enable(ev, FALSE);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,75 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_MAINLOOP_H__
+#define __TONEGEND_MAINLOOP_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#include <dbus/dbus.h>
+#include <pulse/pulseaudio.h>
+
+/*
+ * The main loop everything but the optional render thread runs on. It
+ * is GLib by default; configure --enable-epoll replaces it by a minimal
+ * epoll/timerfd loop. Either way the rest of the daemon sees it only
+ * through the pa_mainloop_api returned by mainloop_get_api().
+ */
+
+struct mainloop_stats {
+    uint64_t  start;        /* monotonic usec at mainloop_create() */
+    uint64_t  wakeup;       /* monotonic usec of the last wakeup */
+    uint32_t  wakeups;      /* returns from poll */
+    uint32_t  requests;     /* D-Bus method calls dispatched */
+    uint64_t  latsum;       /* wakeup to method handler, usec */
+    uint32_t  latmax;
+};
+
+/* backend: glibloop.c or epolloop.c */
+extern const char *mainloop_backend;
+
+int  mainloop_create(void);
+void mainloop_destroy(void);
+pa_mainloop_api *mainloop_get_api(void);
+void mainloop_run(void);
+int  mainloop_quit(void);
+int  mainloop_setup_dbus(DBusConnection *);
+
+/* common: mainloop.c */
+void mainloop_stats_reset(void);
+void mainloop_woke_up(void);
+void mainloop_request_dispatched(void);
+void mainloop_print_stats(void);
+int  mainloop_attach_dbus(pa_mainloop_api *, DBusConnection *);
+void mainloop_detach_dbus(DBusConnection *);
+
+#endif /* __TONEGEND_MAINLOOP_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,473 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+
+#include "plan.h"
+
+/*
+ * Compiles the text tone plan, toneplan.txt, into the binary one that
+ * the daemon maps (see plan.h). A line that starts with a two letter
+ * country code and the name of the country starts a country; the
+ * indented lines after it are its tones, one per event:
+ *
+ *   <event> <step>[,<step>...] [x<count>]
+ *
+ * where an event is one of dial, busy, congest, radio_ack, radio_na,
+ * error, wait and ring, and a step is the frequencies that play for
+ * a while, e.g. 350+440/2000, or 0/4000 for silence. The steps repeat
+ * until the tone is stopped or, with x<count>, <count> times. A single
+ * step without a time is a continuous tone. The tones of the 'default'
+ * country are used by the countries that do not have their own.
+ *
+ * The plan is written in the byte order of the machine running this,
+ * or in the one given with -e for a cross build.
+ */
+
+#define MAXFREQ   4             /* frequencies of a step */
+#define MAXSTEP   16            /* steps of a tone */
+
+struct event {
+    int               defined;
+    int               count;
+    uint32_t          length;
+    struct plan_tone  tone[PLAN_MAXTONE];
+};
+
+struct entry {
+    char          code[4];
+    char          name[28];
+    struct event  event[PLAN_EVENTS];
+};
+
+static void usage(char *, int);
+static int parse(FILE *, char *);
+static int parse_country(char *, struct entry **);
+static int parse_event(char *, struct entry *);
+static int compile(char *, struct event *);
+static int write_plan(char *);
+static int compare(const void *, const void *);
+static uint16_t order16(uint16_t);
+static uint32_t order32(uint32_t);
+
+static char *event_names[PLAN_EVENTS] = {
+    "dial", "busy", "congest", "radio_ack", "radio_na", "error", "wait", "ring"
+};
+
+static struct entry   entries[PLAN_CODES];
+static int            nentry;
+static struct entry   defaults;
+static char          *source;
+static int            lineno;
+static int            swap;         /* other byte order than ours */
+
+
+int main(int argc, char **argv)
+{
+    const uint16_t one = 1;
+    int            big = *(const uint8_t *)&one == 0;
+    FILE          *f;
+    int            sts;
+    int            opt;
+
+    while ((opt = getopt(argc, argv, "e:h")) != -1) {
+        switch (opt) {
+        case 'e':
+            if (!strcmp(optarg, "big"))
+                swap = !big;
+            else if (!strcmp(optarg, "little"))
+                swap = big;
+            else
+                usage(argv[0], EINVAL);
+            break;
+        case 'h':   usage(argv[0], 0);          break;
+        default:    usage(argv[0], EINVAL);     break;
+        }
+    }
+
+    if (argc - optind != 2)
+        usage(argv[0], EINVAL);
+
+    source = argv[optind];
+
+    if ((f = fopen(source, "r")) == NULL) {
+        fprintf(stderr, "Can't open '%s': %s\n", source, strerror(errno));
+        return errno;
+    }
+
+    sts = parse(f, source);
+    fclose(f);
+
+    if (sts < 0)
+        return EINVAL;
+
+    return write_plan(argv[optind + 1]) < 0 ? EIO : 0;
+}
+
+
+static void usage(char *argv0, int exit_code)
+{
+    printf("usage: %s [-h] [-e {big | little}] toneplan.txt toneplan\n",
+           basename(argv0));
+    exit(exit_code);
+}
+
+static int parse(FILE *f, char *path)
+{
+    struct entry *entry = NULL;
+    char          line[512];
+    char         *p;
+    int           err = 0;
+
+    for (lineno = 1;  fgets(line, sizeof(line), f);  lineno++) {
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+
+        for (p = line + strlen(line);  p > line && isspace(p[-1]);  )
+            *--p = '\0';
+
+        if (!line[0])
+            continue;
+
+        if (!isspace(line[0])) {
+            if (parse_country(line, &entry) < 0)
+                err = -1;
+        }
+        else if (entry == NULL) {
+            fprintf(stderr, "%s:%d: tone outside of a country\n",
+                    path, lineno);
+            err = -1;
+        }
+        else if (parse_event(line + strspn(line, " \t"), entry) < 0)
+            err = -1;
+    }
+
+    return err;
+}
+
+static int parse_country(char *line, struct entry **entry)
+{
+    char *code = line;
+    char *name;
+    int   i;
+
+    name  = code + strcspn(code, " \t");
+    *name = '\0';
+    name += 1 + strspn(name + 1, " \t");
+
+    if (!strcmp(code, "default")) {
+        *entry = &defaults;
+        return 0;
+    }
+
+    if (strlen(code) != 2 || !islower(code[0]) || !islower(code[1])) {
+        fprintf(stderr, "%s:%d: invalid country code '%s'\n",
+                source, lineno, code);
+        return -1;
+    }
+
+    for (i = 0;  i < nentry;  i++) {
+        if (!strcmp(entries[i].code, code)) {
+            fprintf(stderr, "%s:%d: country '%s' is already defined\n",
+                    source, lineno, code);
+            return -1;
+        }
+    }
+
+    *entry = entries + nentry++;
+
+    strcpy((*entry)->code, code);
+    strncpy((*entry)->name, name, sizeof((*entry)->name) - 1);
+
+    return 0;
+}
+
+static int parse_event(char *line, struct entry *entry)
+{
+    struct event *ev;
+    char         *spec;
+    int           i;
+
+    spec  = line + strcspn(line, " \t");
+    *spec = '\0';
+    spec += 1 + strspn(spec + 1, " \t");
+
+    for (i = 0;  i < PLAN_EVENTS;  i++) {
+        if (!strcmp(line, event_names[i]))
+            break;
+    }
+
+    if (i >= PLAN_EVENTS) {
+        fprintf(stderr, "%s:%d: invalid event '%s'\n", source, lineno, line);
+        return -1;
+    }
+
+    ev = entry->event + i;
+
+    if (ev->defined) {
+        fprintf(stderr, "%s:%d: '%s' is already defined\n",
+                source, lineno, line);
+        return -1;
+    }
+
+    if (compile(spec, ev) < 0) {
+        fprintf(stderr, "%s:%d: invalid %s tone '%s'\n",
+                source, lineno, line, spec);
+        return -1;
+    }
+
+    ev->defined = 1;
+
+    return 0;
+}
+
+/*
+ * a step of the tone becomes one tone_create() per frequency, that
+ * plays in every period from the start of the step on
+ */
+static int compile(char *spec, struct event *ev)
+{
+    struct step {
+        int       nfreq;
+        uint32_t  freq[MAXFREQ];
+        uint32_t  msec;
+        uint32_t  start;
+    }                  steps[MAXSTEP];
+    struct step       *st;
+    struct plan_tone  *t;
+    uint32_t           period;
+    unsigned long      count = 0;
+    unsigned long      v;
+    char              *p = spec;
+    int                nstep;
+    int                i, j;
+
+    for (nstep = 0, period = 0;  ;  nstep++) {
+        if (nstep >= MAXSTEP)
+            return -1;
+
+        st = steps + nstep;
+        memset(st, 0, sizeof(*st));
+
+        for (;;) {
+            v = strtoul(p, &p, 10);
+
+            if (v > 20000)
+                return -1;
+
+            if (v > 0) {
+                if (st->nfreq >= MAXFREQ)
+                    return -1;
+                st->freq[st->nfreq++] = v;
+            }
+
+            if (*p != '+')
+                break;
+            p++;
+        }
+
+        if (*p == '/') {
+            if ((v = strtoul(p + 1, &p, 10)) < 1 || v > 60000)
+                return -1;
+            st->msec = v;
+        }
+
+        st->start = period;
+        period   += st->msec;
+
+        if (*p != ',')
+            break;
+        p++;
+    }
+
+    nstep++;
+
+    if (*p) {
+        p += strspn(p, " \t");
+
+        if (*p++ != 'x' || (count = strtoul(p, &p, 10)) < 1 || count > 100 ||
+            *p)
+            return -1;
+    }
+
+    /* a continuous tone */
+    if (period == 0) {
+        if (nstep > 1 || count > 0)
+            return -1;
+        steps[0].msec = period = 1000;
+    }
+    else {
+        for (i = 0;  i < nstep;  i++) {
+            if (steps[i].msec == 0)
+                return -1;
+        }
+    }
+
+    if (count * period > 600000)
+        return -1;
+
+    ev->count  = 0;
+    ev->length = count * period * 1000;
+
+    for (i = 0, st = steps;  i < nstep;  i++, st++) {
+        for (j = 0;  j < st->nfreq;  j++) {
+            if (ev->count >= PLAN_MAXTONE)
+                return -1;
+
+            t = ev->tone + ev->count++;
+
+            t->freq     = st->freq[j];
+            t->level    = st->nfreq > 1 ? 140 / st->nfreq : 100;
+            t->period   = period * 1000;
+            t->play     = st->msec * 1000;
+            t->start    = st->start * 1000;
+            t->duration = count ? ev->length - t->start : 0;
+        }
+    }
+
+    return 0;
+}
+
+static int write_plan(char *path)
+{
+    static struct plan_header  hdr;
+    static struct plan_header  out;
+    struct plan_country        country;
+    struct plan_tone           tone;
+    struct entry              *entry;
+    struct event              *ev;
+    FILE                      *f;
+    uint32_t                   ntone;
+    int                        i, j, k;
+
+    qsort(entries, nentry, sizeof(entries[0]), compare);
+
+    hdr.magic    = PLAN_MAGIC;
+    hdr.version  = PLAN_VERSION;
+    hdr.ncountry = nentry;
+    hdr.ntone    = 0;
+
+    for (i = 0, entry = entries;  i < nentry;  i++, entry++) {
+        hdr.index[(entry->code[0]-'a') * 26 + (entry->code[1]-'a')] = i + 1;
+
+        for (j = 0;  j < PLAN_EVENTS;  j++) {
+            if (!entry->event[j].defined)
+                entry->event[j] = defaults.event[j];
+
+            hdr.ntone += entry->event[j].count;
+        }
+    }
+
+    if (hdr.ntone > UINT16_MAX) {
+        fprintf(stderr, "too many tones (%u)\n", hdr.ntone);
+        return -1;
+    }
+
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Can't create '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    out.magic    = order32(hdr.magic);
+    out.version  = order32(hdr.version);
+    out.ncountry = order32(hdr.ncountry);
+    out.ntone    = order32(hdr.ntone);
+
+    for (i = 0;  i < PLAN_CODES;  i++)
+        out.index[i] = order16(hdr.index[i]);
+
+    fwrite(&out, sizeof(out), 1, f);
+
+    for (i = 0, ntone = 0, entry = entries;  i < nentry;  i++, entry++) {
+        memset(&country, 0, sizeof(country));
+        memcpy(country.code, entry->code, sizeof(country.code));
+        memcpy(country.name, entry->name, sizeof(country.name));
+
+        for (j = 0;  j < PLAN_EVENTS;  j++) {
+            ev = entry->event + j;
+
+            country.event[j].first  = order16(ntone);
+            country.event[j].count  = order16(ev->count);
+            country.event[j].length = order32(ev->length);
+
+            ntone += ev->count;
+        }
+
+        fwrite(&country, sizeof(country), 1, f);
+    }
+
+    for (i = 0, entry = entries;  i < nentry;  i++, entry++) {
+        for (j = 0;  j < PLAN_EVENTS;  j++) {
+            ev = entry->event + j;
+
+            for (k = 0;  k < ev->count;  k++) {
+                tone.freq     = order32(ev->tone[k].freq);
+                tone.level    = order32(ev->tone[k].level);
+                tone.period   = order32(ev->tone[k].period);
+                tone.play     = order32(ev->tone[k].play);
+                tone.start    = order32(ev->tone[k].start);
+                tone.duration = order32(ev->tone[k].duration);
+
+                fwrite(&tone, sizeof(tone), 1, f);
+            }
+        }
+    }
+
+    if (ferror(f) | (fclose(f) != 0)) {
+        fprintf(stderr, "Can't write '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    printf("%s: %d countries, %u tones\n", path, nentry, hdr.ntone);
+
+    return 0;
+}
+
+static int compare(const void *a, const void *b)
+{
+    return strcmp(((struct entry *)a)->code, ((struct entry *)b)->code);
+}
+
+static uint16_t order16(uint16_t v)
+{
+    return swap ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+static uint32_t order32(uint32_t v)
+{
+    return swap ? ((v >> 24) | ((v >> 8) & 0xff00) |
+                   ((v << 8) & 0xff0000) | (v << 24)) : v;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
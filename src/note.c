@@ -29,6 +29,7 @@ USA.
 #include <log/log.h>
 #include <trace/trace.h>
 
+#include "ausrv.h"
 #include "stream.h"
 #include "tone.h"
 #include "note.h"
@@ -41,6 +42,8 @@ USA.
 
 static char *note_stream = STREAM_NOTES;
 
+static void play_command(struct ausrv *, uintptr_t *);
+
 static uint32_t   frequencies[OCTAVE_DIM][NOTE_DIM] = {
     /*  Ab     A     B     H     C    Db     D    Eb     E     F    Gb     G*/
     {0,   0,  220,  233,  247,  262,  277,  294,  311,  338,  349,  370,  392},
@@ -69,10 +72,30 @@ int note_init(int argc, char **argv)
     return 0;
 }
 
+/*
+ * The duration of a note is 60000000 / (beat * fract) usec, so neither
+ * of them can be zero.
+ */
+int note_check(int note, int scale, int beat, int style, int fract,
+               uint32_t vol)
+{
+    int octave = scale - 3;
+
+    if (note   < 0 || note   >= NOTE_DIM   ||
+        octave < 0 || octave >= OCTAVE_DIM ||
+        beat   < 1 || beat   >= 200        ||
+        style  < 0 || style  >= STYLE_DIM  ||
+        fract  < 1 || fract  >  32         ||
+        vol    < 1 || vol    >  100)
+        return -EINVAL;
+
+    return 0;
+}
+
 void note_play(struct ausrv *ausrv, int note, int scale, int beat,
 	       int style, int fract, uint32_t vol, int idx)
 {
-    struct stream *stream = stream_find(ausrv, note_stream);
+    struct stream *stream;
     int            octave = scale - 3;
     int            type;
     uint32_t       freq;
@@ -80,16 +103,19 @@ void note_play(struct ausrv *ausrv, int note, int scale, int beat,
     uint32_t       play;
     uint32_t       dur;
 
-    if (note   < 0 || note   >= NOTE_DIM   ||
-        octave < 0 || octave >= OCTAVE_DIM ||
-        beat   < 0 || beat   >= 200        ||
-        style  < 0 || style  >= STYLE_DIM  ||
-        fract  < 1 || fract  >  32         ||
-        vol    < 1 || vol    >  100        ||
-        idx    < 0 || idx >= (int)(sizeof(types)/sizeof(types[0]))) {
+    if (note_check(note, scale, beat, style, fract, vol) < 0 ||
+        idx < 0 || idx >= (int)(sizeof(types)/sizeof(types[0]))) {
         return;
     }
 
+    /* the arguments are range checked so they fit to 16 bits */
+    if (ausrv_queue_command(ausrv, play_command,
+                            (note  << 16) | scale, (beat << 16) | style,
+                            (fract << 16) | vol  , idx))
+        return;
+
+    stream = stream_find(ausrv, note_stream);
+
     if (stream == NULL) {
         stream = stream_create(ausrv, note_stream, NULL, 0,
                                tone_write_callback,
@@ -101,6 +127,8 @@ void note_play(struct ausrv *ausrv, int note, int scale, int beat,
             LOG_ERROR("%s(): Can't create stream", __FUNCTION__);
             return;
         }
+
+        stream_set_checkpoint(stream, tone_save, tone_restore, tone_discard);
     }
         
     type   = types[idx];
@@ -114,6 +142,12 @@ void note_play(struct ausrv *ausrv, int note, int scale, int beat,
     tone_create(stream, type, freq, vol, period, play, 0, dur);
 }
 
+static void play_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    note_play(ausrv, arg[0] >> 16, (int16_t)arg[0], arg[1] >> 16,
+              (int16_t)arg[1], arg[2] >> 16, (uint16_t)arg[2], arg[3]);
+}
+
 
 
 /*
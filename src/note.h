@@ -58,6 +58,7 @@ USA.
 #define STYLE_DIM       3
 
 int note_init(int, char **);
+int note_check(int, int, int, int, int, uint32_t);
 void note_play(struct ausrv *, int, int, int, int, int, uint32_t, int);
 
 
@@ -21,7 +21,6 @@ USA.
 
 #define _GNU_SOURCE
 
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -31,6 +30,7 @@ USA.
 
 #include "tonegend.h"
 #include "dbusif.h"
+#include "ausrv.h"
 #include "tone.h"
 #include "stream.h"
 #include "notification.h"
@@ -52,9 +52,10 @@ struct method {
 
 static int start_notif_tone(DBusMessage *, struct tonegend *);
 static int stop_tone(DBusMessage *, struct tonegend *);
-static uint32_t linear_volume(int);
 static void notif_play(struct ausrv *ausrv, int type, uint32_t vol, int dur);
 static void notif_stop(struct ausrv *ausrv, int kill_stream);
+static void play_command(struct ausrv *, uintptr_t *);
+static void stop_command(struct ausrv *, uintptr_t *);
 
 static struct method  method_defs[] = {
     {NOTIF_INTERFACE, "StartNotificationTone", "uiu", start_notif_tone},
@@ -115,7 +116,7 @@ static int start_notif_tone(DBusMessage *msg, struct tonegend *tonegend)
         return FALSE;
     }
 
-    volume = linear_volume(dbm0);
+    volume = (vol_scale * tone_linear_volume(dbm0)) / 100;
 
     
 
@@ -123,17 +124,7 @@ static int start_notif_tone(DBusMessage *msg, struct tonegend *tonegend)
           __FUNCTION__, event, dbm0, volume, duration);
 
 
-    switch (event) {
-    case 66:  beeptype = TONE_DIAL;      break;
-    case 72:  beeptype = TONE_BUSY;      break;
-    case 73:  beeptype = TONE_CONGEST;   break;
-    case 256: beeptype = TONE_RADIO_ACK; break;
-    case 257: beeptype = TONE_RADIO_NA;  break;
-    case 74:  beeptype = TONE_ERROR;     break;
-    case 79:  beeptype = TONE_WAIT;      break;
-    case 70:  beeptype = TONE_RING;      break;
-        
-    default:
+    if ((beeptype = tone_event_type(event)) < 0) {
         LOG_ERROR("%s(): invalid event %d", __FUNCTION__, event);
         return FALSE;
     }
@@ -155,28 +146,16 @@ static int stop_tone(DBusMessage *msg, struct tonegend *tonegend)
     return TRUE;
 }
 
-/*
- * This function maps the RFC4733 defined
- * power level of 0dbm0 - -63dbm0
- * to the linear range of 0 - 100
- */
-static uint32_t linear_volume(int dbm0)
-{
-    double volume;              /* volume on the scale 0-100 */
-
-    if (dbm0 > 0)   dbm0 = 0;
-    if (dbm0 < -63) dbm0 = -63;
-
-    volume = pow(10.0, (double)(dbm0 + 63) / 20.0) / 14.125375446;
-
-    return (vol_scale * (uint32_t)(volume + 0.5)) / 100;
-}
-
 
 
 static void notif_play(struct ausrv *ausrv, int type, uint32_t vol, int dur)
 {
-    struct stream *stream = stream_find(ausrv, notif_stream);
+    struct stream *stream;
+
+    if (ausrv_queue_latest_command(ausrv, play_command, type, vol, dur, 0))
+        return;
+
+    stream = stream_find(ausrv, notif_stream);
     
     if (stream != NULL) 
         notif_stop(ausrv, FALSE);
@@ -191,6 +170,8 @@ static void notif_play(struct ausrv *ausrv, int type, uint32_t vol, int dur)
             LOG_ERROR("%s(): Can't create stream", __FUNCTION__);
             return;
         }
+
+        stream_set_checkpoint(stream, tone_save, tone_restore, tone_discard);
     }
     
     switch (type) {
@@ -238,9 +219,14 @@ static void notif_play(struct ausrv *ausrv, int type, uint32_t vol, int dur)
 
 static void notif_stop(struct ausrv *ausrv, int kill_stream)
 {
-    struct stream *stream = stream_find(ausrv, notif_stream);
+    struct stream *stream;
     struct tone   *tone;
     struct tone   *hd;
+
+    if (ausrv_queue_passive_command(ausrv, stop_command, kill_stream, 0,0,0))
+        return;
+
+    stream = stream_find(ausrv, notif_stream);
     
     if (stream != NULL) {
         if (kill_stream)
@@ -255,6 +241,16 @@ static void notif_stop(struct ausrv *ausrv, int kill_stream)
     }
 }
 
+static void play_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    notif_play(ausrv, arg[0], arg[1], arg[2]);
+}
+
+static void stop_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    notif_stop(ausrv, arg[0]);
+}
+
 
 void notif_set_properties(char *propstring)
 {
@@ -0,0 +1,467 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "stream.h"
+#include "tone.h"
+#include "indicator.h"
+#include "pcmcache.h"
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define FNV_BASIS  2166136261U
+#define FNV_PRIME  16777619U
+
+static uint32_t setup_tones(uint32_t, struct stream **, uint32_t *);
+static int map_cache(const char *, uint32_t, uint32_t);
+static int valid_cache(struct pcmcache_header *, size_t, uint32_t, uint32_t);
+static int build_cache(const char *, uint32_t, uint32_t, struct stream **,
+                       uint32_t *);
+static int write_all(int, const void *, size_t);
+static char *default_dir(void);
+static int make_dir(const char *);
+static uint32_t checksum(struct pcmcache_header *);
+static uint32_t fnv(uint32_t, const void *, size_t);
+
+static struct pcmcache_header *cache;
+static size_t                  size;
+static const int16_t          *samples;
+static int                     stale;
+
+
+/*
+ * maps the cache of the current indicator tones at 'rate' from 'dir'
+ * (by default under $XDG_CACHE_HOME), building it first if it is
+ * missing or was made for other tones
+ */
+int pcmcache_open(const char *dir, uint32_t rate)
+{
+    struct stream *streams[PCMCACHE_EVENTS];
+    uint32_t       periods[PCMCACHE_EVENTS];
+    char           path[PATH_MAX];
+    char          *defdir = NULL;
+    uint32_t       key;
+    int            sts = -1;
+    int            i;
+
+    if (dir == NULL && (dir = defdir = default_dir()) == NULL) {
+        LOG_ERROR("%s(): no cache directory", __FUNCTION__);
+        return -1;
+    }
+
+    if (make_dir(dir) < 0) {
+        LOG_ERROR("%s(): Can't create '%s': %s", __FUNCTION__, dir,
+                  strerror(errno));
+        free(defdir);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/" PCMCACHE_FILE, dir, rate);
+    free(defdir);
+
+    pcmcache_close();
+
+    key = setup_tones(rate, streams, periods);
+
+    if (map_cache(path, key, rate) == 0)
+        sts = 0;
+    else if (build_cache(path, key, rate, streams, periods) == 0)
+        sts = map_cache(path, key, rate);
+
+    for (i = 0;  i < PCMCACHE_EVENTS;  i++)
+        stream_destroy_detached(streams[i]);
+
+    stale = FALSE;
+
+    return sts;
+}
+
+void pcmcache_close(void)
+{
+    if (cache != NULL) {
+        munmap(cache, size);
+        cache   = NULL;
+        size    = 0;
+        samples = NULL;
+    }
+}
+
+/*
+ * the indicator tones changed; the cache stays mapped for the tones
+ * that still play from it, and is rebuilt on the next start
+ */
+void pcmcache_invalidate(void)
+{
+    stale = TRUE;
+}
+
+/*
+ * plays the tone of 'type' from the cache, if it is there,
+ * cut at 'dur' usec if that is given
+ */
+struct tone *pcmcache_create_tone(struct stream *stream, int type,
+                                  uint32_t vol, int dur)
+{
+    const struct pcmcache_loop *loop;
+
+    if (cache == NULL || stale || stream->rate != cache->rate ||
+        type < TONE_DIAL || type > TONE_RING)
+        return NULL;
+
+    loop = cache->loop + (type - TONE_DIAL);
+
+    if (!loop->total)
+        return NULL;
+
+    TRACE("%s(): tone %d from the cache", __FUNCTION__, type);
+
+    return tone_create_pcm(stream, type, samples + loop->offset,
+                           loop->head, loop->total, vol, dur > 0 ? dur : 0);
+}
+
+
+/*
+ * sets up the tones of every event on a detached stream at full
+ * volume and finds the ones that can be looped; the key is a hash
+ * of all of them
+ */
+static uint32_t setup_tones(uint32_t rate, struct stream **streams,
+                            uint32_t *periods)
+{
+    struct tone *tone;
+    uint32_t     key = FNV_BASIS;
+    uint32_t     words[8];
+    int          type;
+    int          i;
+
+    words[0] = PCMCACHE_VERSION;
+    words[1] = rate;
+    key = fnv(key, words, 2 * sizeof(uint32_t));
+
+#ifdef PACKAGE_VERSION
+    key = fnv(key, PACKAGE_VERSION, strlen(PACKAGE_VERSION));
+#endif
+
+    for (i = 0;  i < PCMCACHE_EVENTS;  i++) {
+        type       = TONE_DIAL + i;
+        periods[i] = 0;
+        streams[i] = stream_create_detached(NULL, "pcm cache", rate,
+                                            tone_write_callback,
+                                            tone_destroy_callback, NULL);
+        if (streams[i] == NULL)
+            continue;
+
+        indicator_create_tones(streams[i], type, 100, 0);
+
+        if ((periods[i] = tone_loop_period(streams[i])) > PCMCACHE_MAXPERIOD)
+            periods[i] = 0;
+
+        key = fnv(key, periods + i, sizeof(uint32_t));
+
+        if (!periods[i])
+            continue;
+
+        for (tone = streams[i]->data;  tone;  tone = tone->next) {
+            words[0] = tone->type;
+            words[1] = tone->freq;
+            words[2] = tone->period;
+            words[3] = tone->play;
+            words[4] = (uint32_t)tone->start;
+            words[5] = tone->reltime;
+            words[6] = (uint32_t)tone->singen.offs;
+            words[7] = (uint32_t)(tone->singen.offs >> 32);
+
+            key = fnv(key, words, sizeof(words));
+        }
+    }
+
+    return key;
+}
+
+static int map_cache(const char *path, uint32_t key, uint32_t rate)
+{
+    struct pcmcache_header *hdr;
+    struct stat             st;
+    int                     fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return -1;
+    }
+
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (hdr == MAP_FAILED) {
+        LOG_ERROR("%s(): Can't map '%s': %s", __FUNCTION__, path,
+                  strerror(errno));
+        return -1;
+    }
+
+    if (!valid_cache(hdr, st.st_size, key, rate)) {
+        TRACE("%s(): '%s' is out of date", __FUNCTION__, path);
+        munmap(hdr, st.st_size);
+        return -1;
+    }
+
+    cache   = hdr;
+    size    = st.st_size;
+    samples = (const int16_t *)(hdr + 1);
+
+    TRACE("%s(): mapped '%s' (%zu bytes)", __FUNCTION__, path, size);
+
+    return 0;
+}
+
+static int valid_cache(struct pcmcache_header *hdr, size_t len,
+                       uint32_t key, uint32_t rate)
+{
+    struct pcmcache_loop *loop;
+    int                   i;
+
+    if (hdr->magic   != PCMCACHE_MAGIC   ||
+        hdr->version != PCMCACHE_VERSION ||
+        hdr->checksum != checksum(hdr)   ||
+        hdr->key     != key              ||
+        hdr->rate    != rate             ||
+        hdr->format  != PCMCACHE_S16     ||
+        len != sizeof(*hdr) + (size_t)hdr->nsample * sizeof(int16_t))
+        return FALSE;
+
+    for (i = 0;  i < PCMCACHE_EVENTS;  i++) {
+        loop = hdr->loop + i;
+
+        if (loop->total && (loop->head >= loop->total  ||
+                            loop->total > hdr->nsample ||
+                            loop->offset > hdr->nsample - loop->total))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * renders the first two periods of every tone that can be looped and
+ * replaces the cache file with them in one go
+ */
+static int build_cache(const char *path, uint32_t key, uint32_t rate,
+                       struct stream **streams, uint32_t *periods)
+{
+    struct pcmcache_header  hdr;
+    struct pcmcache_loop   *loop;
+    struct stream          *stream;
+    int16_t                *buf = NULL;
+    char                    tmp[PATH_MAX];
+    uint64_t                n;
+    int                     fd;
+    int                     i;
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    hdr.magic   = PCMCACHE_MAGIC;
+    hdr.version = PCMCACHE_VERSION;
+    hdr.key     = key;
+    hdr.rate    = rate;
+    hdr.format  = PCMCACHE_S16;
+
+    for (i = 0;  i < PCMCACHE_EVENTS;  i++) {
+        if (periods[i] && streams[i] != NULL) {
+            n    = (uint64_t)periods[i] * rate / 1000000ULL;
+            loop = hdr.loop + i;
+
+            loop->offset = hdr.nsample;
+            loop->head   = n;
+            loop->total  = 2 * n;
+
+            hdr.nsample += 2 * n;
+        }
+    }
+
+    hdr.checksum = checksum(&hdr);
+
+    if (hdr.nsample > 0 &&
+        (buf = malloc(hdr.nsample * sizeof(int16_t))) == NULL)
+    {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+
+    for (i = 0;  i < PCMCACHE_EVENTS;  i++) {
+        loop   = hdr.loop + i;
+        stream = streams[i];
+
+        if (loop->total) {
+            stream->time = stream->write(stream, buf + loop->offset,
+                                         loop->total);
+        }
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    if ((fd = mkostemp(tmp, O_CLOEXEC)) < 0) {
+        LOG_ERROR("%s(): Can't create '%s': %s", __FUNCTION__, tmp,
+                  strerror(errno));
+        free(buf);
+        return -1;
+    }
+
+    if (fchmod(fd, 0644) < 0                                  ||
+        write_all(fd, &hdr, sizeof(hdr)) < 0                  ||
+        write_all(fd, buf, hdr.nsample * sizeof(int16_t)) < 0 ||
+        fsync(fd) < 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    free(buf);
+
+    if (fd < 0 || close(fd) < 0 || rename(tmp, path) < 0) {
+        LOG_ERROR("%s(): Can't write '%s': %s", __FUNCTION__, path,
+                  strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+
+    TRACE("%s(): '%s': %u samples", __FUNCTION__, path, hdr.nsample);
+
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    ssize_t     n;
+
+    while (len > 0) {
+        if ((n = write(fd, p, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p   += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static char *default_dir(void)
+{
+    char *dir = NULL;
+    char *env;
+
+    if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] == '/') {
+        if (asprintf(&dir, "%s/" PCMCACHE_DIR, env) < 0)
+            dir = NULL;
+    }
+    else if ((env = getenv("HOME")) != NULL && env[0] == '/') {
+        if (asprintf(&dir, "%s/.cache/" PCMCACHE_DIR, env) < 0)
+            dir = NULL;
+    }
+
+    return dir;
+}
+
+/* mkdir -p */
+static int make_dir(const char *dir)
+{
+    char  path[PATH_MAX];
+    char *p;
+    char  c;
+
+    if (snprintf(path, sizeof(path), "%s", dir) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    for (p = path + 1;  ;  p++) {
+        if (*p == '/' || *p == '\0') {
+            c  = *p;
+            *p = '\0';
+
+            if (mkdir(path, 0755) < 0 && errno != EEXIST)
+                return -1;
+
+            if ((*p = c) == '\0')
+                break;
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t checksum(struct pcmcache_header *hdr)
+{
+    struct pcmcache_header copy = *hdr;
+
+    copy.checksum = 0;
+
+    return fnv(FNV_BASIS, &copy, sizeof(copy));
+}
+
+static uint32_t fnv(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
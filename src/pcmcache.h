@@ -0,0 +1,83 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_PCMCACHE_H__
+#define __TONEGEND_PCMCACHE_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#include "tone.h"
+
+/*
+ * On-disk cache of the endless indicator tones of the active standard
+ * or country, rendered at full volume. Every tone is stored as its
+ * first period followed by its steady state period, which is looped.
+ * The file is mapped shared and the tones play straight from it (see
+ * tone_create_pcm()), so instances at the same rate share the pages.
+ * It is rebuilt when the key, a hash of the tone definitions, does not
+ * match; the checksum guards the header.
+ */
+
+#define PCMCACHE_DIR        "tonegend"      /* under $XDG_CACHE_HOME */
+#define PCMCACHE_FILE       "tones-%u.pcm"  /* by sample rate */
+#define PCMCACHE_MAGIC      0x6d637074      /* "tpcm" */
+#define PCMCACHE_VERSION    1
+#define PCMCACHE_EVENTS     (TONE_RING - TONE_DIAL + 1)
+#define PCMCACHE_MAXPERIOD  6000000         /* usec */
+
+#define PCMCACHE_S16        0               /* host byte order */
+
+struct pcmcache_loop {
+    uint32_t  offset;           /* of the first sample */
+    uint32_t  head;             /* samples of the first period */
+    uint32_t  total;            /* head + loop, or 0 if not cached */
+};
+
+struct pcmcache_header {
+    uint32_t              magic;
+    uint32_t              version;
+    uint32_t              key;
+    uint32_t              rate;
+    uint32_t              format;
+    uint32_t              nsample;
+    struct pcmcache_loop  loop[PCMCACHE_EVENTS];   /* TONE_DIAL ... */
+    uint32_t              checksum;
+};
+
+struct stream;
+
+int pcmcache_open(const char *, uint32_t);
+void pcmcache_close(void);
+void pcmcache_invalidate(void);
+struct tone *pcmcache_create_tone(struct stream *, int, uint32_t, int);
+
+#endif /* __TONEGEND_PCMCACHE_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
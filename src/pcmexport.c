@@ -0,0 +1,801 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "tonegend.h"
+#include "dbusif.h"
+#include "ausrv.h"
+#include "mainloop.h"
+#include "stream.h"
+#include "tone.h"
+#include "indicator.h"
+#include "dtmf.h"
+#include "cadence.h"
+#include "pcmexport.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define MAX_DURATION  600000    /* msec */
+#define DIAL_MAXLEN   64
+#define DIAL_MINDUR   40        /* msec, tone and pause (ITU-T Q.24) */
+#define DIAL_MAXDUR   10000     /* msec, both tone and pause */
+
+#define OWNER_RULE  "type='signal',sender='" DBUS_SERVICE_DBUS "',"  \
+                    "member='NameOwnerChanged',arg0='%s'"
+
+#define RENDER_INDICATOR  0
+#define RENDER_DTMF       1
+#define RENDER_CADENCE    2
+
+struct method {
+    char  *intf;                                    /* interface name */
+    char  *memb;                                    /* method name */
+    char  *sig;                                     /* signature */
+    int  (*func)(DBusMessage *, struct tonegend *); /* implementing function */
+};
+
+/*
+ * Set up on the D-Bus side, which creates the memfd and replies with
+ * it. The audio side, which knows the tones, sets them up on a detached
+ * stream and posts the render back to the main loop. That renders into
+ * the memfd, off the render thread, and finally seals it. Only the main
+ * loop touches 'exports'.
+ */
+struct export {
+    struct ausrv_post   post;       /* first: back from the audio side */
+    struct export      *next;
+    struct ausrv       *ausrv;
+    char               *owner;      /* unique name of the client */
+    int                 stopped;    /* before it was handed back */
+    uint32_t            id;
+    int                 fd;
+    struct pcmx_header *hdr;
+    int16_t            *buf;
+    size_t              mapsize;
+    int                 ring;
+    int                 what;       /* RENDER_xxx */
+    uint32_t            type;       /* indicator type or tone id */
+    char               *digits;     /* RENDER_DTMF */
+    uint32_t            on;         /* usec, 0 for a continuous DTMF tone */
+    uint32_t            off;
+    uint32_t            vol;
+    uint32_t            dur;        /* usec, 0 if as long as the tone */
+    pa_time_event      *timer;
+    struct stream      *stream;
+    uint64_t            start;      /* usec, wall clock time of the start */
+};
+
+static int render_event(DBusMessage *, struct tonegend *);
+static int render_tone(DBusMessage *, struct tonegend *);
+static int render_dial_string(DBusMessage *, struct tonegend *);
+static int stop_render(DBusMessage *, struct tonegend *);
+static DBusHandlerResult name_owner_changed(DBusConnection *, DBusMessage *,
+                                            void *);
+static int setup(struct tonegend *, struct export *, const char *, uint32_t);
+static int owned(const char *);
+static void start(struct ausrv *, struct export *);
+static void started(struct ausrv *, struct ausrv_post *);
+static void stop(struct export *);
+static void render_callback(pa_mainloop_api *, pa_time_event *,
+                            const struct timeval *, void *);
+static uint32_t render(struct export *);
+static void finish(struct export *, uint32_t);
+static uint32_t samples(uint32_t);
+static uint64_t now(void);
+static void start_command(struct ausrv *, uintptr_t *);
+static void drop_start(uintptr_t *);
+
+static struct method  method_defs[] = {
+    {NULL, "RenderEvent"     , "uiu" , render_event      },
+    {NULL, "RenderTone"      , "uiu" , render_tone       },
+    {NULL, "RenderDialString", "suui", render_dial_string},
+    {NULL, "StopRender"      , "u"   , stop_render       },
+    {NULL, NULL, NULL, NULL}
+};
+
+static uint32_t        rate = 48000;
+static uint32_t        nextid = 1;
+static int             active;      /* renders not finished yet */
+static struct export  *exports;
+
+
+int pcmexport_init(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    return 0;
+}
+
+int pcmexport_create(struct tonegend *tonegend, uint32_t sample_rate)
+{
+    DBusConnection *conn = tonegend->dbus_ctx->conn;
+    struct method  *m;
+    int             err;
+    int             sts;
+
+    if (sample_rate)
+        rate = sample_rate;
+
+    for (m = method_defs, err = 0;    m->memb != NULL;    m++) {
+        sts = dbusif_register_input_method(tonegend, m->intf, m->memb,
+                                           m->sig, m->func);
+
+        if (sts < 0) {
+            LOG_ERROR("%s(): Can't register D-Bus method '%s'",
+                      __FUNCTION__, m->memb);
+            err = -1;
+        }
+    }
+
+    /* the renders of a client that leaves the bus are stopped */
+    if (!dbus_connection_add_filter(conn, name_owner_changed, tonegend, NULL)){
+        LOG_ERROR("%s(): Can't add D-Bus filter", __FUNCTION__);
+        err = -1;
+    }
+
+    return err;
+}
+
+
+static int render_event(DBusMessage *msg, struct tonegend *tonegend)
+{
+    static const char *symbols = "0123456789*#ABCD";
+
+    struct export  exp;
+    uint32_t       event;
+    int32_t        dbm0;
+    uint32_t       duration;
+    int            type;
+    int            success;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_UINT32, &event,
+                                    DBUS_TYPE_INT32 , &dbm0,
+                                    DBUS_TYPE_UINT32, &duration,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    memset(&exp, 0, sizeof(exp));
+
+    if (event < DTMF_MAX) {
+        exp.what   = RENDER_DTMF;
+        exp.digits = strndup(symbols + event, 1);
+        exp.on     = duration * 1000;
+
+        if (exp.digits == NULL)
+            return FALSE;
+    }
+    else {
+        exp.what = RENDER_INDICATOR;
+
+        if ((type = tone_event_type(event)) < 0) {
+            LOG_ERROR("%s(): invalid event %d", __FUNCTION__, event);
+            return FALSE;
+        }
+
+        exp.type = type;
+    }
+
+    if (duration > MAX_DURATION) {
+        LOG_ERROR("%s(): invalid duration %u msec", __FUNCTION__, duration);
+        free(exp.digits);
+        return FALSE;
+    }
+
+    TRACE("%s(): event %u volume %d dbm0 duration %u msec",
+          __FUNCTION__, event, dbm0, duration);
+
+    exp.vol = tone_linear_volume(dbm0);
+    exp.dur = duration * 1000;
+
+    return setup(tonegend, &exp, dbus_message_get_sender(msg), exp.dur);
+}
+
+static int render_tone(DBusMessage *msg, struct tonegend *tonegend)
+{
+    struct export  exp;
+    uint32_t       id;
+    int32_t        dbm0;
+    uint32_t       duration;
+    int            success;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_UINT32, &id,
+                                    DBUS_TYPE_INT32 , &dbm0,
+                                    DBUS_TYPE_UINT32, &duration,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    if (!cadence_defined(id) || duration > MAX_DURATION) {
+        LOG_ERROR("%s(): no tone %u or invalid duration %u msec",
+                  __FUNCTION__, id, duration);
+        return FALSE;
+    }
+
+    TRACE("%s(): tone %u volume %d dbm0 duration %u msec",
+          __FUNCTION__, id, dbm0, duration);
+
+    memset(&exp, 0, sizeof(exp));
+    exp.what = RENDER_CADENCE;
+    exp.type = id;
+    exp.vol  = tone_linear_volume(dbm0);
+    exp.dur  = duration * 1000;
+
+    return setup(tonegend, &exp, dbus_message_get_sender(msg), exp.dur);
+}
+
+static int render_dial_string(DBusMessage *msg, struct tonegend *tonegend)
+{
+    struct export  exp;
+    char          *digits;
+    uint32_t       on;
+    uint32_t       off;
+    int32_t        dbm0;
+    char          *p;
+    int            success;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_STRING, &digits,
+                                    DBUS_TYPE_UINT32, &on,
+                                    DBUS_TYPE_UINT32, &off,
+                                    DBUS_TYPE_INT32 , &dbm0,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    for (p = digits;  *p;  p++) {
+        if (*p != ',' && dtmf_symbol(*p) < 0)
+            break;
+    }
+
+    if (*p || p == digits || p - digits > DIAL_MAXLEN ||
+        on  < DIAL_MINDUR || on  > DIAL_MAXDUR        ||
+        off < DIAL_MINDUR || off > DIAL_MAXDUR)
+    {
+        LOG_ERROR("%s(): invalid dial string '%s' (%u/%u msec)",
+                  __FUNCTION__, digits, on, off);
+        return FALSE;
+    }
+
+    TRACE("%s(): '%s' %u/%u msec %d dbm0", __FUNCTION__, digits, on, off,
+          dbm0);
+
+    memset(&exp, 0, sizeof(exp));
+    exp.what = RENDER_DTMF;
+    exp.on   = on  * 1000;
+    exp.off  = off * 1000;
+    exp.vol  = tone_linear_volume(dbm0);
+
+    if ((exp.digits = strdup(digits)) == NULL)
+        return FALSE;
+
+    return setup(tonegend, &exp, dbus_message_get_sender(msg),
+                 dtmf_dial_length(digits, exp.on, exp.off));
+}
+
+static int stop_render(DBusMessage *msg, struct tonegend *tonegend)
+{
+    struct export *exp;
+    const char    *sender;
+    uint32_t       id;
+    int            success;
+
+    (void)tonegend;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_UINT32, &id,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    if (!id || id >= nextid) {
+        LOG_ERROR("%s(): invalid render id %u", __FUNCTION__, id);
+        return FALSE;
+    }
+
+    TRACE("%s(): render %u", __FUNCTION__, id);
+
+    sender = dbus_message_get_sender(msg);
+
+    for (exp = exports;  exp;  exp = exp->next) {
+        if (exp->id == id)
+            break;
+    }
+
+    /* a render that has finished already is ignored */
+    if (exp == NULL)
+        return TRUE;
+
+    if (sender == NULL || strcmp(sender, exp->owner)) {
+        LOG_ERROR("%s(): render %u is not of '%s'", __FUNCTION__, id,
+                  sender ? sender : "<unknown>");
+        return FALSE;
+    }
+
+    stop(exp);
+
+    return TRUE;
+}
+
+static DBusHandlerResult name_owner_changed(DBusConnection *conn,
+                                            DBusMessage    *msg,
+                                            void           *data)
+{
+    struct export *exp;
+    struct export *next;
+    char          *name;
+    char          *before;
+    char          *after;
+    int            success;
+
+    (void)conn;
+    (void)data;
+
+    if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
+        success = dbus_message_get_args(msg, NULL,
+                                        DBUS_TYPE_STRING, &name,
+                                        DBUS_TYPE_STRING, &before,
+                                        DBUS_TYPE_STRING, &after,
+                                        DBUS_TYPE_INVALID);
+
+        if (success && !after[0]) {
+            for (exp = exports;  exp;  exp = next) {
+                next = exp->next;
+
+                if (!strcmp(name, exp->owner)) {
+                    TRACE("%s(): '%s' is gone; stopping render %u",
+                          __FUNCTION__, name, exp->id);
+                    stop(exp);
+                }
+            }
+        }
+    }
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/*
+ * creates the memfd of a render 'length' usec long (0 if not known) for
+ * 'owner', puts it in the reply and hands the render over to the audio
+ * side
+ */
+static int setup(struct tonegend *tonegend, struct export *tmpl,
+                 const char *owner, uint32_t length)
+{
+    DBusConnection     *conn = tonegend->dbus_ctx->conn;
+    struct export      *exp;
+    struct pcmx_header *hdr;
+    uint32_t            size;
+    size_t              mapsize;
+    char                path[64];
+    char                rule[256];
+    int                 fd;
+    int                 rdfd;
+    int                 sts;
+    int                 n;
+
+    if (!dbusif_can_send_fds(tonegend) || owner == NULL) {
+        LOG_ERROR("%s(): D-Bus connection can't pass file descriptors",
+                  __FUNCTION__);
+        free(tmpl->digits);
+        return FALSE;
+    }
+
+    if (active >= PCMX_MAX || (n = owned(owner)) >= PCMX_MAX_CLIENT) {
+        LOG_ERROR("%s(): too many renders", __FUNCTION__);
+        free(tmpl->digits);
+        return FALSE;
+    }
+
+    active++;
+
+    exp = NULL;
+    hdr = MAP_FAILED;
+    fd  = -1;
+
+    tmpl->ring = !length || length > PCMX_MAXLEN;
+    size       = samples(tmpl->ring ? PCMX_RING : length);
+    mapsize    = sizeof(*hdr) + (size_t)size * sizeof(int16_t);
+
+    if ((exp = malloc(sizeof(*exp))) == NULL ||
+        (tmpl->owner = strdup(owner)) == NULL)
+    {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        goto failed;
+    }
+
+    if ((fd = memfd_create("tonegend-pcm", MFD_CLOEXEC|MFD_ALLOW_SEALING)) < 0||
+        ftruncate(fd, mapsize) < 0                                           ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+    {
+        LOG_ERROR("%s(): Can't create memfd: %s", __FUNCTION__,
+                  strerror(errno));
+        goto failed;
+    }
+
+    hdr = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (hdr == MAP_FAILED) {
+        LOG_ERROR("%s(): Can't map memfd: %s", __FUNCTION__, strerror(errno));
+        goto failed;
+    }
+
+    hdr->magic   = PCMX_MAGIC;
+    hdr->version = PCMX_VERSION;
+    hdr->rate    = rate;
+    hdr->size    = size;
+    hdr->length  = samples(length);
+    hdr->flags   = 0;
+    hdr->cursor  = 0;
+
+    *exp         = *tmpl;
+    exp->ausrv   = tonegend->ausrv_ctx;
+    exp->id      = nextid;
+    exp->fd      = fd;
+    exp->hdr     = hdr;
+    exp->buf     = (int16_t *)(hdr + 1);
+    exp->mapsize = mapsize;
+
+    /*
+     * The clients get a read-only descriptor of their own: they can't
+     * write the samples, and their shared mappings don't hold off the
+     * write seal. The reply takes a copy of it.
+     */
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    if ((rdfd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        LOG_ERROR("%s(): Can't reopen memfd: %s", __FUNCTION__,
+                  strerror(errno));
+        goto failed;
+    }
+
+    sts = dbusif_reply_args(tonegend, DBUS_TYPE_UNIX_FD, &rdfd,
+                            DBUS_TYPE_UINT32 , &exp->id,
+                            DBUS_TYPE_INVALID);
+    close(rdfd);
+
+    if (sts < 0) {
+        LOG_ERROR("%s(): Can't add the memfd to the reply", __FUNCTION__);
+        goto failed;
+    }
+
+    TRACE("%s(): render %u: %u samples in a %s", __FUNCTION__, exp->id,
+          hdr->length, exp->ring ? "ring" : "buffer");
+
+    nextid++;
+
+    /* we are told when the client goes */
+    if (n == 0) {
+        snprintf(rule, sizeof(rule), OWNER_RULE, owner);
+        dbus_bus_add_match(conn, rule, NULL);
+    }
+
+    exp->next = exports;
+    exports   = exp;
+
+    start(tonegend->ausrv_ctx, exp);
+
+    return TRUE;
+
+ failed:
+    if (hdr != MAP_FAILED)
+        munmap(hdr, mapsize);
+    if (fd >= 0)
+        close(fd);
+    free(exp);
+    free(tmpl->owner);
+    free(tmpl->digits);
+    active--;
+    return FALSE;
+}
+
+/* how many renders 'owner' has */
+static int owned(const char *owner)
+{
+    struct export *exp;
+    int            n;
+
+    for (exp = exports, n = 0;  exp;  exp = exp->next) {
+        if (!strcmp(owner, exp->owner))
+            n++;
+    }
+
+    return n;
+}
+
+/*
+ * On the audio side: sets up the tones on a detached stream and hands
+ * it back to the main loop to render them; without a stream the render
+ * is stopped there.
+ */
+static void start(struct ausrv *ausrv, struct export *exp)
+{
+    struct cadence *cad;
+    uint32_t        length;
+
+    if (ausrv_queue_owned_command(ausrv, start_command, drop_start,
+                                  (uintptr_t)exp, 0,0,0))
+        return;
+
+    exp->stream = stream_create_detached(ausrv, "pcm export", rate,
+                                         tone_write_callback,
+                                         tone_destroy_callback, NULL);
+    if (exp->stream == NULL) {
+        ausrv_post_main(ausrv, &exp->post, started);
+        return;
+    }
+
+    switch (exp->what) {
+
+    case RENDER_INDICATOR:
+        length = indicator_create_tones(exp->stream, exp->type, exp->vol,
+                                        exp->dur);
+        break;
+
+    case RENDER_DTMF:
+        length = dtmf_create_tones(exp->stream, exp->digits, exp->on,
+                                   exp->off, exp->vol);
+        break;
+
+    case RENDER_CADENCE:
+        if ((cad = cadence_find(exp->type)) == NULL) {
+            stream_destroy_detached(exp->stream);
+            exp->stream = NULL;
+            break;
+        }
+        length = cadence_create_tones(exp->stream, cad, exp->vol, exp->dur);
+        break;
+
+    default:
+        length = 0;
+        break;
+    }
+
+    /* a tone that ends by itself stops the ring when it does */
+    if (exp->stream != NULL && !exp->hdr->length)
+        exp->hdr->length = samples(length);
+
+    ausrv_post_main(ausrv, &exp->post, started);
+}
+
+/* on the main loop: the tones are set up, or the render failed */
+static void started(struct ausrv *ausrv, struct ausrv_post *post)
+{
+    pa_mainloop_api *api = mainloop_get_api();
+    struct export   *exp = (struct export *)post;
+    struct timeval   tv;
+
+    (void)ausrv;
+
+    if (exp->stream == NULL || exp->stopped) {
+        finish(exp, PCMX_STOPPED);
+        return;
+    }
+
+    exp->start = now();
+
+    gettimeofday(&tv, NULL);
+
+    if (!(exp->timer = api->time_new(api, &tv, render_callback, exp))) {
+        LOG_ERROR("%s(): Can't create timer", __FUNCTION__);
+        finish(exp, PCMX_STOPPED);
+    }
+}
+
+/* on the main loop; one not handed back yet is stopped when it is */
+static void stop(struct export *exp)
+{
+    if (exp->timer != NULL)
+        finish(exp, PCMX_STOPPED);
+    else
+        exp->stopped = TRUE;
+}
+
+static void render_callback(pa_mainloop_api *api, pa_time_event *event,
+                            const struct timeval *tv, void *data)
+{
+    struct export  *exp = (struct export *)data;
+    struct timeval  next;
+    uint32_t        wait;
+
+    (void)tv;
+
+    if ((wait = render(exp)) == UINT32_MAX)
+        return;
+
+    gettimeofday(&next, NULL);
+    next.tv_usec += wait;
+
+    if (next.tv_usec >= 1000000) {
+        next.tv_sec  += 1;
+        next.tv_usec -= 1000000;
+    }
+
+    api->time_restart(event, &next);
+}
+
+/*
+ * renders up to a second of the tone, into a buffer as fast as it goes
+ * or into a ring as far as PCMX_AHEAD ahead of the wall clock; returns
+ * in how many usec to go on, or UINT32_MAX if the render is finished.
+ * It runs on the main loop, so a long buffer keeps only that busy, a
+ * second at a time, and not the render thread.
+ */
+static uint32_t render(struct export *exp)
+{
+    struct pcmx_header *hdr    = exp->hdr;
+    struct stream      *stream = exp->stream;
+    uint64_t            cursor = hdr->cursor;
+    uint64_t            target;
+    uint64_t            limit;
+    uint32_t            offs;
+    uint32_t            n;
+
+    if (!exp->ring)
+        target = hdr->length;
+    else {
+        target = ((now() - exp->start + PCMX_AHEAD) * rate) / 1000000;
+
+        if (hdr->length && target > hdr->length)
+            target = hdr->length;
+    }
+
+    limit = cursor + rate;
+
+    if (target > limit)
+        target = limit;
+
+    while (cursor < target) {
+        offs = cursor % hdr->size;
+        n    = hdr->size - offs;
+
+        if (n > target - cursor)
+            n = target - cursor;
+
+        stream->time = stream->write(stream, exp->buf + offs, n);
+        cursor += n;
+    }
+
+    __atomic_store_n(&hdr->cursor, cursor, __ATOMIC_RELEASE);
+
+    if (hdr->length && cursor >= hdr->length)
+        finish(exp, 0);
+    else if (!hdr->length && cursor >= (uint64_t)samples(PCMX_MAXRUN))
+        finish(exp, PCMX_STOPPED);
+    else
+        return (!exp->ring || target == limit) ? 0 : PCMX_TICK;
+
+    return UINT32_MAX;
+}
+
+/* on the main loop: flags the render done, seals the memfd, lets it go */
+static void finish(struct export *exp, uint32_t flags)
+{
+    DBusConnection *conn = exp->ausrv->tonegend->dbus_ctx->conn;
+    struct export **link;
+    char            rule[256];
+
+    if (exp->timer != NULL)
+        mainloop_get_api()->time_free(exp->timer);
+
+    __atomic_store_n(&exp->hdr->flags, flags | PCMX_DONE, __ATOMIC_RELEASE);
+
+    TRACE("%s(): render %u %s at sample %llu", __FUNCTION__, exp->id,
+          (flags & PCMX_STOPPED) ? "stopped" : "done",
+          (unsigned long long)exp->hdr->cursor);
+
+    for (link = &exports;  *link;  link = &(*link)->next) {
+        if (*link == exp) {
+            *link = exp->next;
+            break;
+        }
+    }
+
+    stream_destroy_detached(exp->stream);
+    munmap(exp->hdr, exp->mapsize);
+
+    /* the readers' copies stay as they are */
+    if (fcntl(exp->fd, F_ADD_SEALS, F_SEAL_WRITE) < 0)
+        LOG_ERROR("%s(): Can't seal render %u: %s", __FUNCTION__, exp->id,
+                  strerror(errno));
+
+    close(exp->fd);
+
+    if (!owned(exp->owner)) {
+        snprintf(rule, sizeof(rule), OWNER_RULE, exp->owner);
+        dbus_bus_remove_match(conn, rule, NULL);
+    }
+
+    free(exp->owner);
+    free(exp->digits);
+    free(exp);
+
+    active--;
+}
+
+static uint32_t samples(uint32_t usec)
+{
+    return ((uint64_t)usec * (uint64_t)rate) / 1000000ULL;
+}
+
+static uint64_t now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec;
+}
+
+static void start_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    start(ausrv, (struct export *)arg[0]);
+}
+
+/* a render that was never started; the client sees it stopped */
+static void drop_start(uintptr_t *arg)
+{
+    struct export *exp = (struct export *)arg[0];
+
+    exp->stream = NULL;
+
+    ausrv_post_main(exp->ausrv, &exp->post, started);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,83 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_PCMEXPORT_H__
+#define __TONEGEND_PCMEXPORT_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+/*
+ * Tones rendered into shared memory for clients that mix the audio
+ * themselves. The Render* methods return a memfd that starts with this
+ * header, followed by 'size' mono S16 samples in host byte order at
+ * 'rate'. Sample n of the tone is at n % size; 'cursor' is the number
+ * of samples rendered so far and is stored after the samples it covers.
+ *
+ * A tone of a known length up to PCMX_MAXLEN is rendered as fast as
+ * possible into a buffer of its own length. Any other is rendered into
+ * a ring, PCMX_AHEAD ahead of the wall clock time from its start, so a
+ * reader that keeps up has 'size' minus that to spare. Once 'length'
+ * samples are rendered, or the render is stopped, PCMX_DONE is set and
+ * the memfd is sealed against writes. The length of a tone that ends by
+ * itself is only known once rendering starts; 'length' is valid when
+ * 'cursor' is nonzero or PCMX_DONE is set.
+ */
+
+#define PCMX_MAGIC      0x78637074      /* "tpcx" */
+#define PCMX_VERSION    1
+#define PCMX_MAX        8               /* renders at a time */
+#define PCMX_MAX_CLIENT 4               /* of one client */
+#define PCMX_MAXLEN     60000000        /* usec, in a buffer of its own */
+#define PCMX_MAXRUN     600000000       /* usec, of an endless ring */
+#define PCMX_RING       2000000         /* usec */
+#define PCMX_AHEAD      200000          /* usec */
+#define PCMX_TICK       50000           /* usec */
+
+#define PCMX_DONE       0x01            /* no more samples will come */
+#define PCMX_STOPPED    0x02            /* by StopRender() or PCMX_MAXRUN */
+
+struct pcmx_header {
+    uint32_t  magic;
+    uint32_t  version;
+    uint32_t  rate;
+    uint32_t  size;             /* samples in the buffer */
+    uint32_t  length;           /* samples of the tone, 0 if endless */
+    uint32_t  flags;
+    uint64_t  cursor;
+};
+
+struct tonegend;
+
+int pcmexport_init(int, char **);
+int pcmexport_create(struct tonegend *, uint32_t);
+
+#endif /* __TONEGEND_PCMEXPORT_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
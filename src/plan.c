@@ -0,0 +1,180 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "plan.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+static int code_index(const char *);
+
+static struct plan_header  *plan;
+static size_t               size;
+static struct plan_country *countries;
+static struct plan_tone    *tones;
+
+
+/*
+ * maps the tone plan; only the header is checked here, the
+ * lookups check their own bounds
+ */
+int plan_open(const char *path)
+{
+    struct plan_header *hdr;
+    struct stat         st;
+    size_t              len;
+    int                 fd;
+
+    if (path == NULL)
+        path = TONEPLAN;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*plan)) {
+        LOG_ERROR("%s(): invalid tone plan '%s'", __FUNCTION__, path);
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (hdr == MAP_FAILED) {
+        LOG_ERROR("%s(): Can't map '%s': %s", __FUNCTION__, path,
+                  strerror(errno));
+        return -1;
+    }
+
+    len = sizeof(*hdr) +
+          (size_t)hdr->ncountry * sizeof(struct plan_country) +
+          (size_t)hdr->ntone    * sizeof(struct plan_tone);
+
+    if (hdr->magic != PLAN_MAGIC || hdr->version != PLAN_VERSION ||
+        hdr->ncountry > PLAN_CODES || hdr->ntone > UINT16_MAX   ||
+        len != (size_t)st.st_size)
+    {
+        LOG_ERROR("%s(): '%s' is not a tone plan of this host",
+                  __FUNCTION__, path);
+        munmap(hdr, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    plan_close();
+
+    plan      = hdr;
+    size      = st.st_size;
+    countries = (struct plan_country *)(plan + 1);
+    tones     = (struct plan_tone *)(countries + plan->ncountry);
+
+    TRACE("%s(): %u countries, %u tones", __FUNCTION__,
+          plan->ncountry, plan->ntone);
+
+    return 0;
+}
+
+void plan_close(void)
+{
+    if (plan != NULL) {
+        munmap(plan, size);
+        plan = NULL;
+        size = 0;
+    }
+}
+
+const struct plan_country *plan_country(const char *code)
+{
+    int idx;
+
+    if (plan == NULL || (idx = code_index(code)) < 0)
+        return NULL;
+
+    if ((idx = plan->index[idx]) == 0 || (uint32_t)idx > plan->ncountry)
+        return NULL;
+
+    return countries + (idx - 1);
+}
+
+/*
+ * the tones of an event of the country, and the length of the event
+ * if it is a fixed one; NULL if the country has no such tone
+ */
+const struct plan_tone *plan_tones(const struct plan_country *country,
+                                   int type, int *count, uint32_t *length)
+{
+    const struct plan_event *ev;
+
+    if (country == NULL || type < TONE_DIAL || type > TONE_RING)
+        return NULL;
+
+    ev = country->event + (type - TONE_DIAL);
+
+    if (ev->count == 0 || (uint32_t)ev->first + ev->count > plan->ntone)
+        return NULL;
+
+    *count  = ev->count;
+    *length = ev->length;
+
+    return tones + ev->first;
+}
+
+
+static int code_index(const char *code)
+{
+    int c0, c1;
+
+    if (code == NULL || !code[0] || !code[1] || code[2])
+        return -1;
+
+    c0 = (code[0] | 0x20) - 'a';
+    c1 = (code[1] | 0x20) - 'a';
+
+    if (c0 < 0 || c0 >= 26 || c1 < 0 || c1 >= 26)
+        return -1;
+
+    return c0 * 26 + c1;
+}
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,95 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_PLAN_H__
+#define __TONEGEND_PLAN_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#include "tone.h"
+
+/*
+ * Tone plan: the indicator tones of the countries, compiled by
+ * tonegend-mkplan from toneplan.txt and mapped by the daemon as is.
+ * The file is a header, PLAN_CODES country indexes, the countries
+ * and then the tones of all the events. A country is found by its
+ * two letter code and a tone by its type, so there is nothing to
+ * parse or search. The file is in the byte order of the host that
+ * made it; the magic tells if it is not.
+ */
+
+#ifndef TONEPLAN
+#define TONEPLAN        "/usr/share/tone-generator/toneplan"
+#endif
+
+#define PLAN_MAGIC      0x6e6c7074      /* "tpln" */
+#define PLAN_VERSION    1
+#define PLAN_CODES      (26 * 26)       /* 'aa' ... 'zz' */
+#define PLAN_EVENTS     (TONE_RING - TONE_DIAL + 1)
+#define PLAN_MAXTONE    16              /* tones of an event */
+
+struct plan_tone {              /* the arguments of tone_create() */
+    uint32_t  freq;
+    uint32_t  level;            /* % of the volume */
+    uint32_t  period;           /* usec */
+    uint32_t  play;
+    uint32_t  start;
+    uint32_t  duration;         /* 0: until stopped */
+};
+
+struct plan_event {
+    uint16_t  first;            /* index of the first tone */
+    uint16_t  count;            /* tones; 0 for a silent event */
+    uint32_t  length;           /* usec of a fixed length event, or 0 */
+};
+
+struct plan_country {
+    char               code[4];
+    char               name[28];
+    struct plan_event  event[PLAN_EVENTS];  /* TONE_DIAL ... TONE_RING */
+};
+
+struct plan_header {
+    uint32_t  magic;
+    uint32_t  version;
+    uint32_t  ncountry;
+    uint32_t  ntone;
+    uint16_t  index[PLAN_CODES];    /* country + 1, or 0 */
+};
+
+int plan_open(const char *);
+void plan_close(void);
+const struct plan_country *plan_country(const char *);
+const struct plan_tone *plan_tones(const struct plan_country *, int,
+                                   int *, uint32_t *);
+
+#endif /* __TONEGEND_PLAN_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
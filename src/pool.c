@@ -0,0 +1,211 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <alloca.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "pool.h"
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+/*
+ * Fixed size object pools. Objects are carved out of chunks that are
+ * allocated (and touched, so they are faulted in) on the control path,
+ * and they are recycled through a free list; chunks are given back
+ * only by pool_destroy(). Hence releasing an object, which is what the
+ * renderers do when a tone ends, never gets to the allocator.
+ * Objects are allocated on the audio loop only, but render workers may
+ * release them; released objects are pushed to a lock-free list which
+ * the allocating side takes over as a whole once its own list is empty.
+ */
+
+#define POOL_ALIGN     16
+#define ALIGN(s)       (((s) + POOL_ALIGN - 1) & ~((size_t)POOL_ALIGN - 1))
+
+struct pool_chunk {
+    struct pool_chunk  *next;
+};
+
+struct pool_entry {
+    struct pool_entry  *next;
+};
+
+struct pool {
+    char               *name;
+    size_t              size;       /* aligned object size */
+    int                 count;      /* objects per chunk */
+    int                 nchunk;
+    struct pool_chunk  *chunks;
+    struct pool_entry  *free;
+    struct pool_entry  *released;   /* pushed by pool_free() */
+};
+
+static int add_chunk(struct pool *);
+
+
+struct pool *pool_create(const char *name, size_t size, int count)
+{
+    struct pool *pool;
+
+    if (size < sizeof(struct pool_entry))
+        size = sizeof(struct pool_entry);
+
+    if (count < 1)
+        count = 1;
+
+    if ((pool = malloc(sizeof(*pool))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->name  = strdup(name ? name : "pool");
+    pool->size  = ALIGN(size);
+    pool->count = count;
+
+    if (add_chunk(pool) < 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+    struct pool_chunk *chunk;
+
+    if (pool != NULL) {
+        while ((chunk = pool->chunks) != NULL) {
+            pool->chunks = chunk->next;
+            free(chunk);
+        }
+
+        free(pool->name);
+        free(pool);
+    }
+}
+
+void *pool_alloc(struct pool *pool)
+{
+    struct pool_entry *entry;
+
+    if (pool->free == NULL) {
+        pool->free = __atomic_exchange_n(&pool->released, NULL,
+                                         __ATOMIC_ACQUIRE);
+
+        if (pool->free == NULL && add_chunk(pool) < 0)
+            return NULL;
+    }
+
+    entry = pool->free;
+    pool->free = entry->next;
+
+    memset(entry, 0, pool->size);
+
+    return (void *)entry;
+}
+
+void pool_free(struct pool *pool, void *ptr)
+{
+    struct pool_entry *entry = (struct pool_entry *)ptr;
+
+    if (entry != NULL) {
+        entry->next = __atomic_load_n(&pool->released, __ATOMIC_RELAXED);
+
+        while (!__atomic_compare_exchange_n(&pool->released, &entry->next,
+                                            entry, TRUE, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+/*
+ * touch the next 'size' bytes of the stack of the calling thread, so
+ * that later calls going that deep do not fault. With mlockall(2) in
+ * effect the pages stay resident.
+ */
+void pool_prefault_stack(size_t size)
+{
+    volatile char *stack = alloca(size);
+    size_t         page  = sysconf(_SC_PAGESIZE);
+    size_t         i;
+
+    for (i = 0;  i < size;  i += page)
+        stack[i] = 0;
+}
+
+
+static int add_chunk(struct pool *pool)
+{
+    struct pool_chunk *chunk;
+    struct pool_entry *entry;
+    char              *objs;
+    int                i;
+
+    if ((chunk = malloc(ALIGN(sizeof(*chunk)) +
+                        pool->size * pool->count)) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory for pool '%s'",
+                  __FUNCTION__, pool->name);
+        return -1;
+    }
+
+    objs = (char *)chunk + ALIGN(sizeof(*chunk));
+    memset(objs, 0, pool->size * pool->count);
+
+    for (i = pool->count - 1;  i >= 0;  i--) {
+        entry = (struct pool_entry *)(objs + pool->size * i);
+        entry->next = pool->free;
+        pool->free  = entry;
+    }
+
+    chunk->next  = pool->chunks;
+    pool->chunks = chunk;
+    pool->nchunk++;
+
+    TRACE("%s(): pool '%s' has now %d objects of %u bytes", __FUNCTION__,
+          pool->name, pool->nchunk * pool->count, (unsigned)pool->size);
+
+    return 0;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,42 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_POOL_H__
+#define __TONEGEND_POOL_H__
+
+#include <stddef.h>
+
+struct pool;
+
+struct pool *pool_create(const char *, size_t, int);
+void  pool_destroy(struct pool *);
+void *pool_alloc(struct pool *);
+void  pool_free(struct pool *, void *);
+void  pool_prefault_stack(size_t);
+
+#endif /* __TONEGEND_POOL_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,361 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pulse/pulseaudio.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "ausrv.h"
+#include "stream.h"
+#include "pulseout.h"
+#include "shed.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+static int  pulse_create(struct stream *, char *, void *, uint32_t, uint32_t);
+static void pulse_write(struct stream *, int16_t *, size_t, void (*)(void *));
+static int  pulse_cork(struct stream *, int);
+static int  pulse_flush(struct stream *);
+static int  pulse_drain(struct stream *);
+static int  pulse_timing(struct stream *, uint64_t *);
+static void pulse_release(struct stream *);
+
+static void state_callback(pa_stream *, void *);
+static void underflow_callback(pa_stream *, void *);
+static void suspended_callback(pa_stream *, void *);
+static void write_callback(pa_stream *, size_t, void *);
+static void flush_callback(pa_stream *, int, void *);
+static void drain_callback(pa_stream *, int, void *);
+static void print_buffer_attributes(struct stream *);
+
+struct stream_backend pulseout_backend = {
+    .name        = "pulse",
+    .need_server = 1,
+    .config      = NULL,
+    .create      = pulse_create,
+    .write       = pulse_write,
+    .cork        = pulse_cork,
+    .flush       = pulse_flush,
+    .drain       = pulse_drain,
+    .timing      = pulse_timing,
+    .release     = pulse_release,
+};
+
+
+static int pulse_create(struct stream *stream, char *sink, void *proplist,
+                        uint32_t tlength, uint32_t bufsize)
+{
+    struct ausrv      *ausrv = stream->ausrv;
+    pa_stream         *pastr;
+    pa_buffer_attr     battr;
+    pa_stream_flags_t  flags;
+    pa_sample_spec     spec;
+    uint32_t           ss = stream_sample_size(stream);
+
+    memset(&spec, 0, sizeof(spec));
+    spec.rate     = stream->rate;
+    spec.channels = 1;          /* e.g. MONO */
+
+    switch (stream->format) {
+    case STREAM_FORMAT_ULAW:  spec.format = PA_SAMPLE_ULAW;   break;
+    case STREAM_FORMAT_ALAW:  spec.format = PA_SAMPLE_ALAW;   break;
+    default:                  spec.format = PA_SAMPLE_S16LE;  break;
+    }
+
+    pastr = pa_stream_new_with_proplist(ausrv->context, stream->name,
+                                        &spec, NULL, (pa_proplist *)proplist);
+    if (pastr == NULL)
+        return -1;
+
+    stream->output = pastr;
+
+    /* these are for the 48Khz mono 16bit streams; convert if encoded */
+    if (tlength != (uint32_t)-1)
+        tlength = (tlength / sizeof(int16_t)) * ss;
+    if (bufsize != (uint32_t)-1)
+        bufsize = (bufsize / sizeof(int16_t)) * ss;
+
+    battr.maxlength = -1;                /* default (4MB) */
+    battr.tlength   = tlength;
+    battr.minreq    = bufsize;
+    battr.prebuf    = -1;                /* default (tlength) */
+    battr.fragsize  = -1;                /* default (tlength) */
+
+    flags = PA_STREAM_ADJUST_LATENCY;
+
+    if (shed_enabled()) {
+        /* keep the latency at hand for the deadline checks */
+        flags |= PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING;
+    }
+
+    pa_stream_set_state_callback(pastr, state_callback,(void*)stream);
+    pa_stream_set_underflow_callback(pastr, underflow_callback,(void*)stream);
+    pa_stream_set_suspended_callback(pastr, suspended_callback,(void*)stream);
+    pa_stream_set_write_callback(pastr, write_callback,(void *)stream);
+    pa_stream_connect_playback(pastr, sink, &battr, flags, NULL, NULL);
+
+    return 0;
+}
+
+static void pulse_write(struct stream *stream, int16_t *samples,
+                        size_t buflen, void (*free_cb)(void *))
+{
+    pa_stream_write((pa_stream *)stream->output, (void *)samples,buflen,
+                    free_cb, 0,PA_SEEK_RELATIVE);
+}
+
+static int pulse_cork(struct stream *stream, int cork)
+{
+    pa_operation *oper;
+
+    oper = pa_stream_cork((pa_stream *)stream->output, cork, NULL, NULL);
+
+    if (oper == NULL)
+        return -1;
+
+    pa_operation_unref(oper);
+
+    return 0;
+}
+
+static int pulse_flush(struct stream *stream)
+{
+    pa_stream    *pastr = (pa_stream *)stream->output;
+    pa_operation *oper;
+
+    print_buffer_attributes(stream);
+
+    if ((oper = pa_stream_flush(pastr, flush_callback, (void *)stream)) == NULL)
+        return -1;
+
+    pa_operation_unref(oper);
+
+    pa_stream_set_write_callback(pastr, NULL,NULL);
+
+    return 0;
+}
+
+static int pulse_drain(struct stream *stream)
+{
+    pa_stream    *pastr = (pa_stream *)stream->output;
+    pa_operation *oper;
+
+    print_buffer_attributes(stream);
+
+    if ((oper = pa_stream_drain(pastr, drain_callback, (void *)stream)) == NULL)
+        return -1;
+
+    pa_operation_unref(oper);
+
+    pa_stream_set_write_callback(pastr, NULL,NULL);
+
+    return 0;
+}
+
+static int pulse_timing(struct stream *stream, uint64_t *latency)
+{
+    pa_usec_t usec;
+    int       negative;
+
+    if (pa_stream_get_latency((pa_stream *)stream->output, &usec,&negative) < 0)
+        return -1;
+
+    *latency = negative ? 0 : usec;
+
+    return 0;
+}
+
+static void pulse_release(struct stream *stream)
+{
+    pa_stream *pastr = (pa_stream *)stream->output;
+
+    pa_stream_set_state_callback(pastr, NULL,NULL);
+    pa_stream_set_underflow_callback(pastr, NULL,NULL);
+    pa_stream_set_suspended_callback(pastr, NULL,NULL);
+    pa_stream_set_write_callback(pastr, NULL,NULL);
+}
+
+static void state_callback(pa_stream *pastr, void *userdata)
+{
+    struct stream *stream = (struct stream *)userdata;
+
+    if (!stream || stream->output != pastr) {
+        LOG_ERROR("%s(): confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    switch (pa_stream_get_state(pastr)) {
+        case PA_STREAM_UNCONNECTED:
+            TRACE("%s(): stream '%s' unconnected", __FUNCTION__, stream->name);
+            break;
+
+        case PA_STREAM_CREATING:
+            TRACE("%s(): stream '%s' creating", __FUNCTION__, stream->name);
+            break;
+
+        case PA_STREAM_READY:
+            TRACE("%s(): stream '%s' ready", __FUNCTION__, stream->name);
+            break;
+
+        case PA_STREAM_TERMINATED:
+            TRACE("%s(): stream '%s' terminated", __FUNCTION__, stream->name);
+            stream_free(stream);
+            break;
+
+        default:
+        case PA_STREAM_FAILED:
+            LOG_ERROR("%s(): Stream error: %s", __FUNCTION__,
+                      pa_strerror(pa_context_errno(pa_stream_get_context(pastr))));
+            break;
+    }
+}
+
+
+static void underflow_callback(pa_stream *pastr, void *userdata)
+{
+    (void)pastr;
+
+    struct stream *stream = (struct stream *)userdata;
+
+    if (!stream || !stream->name) 
+        LOG_ERROR("Stream underflow");
+    else {
+        LOG_ERROR("Stream '%s' underflow", stream->name);
+
+        stream->stat.underflows++;
+
+        stream_destroy(stream);
+    }
+}
+
+static void suspended_callback(pa_stream *pastr, void *userdata)
+{
+    (void)pastr;
+
+    struct stream *stream = (struct stream *)userdata;
+
+    if (!stream || !stream->name) 
+        LOG_ERROR("Stream suspended");
+    else {
+        LOG_ERROR("Stream '%s' suspended", stream->name);
+
+    }
+}
+
+static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
+{
+    struct stream        *stream = (struct stream *)userdata;
+    const pa_buffer_attr *battr;
+    uint32_t              ss;
+
+    if (!stream || stream->output != pastr) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    /* PA counts in the encoded format; the stream in 16 bit samples */
+    ss = stream_sample_size(stream);
+
+    if (stream->bufsize == (uint32_t)-1) {
+        if ((battr = pa_stream_get_buffer_attr(pastr)) != NULL)
+            stream->bufsize = (battr->minreq / ss) * sizeof(int16_t);
+    }
+
+    stream_request(stream, (bytes / ss) * sizeof(int16_t));
+}
+
+
+static void flush_callback(pa_stream *pastr, int success, void *userdata)
+{
+    struct stream *stream = (struct stream *)userdata;
+
+    if (stream->output != pastr) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    if (!success)
+        LOG_ERROR("%s(): Can't flush stream '%s'", __FUNCTION__, stream->name);
+    else
+        TRACE("%s(): stream '%s' flushed", __FUNCTION__, stream->name);
+
+    pa_stream_disconnect(pastr);
+    pa_stream_unref(pastr);
+}
+
+
+static void drain_callback(pa_stream *pastr, int success, void *userdata)
+{
+    struct stream *stream = (struct stream *)userdata;
+
+    if (stream->output != pastr) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    if (!success)
+        LOG_ERROR("%s(): Can't drain stream '%s'", __FUNCTION__, stream->name);
+    else
+        TRACE("%s(): stream '%s' drained", __FUNCTION__, stream->name);
+
+    pa_stream_disconnect(pastr);
+    pa_stream_unref(pastr);
+}
+
+
+static void print_buffer_attributes(struct stream *stream)
+{
+    const pa_buffer_attr *battr;
+
+    /* write count is only maintained when statistics are printed */
+    if (stream->stat.wrcnt > 0) {
+        battr = pa_stream_get_buffer_attr((pa_stream *)stream->output);
+
+        if (battr != NULL) {
+            TRACE("Buffer attributes:\n"
+                  "   maxlength %u\n"
+                  "   tlength   %u\n"
+                  "   prebuf    %u\n"
+                  "   minreq    %u",
+                  battr->maxlength, battr->tlength,
+                  battr->prebuf, battr->minreq);
+        }
+    }
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
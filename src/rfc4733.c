@@ -21,7 +21,6 @@ USA.
 
 #define _GNU_SOURCE
 
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -31,9 +30,12 @@ USA.
 
 #include "tonegend.h"
 #include "dbusif.h"
+#include "ausrv.h"
+#include "stream.h"
 #include "tone.h"
 #include "indicator.h"
 #include "dtmf.h"
+#include "tonesig.h"
 #include "rfc4733.h"
 
 #define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
@@ -52,11 +54,18 @@ struct method {
 static int start_event_tone(DBusMessage *, struct tonegend *);
 static int stop_tone(DBusMessage *, struct tonegend *);
 static int stop_event_tone(DBusMessage *, struct tonegend *);
-static uint32_t linear_volume(int);
+static int start_tone_sequence(DBusMessage *, struct tonegend *);
+static int dial_string(DBusMessage *, struct tonegend *);
+static void set_event(struct ausrv *, char *, int, int32_t);
+static void set_event_command(struct ausrv *, uintptr_t *);
 
 #define TONE_INDICATOR      0
 #define TONE_DTMF           1
 #define DBUS_SENDER_MAXLEN  16
+#define SEQUENCE_MAX        32      /* the command queues hold 64 */
+#define SEQUENCE_MAXDUR     10000   /* msec, both tone and gap */
+#define DIAL_MAXLEN         64
+#define DIAL_MINDUR         40      /* msec, tone and pause (ITU-T Q.24) */
 static char tone_sender[2][DBUS_SENDER_MAXLEN];
 
 static struct method  method_defs[] = {
@@ -64,6 +73,8 @@ static struct method  method_defs[] = {
     {NULL, "StartNotificationTone", "uiu", start_event_tone}, /* backward compatible */
     {NULL, "StopTone", "", stop_tone},
     {NULL, "StopEventTone", "u", stop_event_tone},
+    {NULL, "StartToneSequence", "a(uiuu)", start_tone_sequence},
+    {NULL, "DialString", "suui", dial_string},
     {NULL, NULL, NULL, NULL}
 };
 
@@ -118,7 +129,7 @@ static int start_event_tone(DBusMessage *msg, struct tonegend *tonegend)
         return FALSE;
     }
 
-    volume = linear_volume(dbm0);
+    volume = tone_linear_volume(dbm0);
 
     TRACE("%s(): event %u  volume %d dbm0 (%u) duration %u msec",
           __FUNCTION__, event, dbm0, volume, duration);
@@ -130,20 +141,12 @@ static int start_event_tone(DBusMessage *msg, struct tonegend *tonegend)
             TRACE("%s(): got request to play the second DTMF tone", __FUNCTION__);
 
         strncpy(tone_sender[TONE_DTMF], sender, DBUS_SENDER_MAXLEN);
+        tonesig_begin(tonegend, msg);
         dtmf_play(ausrv, event, volume, 0);
+        tonesig_end(tonegend);
     }
     else {
-        switch (event) {
-        case 66:     indtype = TONE_DIAL;        break;
-        case 72:     indtype = TONE_BUSY;        break;
-        case 73:     indtype = TONE_CONGEST;     break;
-        case 256:    indtype = TONE_RADIO_ACK;   break;
-        case 257:    indtype = TONE_RADIO_NA;    break;
-        case 74:     indtype = TONE_ERROR;       break;
-        case 79:     indtype = TONE_WAIT;        break;
-        case 70:     indtype = TONE_RING;        break;
-
-        default:
+        if ((indtype = tone_event_type(event)) < 0) {
             LOG_ERROR("%s(): invalid event %d", __FUNCTION__, event);
             return FALSE;
         }
@@ -152,7 +155,10 @@ static int start_event_tone(DBusMessage *msg, struct tonegend *tonegend)
             TRACE("%s(): got request to play the second indicator tone", __FUNCTION__);
 
         strncpy(tone_sender[TONE_INDICATOR], sender, DBUS_SENDER_MAXLEN);
+        tonesig_begin(tonegend, msg);
         indicator_play(ausrv, indtype, volume, duration * 1000);
+        tonesig_end(tonegend);
+        set_event(ausrv, STREAM_INDICATOR, event, dbm0);
     }
 
     return TRUE;
@@ -186,6 +192,151 @@ static int stop_event_tone(DBusMessage *msg, struct tonegend *tonegend)
     return TRUE;
 }
 
+/*
+ * An array of (event, dbm0, duration, gap) played back to back on the
+ * DTMF stream, the gap following the tone. All of it is checked before
+ * anything is played so a bad element fails the whole call.
+ */
+static int start_tone_sequence(DBusMessage *msg, struct tonegend *tonegend)
+{
+    struct ausrv    *ausrv = tonegend->ausrv_ctx;
+    DBusMessageIter  arr;
+    DBusMessageIter  elem;
+    struct {
+        uint32_t     event;
+        int32_t      dbm0;
+        uint32_t     duration;
+        uint32_t     gap;
+    }                seq[SEQUENCE_MAX];
+    struct dtmf_press *press;
+    uint32_t         gap;
+    int              n;
+    int              i;
+
+    if (!dbus_message_iter_init(msg, &arr) ||
+        dbus_message_iter_get_arg_type(&arr) != DBUS_TYPE_ARRAY)
+    {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    dbus_message_iter_recurse(&arr, &elem);
+
+    for (n = 0;  dbus_message_iter_get_arg_type(&elem) == DBUS_TYPE_STRUCT;
+         n++, dbus_message_iter_next(&elem))
+    {
+        DBusMessageIter field;
+
+        if (n >= SEQUENCE_MAX) {
+            LOG_ERROR("%s(): more than %d tones", __FUNCTION__, SEQUENCE_MAX);
+            return FALSE;
+        }
+
+        /* the signature is checked by the dispatcher */
+        dbus_message_iter_recurse(&elem, &field);
+        dbus_message_iter_get_basic(&field, &seq[n].event);
+        dbus_message_iter_next(&field);
+        dbus_message_iter_get_basic(&field, &seq[n].dbm0);
+        dbus_message_iter_next(&field);
+        dbus_message_iter_get_basic(&field, &seq[n].duration);
+        dbus_message_iter_next(&field);
+        dbus_message_iter_get_basic(&field, &seq[n].gap);
+
+        /* only DTMF tones chain; indicator tones have cadences of their own */
+        if (seq[n].event >= DTMF_MAX                ||
+            seq[n].duration < 10                    ||
+            seq[n].duration > SEQUENCE_MAXDUR       ||
+            seq[n].gap      > SEQUENCE_MAXDUR)
+        {
+            LOG_ERROR("%s(): invalid tone #%d (event %u, %u msec + %u msec)",
+                      __FUNCTION__, n, seq[n].event, seq[n].duration,
+                      seq[n].gap);
+            return FALSE;
+        }
+    }
+
+    TRACE("%s(): %d tones", __FUNCTION__, n);
+
+    if (n == 0)
+        return TRUE;
+
+    /* one command for all of it; the audio side frees the array */
+    if ((press = malloc(n * sizeof(*press))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return FALSE;
+    }
+
+    for (i = 0, gap = 0;  i < n;  gap = seq[i++].gap) {
+        press[i].type = seq[i].event;
+        press[i].vol  = tone_linear_volume(seq[i].dbm0);
+        press[i].dur  = seq[i].duration * 1000;
+        press[i].gap  = gap * 1000;
+    }
+
+    /* cleaned up with the DTMF tones if the sender goes */
+    strncpy(tone_sender[TONE_DTMF], dbus_message_get_sender(msg),
+            DBUS_SENDER_MAXLEN);
+
+    tonesig_begin(tonegend, msg);
+    dtmf_sequence(ausrv, press, n);
+    tonesig_end(tonegend);
+
+    return TRUE;
+}
+
+static int dial_string(DBusMessage *msg, struct tonegend *tonegend)
+{
+    struct ausrv *ausrv = tonegend->ausrv_ctx;
+    char         *digits;
+    uint32_t      on;
+    uint32_t      off;
+    int32_t       dbm0;
+    char         *copy;
+    char         *p;
+    int           success;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_STRING, &digits,
+                                    DBUS_TYPE_UINT32, &on,
+                                    DBUS_TYPE_UINT32, &off,
+                                    DBUS_TYPE_INT32 , &dbm0,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    for (p = digits;  *p;  p++) {
+        if (*p != ',' && dtmf_symbol(*p) < 0)
+            break;
+    }
+
+    if (*p || p == digits || p - digits > DIAL_MAXLEN ||
+        on  < DIAL_MINDUR || on  > SEQUENCE_MAXDUR   ||
+        off < DIAL_MINDUR || off > SEQUENCE_MAXDUR)
+    {
+        LOG_ERROR("%s(): invalid dial string '%s' (%u/%u msec)",
+                  __FUNCTION__, digits, on, off);
+        return FALSE;
+    }
+
+    TRACE("%s(): '%s' %u/%u msec %d dbm0", __FUNCTION__, digits, on, off,
+          dbm0);
+
+    if ((copy = strdup(digits)) == NULL)
+        return FALSE;
+
+    strncpy(tone_sender[TONE_DTMF], dbus_message_get_sender(msg),
+            DBUS_SENDER_MAXLEN);
+
+    tonesig_begin(tonegend, msg);
+    dtmf_dial(ausrv, copy, on * 1000, off * 1000, tone_linear_volume(dbm0));
+    tonesig_end(tonegend);
+
+    return TRUE;
+}
+
 static int stop_tone(DBusMessage *msg, struct tonegend *tonegend)
 {
     struct ausrv *ausrv = tonegend->ausrv_ctx;
@@ -215,20 +366,25 @@ static int stop_tone(DBusMessage *msg, struct tonegend *tonegend)
 }
 
 /*
- * This function maps the RFC4733 defined
- * power level of 0dbm0 - -63dbm0
- * to the linear range of 0 - 100
+ * Tag the indicator stream with the event, so that an RTP output can
+ * send it as a telephone-event instead of (or besides) the rendered
+ * audio. The DTMF events are laid out with their tones by dtmf.c.
  */
-static uint32_t linear_volume(int dbm0)
+static void set_event(struct ausrv *ausrv, char *name, int event, int32_t dbm0)
 {
-    double volume;              /* volume on the scale 0-100 */
+    struct stream *stream;
 
-    if (dbm0 > 0)   dbm0 = 0;
-    if (dbm0 < -63) dbm0 = -63;
+    if (ausrv_queue_command(ausrv, set_event_command,
+                            (uintptr_t)name, event, dbm0, 0))
+        return;
 
-    volume = pow(10.0, (double)(dbm0 + 63) / 20.0) / 14.125375446;
+    if ((stream = stream_find(ausrv, name)) != NULL)
+        stream_set_event(stream, event, -dbm0);
+}
 
-    return (uint32_t)(volume + 0.5);
+static void set_event_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    set_event(ausrv, (char *)arg[0], (int)arg[1], (int32_t)arg[2]);
 }
 
 
@@ -0,0 +1,121 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rtcheck.h"
+
+/*
+ * The allocator entry points are interposed here and forwarded to the
+ * glibc internals. Inside the render path of an armed process they
+ * print the offender and abort, so a debug build fails loudly instead
+ * of occasionally glitching under memory pressure.
+ */
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void  __libc_free(void *);
+
+static void trip(const char *);
+
+static int           armed;
+static __thread int  depth;
+
+
+void rtcheck_arm(void)
+{
+    armed = 1;
+}
+
+void rtcheck_enter(void)
+{
+    if (armed)
+        depth++;
+}
+
+void rtcheck_leave(void)
+{
+    if (armed && depth > 0)
+        depth--;
+}
+
+void *malloc(size_t size)
+{
+    if (depth)
+        trip("malloc");
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (depth)
+        trip("calloc");
+
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (depth)
+        trip("realloc");
+
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (depth && ptr != NULL)
+        trip("free");
+
+    __libc_free(ptr);
+}
+
+
+static void trip(const char *func)
+{
+    static const char pfx[] = "tonegend: ";
+    static const char sfx[] = "() called in the render path\n";
+    ssize_t           unused;
+
+    /* no stdio here; it might allocate */
+    depth = 0;
+
+    unused = write(STDERR_FILENO, pfx, sizeof(pfx) - 1);
+    unused = write(STDERR_FILENO, func, strlen(func));
+    unused = write(STDERR_FILENO, sfx, sizeof(sfx) - 1);
+    (void)unused;
+
+    abort();
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,48 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_RTCHECK_H__
+#define __TONEGEND_RTCHECK_H__
+
+/*
+ * debug aid for the real-time mode (configure --enable-rtcheck): once
+ * armed, any malloc(), calloc(), realloc() or free() between
+ * rtcheck_enter() and rtcheck_leave() aborts the process.
+ */
+
+#ifdef RTCHECK
+void rtcheck_arm(void);
+void rtcheck_enter(void);
+void rtcheck_leave(void);
+#else
+#define rtcheck_arm()      do { } while (0)
+#define rtcheck_enter()    do { } while (0)
+#define rtcheck_leave()    do { } while (0)
+#endif
+
+#endif /* __TONEGEND_RTCHECK_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,682 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <pulse/pulseaudio.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "ausrv.h"
+#include "stream.h"
+#include "rtpout.h"
+#include "g711.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define DEFAULT_RATE      8000
+#define DEFAULT_PTIME     20        /* msec */
+#define DEFAULT_EVENT_PT  101
+#define END_PACKETS       3         /* RFC 4733 2.5.1.4 */
+#define MAX_DURATION      0xffff    /* RFC 4733 2.5.1.3 */
+
+#define RTP_HEADER_LEN    12
+#define RTP_VERSION       2
+#define RTP_MARKER        0x80
+#define EVENT_END         0x80
+
+#define MAX_PACKET        (RTP_HEADER_LEN + 8000 * 2)
+
+struct rtpout_config {
+    struct sockaddr_storage  addr;
+    socklen_t                addrlen;
+    int                      evpt;      /* telephone-event payload type */
+    int                      pcmpt;     /* L16 payload type or -1 */
+    uint32_t                 rate;      /* sample rate = RTP clock */
+    uint32_t                 ptime;     /* packet time in msec */
+};
+
+struct rtpout_event {
+    int        code;                    /* event code or -1 */
+    int        level;                   /* power level in -dBm0 */
+    uint32_t   ts;                      /* RTP timestamp of the segment */
+    uint32_t   duration;                /* in timestamp units */
+    int        resend;                  /* end packets still to send */
+};
+
+struct rtpout {
+    pa_mainloop_api     *api;
+    struct stream       *stream;
+    int                  sock;
+    int                  closing;
+    uint32_t             period;        /* packet time in usec */
+    struct timeval       due;           /* time of the next packet */
+    pa_time_event       *timer;
+    pa_defer_event      *defer;
+    uint32_t             ssrc;
+    uint16_t             seq;
+    uint32_t             ts;            /* timestamp of the next sample */
+    uint64_t             nsent;         /* samples since the stream start */
+    int                  talkspurt;     /* sending audio */
+    struct rtpout_event  cur;           /* event being sent */
+    struct rtpout_event  fin;           /* event being ended */
+    uint8_t              pkt[MAX_PACKET];
+};
+
+static int  rtp_config(char *);
+static int  rtp_create(struct stream *, char *, void *, uint32_t, uint32_t);
+static void rtp_write(struct stream *, int16_t *, size_t, void (*)(void *));
+static int  rtp_cork(struct stream *, int);
+static int  rtp_close(struct stream *);
+static int  rtp_timing(struct stream *, uint64_t *);
+static void rtp_release(struct stream *);
+
+static int  parse_address(char *);
+static int  has_signal(struct stream *, void *, size_t);
+static void end_event(struct rtpout *);
+static void send_event(struct rtpout *, struct rtpout_event *, int, int);
+static void send_audio(struct rtpout *, void *, size_t);
+static void send_packet(struct rtpout *, int, int, uint32_t, size_t);
+static void next_due(struct rtpout *);
+static void start_timer(struct rtpout *);
+static void stop_timer(struct rtpout *);
+static void timer_callback(pa_mainloop_api *, pa_time_event *,
+                           const struct timeval *, void *);
+static void defer_callback(pa_mainloop_api *, pa_defer_event *, void *);
+static void destroy_rtpout(struct rtpout *);
+static void random_bytes(void *, size_t);
+
+static struct rtpout_config cfg = {
+    .evpt  = DEFAULT_EVENT_PT,
+    .pcmpt = -1,
+    .rate  = DEFAULT_RATE,
+    .ptime = DEFAULT_PTIME,
+};
+
+struct stream_backend rtpout_backend = {
+    .name        = "rtp",
+    .need_server = 0,
+    .config      = rtp_config,
+    .create      = rtp_create,
+    .write       = rtp_write,
+    .cork        = rtp_cork,
+    .flush       = rtp_close,
+    .drain       = rtp_close,
+    .timing      = rtp_timing,
+    .release     = rtp_release,
+};
+
+
+static int rtp_config(char *opts)
+{
+    char *key, *val, *next, *end;
+    char  buf[256];
+    long  n;
+
+    if (opts == NULL)
+        goto nodest;
+
+    if (strlen(opts) >= sizeof(buf)) {
+        LOG_ERROR("%s(): output options are too long", __FUNCTION__);
+        return -1;
+    }
+    strcpy(buf, opts);
+
+    for (key = buf;  key != NULL;  key = next) {
+        if ((next = strchr(key, ',')) != NULL)
+            *next++ = '\0';
+
+        if ((val = strchr(key, '=')) == NULL)
+            goto invalid;
+
+        *val++ = '\0';
+
+        if (!strcmp(key, "dest")) {
+            if (parse_address(val) < 0)
+                return -1;
+            continue;
+        }
+
+        n = strtol(val, &end, 10);
+
+        if (*end)
+            goto invalid;
+
+        if (!strcmp(key, "pt") && n >= 96 && n <= 127)
+            cfg.evpt = n;
+        else if (!strcmp(key, "pcm") && n >= 0 && n <= 127)
+            cfg.pcmpt = n;
+        else if (!strcmp(key, "rate") && n >= 8000 && n <= 48000)
+            cfg.rate = n;
+        else if (!strcmp(key, "ptime") && n >= 5 && n <= 100)
+            cfg.ptime = n;
+        else
+            goto invalid;
+    }
+
+    if (cfg.pcmpt == cfg.evpt) {
+        LOG_ERROR("%s(): events and audio need different payload types",
+                  __FUNCTION__);
+        return -1;
+    }
+
+    if (cfg.addrlen == 0)
+        goto nodest;
+
+    return 0;
+
+ invalid:
+    LOG_ERROR("%s(): invalid output option '%s'", __FUNCTION__, key);
+    return -1;
+
+ nodest:
+    LOG_ERROR("%s(): 'rtp' output needs a dest=host:port option",
+              __FUNCTION__);
+    return -1;
+}
+
+static int rtp_create(struct stream *stream, char *sink, void *proplist,
+                      uint32_t tlength, uint32_t bufsize)
+{
+    struct rtpout *out;
+
+    (void)sink;
+    (void)proplist;
+    (void)tlength;
+    (void)bufsize;
+
+    if ((out = malloc(sizeof(*out))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+
+    out->sock = socket(cfg.addr.ss_family,
+                       SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (out->sock < 0 ||
+        connect(out->sock, (struct sockaddr *)&cfg.addr, cfg.addrlen) < 0)
+    {
+        LOG_ERROR("%s(): can't create RTP socket: %s", __FUNCTION__,
+                  strerror(errno));
+        if (out->sock >= 0)
+            close(out->sock);
+        free(out);
+        return -1;
+    }
+
+    /*
+     * the RTP clock is the sample rate and each request is one packet;
+     * there is no point to buffer ahead, the receiver has a jitter buffer
+     */
+    if (stream->format == STREAM_FORMAT_S16LE)  /* G.711 is always 8kHz */
+        stream->rate = cfg.rate;
+
+    stream->bufsize = (stream->rate * cfg.ptime / 1000) * sizeof(int16_t);
+
+    out->api      = stream->ausrv->api;
+    out->stream   = stream;
+    out->period   = cfg.ptime * 1000;
+    out->cur.code = -1;
+    out->fin.code = -1;
+
+    random_bytes(&out->ssrc, sizeof(out->ssrc));
+    random_bytes(&out->seq , sizeof(out->seq));
+    random_bytes(&out->ts  , sizeof(out->ts));
+
+    out->defer = out->api->defer_new(out->api, defer_callback, out);
+
+    stream->output = out;
+
+    TRACE("%s(): stream '%s' ssrc 0x%08x %uHz ptime %ums",
+          __FUNCTION__, stream->name, out->ssrc, stream->rate, cfg.ptime);
+
+    return 0;
+}
+
+/*
+ * Called with one packet time worth of samples. While the tones of an
+ * RFC 4733 event play on the stream timeline and they are audible, we
+ * send telephone-event packets; otherwise the samples go out as L16
+ * audio, if enabled. Every sample of the timeline comes here in order,
+ * so counting them tells the stream time of the packet.
+ */
+static void rtp_write(struct stream *stream, int16_t *samples, size_t buflen,
+                      void (*free_cb)(void *))
+{
+    struct rtpout       *out = (struct rtpout *)stream->output;
+    struct rtpout_event *cur = &out->cur;
+    size_t               nsamp = buflen / stream_sample_size(stream);
+    uint64_t             start;
+    uint64_t             end;
+    int                  code;
+    int                  level;
+    int                  active;
+
+    start = out->nsent * 1000000ULL / stream->rate;
+    end   = (out->nsent + nsamp) * 1000000ULL / stream->rate;
+    code  = stream_event_at(stream, start, end, &level);
+
+    out->nsent += nsamp;
+
+    active = code >= 0 && has_signal(stream, samples, nsamp);
+
+    /* retransmit the end of the previous event */
+    if (out->fin.resend > 0)
+        send_event(out, &out->fin, EVENT_END, FALSE);
+
+    if (cur->code >= 0 && (!active || cur->code != code))
+        end_event(out);
+
+    if (active) {
+        if (cur->code < 0) {
+            cur->code     = code;
+            cur->level    = level;
+            cur->ts       = out->ts;
+            cur->duration = nsamp;
+
+            out->talkspurt = FALSE;
+
+            send_event(out, cur, 0, TRUE);
+        }
+        else if (cur->duration + nsamp > MAX_DURATION) {
+            /* long event; start a new segment */
+            cur->ts       = out->ts;
+            cur->duration = nsamp;
+
+            send_event(out, cur, 0, FALSE);
+        }
+        else {
+            cur->duration += nsamp;
+
+            send_event(out, cur, 0, FALSE);
+        }
+    }
+    else if (cfg.pcmpt >= 0)
+        send_audio(out, samples, nsamp);
+
+    out->ts += nsamp;
+
+    if (free_cb != NULL)
+        free_cb(samples);
+}
+
+static int rtp_cork(struct stream *stream, int cork)
+{
+    struct rtpout *out = (struct rtpout *)stream->output;
+
+    if (out->closing)
+        return -1;
+
+    if (cork) {
+        end_event(out);
+        stop_timer(out);
+    }
+    else {
+        gettimeofday(&out->due, NULL);
+        start_timer(out);
+    }
+
+    return 0;
+}
+
+static int rtp_close(struct stream *stream)
+{
+    struct rtpout *out = (struct rtpout *)stream->output;
+
+    /*
+     * no more samples are requested, but the end of an ongoing event
+     * still has to be sent (and resent) at the packet rate
+     */
+    out->closing = TRUE;
+
+    end_event(out);
+
+    if (out->fin.resend > 0) {
+        out->api->defer_enable(out->defer, FALSE);
+
+        if (out->timer == NULL) {
+            gettimeofday(&out->due, NULL);
+            next_due(out);
+            start_timer(out);
+        }
+    }
+    else {
+        stop_timer(out);
+        out->api->defer_enable(out->defer, TRUE);
+    }
+
+    return 0;
+}
+
+static int rtp_timing(struct stream *stream, uint64_t *latency)
+{
+    (void)stream;
+
+    /* each packet is sent when it is due */
+    *latency = 0;
+
+    return 0;
+}
+
+static void rtp_release(struct stream *stream)
+{
+    destroy_rtpout((struct rtpout *)stream->output);
+    stream->output = NULL;
+}
+
+
+static int parse_address(char *dest)
+{
+    struct addrinfo  hints;
+    struct addrinfo *ai;
+    char            *host = dest;
+    char            *port;
+    int              err;
+
+    /* host:port or [ipv6-address]:port */
+    if (*host == '[') {
+        host++;
+        if ((port = strchr(host, ']')) == NULL || port[1] != ':')
+            goto invalid;
+        *port++ = '\0';
+    }
+    else if ((port = strrchr(host, ':')) == NULL)
+        goto invalid;
+
+    *port++ = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if ((err = getaddrinfo(host, port, &hints, &ai)) != 0) {
+        LOG_ERROR("%s(): can't resolve '%s': %s", __FUNCTION__, host,
+                  gai_strerror(err));
+        return -1;
+    }
+
+    memcpy(&cfg.addr, ai->ai_addr, ai->ai_addrlen);
+    cfg.addrlen = ai->ai_addrlen;
+
+    freeaddrinfo(ai);
+
+    return 0;
+
+ invalid:
+    LOG_ERROR("%s(): invalid RTP destination '%s'", __FUNCTION__, dest);
+    return -1;
+}
+
+static int has_signal(struct stream *stream, void *samples, size_t nsamp)
+{
+    int16_t *s16 = (int16_t *)samples;
+    uint8_t *enc = (uint8_t *)samples;
+    uint8_t  silence;
+    size_t   i;
+
+    if (stream->format == STREAM_FORMAT_S16LE) {
+        for (i = 0;  i < nsamp;  i++) {
+            if (s16[i])
+                return TRUE;
+        }
+    }
+    else {
+        if (stream->format == STREAM_FORMAT_ULAW)
+            silence = G711_ULAW_SILENCE;
+        else
+            silence = G711_ALAW_SILENCE;
+
+        for (i = 0;  i < nsamp;  i++) {
+            if (enc[i] != silence)
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void end_event(struct rtpout *out)
+{
+    if (out->cur.code >= 0) {
+        out->fin        = out->cur;
+        out->fin.resend = END_PACKETS;
+        out->cur.code   = -1;
+
+        send_event(out, &out->fin, EVENT_END, FALSE);
+    }
+}
+
+static void send_event(struct rtpout *out, struct rtpout_event *ev,
+                       int end, int marker)
+{
+    uint8_t *payload = out->pkt + RTP_HEADER_LEN;
+
+    payload[0] = ev->code;
+    payload[1] = end | (ev->level & 0x3f);
+    payload[2] = (ev->duration >> 8) & 0xff;
+    payload[3] = ev->duration & 0xff;
+
+    send_packet(out, cfg.evpt, marker, ev->ts, 4);
+
+    if (end && --ev->resend <= 0)
+        ev->code = -1;
+}
+
+static void send_audio(struct rtpout *out, void *samples, size_t nsamp)
+{
+    uint8_t *payload = out->pkt + RTP_HEADER_LEN;
+    int16_t *s16     = (int16_t *)samples;
+    uint32_t ss      = stream_sample_size(out->stream);
+    size_t   i;
+
+    if (nsamp * ss > MAX_PACKET - RTP_HEADER_LEN)
+        nsamp = (MAX_PACKET - RTP_HEADER_LEN) / ss;
+
+    if (ss == 1)        /* G.711 goes as it is */
+        memcpy(payload, samples, nsamp);
+    else {              /* L16 is in network byte order */
+        for (i = 0;  i < nsamp;  i++) {
+            payload[i*2+0] = ((uint16_t)s16[i] >> 8) & 0xff;
+            payload[i*2+1] = (uint16_t)s16[i] & 0xff;
+        }
+    }
+
+    send_packet(out, cfg.pcmpt, !out->talkspurt, out->ts, nsamp * ss);
+
+    out->talkspurt = TRUE;
+}
+
+static void send_packet(struct rtpout *out, int pt, int marker, uint32_t ts,
+                        size_t len)
+{
+    uint8_t *hdr = out->pkt;
+
+    hdr[0]  = RTP_VERSION << 6;
+    hdr[1]  = (marker ? RTP_MARKER : 0) | (pt & 0x7f);
+    hdr[2]  = (out->seq >> 8) & 0xff;
+    hdr[3]  = out->seq & 0xff;
+    hdr[4]  = (ts >> 24) & 0xff;
+    hdr[5]  = (ts >> 16) & 0xff;
+    hdr[6]  = (ts >> 8) & 0xff;
+    hdr[7]  = ts & 0xff;
+    hdr[8]  = (out->ssrc >> 24) & 0xff;
+    hdr[9]  = (out->ssrc >> 16) & 0xff;
+    hdr[10] = (out->ssrc >> 8) & 0xff;
+    hdr[11] = out->ssrc & 0xff;
+
+    out->seq++;
+
+    if (send(out->sock, out->pkt, RTP_HEADER_LEN + len, 0) < 0) {
+        if (errno == EAGAIN)
+            out->stream->stat.underflows++;
+        else if (errno != ECONNREFUSED)   /* nobody listens (yet) */
+            LOG_ERROR("%s(): send failed: %s", __FUNCTION__, strerror(errno));
+    }
+}
+
+static void next_due(struct rtpout *out)
+{
+    uint64_t due;
+
+    due  = (uint64_t)out->due.tv_sec * 1000000ULL + out->due.tv_usec;
+    due += out->period;
+
+    out->due.tv_sec  = due / 1000000ULL;
+    out->due.tv_usec = due % 1000000ULL;
+}
+
+static void start_timer(struct rtpout *out)
+{
+    if (out->timer != NULL)
+        out->api->time_restart(out->timer, &out->due);
+    else
+        out->timer = out->api->time_new(out->api, &out->due,
+                                        timer_callback, out);
+}
+
+static void stop_timer(struct rtpout *out)
+{
+    if (out->timer != NULL) {
+        out->api->time_free(out->timer);
+        out->timer = NULL;
+    }
+}
+
+static void timer_callback(pa_mainloop_api *api, pa_time_event *event,
+                           const struct timeval *tv, void *userdata)
+{
+    struct rtpout *out = (struct rtpout *)userdata;
+
+    (void)tv;
+
+    if (event != out->timer) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    /* schedule relative to the previous deadline, so we don't drift */
+    next_due(out);
+
+    if (!out->closing) {
+        start_timer(out);
+        stream_request(out->stream, out->stream->bufsize);
+    }
+    else {
+        if (out->fin.resend > 0)
+            send_event(out, &out->fin, EVENT_END, FALSE);
+
+        if (out->fin.resend > 0)
+            start_timer(out);
+        else {
+            stop_timer(out);
+            api->defer_enable(out->defer, TRUE);
+        }
+    }
+}
+
+static void defer_callback(pa_mainloop_api *api, pa_defer_event *event,
+                           void *userdata)
+{
+    struct rtpout *out    = (struct rtpout *)userdata;
+    struct stream *stream = out->stream;
+
+    (void)event;
+
+    if (out->closing) {
+        TRACE("%s(): stream '%s' closed", __FUNCTION__, stream->name);
+
+        destroy_rtpout(out);
+        stream_free(stream);
+
+        return;
+    }
+
+    api->defer_enable(out->defer, FALSE);
+
+    gettimeofday(&out->due, NULL);
+    next_due(out);
+
+    start_timer(out);
+
+    stream_request(stream, stream->bufsize);
+}
+
+static void destroy_rtpout(struct rtpout *out)
+{
+    if (out != NULL) {
+        stop_timer(out);
+
+        if (out->defer != NULL)
+            out->api->defer_free(out->defer);
+
+        if (out->sock >= 0)
+            close(out->sock);
+
+        free(out);
+    }
+}
+
+static void random_bytes(void *buf, size_t len)
+{
+    struct timeval  tv;
+    uint8_t        *p = (uint8_t *)buf;
+    size_t          i;
+    int             fd;
+
+    if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) >= 0) {
+        if (read(fd, buf, len) == (ssize_t)len) {
+            close(fd);
+            return;
+        }
+        close(fd);
+    }
+
+    gettimeofday(&tv, NULL);
+    srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
+
+    for (i = 0;  i < len;  i++)
+        p[i] = random() & 0xff;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
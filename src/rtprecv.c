@@ -0,0 +1,453 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*
+ * Loopback receiver for 'tonegend -o rtp,dest=127.0.0.1:<port>'. It
+ * checks that the packets of each source come with consecutive sequence
+ * numbers, that the L16 audio has a packet time worth of payload and a
+ * continuous timestamp, and that the RFC 4733 events keep the timestamp
+ * of their start, grow by a packet time and end with three identical end
+ * packets. It exits with 0 if everything was right and at least -m
+ * events were seen, or exactly the comma separated event codes of -e in
+ * that order; it stops after -w seconds without packets.
+ */
+
+#define RTP_HEADER_LEN  12
+#define RTP_VERSION     2
+#define RTP_MARKER      0x80
+#define EVENT_END       0x80
+#define END_PACKETS     3
+#define MAX_SOURCES     8
+#define MAX_EVENTS      64
+#define MAX_PACKET      (RTP_HEADER_LEN + 8000 * 2)
+
+#define FALSE 0
+#define TRUE  (!FALSE)
+
+struct source {
+    uint32_t  ssrc;
+    uint16_t  seq;              /* last sequence number */
+    uint32_t  next;             /* timestamp of the next sample */
+    int       talkspurt;        /* audio was sent since the last event */
+    int       evcode;           /* -1 or the event being sent */
+    uint32_t  evts;
+    uint32_t  evdur;
+    int       fincode;          /* -1 or the event being ended */
+    uint32_t  fints;
+    uint32_t  findur;
+    int       finpkts;
+    unsigned  packets;
+    unsigned  audio;
+    unsigned  events;
+};
+
+static void usage(char *, int);
+static int  parse_codes(char *, int *);
+static struct source *lookup(uint32_t);
+static void check(uint8_t *, size_t);
+static void audio(struct source *, uint32_t, int, size_t);
+static void event(struct source *, uint32_t, int, uint8_t *, size_t);
+static void ended(struct source *);
+static void finish(struct source *);
+static void fail(struct source *, const char *, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+static struct source sources[MAX_SOURCES];
+static int           nsource;
+static int           evpt    = 101;
+static int           pcmpt   = -1;
+static uint32_t      nsamp   = 160;
+static int           errors;
+static int           verbose;
+static int           codes[MAX_EVENTS];    /* the events started, in order */
+static int           ncode;
+
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    struct pollfd      pfd;
+    uint8_t            pkt[MAX_PACKET];
+    ssize_t            len;
+    int                port    = 5004;
+    int                rate    = 8000;
+    int                ptime   = 20;
+    int                wait    = 5;
+    int                minev   = 1;
+    unsigned           events  = 0;
+    int                expect[MAX_EVENTS];
+    int                nexpect = -1;       /* -1: any */
+    int                sock;
+    int                opt;
+    int                i;
+
+    while ((opt = getopt(argc, argv, "p:t:a:r:P:w:m:e:vh")) != -1) {
+        switch (opt) {
+        case 'p':   port    = atoi(optarg);     break;
+        case 't':   evpt    = atoi(optarg);     break;
+        case 'a':   pcmpt   = atoi(optarg);     break;
+        case 'r':   rate    = atoi(optarg);     break;
+        case 'P':   ptime   = atoi(optarg);     break;
+        case 'w':   wait    = atoi(optarg);     break;
+        case 'm':   minev   = atoi(optarg);     break;
+        case 'e':   nexpect = parse_codes(optarg, expect);  break;
+        case 'v':   verbose = 1;                break;
+        case 'h':   usage(argv[0], 0);          break;
+        default:    usage(argv[0], EINVAL);     break;
+        }
+    }
+
+    if (port < 1 || port > 65535 || rate < 8000 || ptime < 5 || wait < 1)
+        usage(argv[0], EINVAL);
+
+    if (nexpect == 0)
+        usage(argv[0], EINVAL);
+    else if (nexpect > 0)
+        minev = nexpect;
+
+    nsamp = rate * ptime / 1000;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        printf("can't listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        return EIO;
+    }
+
+    pfd.fd     = sock;
+    pfd.events = POLLIN;
+
+    while (poll(&pfd, 1, wait * 1000) > 0) {
+        if ((len = recv(sock, pkt, sizeof(pkt), 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("recv failed: %s\n", strerror(errno));
+            return EIO;
+        }
+
+        check(pkt, len);
+    }
+
+    close(sock);
+
+    for (i = 0;  i < nsource;  i++) {
+        finish(sources + i);
+        events += sources[i].events;
+
+        printf("ssrc 0x%08x: %u packets, %u audio, %u events\n",
+               sources[i].ssrc, sources[i].packets, sources[i].audio,
+               sources[i].events);
+    }
+
+    if (events < (unsigned)minev) {
+        printf("got %u events, expected at least %d\n", events, minev);
+        errors++;
+    }
+
+    if (nexpect > 0) {
+        for (i = 0;  i < ncode || i < nexpect;  i++) {
+            if (i >= ncode || i >= nexpect || codes[i] != expect[i]) {
+                printf("event #%d is %d, expected %d\n", i + 1,
+                       i < ncode ? codes[i] : -1,
+                       i < nexpect ? expect[i] : -1);
+                errors++;
+                break;
+            }
+        }
+    }
+
+    printf("%s (%d errors)\n", errors ? "FAILED" : "OK", errors);
+
+    return errors ? 1 : 0;
+}
+
+
+static void usage(char *argv0, int exit_code)
+{
+    printf("usage: %s [-h] [-v] [-p port] [-t event_pt] [-a audio_pt] "
+           "[-r rate] [-P ptime_in_ms] [-w idle_sec] [-m min_events] "
+           "[-e code,code,...]\n", basename(argv0));
+    exit(exit_code);
+}
+
+static int parse_codes(char *list, int *expect)
+{
+    char *p;
+    char *e;
+    int   n;
+
+    for (p = list, n = 0;  *p && n < MAX_EVENTS;  n++, p = e) {
+        expect[n] = strtol(p, &e, 10);
+
+        if (e == p || expect[n] < 0 || expect[n] > 255 ||
+            (*e != ',' && *e != '\0'))
+            return 0;
+
+        if (*e == ',')
+            e++;
+    }
+
+    return *p ? 0 : n;
+}
+
+static struct source *lookup(uint32_t ssrc)
+{
+    struct source *src;
+    int            i;
+
+    for (i = 0;  i < nsource;  i++) {
+        if (sources[i].ssrc == ssrc)
+            return sources + i;
+    }
+
+    if (nsource >= MAX_SOURCES)
+        return NULL;
+
+    src = sources + nsource++;
+
+    memset(src, 0, sizeof(*src));
+    src->ssrc    = ssrc;
+    src->evcode  = -1;
+    src->fincode = -1;
+
+    return src;
+}
+
+static void check(uint8_t *pkt, size_t len)
+{
+    struct source *src;
+    uint16_t       seq;
+    uint32_t       ts;
+    uint32_t       ssrc;
+    int            marker;
+    int            pt;
+
+    if (len < RTP_HEADER_LEN || (pkt[0] >> 6) != RTP_VERSION) {
+        printf("not an RTP packet (%zu bytes)\n", len);
+        errors++;
+        return;
+    }
+
+    if (pkt[0] & 0x3f) {
+        printf("unexpected padding, extension or CSRC (0x%02x)\n", pkt[0]);
+        errors++;
+        return;
+    }
+
+    marker = pkt[1] & RTP_MARKER;
+    pt     = pkt[1] & 0x7f;
+    seq    = (pkt[2] << 8) | pkt[3];
+    ts     = ((uint32_t)pkt[4]<<24) | (pkt[5]<<16) | (pkt[6]<<8) | pkt[7];
+    ssrc   = ((uint32_t)pkt[8]<<24) | (pkt[9]<<16) | (pkt[10]<<8) | pkt[11];
+
+    if ((src = lookup(ssrc)) == NULL) {
+        printf("too many sources\n");
+        errors++;
+        return;
+    }
+
+    if (src->packets++ > 0 && seq != (uint16_t)(src->seq + 1))
+        fail(src, "sequence number %u after %u", seq, src->seq);
+
+    src->seq = seq;
+
+    if (verbose) {
+        printf("ssrc 0x%08x seq %5u ts %10u pt %3d%s len %zu\n", ssrc, seq,
+               ts, pt, marker ? " M" : "  ", len - RTP_HEADER_LEN);
+    }
+
+    if (pt == evpt)
+        event(src, ts, marker, pkt + RTP_HEADER_LEN, len - RTP_HEADER_LEN);
+    else if (pt == pcmpt)
+        audio(src, ts, marker, len - RTP_HEADER_LEN);
+    else
+        fail(src, "unexpected payload type %d", pt);
+}
+
+static void audio(struct source *src, uint32_t ts, int marker, size_t len)
+{
+    src->audio++;
+
+    if (len != nsamp * sizeof(int16_t))
+        fail(src, "audio payload of %zu bytes instead of %zu", len,
+             nsamp * sizeof(int16_t));
+
+    /* the first packet after an event or a silent gap has the marker */
+    if (src->packets > 1 && (int32_t)(ts - src->next) < 0)
+        fail(src, "audio timestamp %u goes back from %u", ts, src->next);
+    else if (src->talkspurt && !marker && ts != src->next)
+        fail(src, "audio timestamp %u instead of %u", ts, src->next);
+    else if (!src->talkspurt && !marker)
+        fail(src, "talkspurt started without the marker bit");
+
+    if (src->evcode >= 0)
+        fail(src, "audio during event %d", src->evcode);
+
+    src->talkspurt = TRUE;
+    src->next      = ts + nsamp;
+}
+
+static void event(struct source *src, uint32_t ts, int marker,
+                  uint8_t *payload, size_t len)
+{
+    int      code;
+    int      end;
+    uint32_t dur;
+
+    if (len != 4) {
+        fail(src, "telephone-event payload of %zu bytes", len);
+        return;
+    }
+
+    code = payload[0];
+    end  = payload[1] & EVENT_END;
+    dur  = (payload[2] << 8) | payload[3];
+
+    if (!dur || dur % nsamp)
+        fail(src, "event %d duration %u is not a multiple of %u",
+             code, dur, nsamp);
+
+    if (end) {
+        if (src->evcode >= 0 && code == src->evcode && ts == src->evts) {
+            ended(src);
+
+            if (dur != src->evdur)
+                fail(src, "event %d ends with duration %u instead of %u",
+                     code, dur, src->evdur);
+
+            src->fincode = code;
+            src->fints   = ts;
+            src->findur  = dur;
+            src->finpkts = 1;
+            src->evcode  = -1;
+        }
+        else if (src->fincode >= 0 && code == src->fincode &&
+                 ts == src->fints)
+        {
+            if (dur != src->findur)
+                fail(src, "event %d end packets disagree on duration",code);
+
+            if (++src->finpkts > END_PACKETS)
+                fail(src, "event %d has more than %d end packets", code,
+                     END_PACKETS);
+        }
+        else
+            fail(src, "end of event %d ts %u that was not started",code,ts);
+
+        return;
+    }
+
+    if (marker) {
+        if (src->evcode >= 0)
+            fail(src, "event %d started before %d was ended",
+                 code, src->evcode);
+
+        if (src->packets > 1 && (int32_t)(ts - src->next) < 0)
+            fail(src, "event timestamp %u goes back from %u", ts, src->next);
+
+        if (dur != nsamp)
+            fail(src, "event %d starts with duration %u", code, dur);
+
+        src->events++;
+        src->evcode = code;
+        src->evts   = ts;
+
+        if (ncode < MAX_EVENTS)
+            codes[ncode++] = code;
+    }
+    else if (src->evcode != code)
+        fail(src, "update of event %d that was not started", code);
+    else if (ts == src->evts) {
+        if (dur != src->evdur + nsamp)
+            fail(src, "event %d duration %u after %u", code, dur, src->evdur);
+    }
+    else if (ts != src->evts + src->evdur || dur != nsamp) {
+        /* long events are split into segments with a new timestamp */
+        fail(src, "event %d segment ts %u duration %u", code, ts, dur);
+    }
+    else
+        src->evts = ts;
+
+    src->evdur     = dur;
+    src->next      = ts + dur;
+    src->talkspurt = FALSE;
+}
+
+static void ended(struct source *src)
+{
+    if (src->fincode >= 0 && src->finpkts != END_PACKETS) {
+        fail(src, "event %d has %d end packets instead of %d",
+             src->fincode, src->finpkts, END_PACKETS);
+    }
+
+    src->fincode = -1;
+}
+
+static void finish(struct source *src)
+{
+    ended(src);
+
+    if (src->evcode >= 0)
+        fail(src, "event %d was never ended", src->evcode);
+}
+
+static void fail(struct source *src, const char *fmt, ...)
+{
+    va_list ap;
+
+    printf("ssrc 0x%08x seq %u: ", src->ssrc, src->seq);
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+
+    printf("\n");
+
+    errors++;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
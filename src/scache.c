@@ -0,0 +1,418 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <pulse/pulseaudio.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "ausrv.h"
+#include "stream.h"
+#include "scache.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define MAX_ENTRIES  16
+
+/*
+ * Fixed length tones are rendered once and uploaded to the sample cache
+ * of the server. After that they are played by the server without us
+ * waking up and without the stream setup latency.
+ */
+struct scache_entry {
+    struct scache_entry *next;
+    char                *name;
+    struct ausrv        *ausrv;
+    int                  ready;     /* uploaded */
+    uint32_t             duration;  /* in usec */
+    pa_stream           *upload;    /* while being uploaded */
+    int16_t             *samples;   /* while being uploaded */
+    size_t               length;    /* in bytes */
+    size_t               offset;    /* bytes uploaded so far */
+};
+
+static struct scache_entry *find_entry(char *);
+static void remove_entry(struct scache_entry *, int);
+static void upload_state_callback(pa_stream *, void *);
+static void upload_write_callback(pa_stream *, size_t, void *);
+static void play_callback(pa_context *, uint32_t, void *);
+static uint64_t now_usec(void);
+
+static struct scache_entry *entries;
+static int                  nentry;
+static uint32_t             playing = PA_INVALID_INDEX;
+static uint64_t             playing_end;
+static uint32_t             issued;     /* play requests sent */
+static uint32_t             answered;   /* play requests replied to */
+static uint32_t             stopped;    /* requests to kill once answered */
+
+
+int scache_init(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    return 0;
+}
+
+/*
+ * Returns TRUE if the tone was found in the cache and the server was
+ * asked to play it. Otherwise the caller should play it as usual.
+ */
+int scache_play(struct ausrv *ausrv, char *name, void *proplist)
+{
+    struct scache_entry *entry;
+    pa_operation        *oper;
+
+    if (!stream_output_needs_server() || !ausrv->connected)
+        return FALSE;
+
+    if ((entry = find_entry(name)) == NULL || !entry->ready)
+        return FALSE;
+
+    TRACE("%s(): playing '%s' from the sample cache", __FUNCTION__, name);
+
+    scache_stop(ausrv);
+
+    oper = pa_context_play_sample_with_proplist(ausrv->context, name, NULL,
+                                                PA_VOLUME_INVALID,
+                                                (pa_proplist *)proplist,
+                                                play_callback, strdup(name));
+    if (oper == NULL) {
+        LOG_ERROR("%s(): can't play '%s': %s", __FUNCTION__, name,
+                  pa_strerror(pa_context_errno(ausrv->context)));
+        remove_entry(entry, TRUE);
+        return FALSE;
+    }
+
+    pa_operation_unref(oper);
+
+    issued++;
+    playing_end = now_usec() + entry->duration;
+
+    return TRUE;
+}
+
+/*
+ * The tones of the detached stream are rendered for 'duration' usecs
+ * and uploaded as 'name'. The stream is destroyed in any case.
+ */
+void scache_upload(struct ausrv *ausrv, char *name, struct stream *stream,
+                   uint32_t duration)
+{
+    struct scache_entry *entry = NULL;
+    pa_sample_spec       spec;
+    size_t               length;
+
+    if (!stream_output_needs_server() || !ausrv->connected ||
+        find_entry(name) != NULL)
+        goto out;
+
+    if (nentry >= MAX_ENTRIES) {
+        for (entry = entries;  entry->next;  entry = entry->next)
+            ;
+        remove_entry(entry, TRUE);     /* the least recently used one */
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.format   = PA_SAMPLE_S16LE;
+    spec.rate     = stream->rate;
+    spec.channels = 1;
+
+    length = ((uint64_t)stream->rate * duration / 1000000ULL) *
+             sizeof(int16_t);
+
+    if (!length)
+        goto out;
+
+    if ((entry = malloc(sizeof(*entry))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        goto out;
+    }
+    memset(entry, 0, sizeof(*entry));
+
+    if ((entry->samples = malloc(length)) == NULL ||
+        (entry->name = strdup(name)) == NULL)
+    {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        goto failed;
+    }
+
+    entry->ausrv    = ausrv;
+    entry->duration = duration;
+    entry->length   = length;
+
+    stream_render(stream, entry->samples, length);
+
+    entry->upload = pa_stream_new(ausrv->context, name, &spec, NULL);
+
+    if (entry->upload == NULL) {
+        LOG_ERROR("%s(): can't create upload stream for '%s'",
+                  __FUNCTION__, name);
+        goto failed;
+    }
+
+    pa_stream_set_state_callback(entry->upload, upload_state_callback, entry);
+    pa_stream_set_write_callback(entry->upload, upload_write_callback, entry);
+
+    if (pa_stream_connect_upload(entry->upload, length) < 0) {
+        LOG_ERROR("%s(): can't upload '%s'", __FUNCTION__, name);
+        goto failed;
+    }
+
+    entry->next = entries;
+    entries = entry;
+    nentry++;
+
+    TRACE("%s(): uploading '%s' (%zu bytes)", __FUNCTION__, name, length);
+
+    goto out;
+
+ failed:
+    if (entry != NULL) {
+        if (entry->upload != NULL)
+            pa_stream_unref(entry->upload);
+
+        free(entry->samples);
+        free(entry->name);
+        free(entry);
+    }
+
+ out:
+    stream_destroy_detached(stream);
+}
+
+/*
+ * stop the cached tone we asked the server to play, if any; one whose
+ * play request is not answered yet is killed when the reply arrives
+ */
+void scache_stop(struct ausrv *ausrv)
+{
+    pa_operation *oper;
+
+    stopped = issued;
+
+    if (playing != PA_INVALID_INDEX && now_usec() < playing_end &&
+        ausrv->connected && ausrv->context != NULL)
+    {
+        TRACE("%s(): killing sink input %u", __FUNCTION__, playing);
+
+        oper = pa_context_kill_sink_input(ausrv->context, playing, NULL,NULL);
+
+        if (oper != NULL)
+            pa_operation_unref(oper);
+    }
+
+    playing = PA_INVALID_INDEX;
+}
+
+/* the server went away; forget everything we had there */
+void scache_reset(struct ausrv *ausrv)
+{
+    struct scache_entry *entry;
+    struct scache_entry *next;
+
+    for (entry = entries;  entry;  entry = next) {
+        next = entry->next;
+
+        if (entry->ausrv == ausrv)
+            remove_entry(entry, FALSE);
+    }
+
+    playing  = PA_INVALID_INDEX;
+    answered = stopped = issued;
+}
+
+
+static struct scache_entry *find_entry(char *name)
+{
+    struct scache_entry *prev;
+    struct scache_entry *entry;
+
+    for (prev = (struct scache_entry *)&entries;  prev->next;  prev = entry) {
+        entry = prev->next;
+
+        if (!strcmp(name, entry->name)) {
+            /* keep the most recently used one in front */
+            prev->next  = entry->next;
+            entry->next = entries;
+            entries     = entry;
+
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void remove_entry(struct scache_entry *entry, int from_server)
+{
+    struct scache_entry *prev;
+    struct ausrv        *ausrv = entry->ausrv;
+    pa_operation        *oper;
+
+    for (prev = (struct scache_entry *)&entries; prev->next; prev = prev->next){
+        if (prev->next == entry) {
+            prev->next = entry->next;
+            nentry--;
+            break;
+        }
+    }
+
+    TRACE("%s(): '%s'", __FUNCTION__, entry->name);
+
+    if (entry->upload != NULL) {
+        pa_stream_set_state_callback(entry->upload, NULL, NULL);
+        pa_stream_set_write_callback(entry->upload, NULL, NULL);
+        pa_stream_disconnect(entry->upload);
+        pa_stream_unref(entry->upload);
+    }
+    else if (from_server && entry->ready && ausrv->connected) {
+        oper = pa_context_remove_sample(ausrv->context, entry->name,
+                                        NULL, NULL);
+        if (oper != NULL)
+            pa_operation_unref(oper);
+    }
+
+    free(entry->samples);
+    free(entry->name);
+    free(entry);
+}
+
+static void upload_state_callback(pa_stream *pastr, void *userdata)
+{
+    struct scache_entry *entry = (struct scache_entry *)userdata;
+
+    if (entry->upload != pastr) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    switch (pa_stream_get_state(pastr)) {
+
+    case PA_STREAM_TERMINATED:
+        TRACE("%s(): '%s' is in the sample cache", __FUNCTION__, entry->name);
+
+        pa_stream_unref(entry->upload);
+        free(entry->samples);
+
+        entry->upload  = NULL;
+        entry->samples = NULL;
+        entry->ready   = TRUE;
+        break;
+
+    case PA_STREAM_FAILED:
+        LOG_ERROR("Upload of '%s' failed", entry->name);
+        remove_entry(entry, FALSE);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void upload_write_callback(pa_stream *pastr, size_t bytes,
+                                  void *userdata)
+{
+    struct scache_entry *entry = (struct scache_entry *)userdata;
+    size_t               len;
+
+    if (entry->upload != pastr) {
+        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+        return;
+    }
+
+    if ((len = entry->length - entry->offset) > bytes)
+        len = bytes;
+
+    if (len > 0) {
+        pa_stream_write(pastr, (char *)entry->samples + entry->offset, len,
+                        NULL, 0, PA_SEEK_RELATIVE);
+        entry->offset += len;
+    }
+
+    if (entry->offset >= entry->length) {
+        pa_stream_set_write_callback(pastr, NULL, NULL);
+        pa_stream_finish_upload(pastr);
+    }
+}
+
+static void play_callback(pa_context *context, uint32_t idx, void *userdata)
+{
+    char                *name = (char *)userdata;
+    struct scache_entry *entry;
+    pa_operation        *oper;
+    int                  stale;
+
+    /* the replies come in the order of the requests */
+    stale = (int32_t)(++answered - stopped) <= 0;
+
+    if (idx == PA_INVALID_INDEX) {
+        LOG_ERROR("%s(): can't play cached sample '%s': %s", __FUNCTION__,
+                  name ? name : "<unknown>",
+                  pa_strerror(pa_context_errno(context)));
+
+        /* the server lost it; upload it again next time */
+        if (name != NULL && (entry = find_entry(name)) != NULL)
+            remove_entry(entry, FALSE);
+    }
+    else if (stale) {
+        TRACE("%s(): '%s' was stopped meanwhile; killing sink input %u",
+              __FUNCTION__, name ? name : "<unknown>", idx);
+
+        oper = pa_context_kill_sink_input(context, idx, NULL, NULL);
+
+        if (oper != NULL)
+            pa_operation_unref(oper);
+    }
+    else
+        playing = idx;
+
+    free(name);
+}
+
+static uint64_t now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,43 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_SCACHE_H__
+#define __TONEGEND_SCACHE_H__
+
+#include <stdint.h>
+
+struct ausrv;
+struct stream;
+
+int  scache_init(int, char **);
+int  scache_play(struct ausrv *, char *, void *);
+void scache_upload(struct ausrv *, char *, struct stream *, uint32_t);
+void scache_stop(struct ausrv *);
+void scache_reset(struct ausrv *);
+
+#endif /* __TONEGEND_SCACHE_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,143 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "shed.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+/*
+ * Deadline based load shedding. The streams report their slack, i.e.
+ * how long they could still wait before the output runs dry, minus the
+ * time the next block takes to render. Running short of the margin
+ * raises the level immediately, one step per check; it is lowered one
+ * step at a time once there was plenty of slack for a while.
+ */
+
+#define RELAX_FACTOR    4       /* slack to count as calm, x margin */
+#define RELAX_CHECKS    50      /* calm checks before lowering the level */
+
+static uint32_t          margin;        /* usec; 0 disables shedding */
+static int               calm;
+static struct shed_stats stats;
+
+
+void shed_set_margin(uint32_t usec)
+{
+    margin = usec;
+
+    if (!margin)
+        stats.level = SHED_NONE;
+}
+
+int shed_enabled(void)
+{
+    return margin > 0;
+}
+
+int shed_level(void)
+{
+    return stats.level;
+}
+
+int shed_check(int64_t slack)
+{
+    if (!margin)
+        return SHED_NONE;
+
+    stats.checks++;
+
+    if (slack < (int64_t)margin) {
+        stats.misses++;
+        calm = 0;
+
+        if (stats.level < SHED_MAX) {
+            stats.level++;
+            stats.escalations++;
+
+            if (stats.level > stats.peak)
+                stats.peak = stats.level;
+
+            TRACE("load shedding level %d (slack %lld usec)",
+                  stats.level, (long long)slack);
+        }
+    }
+    else if (slack > (int64_t)margin * RELAX_FACTOR && stats.level > 0) {
+        if (++calm >= RELAX_CHECKS) {
+            calm = 0;
+            stats.level--;
+            stats.relaxations++;
+
+            TRACE("load shedding level %d", stats.level);
+        }
+    }
+    else
+        calm = 0;
+
+    return stats.level;
+}
+
+/* called by the renderers, which may be on render workers */
+void shed_account(int level, int muted)
+{
+    if (muted)
+        __atomic_add_fetch(&stats.muted, 1, __ATOMIC_RELAXED);
+    else if (level >= 0 && level <= SHED_MAX)
+        __atomic_add_fetch(&stats.blocks[level], 1, __ATOMIC_RELAXED);
+}
+
+void shed_get_stats(struct shed_stats *st)
+{
+    memcpy(st, &stats, sizeof(*st));
+}
+
+void shed_print_stats(void)
+{
+    printf("load shedding: level %d (peak %d), %u deadline checks, "
+           "%u misses\n"
+           "   %u escalations, %u relaxations\n"
+           "   blocks: %u full, %u coarse envelope, %u table oscillator, "
+           "%u priority, %u muted\n",
+           stats.level, stats.peak, stats.checks, stats.misses,
+           stats.escalations, stats.relaxations,
+           stats.blocks[SHED_NONE], stats.blocks[SHED_ENVELOP],
+           stats.blocks[SHED_OSCILLATOR], stats.blocks[SHED_PRIORITY],
+           stats.muted);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
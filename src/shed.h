@@ -0,0 +1,64 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_SHED_H__
+#define __TONEGEND_SHED_H__
+
+#include <stdint.h>
+
+/*
+ * load shedding levels; each one includes the ones below it
+ */
+#define SHED_NONE        0
+#define SHED_ENVELOP     1      /* envelopes evaluated every few samples */
+#define SHED_OSCILLATOR  2      /* table lookup instead of the resonator */
+#define SHED_PRIORITY    3      /* only the highest priority class plays */
+#define SHED_MAX         SHED_PRIORITY
+
+#define SHED_ENVELOP_STEP  32   /* samples per envelope evaluation */
+
+struct shed_stats {
+    uint32_t  checks;                   /* deadline checks made */
+    uint32_t  misses;                   /* checks with too little slack */
+    uint32_t  escalations;              /* times the level was raised */
+    uint32_t  relaxations;              /* times the level was lowered */
+    uint32_t  blocks[SHED_MAX + 1];     /* blocks rendered at each level */
+    uint32_t  muted;                    /* blocks replaced by silence */
+    int       level;                    /* current level */
+    int       peak;                     /* highest level so far */
+};
+
+void shed_set_margin(uint32_t);
+int  shed_enabled(void);
+int  shed_level(void);
+int  shed_check(int64_t);
+void shed_account(int, int);
+void shed_get_stats(struct shed_stats *);
+void shed_print_stats(void);
+
+#endif /* __TONEGEND_SHED_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
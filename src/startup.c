@@ -0,0 +1,151 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "startup.h"
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+static uint64_t boottime_usec(void);
+static uint64_t exec_time(void);
+
+static uint64_t  exec_usec;               /* 0 if unknown */
+static uint64_t  marks[STARTUP_MAX];      /* CLOCK_BOOTTIME usec */
+
+static const char *names[STARTUP_MAX] = {
+    [STARTUP_MAIN]   = "main",
+    [STARTUP_NAME]   = "name owned",
+    [STARTUP_SERVER] = "server ready",
+    [STARTUP_SAMPLE] = "first sample",
+};
+
+
+void startup_init(void)
+{
+    exec_usec = exec_time();
+    marks[STARTUP_MAIN] = boottime_usec();
+}
+
+/* the first call for each milestone counts; safe from any thread */
+void startup_mark(int what)
+{
+    uint64_t none = 0;
+
+    if (what < 0 || what >= STARTUP_MAX ||
+        __atomic_load_n(&marks[what], __ATOMIC_RELAXED))
+        return;
+
+    __atomic_compare_exchange_n(&marks[what], &none, boottime_usec(), FALSE,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    if (what == STARTUP_SAMPLE)
+        startup_print();
+}
+
+void startup_print(void)
+{
+    uint64_t  base = exec_usec ? exec_usec : marks[STARTUP_MAIN];
+    uint64_t  t;
+    char      buf[256];
+    int       len = 0;
+    int       i;
+
+    for (i = 0;  i < STARTUP_MAX && len < (int)sizeof(buf);  i++) {
+        if ((t = __atomic_load_n(&marks[i], __ATOMIC_RELAXED)) != 0) {
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%s +%u.%03u",
+                            len ? ", " : "", names[i],
+                            (unsigned)((t - base) / 1000),
+                            (unsigned)((t - base) % 1000));
+        }
+    }
+
+    LOG_INFO("startup (msec from %s): %s", exec_usec ? "exec" : "main",
+             len ? buf : "-");
+}
+
+
+static uint64_t boottime_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/*
+ * The start time of the process in /proc/self/stat is in clock ticks
+ * since boot, so it is only good to a tick (usually 10 msec).
+ */
+static uint64_t exec_time(void)
+{
+    FILE               *f;
+    char                stat[1024];
+    char               *p;
+    unsigned long long  start;
+    long                hz = sysconf(_SC_CLK_TCK);
+
+    if ((f = fopen("/proc/self/stat", "r")) == NULL)
+        return 0;
+
+    p = fgets(stat, sizeof(stat), f);
+    fclose(f);
+
+    /* the command name may contain anything but ends with the last ')' */
+    if (p == NULL || hz <= 0 || (p = strrchr(stat, ')')) == NULL)
+        return 0;
+
+    /* field 22; skip the state and the 18 fields after it */
+    if (sscanf(p + 2, "%*c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+               "%*s %*s %*s %*s %*s %*s %*s %llu", &start) != 1)
+        return 0;
+
+    return (uint64_t)start * 1000000ULL / (uint64_t)hz;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,45 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_STARTUP_H__
+#define __TONEGEND_STARTUP_H__
+
+/*
+ * startup milestones, timed from the exec of the daemon
+ */
+#define STARTUP_MAIN     0      /* main() entered */
+#define STARTUP_NAME     1      /* D-Bus name owned */
+#define STARTUP_SERVER   2      /* audio server ready */
+#define STARTUP_SAMPLE   3      /* first samples asked for */
+#define STARTUP_MAX      4
+
+void startup_init(void);
+void startup_mark(int);
+void startup_print(void);
+
+#endif /* __TONEGEND_STARTUP_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -33,7 +33,18 @@ USA.
 #include <trace/trace.h>
 
 #include "ausrv.h"
+#include "mainloop.h"
 #include "stream.h"
+#include "pulseout.h"
+#include "fileout.h"
+#include "rtpout.h"
+#include "g711.h"
+#include "rtcheck.h"
+#include "shed.h"
+#include "startup.h"
+#ifdef HAVE_ALSA
+#include "alsaout.h"
+#endif
 
 #define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
 #define LOG_INFO(f, args...) log_error(logctx, f, ##args)
@@ -41,24 +52,72 @@ USA.
 
 #define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
 
-static void state_callback(pa_stream *, void *);
-static void underflow_callback(pa_stream *, void *);
-static void suspended_callback(pa_stream *, void *);
-static void write_callback(pa_stream *, size_t, void *);
-static void flush_callback(pa_stream *, int, void *);
-static void drain_callback(pa_stream *, int, void *);
+static void update_statistics(struct stream *, size_t, uint32_t, uint32_t,
+                              uint32_t);
 static void write_samples(struct stream *, int16_t *,size_t, uint32_t *);
+static int  lookup_format(char *);
+static size_t encode_samples(struct stream *, int16_t *, size_t);
+static int  preallocate_buffer(struct stream *, uint32_t, pa_sample_spec *);
+static void request_preallocated(struct stream *, size_t);
+static void prerender(struct stream *);
+static void render_ahead(void *);
+static void sync_stream(struct stream *);
+static int  setup_queue(struct stream *);
+static void request_queued(struct stream *, size_t);
+static void fill_queue(pa_mainloop_api *, pa_defer_event *, void *);
+static void rewind_queue(struct stream *);
+static void release_queue(struct stream *);
+static int  stream_priority(char *);
+static void check_deadline(struct stream *, size_t);
+static void end_cues(struct stream *, void (*)(void *, int), uint64_t,
+                     uint32_t);
+static int  add_cue(struct stream *, uint64_t, void (*)(void *, int), void *);
+static uint64_t cue_time(struct stream *, uint32_t);
+static void insert_cue(struct stream *, struct stream_cue *);
+static void wrote(struct stream *, uint32_t);
+static void check_cues(struct stream *);
+static void post_cue(struct stream *, struct stream_cue *, int, uint32_t);
+static void cue_posted(struct ausrv *, struct ausrv_post *);
+static void cue_callback(pa_mainloop_api *, pa_time_event *,
+                         const struct timeval *, void *);
+static void drop_cues(struct stream *);
+static void drop_events(struct stream *);
+
+#define MAX_FORMATS 8
+
+struct stream_format {
+    char  *name;                /* stream name or NULL for all streams */
+    int    format;
+};
+
+static struct stream_backend *backends[] = {
+    &pulseout_backend,
+    &fileout_null_backend,
+    &fileout_file_backend,
+    &rtpout_backend,
+#ifdef HAVE_ALSA
+    &alsaout_backend,
+#endif
+    NULL
+};
 
 static uint32_t default_rate     = 48000;
 static int      print_statistics = 0;
 static int      target_buflen    = 1000; /* 1000msec ie. 1sec */
 static int      min_bufreq       = 200;  /* 200msec */
+static int      realtime         = 0;
+static int      ahead_depth      = 0;    /* render-ahead blocks */
+static struct stream_backend *backend = &pulseout_backend;
+static struct stream_format   formats[MAX_FORMATS];
+static int                    nformat;
 
 int stream_init(int argc, char **argv)
 {
     (void)argc;
     (void)argv;
 
+    g711_init();
+
     return 0;
 }
 
@@ -91,6 +150,130 @@ void stream_buffering_parameters(int tlen, int minreq)
     }
 }
 
+/*
+ * in real-time mode every stream renders into a single buffer that is
+ * allocated with the stream, and the backends copy the samples instead
+ * of taking over the buffer; so no memory is allocated or released
+ * while the samples are requested
+ */
+void stream_set_realtime(int enable)
+{
+    realtime = enable;
+}
+
+/*
+ * With a depth of two or more, streams that can checkpoint their state
+ * (see stream_set_checkpoint()) render that many blocks ahead on the
+ * audio loop when it is idle, and the requests are served from the
+ * rendered blocks. Otherwise the next block is rendered right after
+ * each write.
+ */
+void stream_set_render_ahead(int depth)
+{
+    ahead_depth = depth > 1 ? depth : 0;
+}
+
+int stream_set_output(char *spec)
+{
+    struct stream_backend **b;
+    char                   *opts;
+    size_t                  len;
+
+    if (spec == NULL)
+        return 0;
+
+    if ((opts = strchr(spec, ',')) != NULL)
+        len = opts++ - spec;
+    else
+        len = strlen(spec);
+
+    for (b = backends;  *b != NULL;  b++) {
+        if (strlen((*b)->name) == len && !strncmp(spec, (*b)->name, len)) {
+            if ((*b)->config != NULL && (*b)->config(opts) < 0)
+                return -1;
+
+            if (opts != NULL && (*b)->config == NULL) {
+                LOG_ERROR("%s(): '%s' output takes no options",
+                          __FUNCTION__, (*b)->name);
+                return -1;
+            }
+
+            backend = *b;
+
+            TRACE("%s(): using '%s' output", __FUNCTION__, backend->name);
+
+            return 0;
+        }
+    }
+
+    LOG_ERROR("%s(): unknown output '%s'", __FUNCTION__, spec);
+
+    return -1;
+}
+
+/*
+ * spec is a comma separated list of <stream>=<format> pairs, or just a
+ * <format> that applies to every stream, e.g. 'dtmf=ulaw,indtone=alaw'
+ */
+int stream_set_formats(char *spec)
+{
+    struct stream_format *f;
+    char                 *name, *fmt, *next;
+    char                  buf[256];
+    int                   i;
+
+    if (spec == NULL)
+        return 0;
+
+    if (strlen(spec) >= sizeof(buf)) {
+        LOG_ERROR("%s(): format list is too long", __FUNCTION__);
+        return -1;
+    }
+    strcpy(buf, spec);
+
+    for (name = buf, i = 0;  name != NULL;  name = next, i++) {
+        if ((next = strchr(name, ',')) != NULL)
+            *next++ = '\0';
+
+        if ((fmt = strchr(name, '=')) != NULL)
+            *fmt++ = '\0';
+        else {
+            fmt  = name;
+            name = NULL;
+        }
+
+        if (i >= MAX_FORMATS) {
+            LOG_ERROR("%s(): too many formats", __FUNCTION__);
+            return -1;
+        }
+
+        f = formats + i;
+
+        if (!strcmp(fmt, "s16le"))
+            f->format = STREAM_FORMAT_S16LE;
+        else if (!strcmp(fmt, "ulaw"))
+            f->format = STREAM_FORMAT_ULAW;
+        else if (!strcmp(fmt, "alaw"))
+            f->format = STREAM_FORMAT_ALAW;
+        else {
+            LOG_ERROR("%s(): invalid format '%s'", __FUNCTION__, fmt);
+            return -1;
+        }
+
+        free(f->name);
+        f->name = name ? strdup(name) : NULL;
+    }
+
+    nformat = i;
+
+    return 0;
+}
+
+int stream_output_needs_server(void)
+{
+    return backend->need_server;
+}
+
 struct stream *stream_create(struct ausrv *ausrv,
                              char         *name,
                              char         *sink,
@@ -101,8 +284,6 @@ struct stream *stream_create(struct ausrv *ausrv,
                              void         *data)
 {
     struct stream      *stream;
-    pa_buffer_attr      battr;
-    pa_stream_flags_t   flags;
     pa_sample_spec      spec;
     struct timeval      tv;
     uint64_t            start;
@@ -111,6 +292,7 @@ struct stream *stream_create(struct ausrv *ausrv,
     uint32_t            tlength;
     char                tlstr[32];
     char                bfstr[32];
+    int                 format;
 
     if (!ausrv->connected) {
         LOG_ERROR("Can't create stream '%s': no server connected", name);
@@ -123,6 +305,11 @@ struct stream *stream_create(struct ausrv *ausrv,
     if (sample_rate == 0)
         sample_rate = default_rate;
 
+    format = lookup_format(name);
+
+    if (format != STREAM_FORMAT_S16LE)
+        sample_rate = 8000;     /* G.711 is always 8kHz */
+
     memset(&spec, 0, sizeof(spec));
     spec.format   = PA_SAMPLE_S16LE;
     spec.rate     = sample_rate;
@@ -153,16 +340,24 @@ struct stream *stream_create(struct ausrv *ausrv,
     stream->id      = ausrv->nextid++;
     stream->name    = strdup(name);
     stream->rate    = sample_rate;
-    stream->pastr   = pa_stream_new_with_proplist(ausrv->context, name,
-                                                  &spec, NULL,
-                                                  (pa_proplist *)proplist);
+    stream->format  = format;
+    stream->backend = backend;
     stream->start   = start;
     stream->flush   = TRUE;
+    stream->event   = -1;
+    stream->prio    = stream_priority(name);
     stream->bufsize = bufsize;
     stream->write   = write;
     stream->destroy = destroy;
     stream->data    = data;
 
+    worker_job_init(&stream->job, render_ahead, stream);
+
+    if (realtime && preallocate_buffer(stream, tlength, &spec) < 0) {
+        stream_free(stream);
+        return NULL;
+    }
+
     if (print_statistics) {
         stat = &stream->stat;
         stat->wrtime  = start;
@@ -172,47 +367,28 @@ struct stream *stream_create(struct ausrv *ausrv,
     }
 
 
-    if (stream->pastr == NULL) {
-        free(stream->name);
-        
-        free(stream);
+    if (backend->create(stream, sink, proplist, tlength, bufsize) < 0) {
+        stream_free(stream);
 
         TRACE("%s(): stream creation of '%s' failed", __FUNCTION__, name);
 
         return NULL;    
     }
 
-    /* these are for the 48Khz mono 16bit streams */
-    battr.maxlength = -1;                /* default (4MB) */
-    battr.tlength   = tlength;
-    battr.minreq    = bufsize;
-    battr.prebuf    = -1;                /* default (tlength) */
-    battr.fragsize  = -1;                /* default (tlength) */
-
-    flags = PA_STREAM_ADJUST_LATENCY;
-
-    pa_stream_set_state_callback(stream->pastr, state_callback,(void*)stream);
-    pa_stream_set_underflow_callback(stream->pastr, underflow_callback,
-                                     (void *)stream);
-    pa_stream_set_suspended_callback(stream->pastr, suspended_callback,
-                                     (void *)stream);
-    pa_stream_set_write_callback(stream->pastr, write_callback,(void *)stream);
-    pa_stream_connect_playback(stream->pastr, sink, &battr, flags, NULL, NULL);
-
     ausrv->streams = stream;
 
     TRACE("%s(): stream '%s' created", __FUNCTION__, stream->name);
 
     if (print_statistics) {
-        if (battr.tlength == (uint32_t)-1)
+        if (tlength == (uint32_t)-1)
             snprintf(tlstr, sizeof(tlstr), "<default>");
         else
-            snprintf(tlstr, sizeof(tlstr), "%u", battr.tlength);
+            snprintf(tlstr, sizeof(tlstr), "%u", tlength);
 
-        if (battr.minreq == (uint32_t)-1)
+        if (bufsize == (uint32_t)-1)
             snprintf(bfstr, sizeof(tlstr), "<default>");
         else
-            snprintf(bfstr, sizeof(tlstr), "%u", battr.minreq);
+            snprintf(bfstr, sizeof(tlstr), "%u", bufsize);
 
         TRACE("Requested buffer attributes:\n"
               "   tlength  %s\n"
@@ -223,14 +399,60 @@ struct stream *stream_create(struct ausrv *ausrv,
     return stream;
 }
 
+/*
+ * A detached stream has no output and it is not on the stream list.
+ * The caller pulls the samples with stream_render() and releases it by
+ * stream_destroy_detached(). Used to pre-render fixed length tones.
+ */
+struct stream *stream_create_detached(struct ausrv *ausrv,
+                                      char         *name,
+                                      uint32_t      sample_rate,
+                                      uint32_t    (*write)(struct stream*,
+                                                           int16_t*, int),
+                                      void        (*destroy)(void*),
+                                      void         *data)
+{
+    struct stream *stream;
+
+    if ((stream = (struct stream *)malloc(sizeof(*stream))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+    memset(stream, 0, sizeof(*stream));
+
+    stream->ausrv   = ausrv;
+    stream->id      = -1;
+    stream->name    = strdup(name ? name : "detached tone");
+    stream->rate    = sample_rate ? sample_rate : default_rate;
+    stream->format  = STREAM_FORMAT_S16LE;
+    stream->event   = -1;
+    stream->flush   = TRUE;
+    stream->write   = write;
+    stream->destroy = destroy;
+    stream->data    = data;
+
+    worker_job_init(&stream->job, render_ahead, stream);
+
+    return stream;
+}
+
+void stream_destroy_detached(struct stream *stream)
+{
+    if (stream != NULL) {
+        if (stream->destroy != NULL)
+            stream->destroy(stream->data);
+
+        drop_events(stream);
+        stream_free(stream);
+    }
+}
+
 void stream_destroy(struct stream *stream)
 {
     struct ausrv         *ausrv = stream->ausrv;
     struct stream        *prev;
-    pa_stream            *pastr;
-    const pa_buffer_attr *battr;
     struct stream_stat   *stat;
-    pa_operation         *oper;
+    int                   sts;
     struct timeval        tv;
     uint64_t              stop;
     double                upt;
@@ -245,6 +467,7 @@ void stream_destroy(struct stream *stream)
 
     TRACE("%s(): destroying stream '%s'", __FUNCTION__, stream->name);
 
+    worker_wait(&stream->job);
 
     if (stream->killed) {
         TRACE("%s(): stream is already killed", __FUNCTION__);
@@ -257,44 +480,34 @@ void stream_destroy(struct stream *stream)
 
     for (prev=(struct stream *)&ausrv->streams;  prev->next;  prev=prev->next){
         if (prev->next == stream) {
-            pastr = stream->pastr;
-            battr = pa_stream_get_buffer_attr(pastr);
             stat  = &stream->stat;
 
             if (stream->flush)
-                oper = pa_stream_flush(pastr, flush_callback, (void *)stream);
+                sts = stream->backend->flush(stream);
             else
-                oper = pa_stream_drain(pastr, drain_callback, (void *)stream);
+                sts = stream->backend->drain(stream);
 
-            if (oper == NULL)
+            if (sts < 0)
                 return;
 
-            pa_operation_unref(oper);
-
             prev->next = stream->next;
             stream->next   = NULL;
             stream->killed = TRUE;
 
+            release_queue(stream);
+            drop_cues(stream);
+            drop_events(stream);
+
             if (stream->destroy != NULL)
                 stream->destroy(stream->data);
 
             stream->ausrv  = NULL;
 
-            free(stream->buf.samples);
-
-            pa_stream_set_write_callback(pastr, NULL,NULL);
+            if (stream->buf.prealloc == NULL)
+                free(stream->buf.samples);
+            stream->buf.samples = NULL;
 
             if (print_statistics && stat->wrcnt > 0) {
-                if (battr != NULL) {
-                    TRACE("Buffer attributes:\n"
-                          "   maxlength %u\n"
-                          "   tlength   %u\n"
-                          "   prebuf    %u\n"
-                          "   minreq    %u",
-                          battr->maxlength, battr->tlength,
-                          battr->prebuf, battr->minreq);
-                }
-
                 upt  = (double)(stop - stream->start) / 1000000.0;
                 strt = (double)(stream->time) / 1000000.0;
                 dur  = (double)(stat->wrtime - stat->firstwr)/1000000.0 + 0.01;
@@ -341,28 +554,166 @@ void stream_set_timeout(struct stream *stream, uint32_t timeout)
         stream->end = stream->time + timeout;
 }
 
+/*
+ * Backends that can signal events (e.g. RTP) look at this instead of,
+ * or in addition to, the rendered samples.
+ */
+void stream_set_event(struct stream *stream, int event, int level)
+{
+    if (level < 0)  level = 0;
+    if (level > 63) level = 63;
+
+    stream->event   = event;
+    stream->evlevel = level;
+}
+
+/*
+ * The event of the tones that play from 'start' for 'length' usec, or
+ * until stream_end_events() if the length is 0. Later events are laid
+ * out after the earlier ones, as the tones are.
+ */
+int stream_add_event(struct stream *stream, uint32_t start, uint32_t length,
+                     int code, int level)
+{
+    struct stream_event  *ev;
+    struct stream_event **link;
+
+    if ((ev = (struct stream_event *)malloc(sizeof(*ev))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+
+    if (level < 0)  level = 0;
+    if (level > 63) level = 63;
+
+    ev->start = cue_time(stream, start);
+    ev->end   = length ? ev->start + length : STREAM_CUE_ENDLESS;
+    ev->code  = code;
+    ev->level = level;
+
+    for (link = &stream->events;  *link;  link = &(*link)->next) {
+        if ((*link)->start > ev->start)
+            break;
+    }
+
+    ev->next = *link;
+    *link    = ev;
+
+    return 0;
+}
+
+/* the endless events end at 'time', e.g. the key was released */
+void stream_end_events(struct stream *stream, uint32_t time)
+{
+    struct stream_event *ev;
+    uint64_t             end = cue_time(stream, time);
+
+    for (ev = stream->events;  ev;  ev = ev->next) {
+        if (ev->end == STREAM_CUE_ENDLESS)
+            ev->end = end > ev->start ? end : ev->start;
+    }
+}
+
+/* nothing plays after 'time' any more, e.g. the tones were cut */
+void stream_cut_events(struct stream *stream, uint32_t time)
+{
+    struct stream_event **link;
+    struct stream_event  *ev;
+    uint64_t              end = cue_time(stream, time);
+
+    for (link = &stream->events;  (ev = *link); ) {
+        if (ev->start >= end) {
+            *link = ev->next;
+            free(ev);
+        }
+        else {
+            if (ev->end > end)
+                ev->end = end;
+            link = &ev->next;
+        }
+    }
+}
+
+/*
+ * The event of the samples from 'start' to 'end' on the stream timeline:
+ * the one playing in the middle of them, or else any that overlaps them,
+ * or else the one tagged by stream_set_event(); -1 if there is none.
+ * The events that ended before 'start' are forgotten.
+ */
+int stream_event_at(struct stream *stream, uint64_t start, uint64_t end,
+                    int *level)
+{
+    struct stream_event *ev;
+    struct stream_event *hit = NULL;
+    uint64_t             mid = start + (end - start) / 2;
+
+    while ((ev = stream->events) != NULL && ev->end <= start) {
+        stream->events = ev->next;
+        free(ev);
+    }
+
+    for (ev = stream->events;  ev && ev->start < end;  ev = ev->next) {
+        if (ev->end <= start || ev->end <= ev->start)
+            continue;           /* over, or ended before it started */
+
+        if (ev->start <= mid && mid < ev->end) {
+            hit = ev;
+            break;
+        }
+
+        if (hit == NULL)
+            hit = ev;
+    }
+
+    if (hit != NULL) {
+        *level = hit->level;
+        return hit->code;
+    }
+
+    *level = stream->evlevel;
+
+    return stream->event;
+}
+
+void stream_set_checkpoint(struct stream *stream,
+                           int  (*save)(struct stream *, void **),
+                           void (*restore)(struct stream *, void *),
+                           void (*discard)(void *))
+{
+    stream->save    = save;
+    stream->restore = restore;
+    stream->discard = discard;
+
+    if (ahead_depth > 0 && stream->bufsize != (uint32_t)-1)
+        setup_queue(stream);
+}
+
 void stream_kill_all(struct ausrv *ausrv)
 {
     struct stream *stream;
 
     while ((stream = ausrv->streams) != NULL) {
+        worker_wait(&stream->job);
+
         ausrv->streams = stream->next;
 
         stream->next   = NULL;
         stream->killed = TRUE;
 
+        release_queue(stream);
+        drop_cues(stream);
+        drop_events(stream);
+
         if (stream->destroy != NULL)
             stream->destroy(stream->data);
 
         stream->ausrv  = NULL;
 
-        pa_stream_set_state_callback(stream->pastr, NULL,NULL);
-        pa_stream_set_underflow_callback(stream->pastr, NULL,NULL);
-        pa_stream_set_suspended_callback(stream->pastr, NULL,NULL);
-        pa_stream_set_write_callback(stream->pastr, NULL,NULL);
+        stream->backend->release(stream);
 
-        free(stream->name);
-        free(stream);
+        if (stream->buf.prealloc == NULL)
+            free(stream->buf.samples);
+        stream_free(stream);
     }
 }
 
@@ -377,6 +728,8 @@ void stream_clean_buffer(struct stream *stream)
     int             i,j;
     int32_t         sample;
 
+    sync_stream(stream);
+
     gettimeofday(&tv, NULL);
     now  = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
     bcnt = ((now - stream->start) * (uint64_t)stream->rate) / 1000000ULL;
@@ -430,6 +783,10 @@ struct stream *stream_find(struct ausrv *ausrv, char *name)
             break;
     }
 
+    /* the caller is going to change the tones; get them in sync */
+    if (stream != NULL)
+        sync_stream(stream);
+
     return stream;
 }
 
@@ -492,79 +849,9 @@ void stream_free_properties(void *proplist)
         pa_proplist_free((pa_proplist *)proplist);
 }
 
-static void state_callback(pa_stream *pastr, void *userdata)
-{
-    struct stream *stream = (struct stream *)userdata;
-
-    if (!stream || stream->pastr != pastr) {
-        LOG_ERROR("%s(): confused with data structures", __FUNCTION__);
-        return;
-    }
-
-    switch (pa_stream_get_state(pastr)) {
-        case PA_STREAM_UNCONNECTED:
-            TRACE("%s(): stream '%s' unconnected", __FUNCTION__, stream->name);
-            break;
-
-        case PA_STREAM_CREATING:
-            TRACE("%s(): stream '%s' creating", __FUNCTION__, stream->name);
-            break;
-
-        case PA_STREAM_READY:
-            TRACE("%s(): stream '%s' ready", __FUNCTION__, stream->name);
-            break;
-
-        case PA_STREAM_TERMINATED:
-            TRACE("%s(): stream '%s' terminated", __FUNCTION__, stream->name);
-            free(stream->name);
-            free(stream);
-            break;
-
-        default:
-        case PA_STREAM_FAILED:
-            LOG_ERROR("%s(): Stream error: %s", __FUNCTION__,
-                      pa_strerror(pa_context_errno(pa_stream_get_context(pastr))));
-            break;
-    }
-}
-
-
-static void underflow_callback(pa_stream *pastr, void *userdata)
-{
-    (void)pastr;
-
-    struct stream *stream = (struct stream *)userdata;
-
-    if (!stream || !stream->name) 
-        LOG_ERROR("Stream underflow");
-    else {
-        LOG_ERROR("Stream '%s' underflow", stream->name);
-
-        stream->stat.underflows++;
-
-        stream_destroy(stream);
-    }
-}
-
-static void suspended_callback(pa_stream *pastr, void *userdata)
-{
-    (void)pastr;
-
-    struct stream *stream = (struct stream *)userdata;
-
-    if (!stream || !stream->name) 
-        LOG_ERROR("Stream suspended");
-    else {
-        LOG_ERROR("Stream '%s' suspended", stream->name);
-
-    }
-}
-
-static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
+void stream_request(struct stream *stream, size_t bytes)
 {
-    struct stream        *stream = (struct stream *)userdata;
     struct stream_stat   *stat   = &stream->stat;
-    const pa_buffer_attr *battr;
     int16_t              *samples;
     size_t                buflen;
     int16_t              *extra;
@@ -572,19 +859,27 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
     struct timeval        tv;
     uint32_t              start;
     uint32_t              gap;
-    uint32_t              calcend;
-    uint32_t              calc;
-    uint32_t              period;
     uint32_t              cpu;
 
 
-    if (!stream || stream->pastr != pastr) {
-        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+    if (stream->killed)
+        return;
+
+    startup_mark(STARTUP_SAMPLE);
+
+    worker_wait(&stream->job);
+
+    check_deadline(stream, bytes);
+
+    if (ahead_depth && stream->save && stream->bufsize != (uint32_t)-1) {
+        request_queued(stream, bytes);
         return;
     }
 
-    if (stream->killed)
+    if (stream->buf.prealloc != NULL) {
+        request_preallocated(stream, bytes);
         return;
+    }
 
     if (print_statistics) {
         gettimeofday(&tv, NULL);
@@ -639,53 +934,13 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
 
     if (samples != NULL) {
 
-        if (print_statistics) {
-            gettimeofday(&tv, NULL);
-            calcend = (uint64_t)tv.tv_sec * (uint64_t)1000000 + 
-                      (uint64_t)tv.tv_usec;
-            calc    = calcend - start;
-            period  = (calcend - stat->wrtime) / 1000;
-
-            stat->wrtime = calcend;
-
-            if (stream->bcnt == 0 /* && buflen > stream->bufsize */) {
-                TRACE("Stream '%s' pre-buffers of %u bytes",
-                      stream->name, buflen);
-                stat->firstwr = stat->wrtime;
-            }
-            else {
-                stat->wrcnt ++;
-                stat->sumgap += gap;
-                stat->sumcalc += calc;
-                stat->cpucalc += cpu;
-                
-                if (buflen < stat->minbuf) stat->minbuf = buflen;
-                if (buflen > stat->maxbuf) stat->maxbuf = buflen;
-                
-                if (gap < stat->mingap) stat->mingap = gap;
-                if (gap > stat->maxgap) stat->maxgap = gap;
-                
-                if (calc < stat->mincalc) stat->mincalc = calc;
-                if (calc > stat->maxcalc) stat->maxcalc = calc;
-
-#if 0
-                TRACE("Buffer writting period %umsec", period);
-#endif
-                
-                if (period > (uint32_t)min_bufreq) {
-                    stat->late++;
-                    
-#if 0
-                    TRACE("Buffer is late %umsec in stream '%s'",
-                          period - min_bufreq, stream->name);
-#endif
-                }
-            }
-        }
+        if (print_statistics)
+            update_statistics(stream, buflen, start, gap, cpu);
 
-        pa_stream_write(stream->pastr, (void*)samples,buflen, free,
-                        0,PA_SEEK_RELATIVE);
         stream->bcnt += buflen;
+        wrote(stream, stream->time);
+        stream->backend->write(stream, samples,
+                               encode_samples(stream, samples,buflen), free);
 
 
 #if 0
@@ -696,78 +951,863 @@ static void write_callback(pa_stream *pastr, size_t bytes, void *userdata)
         if (stream->end && stream->time >= stream->end)
             stream_destroy(stream);
         else {
-            if (stream->bufsize == (uint32_t)-1) {
-                if ((battr = pa_stream_get_buffer_attr(pastr)) != NULL)
-                    stream->bufsize = battr->minreq;
-            }
-
             if (stream->bufsize != (uint32_t)-1) {
                 stream->buf.samples = (int16_t *)malloc(stream->bufsize);
                 stream->buf.buflen  = stream->bufsize;
 
                 if (stream->buf.samples == NULL)
                     LOG_ERROR("%s(): failed to allocate memory", __FUNCTION__);
-                else {
-                    write_samples(stream, stream->buf.samples,stream->bufsize,
-                                  &stream->buf.cpu);
-                }
+                else
+                    prerender(stream);
             }
         }
     }
 }
 
 
-static void flush_callback(pa_stream *pastr, int success, void *userdata)
+/*
+ * Render straight into a buffer owned by the backend, e.g. a mmap'ed
+ * device ring. There is no write-ahead buffering in this case; the
+ * backend is expected to call this right when the samples are needed.
+ */
+void stream_render(struct stream *stream, int16_t *samples, size_t bytes)
 {
-    struct stream *stream = (struct stream *)userdata;
+    struct stream_stat *stat = &stream->stat;
+    struct timeval      tv;
+    uint32_t            start;
+    uint32_t            gap;
+    uint32_t            cpu;
 
-    if (stream->pastr != pastr) {
-        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
+    if (stream->killed) {
+        memset(samples, 0, bytes);
         return;
     }
 
-    if (!success)
-        LOG_ERROR("%s(): Can't flush stream '%s'", __FUNCTION__, stream->name);
-    else
-        TRACE("%s(): stream '%s' flushed", __FUNCTION__, stream->name);
+    /* detached streams are rendered ahead, e.g. for the sample cache */
+    if (stream->backend)
+        startup_mark(STARTUP_SAMPLE);
 
-    pa_stream_disconnect(pastr);
-    pa_stream_unref(pastr);
-}
+    if (print_statistics && stream->backend) {
+        gettimeofday(&tv, NULL);
+        start = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+        gap   = start - stat->wrtime;
+    }
+
+    if (stream->backend)
+        check_deadline(stream, bytes);
+
+    write_samples(stream, samples,bytes, &cpu);
+
+    if (print_statistics && stream->backend)
+        update_statistics(stream, bytes, start, gap, cpu);
+
+    stream->bcnt += bytes;
+    wrote(stream, stream->time);
 
+    if (stream->end && stream->time >= stream->end)
+        stream_destroy(stream);
+}
 
-static void drain_callback(pa_stream *pastr, int success, void *userdata)
+int stream_cork(struct stream *stream, int cork)
 {
-    struct stream *stream = (struct stream *)userdata;
+    if (stream->backend->cork == NULL)
+        return -1;
 
-    if (stream->pastr != pastr) {
-        LOG_ERROR("%s(): Confused with data structures", __FUNCTION__);
-        return;
-    }
+    return stream->backend->cork(stream, cork);
+}
 
-    if (!success)
-        LOG_ERROR("%s(): Can't drain stream '%s'", __FUNCTION__, stream->name);
-    else
-        TRACE("%s(): stream '%s' drained", __FUNCTION__, stream->name);
+int stream_get_latency(struct stream *stream, uint64_t *latency)
+{
+    if (stream->backend->timing == NULL)
+        return -1;
+
+    return stream->backend->timing(stream, latency);
+}
 
-    pa_stream_disconnect(pastr);
-    pa_stream_unref(pastr);
+/* adds a cue for the sample at 'time' on the stream timeline */
+int stream_add_cue(struct stream *stream, uint32_t time,
+                   void (*fire)(void *, int), void *data)
+{
+    return add_cue(stream, cue_time(stream, time), fire, data);
 }
 
+/* adds a cue that fires only once moved, or when the stream goes */
+int stream_add_endless_cue(struct stream *stream, void (*fire)(void *, int),
+                           void *data)
+{
+    return add_cue(stream, STREAM_CUE_ENDLESS, fire, data);
+}
 
-static void write_samples(struct stream *stream, int16_t *samples,
-                          size_t bytes, uint32_t *cpu)
+/* moves a cue to 'time', e.g. to end an endless tone */
+void stream_move_cue(struct stream *stream, void (*fire)(void *, int),
+                     void *data, uint32_t time)
 {
-    int       length;
-    clock_t   cpubeg;
-    clock_t   cpuend;
+    struct stream_cue *prev;
+    struct stream_cue *cue;
 
-    length = bytes/2;
+    for (prev = (struct stream_cue *)&stream->cues;  prev->next;
+         prev = prev->next)
+    {
+        cue = prev->next;
 
-    cpubeg = print_statistics ? clock() : 0;
+        if (cue->fire == fire && cue->data == data) {
+            prev->next = cue->next;
+            cue->time  = cue_time(stream, time);
+
+            insert_cue(stream, cue);
+            check_cues(stream);
+            break;
+        }
+    }
+}
+
+/* moves the endless cues calling 'fire' to 'time' */
+void stream_end_cues(struct stream *stream, void (*fire)(void *, int),
+                     uint32_t time)
+{
+    end_cues(stream, fire, STREAM_CUE_ENDLESS, time);
+}
+
+/* moves the cues calling 'fire' after 'time' to it, e.g. tones were cut */
+void stream_cut_cues(struct stream *stream, void (*fire)(void *, int),
+                     uint32_t time)
+{
+    end_cues(stream, fire, cue_time(stream, time) + 1, time);
+}
+
+/*
+ * the cues calling 'fire' fire now as not played, e.g. a tone was cut;
+ * returns how many there were
+ */
+int stream_drop_cues(struct stream *stream, void (*fire)(void *, int))
+{
+    struct stream_cue *prev;
+    struct stream_cue *cue;
+    int                n = 0;
+
+    for (prev = (struct stream_cue *)&stream->cues;  (cue = prev->next); ) {
+        if (cue->fire == fire) {
+            prev->next = cue->next;
+            post_cue(stream, cue, FALSE, 0);
+            n++;
+        }
+        else
+            prev = cue;
+    }
+
+    return n;
+}
+
+uint32_t stream_sample_size(struct stream *stream)
+{
+    return stream->format == STREAM_FORMAT_S16LE ? sizeof(int16_t) : 1;
+}
+
+void stream_free(struct stream *stream)
+{
+    free(stream->ahead.mem);
+    free(stream->ahead.blocks);
+    free(stream->buf.prealloc);
+    free(stream->name);
+    free(stream);
+}
+
+static int lookup_format(char *name)
+{
+    struct stream_format *f;
+
+    for (f = formats;  f < formats + nformat;  f++) {
+        if (f->name == NULL || !strcmp(name, f->name))
+            return f->format;
+    }
+
+    return STREAM_FORMAT_S16LE;
+}
+
+/*
+ * the output format stage; it is done in place right before the
+ * samples are handed over to the backend, so the write-ahead buffer
+ * and the renderers stay 16 bit. Returns the encoded length in bytes.
+ */
+static size_t encode_samples(struct stream *stream, int16_t *samples,
+                             size_t buflen)
+{
+    size_t nsamp = buflen / sizeof(int16_t);
+
+    switch (stream->format) {
+    case STREAM_FORMAT_ULAW:
+        g711_encode(G711_ULAW, (uint8_t *)samples, samples, nsamp);
+        return nsamp;
+    case STREAM_FORMAT_ALAW:
+        g711_encode(G711_ALAW, (uint8_t *)samples, samples, nsamp);
+        return nsamp;
+    default:
+        return buflen;
+    }
+}
+
+static void update_statistics(struct stream *stream, size_t buflen,
+                              uint32_t start, uint32_t gap, uint32_t cpu)
+{
+    struct stream_stat *stat = &stream->stat;
+    struct timeval      tv;
+    uint32_t            calcend;
+    uint32_t            calc;
+    uint32_t            period;
+
+    gettimeofday(&tv, NULL);
+    calcend = (uint64_t)tv.tv_sec * (uint64_t)1000000 + 
+              (uint64_t)tv.tv_usec;
+    calc    = calcend - start;
+    period  = (calcend - stat->wrtime) / 1000;
+
+    stat->wrtime = calcend;
+
+    if (stream->bcnt == 0 /* && buflen > stream->bufsize */) {
+        TRACE("Stream '%s' pre-buffers of %u bytes",
+              stream->name, buflen);
+        stat->firstwr = stat->wrtime;
+    }
+    else {
+        stat->wrcnt ++;
+        stat->sumgap += gap;
+        stat->sumcalc += calc;
+        stat->cpucalc += cpu;
+        
+        if (buflen < stat->minbuf) stat->minbuf = buflen;
+        if (buflen > stat->maxbuf) stat->maxbuf = buflen;
+        
+        if (gap < stat->mingap) stat->mingap = gap;
+        if (gap > stat->maxgap) stat->maxgap = gap;
+        
+        if (calc < stat->mincalc) stat->mincalc = calc;
+        if (calc > stat->maxcalc) stat->maxcalc = calc;
+
+#if 0
+        TRACE("Buffer writting period %umsec", period);
+#endif
+        
+        if (period > (uint32_t)min_bufreq) {
+            stat->late++;
+            
+#if 0
+            TRACE("Buffer is late %umsec in stream '%s'",
+                  period - min_bufreq, stream->name);
+#endif
+        }
+    }
+}
+
+static int preallocate_buffer(struct stream *stream, uint32_t tlength,
+                              pa_sample_spec *spec)
+{
+    size_t size;
+
+    /*
+     * a request is at most a full target buffer; without one use the
+     * Pulse Audio default. Bigger requests are served in pieces.
+     */
+    if (tlength != (uint32_t)-1)
+        size = tlength;
+    else
+        size = pa_usec_to_bytes(2 * PA_USEC_PER_SEC, spec);
+
+    if (stream->bufsize != (uint32_t)-1 && stream->bufsize > size)
+        size = stream->bufsize;
+
+    size = (size + 1) & ~((size_t)1);
+
+    if ((stream->buf.prealloc = (int16_t *)malloc(size)) == NULL) {
+        LOG_ERROR("%s(): failed to allocate memory", __FUNCTION__);
+        return -1;
+    }
+
+    memset(stream->buf.prealloc, 0, size); /* fault it in */
+    stream->buf.size = size;
+
+    return 0;
+}
+
+/*
+ * stream_request() in real-time mode. The write-ahead buffer, if any,
+ * is the preallocated buffer itself; after it was handed over (and
+ * copied by the backend) the next one is rendered into the same place.
+ */
+static void request_preallocated(struct stream *stream, size_t bytes)
+{
+    int16_t              *samples = stream->buf.prealloc;
+    size_t                size    = stream->buf.size;
+    size_t                buflen;
+    size_t                total;
+    struct timeval        tv;
+    uint32_t              start;
+    uint32_t              gap;
+    uint32_t              cpu;
+    uint32_t              extcpu;
+
+    if (print_statistics) {
+        gettimeofday(&tv, NULL);
+        start = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+        gap   = start - stream->stat.wrtime;
+    }
+
+    bytes = (bytes + 1) & ~((size_t)1);
+    total = 0;
+    cpu   = 0;
+
+    while (total < bytes) {
+        buflen = bytes - total;
+
+        if (buflen > size)
+            buflen = size;
+
+        if (stream->buf.samples == NULL)
+            write_samples(stream, samples,buflen, &extcpu);
+        else {
+            if (buflen <= stream->buf.buflen) {
+                buflen = stream->buf.buflen;
+                extcpu = 0;
+            }
+            else {
+                write_samples(stream, samples + stream->buf.buflen / 2,
+                              buflen - stream->buf.buflen, &extcpu);
+            }
+
+            extcpu += stream->buf.cpu;
+
+            stream->buf.samples = NULL;
+            stream->buf.cpu = 0;
+        }
+
+        cpu   += extcpu;
+        total += buflen;
+
+        stream->backend->write(stream, samples,
+                               encode_samples(stream, samples,buflen), NULL);
+    }
+
+    if (print_statistics)
+        update_statistics(stream, total, start, gap, cpu);
+
+    stream->bcnt += total;
+    wrote(stream, stream->time);
+
+    if (stream->end && stream->time >= stream->end)
+        stream_destroy(stream);
+    else if (stream->bufsize != (uint32_t)-1) {
+        buflen = stream->bufsize < size ? stream->bufsize : size;
+
+        stream->buf.samples = samples;
+        stream->buf.buflen  = buflen;
+
+        prerender(stream);
+    }
+}
+
+/*
+ * render the next write-ahead buffer; on a render worker if there are
+ * any. Everybody who touches the stream afterwards waits for the job
+ * first, see stream_find() and stream_request().
+ */
+static void prerender(struct stream *stream)
+{
+    if (worker_submit(&stream->job) < 0)
+        render_ahead(stream);
+}
+
+static void render_ahead(void *data)
+{
+    struct stream *stream = (struct stream *)data;
+
+    write_samples(stream, stream->buf.samples,stream->buf.buflen,
+                  &stream->buf.cpu);
+}
+
+/*
+ * the tones are about to be looked at or changed outside the renderer;
+ * finish the background rendering and drop whatever was rendered ahead
+ */
+static void sync_stream(struct stream *stream)
+{
+    worker_wait(&stream->job);
+    rewind_queue(stream);
+}
+
+static int setup_queue(struct stream *stream)
+{
+    pa_mainloop_api *api = stream->ausrv->api;
+    size_t           blksize = (stream->bufsize + 1) & ~((size_t)1);
+
+    if (stream->ahead.mem != NULL)
+        return 0;
+
+    stream->ahead.mem    = (int16_t *)malloc(ahead_depth * blksize);
+    stream->ahead.blocks = calloc(ahead_depth, sizeof(struct stream_block));
+    stream->ahead.defer  = api->defer_new(api, fill_queue, stream);
+
+    if (!stream->ahead.mem || !stream->ahead.blocks || !stream->ahead.defer) {
+        LOG_ERROR("%s(): failed to set up render-ahead queue for '%s'",
+                  __FUNCTION__, stream->name);
+        release_queue(stream);
+        free(stream->ahead.mem);
+        free(stream->ahead.blocks);
+        stream->ahead.mem    = NULL;
+        stream->ahead.blocks = NULL;
+        return -1;
+    }
+
+    memset(stream->ahead.mem, 0, ahead_depth * blksize);
+
+    stream->ahead.depth   = ahead_depth;
+    stream->ahead.blksize = blksize;
+
+    return 0;
+}
+
+/*
+ * stream_request() with a render-ahead queue. Whole blocks are written,
+ * rendered ones first; the backend copies them.
+ */
+static void request_queued(struct stream *stream, size_t bytes)
+{
+    struct stream_block  *blk;
+    int16_t              *samples;
+    size_t                blksize;
+    size_t                total;
+    struct timeval        tv;
+    uint32_t              start;
+    uint32_t              gap;
+    uint32_t              cpu;
+    uint32_t              blkcpu;
+    uint32_t              time;
+
+    if (stream->ahead.mem == NULL && setup_queue(stream) < 0) {
+        stream->save = NULL;    /* fall back to the plain write-ahead */
+        stream_request(stream, bytes);
+        return;
+    }
+
+    if (print_statistics) {
+        gettimeofday(&tv, NULL);
+        start = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec;
+        gap   = start - stream->stat.wrtime;
+    }
+
+    blksize = stream->ahead.blksize;
+    total   = 0;
+    cpu     = 0;
+
+    while (total < bytes) {
+        blk     = stream->ahead.blocks + stream->ahead.head;
+        samples = stream->ahead.mem + stream->ahead.head * (blksize / 2);
+
+        if (stream->ahead.count > 0) {
+            blkcpu = blk->cpu;
+
+            stream->discard(blk->state);
+            blk->state = NULL;
+
+            stream->ahead.head = (stream->ahead.head+1) % stream->ahead.depth;
+            stream->ahead.count--;
+        }
+        else {
+            /* ran dry; render it now into the free slot */
+            write_samples(stream, samples,blksize, &blkcpu);
+        }
+
+        cpu   += blkcpu;
+        total += blksize;
+
+        stream->backend->write(stream, samples,
+                               encode_samples(stream, samples,blksize), NULL);
+    }
+
+    if (print_statistics)
+        update_statistics(stream, total, start, gap, cpu);
+
+    stream->bcnt += total;
+
+    /* the stream time of what was written so far */
+    if (stream->ahead.count > 0)
+        time = stream->ahead.blocks[stream->ahead.head].time;
+    else
+        time = stream->time;
+
+    wrote(stream, time);
+
+    if (stream->end && time >= stream->end)
+        stream_destroy(stream);
+    else
+        stream->ausrv->api->defer_enable(stream->ahead.defer, TRUE);
+}
+
+static void fill_queue(pa_mainloop_api *api, pa_defer_event *ev, void *data)
+{
+    struct stream       *stream = (struct stream *)data;
+    struct stream_block *blk;
+    size_t               blksize = stream->ahead.blksize;
+    int                  idx;
+
+    if (stream->killed || stream->ahead.count >= stream->ahead.depth) {
+        api->defer_enable(ev, FALSE);
+        return;
+    }
+
+    idx = (stream->ahead.head + stream->ahead.count) % stream->ahead.depth;
+    blk = stream->ahead.blocks + idx;
+
+    if (stream->save(stream, &blk->state) < 0) {
+        api->defer_enable(ev, FALSE);
+        return;
+    }
+
+    blk->time = stream->time;
+
+    /* one block per loop iteration; let the I/O have its turn between */
+    write_samples(stream, stream->ahead.mem + idx * (blksize / 2), blksize,
+                  &blk->cpu);
+
+    stream->ahead.count++;
+}
+
+/*
+ * go back to the checkpoint of the first block that was not written,
+ * i.e. to where the output actually is
+ */
+static void rewind_queue(struct stream *stream)
+{
+    struct stream_block *blk;
+    int                  i;
+
+    if (stream->ahead.count == 0)
+        return;
+
+    blk = stream->ahead.blocks + stream->ahead.head;
+
+    stream->restore(stream, blk->state);
+    stream->time = blk->time;
+    blk->state   = NULL;
+
+    for (i = 1;  i < stream->ahead.count;  i++) {
+        blk = stream->ahead.blocks +
+              (stream->ahead.head + i) % stream->ahead.depth;
+
+        stream->discard(blk->state);
+        blk->state = NULL;
+    }
+
+    stream->ahead.count = 0;
+
+    if (stream->ahead.defer != NULL)
+        stream->ausrv->api->defer_enable(stream->ahead.defer, TRUE);
+}
+
+static void release_queue(struct stream *stream)
+{
+    struct stream_block *blk;
+    pa_mainloop_api     *api;
+
+    while (stream->ahead.count > 0) {
+        blk = stream->ahead.blocks + stream->ahead.head;
+
+        stream->discard(blk->state);
+        blk->state = NULL;
+
+        stream->ahead.head = (stream->ahead.head + 1) % stream->ahead.depth;
+        stream->ahead.count--;
+    }
+
+    if (stream->ahead.defer != NULL) {
+        api = stream->ausrv->api;
+        api->defer_free(stream->ahead.defer);
+        stream->ahead.defer = NULL;
+    }
+}
+
+static void end_cues(struct stream *stream, void (*fire)(void *, int),
+                     uint64_t after, uint32_t time)
+{
+    struct stream_cue *prev;
+    struct stream_cue *cue;
+    struct stream_cue *ended = NULL;
+
+    for (prev = (struct stream_cue *)&stream->cues;  (cue = prev->next); ) {
+        if (cue->fire == fire && cue->time >= after) {
+            prev->next = cue->next;
+            cue->next  = ended;
+            ended      = cue;
+        }
+        else
+            prev = cue;
+    }
+
+    while ((cue = ended) != NULL) {
+        ended     = cue->next;
+        cue->time = cue_time(stream, time);
+
+        insert_cue(stream, cue);
+    }
+
+    check_cues(stream);
+}
+
+static int add_cue(struct stream *stream, uint64_t time,
+                   void (*fire)(void *, int), void *data)
+{
+    struct stream_cue *cue;
+
+    if ((cue = (struct stream_cue *)calloc(1, sizeof(*cue))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+
+    cue->time = time;
+    cue->fire = fire;
+    cue->data = data;
+
+    insert_cue(stream, cue);
+    check_cues(stream);
+
+    return 0;
+}
+
+/*
+ * the 64 bit time of a 32 bit stream time; the cues are not more than
+ * half the wrap around time, i.e. 35 minutes, off what is written
+ */
+static uint64_t cue_time(struct stream *stream, uint32_t time)
+{
+    int64_t t = (int64_t)stream->written +
+                (int32_t)(time - (uint32_t)stream->written);
+
+    return t > 0 ? (uint64_t)t : 0;
+}
+
+static void insert_cue(struct stream *stream, struct stream_cue *cue)
+{
+    struct stream_cue *prev;
+
+    for (prev = (struct stream_cue *)&stream->cues;  prev->next;
+         prev = prev->next)
+    {
+        if (prev->next->time > cue->time)
+            break;
+    }
+
+    cue->next  = prev->next;
+    prev->next = cue;
+}
+
+/* the samples up to 'time' on the stream timeline are handed over */
+static void wrote(struct stream *stream, uint32_t time)
+{
+    stream->written += (uint32_t)(time - (uint32_t)stream->written);
+
+    check_cues(stream);
+}
+
+/*
+ * The cues of the samples handed to the backend so far fire when the
+ * backend has played out what it has buffered ahead of them.
+ */
+static void check_cues(struct stream *stream)
+{
+    struct stream_cue *cue;
+    uint64_t           latency;
+    uint64_t           delay;
+
+    if ((cue = stream->cues) == NULL || cue->time > stream->written)
+        return;
+
+    if (stream_get_latency(stream, &latency) < 0)
+        latency = 0;
+
+    while ((cue = stream->cues) != NULL && cue->time <= stream->written) {
+        stream->cues = cue->next;
+
+        delay = stream->written - cue->time;
+        delay = latency > delay ? latency - delay : 0;
+
+        post_cue(stream, cue, TRUE, delay);
+    }
+}
+
+/* the D-Bus signals of the cues are sent from the main loop */
+static void post_cue(struct stream *stream, struct stream_cue *cue,
+                     int played, uint32_t delay)
+{
+    cue->played = played;
+    cue->delay  = delay;
+
+    ausrv_post_main(stream->ausrv, &cue->post, cue_posted);
+}
+
+static void cue_posted(struct ausrv *ausrv, struct ausrv_post *post)
+{
+    pa_mainloop_api   *api = mainloop_get_api();
+    struct stream_cue *cue = (struct stream_cue *)post;
+    struct timeval     tv;
+
+    (void)ausrv;
+
+    if (cue->delay > 0) {
+        gettimeofday(&tv, NULL);
+        tv.tv_sec  += cue->delay / 1000000;
+        tv.tv_usec += cue->delay % 1000000;
+
+        if (tv.tv_usec >= 1000000) {
+            tv.tv_sec  += 1;
+            tv.tv_usec -= 1000000;
+        }
+
+        if (api->time_new(api, &tv, cue_callback, cue))
+            return;
+
+        LOG_ERROR("%s(): Can't create timer", __FUNCTION__);
+    }
+
+    cue->fire(cue->data, cue->played);
+    free(cue);
+}
+
+static void cue_callback(pa_mainloop_api *api, pa_time_event *event,
+                         const struct timeval *tv, void *data)
+{
+    struct stream_cue *cue = (struct stream_cue *)data;
+
+    (void)tv;
+
+    api->time_free(event);
+
+    cue->fire(cue->data, cue->played);
+    free(cue);
+}
+
+static void drop_cues(struct stream *stream)
+{
+    struct stream_cue *cue;
+
+    while ((cue = stream->cues) != NULL) {
+        stream->cues = cue->next;
+
+        post_cue(stream, cue, FALSE, 0);
+    }
+}
+
+static void drop_events(struct stream *stream)
+{
+    struct stream_event *ev;
+
+    while ((ev = stream->events) != NULL) {
+        stream->events = ev->next;
+        free(ev);
+    }
+}
+
+static int stream_priority(char *name)
+{
+    if (!strcmp(name, STREAM_DTMF))
+        return 3;
+    if (!strcmp(name, STREAM_INDICATOR))
+        return 2;
+    if (!strcmp(name, STREAM_NOTIFICATION))
+        return 1;
+
+    return 0;
+}
+
+/*
+ * The deadline of the next block is when the server runs out of the
+ * samples it already has, ie. the current latency plus the length of the
+ * block being requested. Whatever is left after our own rendering cost is
+ * the slack that drives the shedding level. In real-time mode the block
+ * goes out in pieces of the preallocated buffer, and the first one is
+ * still in flight, not with the server, until it has been rendered; only
+ * the pieces after it count for the deadline.
+ */
+static void check_deadline(struct stream *stream, size_t bytes)
+{
+    struct stream *s;
+    uint64_t       latency;
+    uint64_t       samples;
+    uint64_t       ahead;
+    int64_t        slack;
+    int            level;
+    int            top;
+
+    if (!shed_enabled())
+        return;
+
+    if (stream->bcnt > 0 && stream_get_latency(stream, &latency) == 0) {
+        samples = bytes / 2;
+        ahead   = samples;
+
+        if (stream->buf.prealloc != NULL)
+            ahead -= samples < stream->buf.size / 2 ? samples :
+                                                      stream->buf.size / 2;
+
+        slack   = (int64_t)latency +
+                  (int64_t)((ahead * 1000000ULL) / stream->rate) -
+                  (int64_t)(((uint64_t)stream->rcost * samples) / 1000ULL);
+
+        shed_check(slack);
+    }
+
+    level = shed_level();
+
+    stream->shed  = level;
+    stream->muted = FALSE;
+
+    if (level >= SHED_PRIORITY) {
+        for (top = stream->prio, s = stream->ausrv->streams;  s;  s = s->next){
+            if (!s->killed && s->prio > top)
+                top = s->prio;
+        }
+        stream->muted = stream->prio < top;
+    }
+}
+
+static void write_samples(struct stream *stream, int16_t *samples,
+                          size_t bytes, uint32_t *cpu)
+{
+    int              length;
+    clock_t          cpubeg;
+    clock_t          cpuend;
+    struct timespec  beg;
+    struct timespec  end;
+    uint64_t         nsec;
+
+    length = bytes/2;
+
+    if (stream->muted) {
+        memset(samples, 0, bytes);
+        stream->time += ((uint64_t)length * 1000000ULL) / stream->rate;
+        shed_account(stream->shed, TRUE);
+        *cpu = 0;
+        return;
+    }
+
+    cpubeg = print_statistics ? clock() : 0;
+
+    if (shed_enabled())
+        clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    rtcheck_enter();
+    stream->time = stream->write(stream, samples, length);
+    rtcheck_leave();
+ 
+    if (shed_enabled()) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        nsec = (uint64_t)(end.tv_sec - beg.tv_sec) * 1000000000ULL +
+               (end.tv_nsec - beg.tv_nsec);
+
+        if (length > 0)
+            stream->rcost = (stream->rcost * 7 + nsec / length) / 8;
+
+        shed_account(stream->shed, FALSE);
+    }
 
-    stream->time = stream->write(stream, samples, length);
- 
     cpuend = print_statistics ? clock() : 0;
 
     *cpu = cpuend - cpubeg;
@@ -28,11 +28,18 @@ USA.
 
 #include <pulse/pulseaudio.h>
 
+#include "ausrv.h"
+#include "worker.h"
+
 #define STREAM_INDICATOR    "indtone"
 #define STREAM_DTMF         "dtmf"
 #define STREAM_NOTES        "ringtone"
 #define STREAM_NOTIFICATION "notiftone"
 
+#define STREAM_FORMAT_S16LE 0
+#define STREAM_FORMAT_ULAW  1    /* G.711 mu-law, 8kHz */
+#define STREAM_FORMAT_ALAW  2    /* G.711 A-law, 8kHz */
+
 #define PROP_STREAM_RESTORE "module-stream-restore.id"
 #define PROP_MEDIA_ROLE     "media.role"
 #define ID_KEYPRESS         "x-maemo-key-pressed"
@@ -40,6 +47,27 @@ USA.
 #define INPUT_BY_ROLE       "sink-input-by-media-role"
 
 struct ausrv;
+struct stream;
+
+/*
+ * output backends; the Pulse Audio one is the default. A backend asks for
+ * samples by calling stream_request() and hands the rendered buffer back
+ * via write(). Once flush() or drain() is called the backend must not ask
+ * for more data, and it calls stream_free() when it is done with the
+ * stream. release() is the synchronous teardown used by stream_kill_all()
+ */
+struct stream_backend {
+    char     *name;
+    int       need_server;                  /* needs a Pulse Audio server */
+    int     (*config)(char *);              /* backend options, or NULL */
+    int     (*create)(struct stream *, char *, void *, uint32_t, uint32_t);
+    void    (*write)(struct stream *, int16_t *, size_t, void (*)(void *));
+    int     (*cork)(struct stream *, int);
+    int     (*flush)(struct stream *);
+    int     (*drain)(struct stream *);
+    int     (*timing)(struct stream *, uint64_t *);  /* latency in usec */
+    void    (*release)(struct stream *);
+};
 
 struct stream_stat {
     uint64_t           firstwr;      /* first writting time */
@@ -58,45 +86,139 @@ struct stream_stat {
     uint32_t           late;
 };
 
+#define STREAM_CUE_ENDLESS  UINT64_MAX    /* until moved or dropped */
+
+/*
+ * Called on the main loop once the sample at 'time' on the stream
+ * timeline is played out, as told by the timing of the backend, with
+ * 'played' TRUE; or with FALSE if the stream goes, or the cue is
+ * dropped, before the sample is written. The time is 64 bits wide, as
+ * the 32 bit stream time wraps around in 71 minutes.
+ */
+struct stream_cue {
+    struct ausrv_post  post;     /* first: hands it over to the main loop */
+    struct stream_cue *next;
+    uint64_t           time;     /* stream time in usec */
+    void             (*fire)(void *, int);
+    void              *data;
+    uint32_t           delay;    /* usec from posting until played out */
+    int                played;
+};
+
+/*
+ * An RFC 4733 event on the stream timeline, laid out together with the
+ * tones that make it, so that an output that sends events (e.g. RTP)
+ * knows what each block of samples stands for.
+ */
+struct stream_event {
+    struct stream_event *next;
+    uint64_t             start;    /* stream time in usec */
+    uint64_t             end;      /* STREAM_CUE_ENDLESS until ended */
+    int                  code;
+    int                  level;    /* power level in -dBm0 */
+};
+
+struct stream_block {
+    uint32_t           time;     /* stream time at the start of the block */
+    uint32_t           cpu;
+    void              *state;    /* checkpoint taken before rendering it */
+};
+
 struct stream {
     struct stream     *next;
     struct ausrv      *ausrv;
     int                id;       /* stream id */
     char              *name;     /* stream name */
     uint32_t           rate;     /* sample rate */
-    pa_stream         *pastr;    /* pulse audio stream */
+    int                format;   /* output format; rendering is S16 */
+    struct stream_backend *backend;  /* output backend */
+    void              *output;   /* backend specific output handle */
     uint64_t           start;    /* wall clock time of stream creation */
     uint32_t           time;     /* buffer time in usecs */
     uint32_t           end;      /* buffer timeout for the stream in usec */
     int                flush;    /* flush on destroy */
     int                killed;
+    int                event;    /* RFC 4733 event being played, or -1 */
+    int                evlevel;  /* power level of the event in -dBm0 */
+    struct stream_event *events; /* laid out with the tones, by start */
     uint32_t           bufsize;  /* write-ahead-buffer size (ie. minreq) */
     uint32_t           bcnt;     /* byte count */
+    uint64_t           written;  /* stream time handed to the backend */
     uint32_t         (*write)(struct stream *, int16_t *, int);
     void             (*destroy)(void *);
     void              *data;     /* extension */
     struct stream_stat stat;     /* statistics */
+    int                prio;     /* class priority when shedding load */
+    int                shed;     /* shedding level for the next block */
+    int                muted;    /* shed: a higher priority class plays */
+    uint32_t           rcost;    /* rendering cost in nsec per sample */
     struct {
         int16_t  *samples;
         size_t    buflen;
         uint32_t  cpu;
+        int16_t  *prealloc;   /* real-time mode: the one and only buffer */
+        size_t    size;       /* size of the preallocated buffer */
     }                  buf;
+    struct worker_job  job;      /* renders buf in the background */
+    int              (*save)(struct stream *, void **);   /* checkpoints */
+    void             (*restore)(struct stream *, void *);
+    void             (*discard)(void *);
+    struct {
+        int                  depth;    /* 0: no render-ahead queue */
+        int                  head;     /* next block to write */
+        int                  count;    /* rendered blocks in the queue */
+        size_t               blksize;
+        int16_t             *mem;      /* depth * blksize bytes */
+        struct stream_block *blocks;
+        pa_defer_event      *defer;    /* fills the queue when idle */
+    }                  ahead;
+    struct stream_cue *cues;     /* in the order of their time */
 };
 
 int stream_init(int, char **);
 void stream_set_default_samplerate(uint32_t);
 void stream_print_statistics(int);
 void stream_buffering_parameters(int, int);
+void stream_set_realtime(int);
+void stream_set_render_ahead(int);
+int stream_set_output(char *);
+int stream_set_formats(char *);
+int stream_output_needs_server(void);
 struct stream *stream_create(struct ausrv *, char *, char *, uint32_t,
                              uint32_t (*)(struct stream *, int16_t*, int),
                              void (*)(void*), void *, void *);
+struct stream *stream_create_detached(struct ausrv *, char *, uint32_t,
+                                      uint32_t (*)(struct stream *,
+                                                   int16_t*, int),
+                                      void (*)(void*), void *);
+void stream_destroy_detached(struct stream *);
 void stream_destroy(struct stream *);
 void stream_set_timeout(struct stream *, uint32_t);
+void stream_set_event(struct stream *, int, int);
+int stream_add_event(struct stream *, uint32_t, uint32_t, int, int);
+void stream_end_events(struct stream *, uint32_t);
+void stream_cut_events(struct stream *, uint32_t);
+int stream_event_at(struct stream *, uint64_t, uint64_t, int *);
+void stream_set_checkpoint(struct stream *, int (*)(struct stream *, void **),
+                           void (*)(struct stream *, void *), void (*)(void *));
+uint32_t stream_sample_size(struct stream *);
 void stream_kill_all(struct ausrv *);
 void stream_clean_buffer(struct stream *);
 struct stream *stream_find(struct ausrv *, char *);
 void *stream_parse_properties(char *);
 void stream_free_properties(void *);
+void stream_request(struct stream *, size_t);
+void stream_render(struct stream *, int16_t *, size_t);
+int stream_cork(struct stream *, int);
+int stream_get_latency(struct stream *, uint64_t *);
+int stream_add_cue(struct stream *, uint32_t, void (*)(void *, int), void *);
+int stream_add_endless_cue(struct stream *, void (*)(void *, int), void *);
+void stream_move_cue(struct stream *, void (*)(void *, int), void *,
+                     uint32_t);
+void stream_end_cues(struct stream *, void (*)(void *, int), uint32_t);
+void stream_cut_cues(struct stream *, void (*)(void *, int), uint32_t);
+int stream_drop_cues(struct stream *, void (*)(void *, int));
+void stream_free(struct stream *);
 
 
 #endif /* __TONEGEND_STREAM_H__ */
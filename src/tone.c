@@ -33,6 +33,8 @@ USA.
 #include "stream.h"
 #include "envelop.h"
 #include "tone.h"
+#include "pool.h"
+#include "shed.h"
 
 #ifndef TRUE
 #define TRUE  1
@@ -51,6 +53,12 @@ USA.
 #define OFFSET    8192
 #define SCALE     1024ULL
 
+#define POOL_SIZE 64       /* tones preallocated at startup */
+
+#define TABLE_BITS 12      /* sine table used by the shedding oscillator */
+#define TABLE_SIZE (1 << TABLE_BITS)
+#define PHASE_UNIT 4294967296.0
+
 static inline void singen_init(struct singen *singen, uint32_t freq,
                                uint32_t rate, uint32_t volume)
 {
@@ -79,13 +87,48 @@ static inline int32_t singen_write(struct singen *singen)
     return (int32_t)(singen->n0 / singen->offs);
 }
 
+static int16_t sine_table[TABLE_SIZE];
+
+static inline int32_t tabgen_write(struct tabgen *tabgen)
+{
+    int32_t sine = sine_table[tabgen->phase >> (32 - TABLE_BITS)];
+
+    tabgen->phase += tabgen->step;
+
+    return (sine * tabgen->amp) >> 15;
+}
+
+static inline int32_t pcmgen_write(struct pcmgen *pcmgen)
+{
+    int32_t sample = pcmgen->samples[pcmgen->pos];
+
+    if (++pcmgen->pos >= pcmgen->total)
+        pcmgen->pos = pcmgen->head;
+
+    return (sample * pcmgen->gain) >> 15;
+}
+
 static void setup_envelop_for_tone(struct tone *, int, uint32_t, uint32_t);
+static void switch_oscillator(struct tone *, uint32_t, int);
+static struct tone *clone_tone(struct tone *);
+static void free_tones(struct tone *);
+
+static struct pool *tone_pool;
 
 int tone_init(int argc, char **argv)
 {
+    int i;
+
     (void)argc;
     (void)argv;
 
+    for (i = 0;  i < TABLE_SIZE;  i++)
+        sine_table[i] = lrint(sin(2.0 * M_PI * i / TABLE_SIZE) * AMPLITUDE);
+
+    if ((tone_pool = pool_create("tone", sizeof(struct tone),
+                                 POOL_SIZE)) == NULL)
+        return -1;
+
     return 0;
 }
 
@@ -107,11 +150,10 @@ struct tone *tone_create(struct stream *stream,
     if (!volume || !period || !play)
         return NULL;
 
-    if ((tone = (struct tone *)malloc(sizeof(*tone))) == NULL) {
+    if ((tone = (struct tone *)pool_alloc(tone_pool)) == NULL) {
         LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
         return NULL;
     }
-    memset(tone, 0, sizeof(*tone));
 
     if (tone_chainable(type) && duration > 0) {
         for (link = (struct tone *)stream->data;   link;   link = link->next) {
@@ -133,6 +175,7 @@ struct tone *tone_create(struct stream *stream,
     tone->type    = type;
     tone->period  = period;
     tone->play    = play;
+    tone->freq    = freq;
     tone->start   = (uint64_t)(time + start) * SCALE;
     tone->end     = duration ? tone->start + (uint64_t)(duration * SCALE) : 0;
     
@@ -157,6 +200,56 @@ struct tone *tone_create(struct stream *stream,
     return tone;
 }
 
+/*
+ * A tone that plays pre-rendered samples instead of a sine: the first
+ * 'head' samples once, then the rest of the 'total' over and over. The
+ * samples are not copied; they must stay until the tone is destroyed.
+ */
+struct tone *tone_create_pcm(struct stream *stream,
+                             int            type,
+                             const int16_t *samples,
+                             uint32_t       head,
+                             uint32_t       total,
+                             uint32_t       volume,
+                             uint32_t       duration)
+{
+    struct tone *tone;
+
+    if (!volume || samples == NULL || head >= total)
+        return NULL;
+
+    if ((tone = (struct tone *)pool_alloc(tone_pool)) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return NULL;
+    }
+
+    if (volume > 100)
+        volume = 100;
+
+    memset(tone, 0, sizeof(*tone));
+
+    tone->next    = (struct tone *)stream->data;
+    tone->stream  = stream;
+    tone->type    = type;
+    tone->period  = UINT32_MAX;
+    tone->play    = UINT32_MAX;
+    tone->start   = (uint64_t)stream->time * SCALE;
+    tone->end     = duration ? tone->start + (uint64_t)(duration * SCALE) : 0;
+    tone->backend = BACKEND_PCM;
+
+    tone->pcmgen.samples = samples;
+    tone->pcmgen.head    = head;
+    tone->pcmgen.total   = total;
+    tone->pcmgen.gain    = (volume << 15) / 100;
+
+    stream->data = (void *)tone;
+
+    if (duration)
+        stream->flush = FALSE;
+
+    return tone;
+}
+
 void tone_destroy(struct tone *tone, int kill_chain)
 {
     struct stream  *stream = tone->stream;
@@ -176,7 +269,7 @@ void tone_destroy(struct tone *tone, int kill_chain)
                     for (link = tone->chain;  link;  link = chain) {
                         chain = link->chain;
                         envelop_destroy(link->envelop);
-                        free(link);
+                        pool_free(tone_pool, link);
                     }
                     prev->next = tone->next;
                 }
@@ -186,7 +279,7 @@ void tone_destroy(struct tone *tone, int kill_chain)
                 } 
             }
             envelop_destroy(tone->envelop);
-            free(tone);
+            pool_free(tone_pool, tone);
             return;
         }
     }
@@ -195,6 +288,71 @@ void tone_destroy(struct tone *tone, int kill_chain)
 }
 
 
+/*
+ * Start an existing tone over from the current stream time with a new
+ * frequency and volume; its envelope is kept. This saves a destroy and
+ * a create when a continuous tone is replaced by another of its kind.
+ */
+void tone_restart(struct tone *tone, uint32_t freq, uint32_t volume)
+{
+    struct stream *stream = tone->stream;
+
+    tone->start   = (uint64_t)stream->time * SCALE;
+    tone->end     = 0;
+    tone->freq    = freq;
+    tone->envleft = 0;
+    tone->backend = BACKEND_SINGEN;
+
+    singen_init(&tone->singen, freq, stream->rate, volume);
+}
+
+/*
+ * Let the renderer end the tone once it has played for the given time.
+ * Returns FALSE if it has already, i.e. the tone can go right away.
+ */
+int tone_end_after(struct tone *tone, uint32_t duration)
+{
+    uint64_t end = tone->start + (uint64_t)duration * SCALE;
+
+    if (end <= (uint64_t)tone->stream->time * SCALE)
+        return FALSE;
+
+    tone->end = end;
+
+    return TRUE;
+}
+
+/*
+ * Replace the envelope by a linear ramp of the given length, in usec,
+ * at both ends of every period the tone plays; 0 leaves it without.
+ */
+void tone_set_ramp(struct tone *tone, uint32_t ramp)
+{
+    envelop_destroy(tone->envelop);
+
+    tone->reltime = TRUE;
+    tone->envelop = NULL;
+
+    if (ramp > 0)
+        tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, ramp, 0,
+                                       tone->play);
+}
+
+/*
+ * Stream time left until the tone ends, in usec; 0 if it is endless
+ * or has ended.
+ */
+uint32_t tone_time_left(struct tone *tone)
+{
+    uint64_t now = (uint64_t)tone->stream->time * SCALE;
+
+    if (!tone->end || tone->end <= now)
+        return 0;
+
+    return (uint32_t)((tone->end - now) / SCALE);
+}
+
+
 int tone_chainable(int type)
 {
     switch (type) {
@@ -207,6 +365,55 @@ int tone_chainable(int type)
     }
 }
 
+/*
+ * This function maps the RFC4733 defined
+ * power level of 0dbm0 - -63dbm0
+ * to the linear range of 0 - 100
+ */
+uint32_t tone_linear_volume(int dbm0)
+{
+    double volume;              /* volume on the scale 0-100 */
+
+    if (dbm0 > 0)   dbm0 = 0;
+    if (dbm0 < -63) dbm0 = -63;
+
+    volume = pow(10.0, (double)(dbm0 + 63) / 20.0) / 14.125375446;
+
+    return (uint32_t)(volume + 0.5);
+}
+
+/* the other way round: the power level of a volume, in -dBm0 */
+int tone_event_level(uint32_t volume)
+{
+    double level;
+
+    if (volume < 1)
+        return 63;
+
+    level = 63.0 - 20.0 * log10((double)volume * 14.125375446);
+
+    if (level < 0.0)
+        return 0;
+
+    return level > 63.0 ? 63 : (int)(level + 0.5);
+}
+
+/* the indicator tone of an RFC 4733 event, or -1 if it has none */
+int tone_event_type(uint32_t event)
+{
+    switch (event) {
+    case 66:     return TONE_DIAL;
+    case 72:     return TONE_BUSY;
+    case 73:     return TONE_CONGEST;
+    case 256:    return TONE_RADIO_ACK;
+    case 257:    return TONE_RADIO_NA;
+    case 74:     return TONE_ERROR;
+    case 79:     return TONE_WAIT;
+    case 70:     return TONE_RING;
+    default:     return -1;
+    }
+}
+
 uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
 {
     struct tone   *tone;
@@ -216,6 +423,7 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
     uint32_t       relt;
     int32_t        sine;
     int32_t        sample;
+    int            coarse;
     int            i;
     
     t  = (uint64_t)stream->time * SCALE;
@@ -226,6 +434,15 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
         t += dt * (uint64_t)len;
     }
     else {
+        coarse = stream->shed >= SHED_ENVELOP;
+
+        for (tone = (struct tone *)stream->data;  tone;  tone = tone->next) {
+            switch_oscillator(tone, stream->rate,
+                              stream->shed >= SHED_OSCILLATOR);
+            if (!coarse)
+                tone->envleft = 0;
+        }
+
         for (i = 0; i < len; i++) {
             sample = 0;
 
@@ -234,6 +451,11 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
 
                 if (tone->end && tone->end < t)
                     tone_destroy(tone, PRESERVE_CHAIN);
+                else if (tone->backend == BACKEND_PCM) {
+                    /* rendered with its cadence and envelope */
+                    if (t > tone->start)
+                        sample += pcmgen_write(&tone->pcmgen);
+                }
                 else if (t > tone->start) {
                     abst = (uint32_t)((t - tone->start) / SCALE);
                     relt = abst % tone->period;
@@ -242,12 +464,30 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
                         switch (tone->backend) {
 
                         case BACKEND_SINGEN:
-                            sine    = singen_write(&tone->singen);
-                            sample += envelop_apply(tone->envelop, sine,
-                                                    tone->reltime ? relt:abst);
+                            sine = singen_write(&tone->singen);
                             break;
+
+                        case BACKEND_TABGEN:
+                            sine = tabgen_write(&tone->tabgen);
+                            break;
+
+                        default:
+                            continue;
                         }
 
+                        if (!coarse) {
+                            sample += envelop_apply(tone->envelop, sine,
+                                                    tone->reltime ? relt:abst);
+                        }
+                        else {
+                            if (tone->envleft-- <= 0) {
+                                tone->envgain = envelop_apply(tone->envelop,
+                                                 AMPLITUDE,
+                                                 tone->reltime ? relt : abst);
+                                tone->envleft = SHED_ENVELOP_STEP - 1;
+                            }
+                            sample += (sine * tone->envgain) >> 15;
+                        }
                     }
                 }
             } /* for */
@@ -274,6 +514,42 @@ uint32_t tone_write_callback(struct stream *stream, int16_t *buf, int len)
     return (uint32_t)(t / SCALE);
 }
 
+/*
+ * The period the tones of the stream repeat with, if they all play for
+ * ever with the same one and it can be looped sample by sample: a whole
+ * number of samples, and of sine periods for the tones that play over
+ * its end. Zero otherwise.
+ */
+uint32_t tone_loop_period(struct stream *stream)
+{
+    struct tone *tone;
+    uint32_t     period = 0;
+    uint32_t     start;
+
+    for (tone = (struct tone *)stream->data;  tone;  tone = tone->next) {
+        if (tone->chain || tone->end || tone->backend != BACKEND_SINGEN)
+            return 0;
+
+        if (period && tone->period != period)
+            return 0;
+
+        period = tone->period;
+        start  = tone->start / SCALE - stream->time;
+
+        if (start >= period)
+            return 0;
+
+        if (start + tone->play >= period &&
+            ((uint64_t)tone->freq * period) % 1000000ULL)
+            return 0;
+    }
+
+    if (((uint64_t)period * stream->rate) % 1000000ULL)
+        return 0;
+
+    return period;
+}
+
 void tone_destroy_callback(void *data)
 {
     struct stream *stream;
@@ -291,6 +567,128 @@ void tone_destroy_callback(void *data)
     }
 }
 
+/*
+ * Checkpoints of the tone timeline for the render-ahead queue of the
+ * stream. A checkpoint is a private copy of the tone list, including
+ * the chained tones, the envelopes and the oscillator states, so
+ * rendering can be restarted from it after the tones were changed.
+ */
+int tone_save(struct stream *stream, void **state)
+{
+    struct tone  *list = NULL;
+    struct tone **tail = &list;
+    struct tone  *tone;
+
+    for (tone = (struct tone *)stream->data;  tone;  tone = tone->next) {
+        if ((*tail = clone_tone(tone)) == NULL) {
+            free_tones(list);
+            return -1;
+        }
+        tail = &(*tail)->next;
+    }
+
+    *state = (void *)list;
+
+    return 0;
+}
+
+void tone_restore(struct stream *stream, void *state)
+{
+    free_tones((struct tone *)stream->data);
+    stream->data = state;
+}
+
+void tone_discard(void *state)
+{
+    free_tones((struct tone *)state);
+}
+
+/*
+ * Move a tone between the resonator and the table oscillator without a
+ * phase jump. The resonator's state (n0, n1) is two consecutive samples
+ * of the sine, from which the phase of the next sample can be recovered.
+ */
+static void switch_oscillator(struct tone *tone, uint32_t rate, int cheap)
+{
+    struct singen *singen = &tone->singen;
+    struct tabgen *tabgen = &tone->tabgen;
+    double         w      = 2.0 * M_PI * ((double)tone->freq / (double)rate);
+    double         theta;
+    int64_t        offs;
+
+    if (cheap && tone->backend == BACKEND_SINGEN) {
+        theta = atan2((double)singen->n1 * sin(w),
+                      (double)singen->n1 * cos(w) - (double)singen->n0);
+        offs  = singen->offs;
+
+        if (theta < 0.0)
+            theta += 2.0 * M_PI;
+
+        tabgen->phase = (uint32_t)(theta / (2.0 * M_PI) * PHASE_UNIT);
+        tabgen->step  = (uint32_t)((double)tone->freq / (double)rate *
+                                   PHASE_UNIT);
+        tabgen->amp   = offs == LONG_MAX ? 0 : (AMPLITUDE * OFFSET) / offs;
+        tabgen->offs  = offs;
+
+        tone->backend = BACKEND_TABGEN;
+    }
+    else if (!cheap && tone->backend == BACKEND_TABGEN) {
+        theta = (double)tabgen->phase / PHASE_UNIT * 2.0 * M_PI;
+        offs  = tabgen->offs;
+
+        singen->m    = 2.0 * cos(w) * (AMPLITUDE * OFFSET);
+        singen->n1   = sin(theta) * (AMPLITUDE * OFFSET);
+        singen->n0   = sin(theta - w) * (AMPLITUDE * OFFSET);
+        singen->offs = offs;
+
+        tone->backend = BACKEND_SINGEN;
+    }
+}
+
+static struct tone *clone_tone(struct tone *tone)
+{
+    struct tone *copy;
+
+    if ((copy = (struct tone *)pool_alloc(tone_pool)) == NULL)
+        return NULL;
+
+    memcpy(copy, tone, sizeof(*copy));
+
+    copy->next    = NULL;
+    copy->chain   = NULL;
+    copy->envelop = envelop_copy(tone->envelop);
+
+    if (tone->envelop != NULL && copy->envelop == NULL)
+        goto failed;
+
+    if (tone->chain != NULL && (copy->chain = clone_tone(tone->chain)) == NULL)
+        goto failed;
+
+    return copy;
+
+ failed:
+    free_tones(copy);
+    return NULL;
+}
+
+static void free_tones(struct tone *list)
+{
+    struct tone *tone;
+    struct tone *link;
+    struct tone *next;
+
+    for (tone = list;  tone;  tone = next) {
+        next = tone->next;
+
+        while (tone != NULL) {
+            link = tone->chain;
+            envelop_destroy(tone->envelop);
+            pool_free(tone_pool, tone);
+            tone = link;
+        }
+    }
+}
+
 static void setup_envelop_for_tone(struct tone *tone, int type, 
                                    uint32_t play, uint32_t duration)
 {
@@ -311,6 +709,7 @@ static void setup_envelop_for_tone(struct tone *tone, int type,
     case TONE_RING:
     case TONE_DTMF_L:
     case TONE_DTMF_H:
+    case TONE_CUSTOM:
         tone->reltime = TRUE;
         tone->envelop = envelop_create(ENVELOP_RAMP_LINEAR, 10000, 0, play);
         break;
@@ -48,10 +48,13 @@ USA.
 #define TONE_DTMF_L          11
 #define TONE_DTMF_H          12
 #define TONE_NOTE_0          13
-#define TONE_SINGEN_END      14
+#define TONE_CUSTOM          14     /* defined over D-Bus, see cadence.c */
+#define TONE_SINGEN_END      15
 
 #define BACKEND_UNKNOWN      0
 #define BACKEND_SINGEN       1
+#define BACKEND_TABGEN       2  /* cheaper oscillator used when shedding */
+#define BACKEND_PCM          3  /* pre-rendered samples, see pcmcache.c */
 
 
 struct stream;
@@ -64,6 +67,21 @@ struct singen {
     int64_t        offs;
 };
 
+struct tabgen {
+    uint32_t       phase;        /* Q32 fraction of the period */
+    uint32_t       step;
+    int32_t        amp;
+    int64_t        offs;         /* singen->offs, kept for switching back */
+};
+
+struct pcmgen {
+    const int16_t *samples;      /* the head and then the loop */
+    uint32_t       head;         /* samples played only once */
+    uint32_t       total;
+    uint32_t       pos;
+    int32_t        gain;         /* Q15 */
+};
+
 
 struct tone {
     struct tone       *next;
@@ -74,10 +92,15 @@ struct tone {
     uint32_t           play;     /* how long to play the sine */
     uint64_t           start;
     uint64_t           end;
+    uint32_t           freq;
     int                backend;
     union {
         struct singen  singen;
+        struct tabgen  tabgen;
+        struct pcmgen  pcmgen;
     };
+    int32_t            envgain;  /* envelope gain while shedding */
+    int                envleft;  /* samples until it is reevaluated */
     int                reltime; /* relative time to be passed to env. func's */
     union envelop     *envelop;
 };
@@ -86,10 +109,23 @@ struct tone {
 int tone_init(int, char **);
 struct tone *tone_create(struct stream *, int, uint32_t, uint32_t,
                          uint32_t, uint32_t, uint32_t, uint32_t);
+struct tone *tone_create_pcm(struct stream *, int, const int16_t *,
+                             uint32_t, uint32_t, uint32_t, uint32_t);
 void tone_destroy(struct tone *, int);
+void tone_restart(struct tone *, uint32_t, uint32_t);
+int tone_end_after(struct tone *, uint32_t);
+uint32_t tone_time_left(struct tone *);
+void tone_set_ramp(struct tone *, uint32_t);
+uint32_t tone_loop_period(struct stream *);
 int tone_chainable(int);
+uint32_t tone_linear_volume(int);
+int tone_event_level(uint32_t);
+int tone_event_type(uint32_t);
 uint32_t tone_write_callback(struct stream *, int16_t *, int);
 void tone_destroy_callback(void *);
+int tone_save(struct stream *, void **);
+void tone_restore(struct stream *, void *);
+void tone_discard(void *);
 
 
 #endif /* __TONEGEND_TONE_H__ */
@@ -31,11 +31,13 @@ USA.
 struct dbusif;
 struct ausrv;
 struct interact;
+struct ctlsock;
 
 struct tonegend {
     struct dbusif    *dbus_ctx;
     struct ausrv     *ausrv_ctx;
     struct interact  *intact_ctx;
+    struct ctlsock   *ctlsock_ctx;
 };
 
 #endif /* __TONEGEND_TONEGEND_H__ */
@@ -0,0 +1,434 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "tonegend.h"
+#include "dbusif.h"
+#include "ausrv.h"
+#include "stream.h"
+#include "tonesig.h"
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define OWNER_RULE  "type='signal',sender='" DBUS_SERVICE_DBUS "',"  \
+                    "member='NameOwnerChanged',arg0='%s'"
+
+struct method {
+    char  *intf;                                    /* interface name */
+    char  *memb;                                    /* method name */
+    char  *sig;                                     /* signature */
+    int  (*func)(DBusMessage *, struct tonegend *); /* implementing function */
+};
+
+/*
+ * A tone request of a subscribed client. Made on the D-Bus side and
+ * handed over to the audio side, where it is 'current' while the
+ * request is served and lives on until both of its cues have fired on
+ * the main loop.
+ */
+struct request {
+    struct tonegend  *tonegend;
+    char             *sender;
+    uint32_t          serial;
+    struct stream    *stream;   /* once laid out */
+    uint32_t          end;      /* stream time, 0 if endless */
+    int               refs;     /* 'current' and the cues not fired yet */
+};
+
+static int subscribe(DBusMessage *, struct tonegend *);
+static DBusHandlerResult name_owner_changed(DBusConnection *, DBusMessage *,
+                                            void *);
+static int find_subscriber(const char *);
+static void unsubscribe(struct tonegend *, int);
+static void set_current(struct ausrv *, struct request *);
+static void clear_current(struct ausrv *);
+static void drop_current(void);
+static void started(void *, int);
+static void finished(void *, int);
+static void send_signal(struct request *, char *);
+static void unref(struct request *);
+static void set_command(struct ausrv *, uintptr_t *);
+static void drop_set(uintptr_t *);
+static void clear_command(struct ausrv *, uintptr_t *);
+
+static struct method  method_defs[] = {
+    {NULL, "SubscribeToneEvents", "b", subscribe},
+    {NULL, NULL, NULL, NULL}
+};
+
+/* the D-Bus side */
+static char           *subscribers[TONESIG_MAXSUB];
+static int             begun;
+
+/* the audio side */
+static struct request *current;
+
+
+int tonesig_init(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    return 0;
+}
+
+int tonesig_create(struct tonegend *tonegend)
+{
+    DBusConnection *conn = tonegend->dbus_ctx->conn;
+    struct method  *m;
+    int             err;
+    int             sts;
+
+    for (m = method_defs, err = 0;    m->memb != NULL;    m++) {
+        sts = dbusif_register_input_method(tonegend, m->intf, m->memb,
+                                           m->sig, m->func);
+
+        if (sts < 0) {
+            LOG_ERROR("%s(): Can't register D-Bus method '%s'",
+                      __FUNCTION__, m->memb);
+            err = -1;
+        }
+    }
+
+    if (!dbus_connection_add_filter(conn, name_owner_changed, tonegend, NULL)){
+        LOG_ERROR("%s(): Can't add D-Bus filter", __FUNCTION__);
+        err = -1;
+    }
+
+    return err;
+}
+
+/*
+ * called by the D-Bus method handlers around the calls that start a
+ * tone; does nothing unless the sender has subscribed
+ */
+void tonesig_begin(struct tonegend *tonegend, DBusMessage *msg)
+{
+    struct request *req;
+    const char     *sender;
+
+    sender = dbus_message_get_sender(msg);
+
+    if (sender == NULL || find_subscriber(sender) < 0)
+        return;
+
+    if ((req = (struct request *)calloc(1, sizeof(*req))) == NULL ||
+        (req->sender = strdup(sender)) == NULL)
+    {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        free(req);
+        return;
+    }
+
+    req->tonegend = tonegend;
+    req->serial   = dbus_message_get_serial(msg);
+    req->refs     = 1;          /* as 'current' */
+
+    begun = TRUE;
+
+    set_current(tonegend->ausrv_ctx, req);
+}
+
+void tonesig_end(struct tonegend *tonegend)
+{
+    if (begun) {
+        begun = FALSE;
+        clear_current(tonegend->ausrv_ctx);
+    }
+}
+
+/* on the audio side: is a subscribed client's request being served */
+int tonesig_wanted(void)
+{
+    return current != NULL;
+}
+
+/*
+ * On the audio side: the tones just set up on the stream play from
+ * 'start' to 'end' on its timeline, or for ever if 'end' is 0. They
+ * end an endless tone of an earlier request on the same stream. The
+ * request may lay out more tones, e.g. a tone sequence; its end is
+ * then moved to the end of the last one.
+ */
+void tonesig_laid_out(struct stream *stream, uint32_t start, uint32_t end)
+{
+    struct request *req = current;
+
+    tonesig_stopped(stream, start);
+
+    if (req == NULL)
+        return;
+
+    if (req->stream == NULL) {
+        req->stream = stream;
+        req->end    = end;
+
+        TRACE("%s(): %u of '%s' at %u - %u usec", __FUNCTION__, req->serial,
+              req->sender, start, end);
+
+        __atomic_add_fetch(&req->refs, 2, __ATOMIC_ACQ_REL);
+
+        if (stream_add_cue(stream, start, started, req) < 0)
+            unref(req);
+
+        if ((end ? stream_add_cue(stream, end, finished, req) :
+                   stream_add_endless_cue(stream, finished, req)) < 0)
+            unref(req);
+    }
+    else if (req->stream == stream) {
+        if (!req->end)
+            req->end = start;   /* ended by tonesig_stopped() above */
+
+        if (end && (int32_t)(end - req->end) > 0) {
+            req->end = end;
+            stream_move_cue(stream, finished, req, end);
+        }
+    }
+}
+
+/* on the audio side: the endless tones of the stream end at 'time' */
+void tonesig_stopped(struct stream *stream, uint32_t time)
+{
+    stream_end_cues(stream, finished, time);
+}
+
+/* on the audio side: all tones of the stream were cut at 'time' */
+void tonesig_cut(struct stream *stream, uint32_t time)
+{
+    stream_cut_cues(stream, started, time);
+    stream_cut_cues(stream, finished, time);
+}
+
+
+static int subscribe(DBusMessage *msg, struct tonegend *tonegend)
+{
+    DBusConnection *conn = tonegend->dbus_ctx->conn;
+    const char     *sender;
+    dbus_bool_t     on;
+    char            rule[256];
+    int             i;
+    int             success;
+
+    success = dbus_message_get_args(msg, NULL,
+                                    DBUS_TYPE_BOOLEAN, &on,
+                                    DBUS_TYPE_INVALID);
+
+    if (!success || (sender = dbus_message_get_sender(msg)) == NULL) {
+        LOG_ERROR("%s(): Can't parse arguments", __FUNCTION__);
+        return FALSE;
+    }
+
+    i = find_subscriber(sender);
+
+    TRACE("%s(): '%s' %ssubscribes", __FUNCTION__, sender, on ? "" : "un");
+
+    if (!on) {
+        if (i >= 0)
+            unsubscribe(tonegend, i);
+        return TRUE;
+    }
+
+    if (i >= 0)
+        return TRUE;
+
+    for (i = 0;  i < TONESIG_MAXSUB;  i++) {
+        if (subscribers[i] == NULL)
+            break;
+    }
+
+    if (i >= TONESIG_MAXSUB) {
+        LOG_ERROR("%s(): too many subscribers", __FUNCTION__);
+        return FALSE;
+    }
+
+    if ((subscribers[i] = strdup(sender)) == NULL)
+        return FALSE;
+
+    /* we are told when the subscriber goes */
+    snprintf(rule, sizeof(rule), OWNER_RULE, sender);
+    dbus_bus_add_match(conn, rule, NULL);
+
+    return TRUE;
+}
+
+static DBusHandlerResult name_owner_changed(DBusConnection *conn,
+                                            DBusMessage    *msg,
+                                            void           *data)
+{
+    struct tonegend *tonegend = (struct tonegend *)data;
+    char            *name;
+    char            *before;
+    char            *after;
+    int              i;
+    int              success;
+
+    (void)conn;
+
+    if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
+        success = dbus_message_get_args(msg, NULL,
+                                        DBUS_TYPE_STRING, &name,
+                                        DBUS_TYPE_STRING, &before,
+                                        DBUS_TYPE_STRING, &after,
+                                        DBUS_TYPE_INVALID);
+
+        if (success && !after[0] && (i = find_subscriber(name)) >= 0) {
+            TRACE("%s(): subscriber '%s' is gone", __FUNCTION__, name);
+            unsubscribe(tonegend, i);
+        }
+    }
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static int find_subscriber(const char *sender)
+{
+    int i;
+
+    for (i = 0;  i < TONESIG_MAXSUB;  i++) {
+        if (subscribers[i] != NULL && !strcmp(sender, subscribers[i]))
+            return i;
+    }
+
+    return -1;
+}
+
+static void unsubscribe(struct tonegend *tonegend, int i)
+{
+    char rule[256];
+
+    snprintf(rule, sizeof(rule), OWNER_RULE, subscribers[i]);
+    dbus_bus_remove_match(tonegend->dbus_ctx->conn, rule, NULL);
+
+    free(subscribers[i]);
+    subscribers[i] = NULL;
+}
+
+static void set_current(struct ausrv *ausrv, struct request *req)
+{
+    if (ausrv_queue_owned_command(ausrv, set_command, drop_set,
+                                  (uintptr_t)req, 0,0,0))
+        return;
+
+    drop_current();
+
+    current = req;
+}
+
+static void clear_current(struct ausrv *ausrv)
+{
+    if (ausrv_queue_command(ausrv, clear_command, 0,0,0,0))
+        return;
+
+    drop_current();
+}
+
+/* a request that laid out no tones is not heard of again */
+static void drop_current(void)
+{
+    struct request *req = current;
+
+    current = NULL;
+
+    if (req != NULL)
+        unref(req);
+}
+
+/* the cues fire on the main loop */
+static void started(void *data, int played)
+{
+    struct request *req = (struct request *)data;
+
+    /* a tone stopped before it was played never started */
+    if (played)
+        send_signal(req, "ToneStarted");
+
+    unref(req);
+}
+
+static void finished(void *data, int played)
+{
+    struct request *req = (struct request *)data;
+
+    (void)played;
+
+    send_signal(req, "ToneFinished");
+    unref(req);
+}
+
+static void send_signal(struct request *req, char *name)
+{
+    TRACE("%s(): %s(%u) to '%s'", __FUNCTION__, name, req->serial,
+          req->sender);
+
+    if (dbusif_send_signal_to(req->tonegend, req->sender, NULL, name,
+                              DBUS_TYPE_UINT32, &req->serial,
+                              DBUS_TYPE_INVALID) < 0)
+        LOG_ERROR("failed to send %s signal", name);
+}
+
+static void unref(struct request *req)
+{
+    if (__atomic_sub_fetch(&req->refs, 1, __ATOMIC_ACQ_REL) <= 0) {
+        free(req->sender);
+        free(req);
+    }
+}
+
+static void set_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    set_current(ausrv, (struct request *)arg[0]);
+}
+
+static void drop_set(uintptr_t *arg)
+{
+    struct request *req = (struct request *)arg[0];
+
+    free(req->sender);
+    free(req);
+}
+
+static void clear_command(struct ausrv *ausrv, uintptr_t *arg)
+{
+    (void)arg;
+
+    clear_current(ausrv);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
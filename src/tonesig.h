@@ -0,0 +1,67 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_TONESIG_H__
+#define __TONEGEND_TONESIG_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+#include <dbus/dbus.h>
+
+/*
+ * ToneStarted(serial) and ToneFinished(serial) tell a client when the
+ * first and the last sample of a tone it asked for are played out; the
+ * serial is that of the method call that started the tone. They are
+ * sent only to the clients that called SubscribeToneEvents(true), and
+ * only to the one that asked for the tone.
+ *
+ * The D-Bus side brackets the requests of a subscribed client with
+ * tonesig_begin() and tonesig_end(). On the audio side the code that
+ * lays out the tones tells where they are on the stream timeline by
+ * tonesig_laid_out(), and the stream cues fire the signals.
+ */
+
+#define TONESIG_MAXSUB   32     /* subscribed clients */
+
+struct tonegend;
+struct stream;
+
+int tonesig_init(int, char **);
+int tonesig_create(struct tonegend *);
+void tonesig_begin(struct tonegend *, DBusMessage *);
+void tonesig_end(struct tonegend *);
+int tonesig_wanted(void);
+void tonesig_laid_out(struct stream *, uint32_t, uint32_t);
+void tonesig_stopped(struct stream *, uint32_t);
+void tonesig_cut(struct stream *, uint32_t);
+
+#endif /* __TONEGEND_TONESIG_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,343 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <log/log.h>
+#include <trace/trace.h>
+
+#include "worker.h"
+#include "pool.h"
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define LOG_ERROR(f, args...) log_error(logctx, f, ##args)
+#define LOG_INFO(f, args...) log_error(logctx, f, ##args)
+#define LOG_WARNING(f, args...) log_error(logctx, f, ##args)
+
+#define TRACE(f, args...) trace_write(trctx, trflags, trkeys, f, ##args)
+
+#define PREFAULT_STACK (64 * 1024)
+
+/*
+ * Render worker pool. Every worker has a queue of its own; jobs are
+ * spread over the queues round robin and a worker that runs out of
+ * work steals from the others. A job is owned by the thread that
+ * submitted it, and that thread picks up the result after
+ * worker_wait(). If the job has not been started by then, the owner
+ * takes it back and runs it itself rather than wait for a worker.
+ */
+
+struct worker {
+    pthread_t           thread;
+    pthread_mutex_t     lock;       /* protects the queue */
+    struct worker_job  *head;
+    struct worker_job  *tail;
+    int                 index;
+};
+
+static void *worker_main(void *);
+static struct worker_job *dequeue(struct worker *);
+static int  unlink_job(struct worker *, struct worker_job *);
+static void finish_job(struct worker_job *);
+static void stop_workers(int);
+
+static struct worker    *workers;
+static int               nworker;
+static int               next_queue;
+static int               pending;   /* queued jobs, protected by idle_lock */
+static int               quit;
+static int               priority;
+static pthread_mutex_t   idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t   done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    done_cond = PTHREAD_COND_INITIALIZER;
+
+
+int worker_start(int count, int prio)
+{
+    struct worker *w;
+    int            i;
+    int            err;
+
+    if (count <= 0 || workers != NULL)
+        return 0;
+
+    if (count > WORKER_MAX)
+        count = WORKER_MAX;
+
+    if ((workers = calloc(count, sizeof(*workers))) == NULL) {
+        LOG_ERROR("%s(): Can't allocate memory", __FUNCTION__);
+        return -1;
+    }
+
+    /* the workers look at each other's queues; set them all up first */
+    for (i = 0;  i < count;  i++) {
+        workers[i].index = i;
+        pthread_mutex_init(&workers[i].lock, NULL);
+    }
+
+    nworker  = count;
+    quit     = FALSE;
+    priority = prio;
+
+    for (i = 0;  i < count;  i++) {
+        w = workers + i;
+
+        if ((err = pthread_create(&w->thread, NULL, worker_main, w)) != 0) {
+            LOG_ERROR("Can't start render worker %d: %s", i, strerror(err));
+            stop_workers(i);
+            return -1;
+        }
+    }
+
+    TRACE("%d render worker(s) started", nworker);
+
+    return 0;
+}
+
+void worker_stop(void)
+{
+    if (workers != NULL)
+        stop_workers(nworker);
+}
+
+int worker_count(void)
+{
+    return nworker;
+}
+
+void worker_job_init(struct worker_job *job, void (*func)(void *), void *data)
+{
+    memset(job, 0, sizeof(*job));
+
+    job->func  = func;
+    job->data  = data;
+    job->state = WORKER_JOB_IDLE;
+}
+
+/*
+ * returns -1 if there are no workers; the caller is expected to run
+ * the job by itself in that case
+ */
+int worker_submit(struct worker_job *job)
+{
+    struct worker *w;
+
+    if (nworker == 0)
+        return -1;
+
+    w = workers + next_queue;
+    next_queue = (next_queue + 1) % nworker;
+
+    job->next  = NULL;
+    job->queue = w->index;
+    __atomic_store_n(&job->state, WORKER_JOB_QUEUED, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&w->lock);
+
+    if (w->tail != NULL)
+        w->tail->next = job;
+    else
+        w->head = job;
+    w->tail = job;
+
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&idle_lock);
+    pending++;
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+
+    return 0;
+}
+
+void worker_wait(struct worker_job *job)
+{
+    struct worker *w;
+
+    if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == WORKER_JOB_IDLE)
+        return;
+
+    w = workers + job->queue;
+
+    if (unlink_job(w, job)) {
+        pthread_mutex_lock(&idle_lock);
+        pending--;
+        pthread_mutex_unlock(&idle_lock);
+
+        job->func(job->data);
+        __atomic_store_n(&job->state, WORKER_JOB_IDLE, __ATOMIC_RELEASE);
+        return;
+    }
+
+    pthread_mutex_lock(&done_lock);
+
+    while (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != WORKER_JOB_IDLE)
+        pthread_cond_wait(&done_cond, &done_lock);
+
+    pthread_mutex_unlock(&done_lock);
+}
+
+
+static void *worker_main(void *data)
+{
+    struct worker      *self = (struct worker *)data;
+    struct worker_job  *job;
+    struct sched_param  param;
+    int                 i;
+    int                 err;
+
+    if (priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+            LOG_ERROR("Can't set SCHED_FIFO priority %d for render worker "
+                      "%d: %s", priority, self->index, strerror(err));
+    }
+
+    pool_prefault_stack(PREFAULT_STACK);
+
+    for (;;) {
+        job = dequeue(self);
+
+        for (i = 1;  job == NULL && i < nworker;  i++)
+            job = dequeue(workers + (self->index + i) % nworker);
+
+        if (job != NULL) {
+            pthread_mutex_lock(&idle_lock);
+            pending--;
+            pthread_mutex_unlock(&idle_lock);
+
+            job->func(job->data);
+            finish_job(job);
+
+            continue;
+        }
+
+        pthread_mutex_lock(&idle_lock);
+
+        while (!pending && !quit)
+            pthread_cond_wait(&idle_cond, &idle_lock);
+
+        if (quit) {
+            pthread_mutex_unlock(&idle_lock);
+            break;
+        }
+
+        pthread_mutex_unlock(&idle_lock);
+    }
+
+    return NULL;
+}
+
+static struct worker_job *dequeue(struct worker *w)
+{
+    struct worker_job *job;
+
+    pthread_mutex_lock(&w->lock);
+
+    if ((job = w->head) != NULL) {
+        if ((w->head = job->next) == NULL)
+            w->tail = NULL;
+
+        job->next = NULL;
+        __atomic_store_n(&job->state, WORKER_JOB_RUNNING, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return job;
+}
+
+static int unlink_job(struct worker *w, struct worker_job *job)
+{
+    struct worker_job *prev;
+    int                found = FALSE;
+
+    pthread_mutex_lock(&w->lock);
+
+    if (__atomic_load_n(&job->state, __ATOMIC_RELAXED) == WORKER_JOB_QUEUED) {
+        for (prev = (struct worker_job *)&w->head;  prev;  prev = prev->next) {
+            if (prev->next == job) {
+                if ((prev->next = job->next) == NULL)
+                    w->tail = prev == (struct worker_job *)&w->head ?
+                              NULL : prev;
+                job->next = NULL;
+                found = TRUE;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return found;
+}
+
+static void stop_workers(int running)
+{
+    int i;
+
+    pthread_mutex_lock(&idle_lock);
+    quit = TRUE;
+    pthread_cond_broadcast(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+
+    for (i = 0;  i < running;  i++)
+        pthread_join(workers[i].thread, NULL);
+
+    for (i = 0;  i < nworker;  i++)
+        pthread_mutex_destroy(&workers[i].lock);
+
+    free(workers);
+    workers    = NULL;
+    nworker    = 0;
+    next_queue = 0;
+}
+
+static void finish_job(struct worker_job *job)
+{
+    pthread_mutex_lock(&done_lock);
+    __atomic_store_n(&job->state, WORKER_JOB_IDLE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&done_lock);
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
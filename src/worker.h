@@ -0,0 +1,53 @@
+/*************************************************************************
+This file is part of tone-generator
+
+Copyright (C) 2010 Nokia Corporation.
+
+This library is free software; you can redistribute
+it and/or modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation
+version 2.1 of the License.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+USA.
+*************************************************************************/
+
+#ifndef __TONEGEND_WORKER_H__
+#define __TONEGEND_WORKER_H__
+
+#define WORKER_JOB_IDLE     0
+#define WORKER_JOB_QUEUED   1
+#define WORKER_JOB_RUNNING  2
+
+#define WORKER_MAX          64
+
+struct worker_job {
+    struct worker_job  *next;
+    void              (*func)(void *);
+    void               *data;
+    int                 state;      /* WORKER_JOB_xxx */
+    int                 queue;      /* index of the queue it was put on */
+};
+
+int  worker_start(int, int);
+void worker_stop(void);
+int  worker_count(void);
+void worker_job_init(struct worker_job *, void (*)(void *), void *);
+int  worker_submit(struct worker_job *);
+void worker_wait(struct worker_job *);
+
+#endif /* __TONEGEND_WORKER_H__ */
+
+/*
+ * Local Variables:
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
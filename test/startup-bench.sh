@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Measure how long a tone request takes when it has to start tonegend
+# by D-Bus activation: every round stops the daemon, sends
+# StartEventTone to the name that nobody owns and times the reply, which
+# includes the bus starting the daemon from the installed
+# com.Nokia.Telephony.Tones.service. Without that file the bus answers
+# ServiceUnknown and there is nothing to measure. The daemon is started
+# with the options of the .service file (or tone-generator.service under
+# systemd), so the -S breakdown of its own startup is not seen here; run
+# it by hand with -S for that.
+#
+# usage: startup-bench.sh [rounds]
+#
+
+ROUNDS=${1:-10}
+NAME=com.Nokia.Telephony.Tones
+UNIT=tone-generator.service
+
+bus() {
+    dbus-send --session --print-reply --type=method_call \
+	--dest=org.freedesktop.DBus /org/freedesktop/DBus \
+	org.freedesktop.DBus.$1 ${2:+string:$2} 2>/dev/null
+}
+
+owner_pid() {
+    bus GetConnectionUnixProcessID $NAME | awk '/uint32/ { print $2 }'
+}
+
+stop_daemon() {
+    local pid
+
+    if systemctl --user -q is-active $UNIT 2>/dev/null; then
+	# Restart=always would bring it back behind our back
+	systemctl --user stop $UNIT
+    elif pid=$(owner_pid) && [ -n "$pid" ]; then
+	kill -TERM $pid
+    fi
+
+    while bus NameHasOwner $NAME | grep -q "boolean true"; do
+	sleep 0.05
+    done
+}
+
+if ! bus ListActivatableNames | grep -q "\"$NAME\""; then
+    echo "$NAME is not activatable; install its .service file first"
+    exit 1
+fi
+
+for i in $(seq 1 $ROUNDS); do
+    stop_daemon
+
+    START=$(date +%s%N)
+    dbus-send --session --print-reply --type=method_call \
+	--dest=$NAME /com/Nokia/Telephony/Tones \
+	com.Nokia.Telephony.Tones.StartEventTone \
+	uint32:5 int32:0 uint32:200 > /dev/null || exit 1
+    END=$(date +%s%N)
+
+    echo "$i: activation and first reply $(( (END - START) / 1000 )) usec"
+    sleep 0.3
+done
+
+stop_daemon